@@ -0,0 +1,457 @@
+#!/usr/bin/env python3
+"""Local stand-in for the WeLearn (Moodle) site, for benchmarks.
+
+Generates a synthetic site from a seed: N courses, each with a tree of folders
+D levels deep, files with sizes drawn from a distribution. Login, dashboard,
+course, folder, resource and pluginfile pages look like Moodle's to the client's
+parsers. Latency, per-connection bandwidth and 429/5xx errors can be injected.
+
+Point the client at it with WELEARN_BASE_URL=http://127.0.0.1:PORT; any
+username and password log in.
+
+Run standalone:  python3 bench/mock_welearn.py --port 8780 --courses 20 --depth 3
+"""
+
+import argparse
+import hashlib
+import http.server
+import json
+import math
+import random
+import secrets
+import socketserver
+import threading
+import time
+import urllib.parse
+from email.utils import formatdate, parsedate_to_datetime
+
+CHUNK = 64 * 1024
+
+
+def parse_size(text):
+    units = {"k": 1024, "m": 1024 ** 2, "g": 1024 ** 3}
+    text = text.strip().lower().rstrip("b")
+    if text and text[-1] in units:
+        return int(float(text[:-1]) * units[text[-1]])
+    return int(text)
+
+
+class SizeDistribution:
+    """fixed:SIZE, uniform:MIN:MAX or lognormal:MEDIAN:SIGMA (sizes like 64k, 2m)"""
+
+    def __init__(self, spec):
+        parts = spec.split(":")
+        self.kind = parts[0]
+        if self.kind == "fixed" and len(parts) == 2:
+            self.args = (parse_size(parts[1]),)
+        elif self.kind == "uniform" and len(parts) == 3:
+            self.args = (parse_size(parts[1]), parse_size(parts[2]))
+        elif self.kind == "lognormal" and len(parts) == 3:
+            self.args = (parse_size(parts[1]), float(parts[2]))
+        else:
+            raise ValueError("bad size distribution: %s" % spec)
+
+    def draw(self, rng):
+        if self.kind == "fixed":
+            return self.args[0]
+        if self.kind == "uniform":
+            return rng.randint(self.args[0], self.args[1])
+        median, sigma = self.args
+        return max(1, int(rng.lognormvariate(math.log(median), sigma)))
+
+
+class Site:
+    """The synthetic course tree. Pages and files are numbered; everything is
+    derived from the seed so two runs with the same options serve the same site."""
+
+    def __init__(self, courses=8, depth=2, folders=2, files=4, sizes="lognormal:256k:1.0", seed=1):
+        self.seed = seed
+        rng = random.Random(seed)
+        dist = SizeDistribution(sizes)
+        self.courses = {}   # course id -> page
+        self.folders = {}   # folder id -> page
+        self.files = {}     # file id -> (name, size, mtime)
+        next_folder = 1000
+        next_file = 10000
+
+        def make_page(title, level):
+            nonlocal next_folder, next_file
+            page = {"title": title, "files": [], "folders": []}
+            for _ in range(files):
+                fid = next_file
+                next_file += 1
+                name = "Lecture_%d.pdf" % fid
+                self.files[fid] = (name, dist.draw(rng), 1600000000 + rng.randint(0, 10 ** 8))
+                page["files"].append(fid)
+            if level < depth:
+                for f in range(folders):
+                    folder_id = next_folder
+                    next_folder += 1
+                    self.folders[folder_id] = make_page("%s / Folder %d" % (title, f + 1), level + 1)
+                    page["folders"].append(folder_id)
+            return page
+
+        for c in range(1, courses + 1):
+            self.courses[c] = make_page("Benchmark Course %d" % c, 0)
+
+    def summary(self):
+        total = sum(size for _, size, _ in self.files.values())
+        return {"courses": len(self.courses), "folders": len(self.folders),
+                "files": len(self.files), "bytes": total}
+
+    def file_block(self, fid):
+        # 4 KiB repeated, different for every file so the store cannot deduplicate
+        digest = hashlib.sha256(("%d:%d" % (self.seed, fid)).encode()).digest()
+        return (digest * 128)[:4096]
+
+
+class Stats:
+    def __init__(self):
+        self.lock = threading.Lock()
+        self.reset()
+
+    def reset(self):
+        with self.lock:
+            self.requests = []  # (kind, status, seconds, body bytes)
+
+    def record(self, kind, status, seconds, sent):
+        with self.lock:
+            self.requests.append((kind, status, seconds, sent))
+
+    def snapshot(self):
+        with self.lock:
+            requests = list(self.requests)
+        result = {"requests": len(requests), "kinds": {}, "errors": 0, "file_bytes": 0}
+        latencies = sorted(r[2] for r in requests)
+        for kind, status, _, sent in requests:
+            result["kinds"][kind] = result["kinds"].get(kind, 0) + 1
+            if status in (429, 500, 502, 503):
+                result["errors"] += 1
+            if kind == "file":
+                result["file_bytes"] += sent
+        result["p50_ms"] = percentile(latencies, 50) * 1000.0
+        result["p99_ms"] = percentile(latencies, 99) * 1000.0
+        return result
+
+
+def percentile(sorted_values, p):
+    if not sorted_values:
+        return 0.0
+    k = min(len(sorted_values) - 1, max(0, int(math.ceil(p / 100.0 * len(sorted_values))) - 1))
+    return sorted_values[k]
+
+
+class Handler(http.server.BaseHTTPRequestHandler):
+    protocol_version = "HTTP/1.1"
+    server_version = "MockWeLearn/1.0"
+
+    def log_message(self, fmt, *args):
+        if self.server.verbose:
+            super().log_message(fmt, *args)
+
+    # --- plumbing -----------------------------------------------------------
+
+    def session(self):
+        cookies = self.headers.get("Cookie", "")
+        for part in cookies.split(";"):
+            name, _, value = part.strip().partition("=")
+            if name == "MoodleSession":
+                return value
+        return None
+
+    def logged_in(self):
+        return self.session() in self.server.sessions
+
+    def respond(self, status, body=b"", content_type="text/html; charset=utf-8", headers=None):
+        self.send_response(status)
+        self.send_header("Content-Type", content_type)
+        self.send_header("Content-Length", str(len(body)))
+        for name, value in (headers or {}).items():
+            self.send_header(name, value)
+        self.end_headers()
+        if self.command != "HEAD" and body:
+            self.wfile.write(body)
+            self.sent += len(body)
+
+    def redirect(self, location, cookie=None):
+        headers = {"Location": location}
+        if cookie:
+            headers["Set-Cookie"] = cookie
+        self.respond(303, headers=headers)
+
+    def throttle(self, started, sent):
+        rate = self.server.bandwidth
+        if rate > 0:
+            ahead = sent / rate - (time.monotonic() - started)
+            if ahead > 0:
+                time.sleep(ahead)
+
+    def page(self, title, body):
+        html = ("<!DOCTYPE html><html><head><title>%s : WeLearn</title></head><body>"
+                "<a href=\"%s/login/logout.php?sesskey=x\">Log out</a>%s</body></html>"
+                % (title, self.server.base_url, body))
+        self.respond(200, html.encode())
+
+    # --- request dispatch ---------------------------------------------------
+
+    def handle_any(self):
+        started = time.monotonic()
+        self.sent = 0
+        url = urllib.parse.urlsplit(self.path)
+        query = urllib.parse.parse_qs(url.query)
+        kind = "page"
+        if url.path.startswith("/__bench/"):
+            kind = "control"
+        elif url.path.startswith("/login/"):
+            kind = "login"
+        elif url.path.startswith("/mod/resource/"):
+            kind = "redirect"
+        elif url.path.startswith("/pluginfile.php/"):
+            kind = "file" if self.command == "GET" else "head"
+
+        if self.server.latency > 0 and kind != "control":
+            time.sleep(self.server.latency)
+        status = 200
+        try:
+            if kind not in ("control", "login") and self.server.rng_error():
+                status = self.server.next_error_status()
+                self.respond(status, b"Try again later", headers={"Retry-After": "1"})
+            else:
+                status = self.route(url.path, query)
+        finally:
+            self.server.stats.record(kind, status, time.monotonic() - started, self.sent)
+
+    def route(self, path, query):
+        base = self.server.base_url
+        site = self.server.site
+
+        if path == "/__bench/stats":
+            self.respond(200, json.dumps(self.server.stats.snapshot()).encode(), "application/json")
+            return 200
+        if path == "/__bench/reset":
+            self.server.stats.reset()
+            self.respond(200, b"{}", "application/json")
+            return 200
+        if path == "/__bench/site":
+            self.respond(200, json.dumps(site.summary()).encode(), "application/json")
+            return 200
+
+        if path == "/login/index.php":
+            return self.login()
+
+        if not self.logged_in():
+            self.redirect(base + "/login/index.php")
+            return 303
+
+        if path in ("/my/", "/my/index.php"):
+            links = "".join('<a class="list-group-item list-group-item-action " href="%s/course/view.php?id=%d">'
+                            "%s</a>" % (base, c, page["title"]) for c, page in site.courses.items())
+            self.page("Dashboard", '<nav data-key="mycourses">%s</nav>' % links)
+            return 200
+
+        if path == "/course/view.php":
+            page = site.courses.get(int(query.get("id", ["0"])[0]))
+            if not page:
+                self.respond(404, b"Course not found")
+                return 404
+            body = "".join('<a href="%s/mod/resource/view.php?id=%d"><img src="/pix/f/pdf.png"> %s</a>'
+                           % (base, fid, site.files[fid][0].rsplit(".", 1)[0]) for fid in page["files"])
+            body += self.folder_links(page)
+            self.page("Course: " + page["title"], body)
+            return 200
+
+        if path == "/mod/folder/view.php":
+            page = site.folders.get(int(query.get("id", ["0"])[0]))
+            if not page:
+                self.respond(404, b"Folder not found")
+                return 404
+            body = "".join('<a href="%s/pluginfile.php/%d/mod_folder/content/0/%s?forcedownload=1">%s</a>'
+                           % (base, fid, site.files[fid][0], site.files[fid][0]) for fid in page["files"])
+            body += self.folder_links(page)
+            self.page(page["title"], body)
+            return 200
+
+        if path == "/mod/resource/view.php":
+            fid = int(query.get("id", ["0"])[0])
+            if fid not in site.files:
+                self.respond(404, b"Resource not found")
+                return 404
+            self.redirect("%s/pluginfile.php/%d/mod_resource/content/1/%s" % (base, fid, site.files[fid][0]))
+            return 303
+
+        if path.startswith("/pluginfile.php/"):
+            try:
+                fid = int(path.split("/")[2])
+            except (IndexError, ValueError):
+                fid = -1
+            if fid not in site.files:
+                self.respond(404, b"File not found")
+                return 404
+            return self.send_file(fid)
+
+        self.respond(404, b"Not found")
+        return 404
+
+    def folder_links(self, page):
+        return "".join('<a href="%s/mod/folder/view.php?id=%d"><img src="/pix/folder.png"> %s</a>'
+                       % (self.server.base_url, f, self.server.site.folders[f]["title"].rsplit(" / ", 1)[-1])
+                       for f in page["folders"])
+
+    def login(self):
+        if self.command == "POST":
+            length = int(self.headers.get("Content-Length", "0"))
+            form = urllib.parse.parse_qs(self.rfile.read(length).decode())
+            if form.get("logintoken", [""])[0] not in self.server.tokens:
+                self.page("Log in", '<div class="loginerrors">Invalid login, please try again</div>')
+                return 200
+            session = secrets.token_hex(16)
+            self.server.sessions.add(session)
+            self.redirect(self.server.base_url + "/my/", "MoodleSession=%s; path=/; HttpOnly" % session)
+            return 303
+        token = secrets.token_hex(8)
+        self.server.tokens.add(token)
+        html = ('<html><head><title>Log in : WeLearn</title></head><body><form action="%s/login/index.php" '
+                'method="post"><input type="hidden" name="logintoken" value="%s"></form></body></html>'
+                % (self.server.base_url, token))
+        body = html.encode()
+        self.send_response(200)
+        self.send_header("Content-Type", "text/html; charset=utf-8")
+        self.send_header("Content-Length", str(len(body)))
+        self.send_header("Set-Cookie", "MoodleSession=%s; path=/; HttpOnly" % secrets.token_hex(16))
+        self.end_headers()
+        if self.command != "HEAD":
+            self.wfile.write(body)
+        return 200
+
+    def send_file(self, fid):
+        name, size, mtime = self.server.site.files[fid]
+        etag = '"%x-%x"' % (fid, size)
+        last_modified = formatdate(mtime, usegmt=True)
+        if self.headers.get("If-None-Match") == etag:
+            self.respond(304, headers={"ETag": etag})
+            return 304
+        since = self.headers.get("If-Modified-Since")
+        if since:
+            try:
+                if parsedate_to_datetime(since).timestamp() >= mtime:
+                    self.respond(304, headers={"ETag": etag})
+                    return 304
+            except (TypeError, ValueError):
+                pass
+
+        start, end, status = 0, size - 1, 200
+        ranges = self.headers.get("Range", "")
+        if ranges.startswith("bytes="):
+            first, _, last = ranges[6:].split(",")[0].partition("-")
+            if first:
+                start = int(first)
+                end = min(int(last), size - 1) if last else size - 1
+            if start >= size:
+                self.respond(416, headers={"Content-Range": "bytes */%d" % size})
+                return 416
+            status = 206
+
+        self.send_response(status)
+        self.send_header("Content-Type", "application/pdf")
+        self.send_header("Content-Length", str(end - start + 1))
+        self.send_header("Content-Disposition", 'inline; filename="%s"' % name)
+        self.send_header("Last-Modified", last_modified)
+        self.send_header("ETag", etag)
+        self.send_header("Accept-Ranges", "bytes")
+        if status == 206:
+            self.send_header("Content-Range", "bytes %d-%d/%d" % (start, end, size))
+        self.end_headers()
+        if self.command == "HEAD":
+            return status
+
+        block = self.server.site.file_block(fid)
+        chunk = block * (CHUNK // len(block))
+        started = time.monotonic()
+        pos = start
+        while pos <= end:
+            offset = pos % len(block)
+            n = min(CHUNK - offset, end - pos + 1)
+            self.wfile.write(chunk[offset:offset + n])
+            self.sent += n
+            pos += n
+            self.throttle(started, pos - start)
+        return status
+
+    do_GET = handle_any
+    do_HEAD = handle_any
+    do_POST = handle_any
+
+
+class MockServer(socketserver.ThreadingMixIn, http.server.HTTPServer):
+    daemon_threads = True
+    allow_reuse_address = True
+
+    def __init__(self, site, port=0, latency_ms=0.0, bandwidth_kbps=0.0, error_rate=0.0, seed=1, verbose=False):
+        super().__init__(("127.0.0.1", port), Handler)
+        self.site = site
+        self.base_url = "http://127.0.0.1:%d" % self.server_address[1]
+        self.latency = latency_ms / 1000.0
+        self.bandwidth = bandwidth_kbps * 1024.0
+        self.error_rate = error_rate
+        self.verbose = verbose
+        self.stats = Stats()
+        self.sessions = set()
+        self.tokens = set()
+        self.error_lock = threading.Lock()
+        self.error_rng = random.Random(seed ^ 0x5eed)
+        self.error_count = 0
+
+    def rng_error(self):
+        if self.error_rate <= 0:
+            return False
+        with self.error_lock:
+            return self.error_rng.random() < self.error_rate
+
+    def next_error_status(self):
+        with self.error_lock:
+            self.error_count += 1
+            return (429, 503, 500)[self.error_count % 3]
+
+    def start(self):
+        thread = threading.Thread(target=self.serve_forever, daemon=True)
+        thread.start()
+        return thread
+
+
+def add_site_arguments(parser):
+    parser.add_argument("--courses", type=int, default=8, help="number of courses (default: 8)")
+    parser.add_argument("--depth", type=int, default=2, help="folder nesting below a course page (default: 2)")
+    parser.add_argument("--folders", type=int, default=2, help="sub-folders per page (default: 2)")
+    parser.add_argument("--files", type=int, default=4, help="files per page (default: 4)")
+    parser.add_argument("--sizes", default="lognormal:256k:1.0",
+                        help="file sizes: fixed:SIZE, uniform:MIN:MAX or lognormal:MEDIAN:SIGMA")
+    parser.add_argument("--latency-ms", type=float, default=20.0, help="delay before every response (default: 20)")
+    parser.add_argument("--bandwidth-kbps", type=float, default=0.0,
+                        help="per-connection body rate in KiB/s, 0 = unlimited")
+    parser.add_argument("--error-rate", type=float, default=0.0,
+                        help="fraction of page and file requests answered 429/503/500")
+    parser.add_argument("--seed", type=int, default=1)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--port", type=int, default=8780)
+    parser.add_argument("--verbose", action="store_true", help="log every request")
+    add_site_arguments(parser)
+    args = parser.parse_args()
+
+    site = Site(args.courses, args.depth, args.folders, args.files, args.sizes, args.seed)
+    server = MockServer(site, args.port, args.latency_ms, args.bandwidth_kbps, args.error_rate, args.seed,
+                        args.verbose)
+    summary = site.summary()
+    print("Mock WeLearn at %s: %d courses, %d folders, %d files, %.1f MiB"
+          % (server.base_url, summary["courses"], summary["folders"], summary["files"],
+             summary["bytes"] / 1048576.0), flush=True)
+    try:
+        server.serve_forever()
+    except KeyboardInterrupt:
+        pass
+
+
+if __name__ == "__main__":
+    main()
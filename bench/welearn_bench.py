@@ -0,0 +1,185 @@
+#!/usr/bin/env python3
+"""End-to-end throughput benchmarks of welearn_cli against the local mock site.
+
+Every scenario starts a fresh mock server (bench/mock_welearn.py), runs the CLI
+in batch mode in a scratch directory and reports:
+
+  pages/s   course, folder and dashboard pages served per second of wall time
+  MB/s      file bodies served per second of wall time
+  p50/p99   server-side request latency (request received to last byte sent)
+  peak RSS  maximum resident set size of the client process
+
+Latencies are measured by the mock server, so they include the injected delay
+and the time the client took to read the body, but not client-side queueing.
+
+With --fixture the scenarios run against a session recorded with
+bench/welearn_fixture.py instead of the synthetic site (the scenarios' site
+overrides do not apply then), paced by the --timing model.
+
+    python3 bench/welearn_bench.py                      # all scenarios
+    python3 bench/welearn_bench.py -s download -s scan  # selected ones
+    python3 bench/welearn_bench.py --json results.json
+    python3 bench/welearn_bench.py --fixture course.fixture.gz --timing recorded
+"""
+
+import argparse
+import json
+import os
+import shutil
+import subprocess
+import sys
+import tempfile
+import time
+import urllib.request
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+import mock_welearn  # noqa: E402
+import welearn_fixture  # noqa: E402
+
+# name, mock server overrides, CLI arguments
+SCENARIOS = [
+    ("scan", {}, ["--dry-run"]),
+    ("scan-event-loop", {}, ["--dry-run", "--event-loop"]),
+    ("scan-crawl-workers", {}, ["--dry-run", "--crawl-workers", "4"]),
+    ("scan-deep", {"depth": 5, "folders": 2, "courses": 2}, ["--dry-run", "--crawl-workers", "4"]),
+    ("download", {}, ["-j", "8"]),
+    ("download-serial", {}, ["-j", "1"]),
+    ("download-adaptive", {"bandwidth_kbps": 2048}, ["--adaptive"]),
+    ("download-errors", {"error_rate": 0.02}, ["-j", "8"]),
+]
+
+
+def fetch_json(url):
+    with urllib.request.urlopen(url, timeout=10) as response:
+        return json.loads(response.read().decode())
+
+
+def start_server(overrides, base, fixture, timing):
+    if fixture:
+        server = welearn_fixture.ReplayServer(fixture, 0, timing)
+        server.start()
+        return server, server.summary()
+    site_args = dict(base)
+    site_args.update(overrides)
+    site = mock_welearn.Site(site_args["courses"], site_args["depth"], site_args["folders"],
+                             site_args["files"], site_args["sizes"], site_args["seed"])
+    server = mock_welearn.MockServer(site, 0, site_args["latency_ms"], site_args.get("bandwidth_kbps", 0.0),
+                                     site_args.get("error_rate", 0.0), site_args["seed"])
+    server.start()
+    return server, site.summary()
+
+
+def run_scenario(cli, name, overrides, cli_args, base, keep, fixture=None, timing="none"):
+    server, site = start_server(overrides, base, fixture, timing)
+
+    workdir = tempfile.mkdtemp(prefix="welearn-bench-%s-" % name)
+    env = dict(os.environ)
+    env.update({"WELEARN_BASE_URL": server.base_url, "WELEARN_USERNAME": "bench", "WELEARN_PASSWORD": "bench"})
+    command = [cli, "-o", "out", "--json"] + cli_args
+
+    started = time.monotonic()
+    with open(os.path.join(workdir, "stderr.log"), "w") as log:
+        process = subprocess.Popen(command, cwd=workdir, env=env, stdout=subprocess.PIPE, stderr=log)
+        output = process.stdout.read()
+        _, status, usage = os.wait4(process.pid, 0)
+        process.returncode = os.waitstatus_to_exitcode(status)
+    elapsed = time.monotonic() - started
+
+    stats = fetch_json(server.base_url + "/__bench/stats")
+    server.shutdown()
+    server.server_close()
+
+    summary = {}
+    try:
+        summary = json.loads(output.decode()).get("summary", {})
+    except ValueError:
+        pass
+    if not keep:
+        shutil.rmtree(workdir, ignore_errors=True)
+
+    pages = stats["kinds"].get("page", 0)
+    return {
+        "scenario": name,
+        "exit_code": process.returncode,
+        "seconds": elapsed,
+        "pages": pages,
+        "pages_per_s": pages / elapsed if elapsed > 0 else 0.0,
+        "file_bytes": stats["file_bytes"],
+        "mb_per_s": stats["file_bytes"] / 1e6 / elapsed if elapsed > 0 else 0.0,
+        "requests": stats["requests"],
+        "injected_errors": stats["errors"],
+        "p50_ms": stats["p50_ms"],
+        "p99_ms": stats["p99_ms"],
+        "peak_rss_kb": usage.ru_maxrss,
+        "downloaded": summary.get("downloaded", 0),
+        "failed": summary.get("failed", 0),
+        "fixture_misses": stats.get("misses", 0),
+        "site": site,
+        "workdir": workdir if keep else None,
+    }
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--cli", default="./welearn_cli", help="client binary (default: ./welearn_cli)")
+    parser.add_argument("-s", "--scenario", action="append",
+                        help="run only this scenario (repeatable): " + ", ".join(s[0] for s in SCENARIOS))
+    parser.add_argument("--json", help="also write the results to this file")
+    parser.add_argument("--keep", action="store_true", help="keep the scratch directories (logs, downloads)")
+    parser.add_argument("--fixture", help="replay this recorded session instead of the synthetic site")
+    parser.add_argument("--timing", default="none",
+                        help="replay timing with --fixture: none, recorded or fixed:MS[:KIBPS] (default: none)")
+    mock_welearn.add_site_arguments(parser)
+    args = parser.parse_args()
+    try:
+        welearn_fixture.TimingModel(args.timing)
+    except ValueError as err:
+        parser.error(str(err))
+
+    cli = os.path.abspath(args.cli)
+    if not os.access(cli, os.X_OK):
+        parser.error("client not found: %s (run make first)" % args.cli)
+    names = [s[0] for s in SCENARIOS]
+    for wanted in args.scenario or []:
+        if wanted not in names:
+            parser.error("unknown scenario: %s" % wanted)
+
+    base = {"courses": args.courses, "depth": args.depth, "folders": args.folders, "files": args.files,
+            "sizes": args.sizes, "latency_ms": args.latency_ms, "bandwidth_kbps": args.bandwidth_kbps,
+            "error_rate": args.error_rate, "seed": args.seed}
+    if args.fixture:
+        fixture = welearn_fixture.ReplayServer(args.fixture)
+        site = fixture.summary()
+        fixture.server_close()
+        print("Fixture %s: %d requests, %d files, %.1f MB, recorded %s; timing %s"
+              % (args.fixture, site["requests"], site["files"], site["bytes"] / 1e6, site["recorded"], args.timing))
+    else:
+        site = mock_welearn.Site(args.courses, args.depth, args.folders, args.files, args.sizes, args.seed).summary()
+        print("Mock site: %d courses, %d folders, %d files, %.1f MB; latency %g ms"
+              % (site["courses"], site["folders"], site["files"], site["bytes"] / 1e6, args.latency_ms))
+    print()
+    header = "%-20s %8s %9s %9s %9s %9s %10s %7s %6s" % (
+        "scenario", "time s", "pages/s", "MB/s", "p50 ms", "p99 ms", "peak RSS", "files", "fail")
+    print(header)
+    print("-" * len(header))
+
+    results = []
+    for name, overrides, cli_args in SCENARIOS:
+        if args.scenario and name not in args.scenario:
+            continue
+        result = run_scenario(cli, name, overrides, cli_args, base, args.keep, args.fixture, args.timing)
+        results.append(result)
+        print("%-20s %8.2f %9.1f %9.2f %9.1f %9.1f %7.1f MB %7d %6d%s" % (
+            name, result["seconds"], result["pages_per_s"], result["mb_per_s"], result["p50_ms"],
+            result["p99_ms"], result["peak_rss_kb"] / 1024.0, result["downloaded"], result["failed"],
+            "" if result["exit_code"] == 0 else "  (exit %d)" % result["exit_code"]), flush=True)
+
+    if args.json:
+        with open(args.json, "w") as out:
+            json.dump({"site": base, "fixture": args.fixture, "timing": args.timing, "results": results}, out,
+                      indent=2)
+            out.write("\n")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,640 @@
+#!/usr/bin/env python3
+"""Record a real WeLearn session into a fixture and replay it offline.
+
+record  runs a local proxy in front of the real site. Point the client at it
+        with WELEARN_BASE_URL and run it as usual; every request/response pair
+        (URL, status, headers, body, timing) is written to a gzip'd JSON-lines
+        fixture. Cookies, the login form fields, session keys and login tokens
+        are scrubbed, as is the username the client logs in with (add more
+        strings with --scrub). File bodies larger than --max-body are stored as
+        size and SHA-256 only and replayed as deterministic filler.
+
+replay  serves a fixture on a local port with no network access. The client
+        runs unchanged against it, so logins, crawls and downloads go through
+        the same transfer code as against the site. Responses are paced by a
+        timing model:
+          none               as fast as possible
+          recorded           the recorded time to first byte and transfer time
+          fixed:MS[:KIBPS]   a fixed delay and optional per-connection bandwidth
+
+    python3 bench/welearn_fixture.py record -o course.fixture.gz &
+    WELEARN_BASE_URL=http://127.0.0.1:8790 ./welearn_cli -o /tmp/mirror
+    python3 bench/welearn_fixture.py replay course.fixture.gz --timing recorded
+    python3 bench/welearn_bench.py --fixture course.fixture.gz -s download
+
+Replay answers If-None-Match/If-Modified-Since with 304 when the recorded ETag
+or date matches and Range requests with 206, so resumed and repeated syncs can
+be benchmarked too. Requests the fixture has no answer for get a 404 and are
+counted as misses in /__bench/stats.
+"""
+
+import argparse
+import base64
+import gzip
+import hashlib
+import http.client
+import http.server
+import json
+import os
+import re
+import signal
+import socketserver
+import sys
+import threading
+import time
+import urllib.parse
+from datetime import datetime, timezone
+from email.utils import parsedate_to_datetime
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+import mock_welearn  # noqa: E402
+
+FIXTURE_VERSION = 1
+BASE_PLACEHOLDER = "{{WELEARN_BASE}}"
+REDACTED = "REDACTED"
+# Same site as the client: $WELEARN_BASE_URL, else WELEARN_DEFAULT_BASE_URL (welearn_common.h)
+DEFAULT_UPSTREAM = os.environ.get("WELEARN_BASE_URL") or "https://welearn.iiserkol.ac.in"
+DEFAULT_MAX_BODY = 64 * 1024
+
+# Hop-by-hop and encoding headers are not part of a recorded response
+DROPPED_HEADERS = {"connection", "keep-alive", "transfer-encoding", "content-encoding", "content-length",
+                   "proxy-connection", "te", "trailer", "upgrade"}
+# Request headers forwarded upstream while recording
+FORWARDED_HEADERS = ("Cookie", "Range", "If-None-Match", "If-Modified-Since", "User-Agent", "Content-Type",
+                     "Accept")
+# Request headers kept in the fixture (they select between responses)
+RECORDED_REQUEST_HEADERS = ("Range", "If-None-Match", "If-Modified-Since")
+# Login form fields never written to disk
+SECRET_FIELDS = ("username", "password", "logintoken")
+
+SESSKEY_PATTERNS = [
+    (re.compile(r"(sesskey=)[A-Za-z0-9]+"), r"\1" + REDACTED),
+    (re.compile(r'("sesskey"\s*:\s*")[^"]*'), r"\1" + REDACTED),
+    (re.compile(r'(name="sesskey"\s+value=")[^"]*'), r"\1" + REDACTED),
+    (re.compile(r'(name="logintoken"\s+value=")[^"]*'), r"\1" + REDACTED),
+]
+
+
+def is_text(content_type):
+    content_type = (content_type or "").lower()
+    return content_type.startswith("text/") or "json" in content_type or "javascript" in content_type \
+        or "xml" in content_type
+
+
+def kind_of(method, path):
+    """Request kinds as counted by mock_welearn, so the benchmark columns match"""
+    if path.startswith("/__bench/"):
+        return "control"
+    if path.startswith("/login/"):
+        return "login"
+    if path.startswith("/mod/resource/"):
+        return "redirect"
+    if path.startswith("/pluginfile.php/"):
+        return "file" if method == "GET" else "head"
+    return "page"
+
+
+def filler(size, seed):
+    """Deterministic stand-in for a body that was not stored"""
+    block = hashlib.sha256(seed.encode()).digest() * 128
+    return (block * (size // len(block) + 1))[:size]
+
+
+# --- fixture file -------------------------------------------------------------
+
+
+class FixtureWriter:
+    def __init__(self, path, upstream):
+        self.lock = threading.Lock()
+        self.out = gzip.open(path, "wt", encoding="utf-8")
+        self.count = 0
+        self.write({"fixture": "welearn", "version": FIXTURE_VERSION,
+                    "recorded": datetime.now(timezone.utc).strftime("%Y-%m-%dT%H:%M:%SZ"),
+                    "upstream_host": urllib.parse.urlsplit(upstream).hostname})
+
+    def write(self, record):
+        with self.lock:
+            self.out.write(json.dumps(record, separators=(",", ":"), ensure_ascii=False) + "\n")
+            if "method" in record:
+                self.count += 1
+
+    def close(self):
+        with self.lock:
+            self.out.close()
+
+
+def load_fixture(path):
+    """Returns the header record and {(method, target): [entries in recorded order]}"""
+    entries = {}
+    with gzip.open(path, "rt", encoding="utf-8") as fixture:
+        header = json.loads(fixture.readline())
+        if header.get("fixture") != "welearn" or header.get("version") != FIXTURE_VERSION:
+            raise ValueError("%s is not a version %d WeLearn fixture" % (path, FIXTURE_VERSION))
+        for line in fixture:
+            if line.strip():
+                entry = json.loads(line)
+                entries.setdefault((entry["method"], entry["target"]), []).append(entry)
+    for candidates in entries.values():
+        candidates.sort(key=lambda e: e["seq"])
+    return header, entries
+
+
+# --- recording proxy ----------------------------------------------------------
+
+
+class Scrubber:
+    """Removes secrets from everything written to the fixture"""
+
+    def __init__(self, extra):
+        self.lock = threading.Lock()
+        self.strings = [s for s in extra if s]
+
+    def learn(self, value):
+        if value and len(value) > 2:
+            with self.lock:
+                if value not in self.strings:
+                    self.strings.append(value)
+
+    def text(self, text):
+        for pattern, replacement in SESSKEY_PATTERNS:
+            text = pattern.sub(replacement, text)
+        with self.lock:
+            strings = list(self.strings)
+        for secret in strings:
+            text = text.replace(secret, REDACTED)
+            quoted = urllib.parse.quote(secret)
+            if quoted != secret:
+                text = text.replace(quoted, REDACTED)
+        return text
+
+    def form(self, body):
+        fields = urllib.parse.parse_qsl(body, keep_blank_values=True)
+        for name, value in fields:
+            if name == "username":
+                self.learn(value)
+        return urllib.parse.urlencode([(n, REDACTED if n in SECRET_FIELDS else v) for n, v in fields])
+
+    @staticmethod
+    def set_cookie(value):
+        name, _, rest = value.partition("=")
+        attributes = rest.partition(";")[2]
+        return "%s=%s;%s" % (name, REDACTED, attributes) if attributes else "%s=%s" % (name, REDACTED)
+
+
+class RecordHandler(http.server.BaseHTTPRequestHandler):
+    protocol_version = "HTTP/1.1"
+    server_version = "WeLearnFixtureRecorder/1.0"
+
+    def log_message(self, fmt, *args):
+        if self.server.verbose:
+            super().log_message(fmt, *args)
+
+    def upstream_connection(self):
+        local = self.server.local
+        if getattr(local, "conn", None) is None:
+            parts = urllib.parse.urlsplit(self.server.upstream)
+            if parts.scheme == "https":
+                local.conn = http.client.HTTPSConnection(parts.netloc, timeout=self.server.timeout_s)
+            else:
+                local.conn = http.client.HTTPConnection(parts.netloc, timeout=self.server.timeout_s)
+        return local.conn
+
+    def forward(self, body):
+        headers = {name: self.headers[name] for name in FORWARDED_HEADERS if self.headers.get(name)}
+        headers["Accept-Encoding"] = "identity"
+        for attempt in range(2):
+            conn = self.upstream_connection()
+            try:
+                started = time.monotonic()
+                conn.request(self.command, self.path, body=body, headers=headers)
+                response = conn.getresponse()
+                ttfb = time.monotonic() - started
+                data = response.read()
+                return response, data, ttfb, time.monotonic() - started
+            except (http.client.HTTPException, OSError):
+                conn.close()
+                self.server.local.conn = None
+                if attempt == 1:
+                    raise
+
+    def handle_any(self):
+        seq = self.server.next_seq()
+        length = int(self.headers.get("Content-Length", "0") or 0)
+        body = self.rfile.read(length) if length else None
+        try:
+            response, data, ttfb, total = self.forward(body)
+        except (http.client.HTTPException, OSError) as err:
+            message = ("Upstream request failed: %s" % err).encode()
+            self.send_response(502)
+            self.send_header("Content-Type", "text/plain")
+            self.send_header("Content-Length", str(len(message)))
+            self.end_headers()
+            self.wfile.write(message)
+            return
+
+        proxy_base = self.server.base_url
+        content_type = response.getheader("Content-Type", "")
+        text = data.decode("utf-8", "replace") if is_text(content_type) else None
+        live_headers = []
+        recorded_headers = []
+        for name, value in response.getheaders():
+            lower = name.lower()
+            if lower in DROPPED_HEADERS:
+                continue
+            if lower == "location":
+                value = self.server.to_placeholder(value)
+                live_headers.append((name, value.replace(BASE_PLACEHOLDER, proxy_base)))
+                recorded_headers.append((name, self.server.scrubber.text(value)))
+            elif lower == "set-cookie":
+                # The client talks plain HTTP to the proxy: drop Secure and the site's domain
+                live = re.sub(r";\s*(Secure|Domain=[^;]*)", "", value, flags=re.I)
+                live_headers.append((name, live))
+                recorded_headers.append((name, Scrubber.set_cookie(live)))
+            else:
+                live_headers.append((name, value))
+                recorded_headers.append((name, value))
+
+        if text is not None:
+            placeholder_text = self.server.to_placeholder(text)
+            live_body = placeholder_text.replace(BASE_PLACEHOLDER, proxy_base).encode("utf-8")
+        else:
+            live_body = data
+
+        self.send_response(response.status, response.reason)
+        for name, value in live_headers:
+            self.send_header(name, value)
+        self.send_header("Content-Length", str(len(live_body)))
+        self.end_headers()
+        if self.command != "HEAD":
+            self.wfile.write(live_body)
+
+        request_body = None
+        if body:
+            request_body = self.server.scrubber.form(body.decode("utf-8", "replace"))
+        record = {
+            "seq": seq,
+            "method": self.command,
+            "target": self.server.scrubber.text(self.path),
+            "request_headers": {n: self.headers[n] for n in RECORDED_REQUEST_HEADERS if self.headers.get(n)},
+            "status": response.status,
+            "headers": recorded_headers,
+            "ttfb_ms": round(ttfb * 1000.0, 3),
+            "total_ms": round(total * 1000.0, 3),
+        }
+        if request_body is not None:
+            record["request_body"] = request_body
+        if self.command == "HEAD":
+            pass
+        elif text is not None:
+            record["body"] = self.server.scrubber.text(placeholder_text)
+        elif self.server.max_body >= 0 and len(data) > self.server.max_body:
+            record["body_filler"] = {"size": len(data), "sha256": hashlib.sha256(data).hexdigest()}
+        else:
+            record["body_b64"] = base64.b64encode(data).decode()
+        self.server.writer.write(record)
+
+    do_GET = handle_any
+    do_HEAD = handle_any
+    do_POST = handle_any
+
+
+class RecordServer(socketserver.ThreadingMixIn, http.server.HTTPServer):
+    daemon_threads = True
+    allow_reuse_address = True
+
+    def __init__(self, upstream, writer, port=0, max_body=DEFAULT_MAX_BODY, scrub=(), timeout_s=60.0,
+                 verbose=False):
+        super().__init__(("127.0.0.1", port), RecordHandler)
+        self.upstream = upstream.rstrip("/")
+        self.writer = writer
+        self.max_body = max_body
+        self.scrubber = Scrubber(scrub)
+        self.timeout_s = timeout_s
+        self.verbose = verbose
+        self.base_url = "http://127.0.0.1:%d" % self.server_address[1]
+        self.local = threading.local()
+        self.seq_lock = threading.Lock()
+        self.seq = 0
+        host = urllib.parse.urlsplit(self.upstream).netloc
+        self.origins = ["https://" + host, "http://" + host, "https:\\/\\/" + host, "http:\\/\\/" + host]
+
+    def next_seq(self):
+        with self.seq_lock:
+            self.seq += 1
+            return self.seq
+
+    def to_placeholder(self, text):
+        for origin in self.origins:
+            text = text.replace(origin, BASE_PLACEHOLDER)
+        return text
+
+
+# --- replay server ------------------------------------------------------------
+
+
+class ReplayHandler(http.server.BaseHTTPRequestHandler):
+    protocol_version = "HTTP/1.1"
+    server_version = "WeLearnFixtureReplay/1.0"
+
+    def log_message(self, fmt, *args):
+        if self.server.verbose:
+            super().log_message(fmt, *args)
+
+    def send(self, status, headers, body, entry=None, started=None):
+        self.send_response(status)
+        for name, value in headers:
+            self.send_header(name, value)
+        self.send_header("Content-Length", str(len(body)))
+        self.end_headers()
+        if self.command == "HEAD" or not body:
+            return
+        duration = self.server.transfer_time(entry, len(body))
+        began = time.monotonic()
+        for pos in range(0, len(body), mock_welearn.CHUNK):
+            chunk = body[pos:pos + mock_welearn.CHUNK]
+            self.wfile.write(chunk)
+            self.sent += len(chunk)
+            if duration > 0:
+                ahead = duration * (pos + len(chunk)) / len(body) - (time.monotonic() - began)
+                if ahead > 0:
+                    time.sleep(ahead)
+
+    def handle_any(self):
+        started = time.monotonic()
+        self.sent = 0
+        url = urllib.parse.urlsplit(self.path)
+        kind = kind_of(self.command, url.path)
+        length = int(self.headers.get("Content-Length", "0") or 0)
+        if length:
+            self.rfile.read(length)
+        status = 200
+        try:
+            if kind == "control":
+                status = self.control(url.path)
+            else:
+                status = self.replay()
+        finally:
+            self.server.stats.record(kind, status, time.monotonic() - started, self.sent)
+
+    def control(self, path):
+        if path == "/__bench/stats":
+            snapshot = self.server.stats.snapshot()
+            snapshot["misses"] = self.server.misses
+            body = json.dumps(snapshot).encode()
+        elif path == "/__bench/reset":
+            self.server.stats.reset()
+            body = b"{}"
+        elif path == "/__bench/site":
+            body = json.dumps(self.server.summary()).encode()
+        else:
+            self.send(404, [("Content-Type", "text/plain")], b"Not found")
+            return 404
+        self.send(200, [("Content-Type", "application/json")], body)
+        return 200
+
+    def replay(self):
+        entry = self.server.lookup(self.command, self.path)
+        if entry is None:
+            self.server.count_miss(self.command, self.path)
+            self.send(404, [("Content-Type", "text/plain")], b"Not in fixture")
+            return 404
+
+        ttfb = self.server.first_byte_time(entry)
+        if ttfb > 0:
+            time.sleep(ttfb)
+
+        base = self.server.base_url
+        headers = []
+        etag = last_modified = None
+        for name, value in entry["headers"]:
+            lower = name.lower()
+            if lower == "set-cookie":
+                value = value.replace(REDACTED, self.server.session_cookie(), 1)
+            elif lower == "location":
+                value = value.replace(BASE_PLACEHOLDER, base)
+            elif lower == "etag":
+                etag = value
+            elif lower == "last-modified":
+                last_modified = value
+            headers.append((name, value))
+
+        if entry["status"] == 200 and self.not_modified(etag, last_modified):
+            kept = [(n, v) for n, v in headers if n.lower() in ("etag", "last-modified", "date", "cache-control")]
+            self.send(304, kept, b"")
+            return 304
+
+        body = self.server.body_of(entry)
+        status = entry["status"]
+        ranges = self.headers.get("Range", "")
+        if status == 200 and ranges.startswith("bytes=") and "Range" not in entry.get("request_headers", {}):
+            first, _, last = ranges[6:].split(",")[0].partition("-")
+            if first.isdigit():
+                start = int(first)
+                end = min(int(last), len(body) - 1) if last.isdigit() else len(body) - 1
+                if start >= len(body):
+                    self.send(416, [("Content-Range", "bytes */%d" % len(body))], b"")
+                    return 416
+                headers = [(n, v) for n, v in headers if n.lower() != "content-range"]
+                headers.append(("Content-Range", "bytes %d-%d/%d" % (start, end, len(body))))
+                body = body[start:end + 1]
+                status = 206
+        self.send(status, headers, body, entry)
+        return status
+
+    def not_modified(self, etag, last_modified):
+        if etag and self.headers.get("If-None-Match") == etag:
+            return True
+        since = self.headers.get("If-Modified-Since")
+        if since and last_modified:
+            try:
+                return parsedate_to_datetime(since) >= parsedate_to_datetime(last_modified)
+            except (TypeError, ValueError):
+                return False
+        return False
+
+    do_GET = handle_any
+    do_HEAD = handle_any
+    do_POST = handle_any
+
+
+class TimingModel:
+    """none, recorded or fixed:MS[:KIBPS]"""
+
+    def __init__(self, spec):
+        parts = spec.split(":")
+        self.kind = parts[0]
+        self.latency = 0.0
+        self.bandwidth = 0.0
+        if self.kind == "fixed" and len(parts) in (2, 3):
+            self.latency = float(parts[1]) / 1000.0
+            self.bandwidth = float(parts[2]) * 1024.0 if len(parts) == 3 else 0.0
+        elif self.kind not in ("none", "recorded") or len(parts) != 1:
+            raise ValueError("bad timing model: %s" % spec)
+
+
+class ReplayServer(socketserver.ThreadingMixIn, http.server.HTTPServer):
+    daemon_threads = True
+    allow_reuse_address = True
+
+    def __init__(self, fixture_path, port=0, timing="none", verbose=False):
+        super().__init__(("127.0.0.1", port), ReplayHandler)
+        self.header, self.entries = load_fixture(fixture_path)
+        self.timing = TimingModel(timing)
+        self.verbose = verbose
+        self.base_url = "http://127.0.0.1:%d" % self.server_address[1]
+        self.stats = mock_welearn.Stats()
+        self.lock = threading.Lock()
+        self.served = {}   # (method, target) -> responses handed out
+        self.misses = 0
+        self.sessions = 0
+        self.bodies = {}   # seq -> decoded body
+
+    def summary(self):
+        entries = [e for candidates in self.entries.values() for e in candidates]
+        return {"recorded": self.header.get("recorded"), "requests": len(entries),
+                "files": sum(1 for e in entries if kind_of(e["method"], e["target"]) == "file"),
+                "bytes": sum(self.body_size(e) for e in entries)}
+
+    def lookup(self, method, target):
+        """Responses to a repeated request are handed out in recorded order,
+        the last one again once they run out. A HEAD without a recording is
+        answered from the GET of the same URL."""
+        key = (method, target)
+        if key not in self.entries and method == "HEAD":
+            key = ("GET", target)
+        candidates = self.entries.get(key)
+        if not candidates:
+            return None
+        with self.lock:
+            n = self.served.get(key, 0)
+            self.served[key] = n + 1
+        return candidates[min(n, len(candidates) - 1)]
+
+    def count_miss(self, method, target):
+        with self.lock:
+            self.misses += 1
+        if self.verbose:
+            sys.stderr.write("replay: no recorded response for %s %s\n" % (method, target))
+
+    def session_cookie(self):
+        with self.lock:
+            self.sessions += 1
+            return "replay%08d" % self.sessions
+
+    def body_size(self, entry):
+        if "body_filler" in entry:
+            return entry["body_filler"]["size"]
+        if "body_b64" in entry:
+            return len(entry["body_b64"]) * 3 // 4 - entry["body_b64"][-2:].count("=")
+        return len(entry.get("body", "").encode("utf-8"))
+
+    def body_of(self, entry):
+        with self.lock:
+            body = self.bodies.get(entry["seq"])
+        if body is not None:
+            return body
+        if "body" in entry:
+            body = entry["body"].replace(BASE_PLACEHOLDER, self.base_url).encode("utf-8")
+        elif "body_b64" in entry:
+            body = base64.b64decode(entry["body_b64"])
+        elif "body_filler" in entry:
+            body = filler(entry["body_filler"]["size"], entry["body_filler"]["sha256"])
+        else:
+            body = b""
+        with self.lock:
+            self.bodies[entry["seq"]] = body
+        return body
+
+    def first_byte_time(self, entry):
+        if self.timing.kind == "recorded":
+            return entry.get("ttfb_ms", 0.0) / 1000.0
+        return self.timing.latency
+
+    def transfer_time(self, entry, size):
+        if self.timing.kind == "recorded" and entry is not None:
+            return max(0.0, entry.get("total_ms", 0.0) - entry.get("ttfb_ms", 0.0)) / 1000.0
+        if self.timing.bandwidth > 0:
+            return size / self.timing.bandwidth
+        return 0.0
+
+    def start(self):
+        thread = threading.Thread(target=self.serve_forever, daemon=True)
+        thread.start()
+        return thread
+
+
+# --- command line -------------------------------------------------------------
+
+
+def stop_on_signals():
+    """Ctrl-C, kill and a SIGINT to a background job all end the server cleanly"""
+    def stop(signum, frame):
+        raise KeyboardInterrupt
+    signal.signal(signal.SIGINT, stop)
+    signal.signal(signal.SIGTERM, stop)
+
+
+def record_main(args):
+    writer = FixtureWriter(args.output, args.upstream)
+    server = RecordServer(args.upstream, writer, args.port, args.max_body, args.scrub, verbose=args.verbose)
+    print("Recording %s through %s into %s; stop with Ctrl-C" % (args.upstream, server.base_url, args.output))
+    print("Run the client with WELEARN_BASE_URL=%s" % server.base_url, flush=True)
+    stop_on_signals()
+    try:
+        server.serve_forever()
+    except KeyboardInterrupt:
+        pass
+    finally:
+        server.server_close()
+        writer.close()
+    print("\nRecorded %d requests" % writer.count)
+
+
+def replay_main(args):
+    server = ReplayServer(args.fixture, args.port, args.timing, args.verbose)
+    summary = server.summary()
+    print("Replaying %s (%d requests, %d files, %.1f MiB, recorded %s) at %s, timing %s"
+          % (args.fixture, summary["requests"], summary["files"], summary["bytes"] / 1048576.0,
+             summary["recorded"], server.base_url, args.timing), flush=True)
+    stop_on_signals()
+    try:
+        server.serve_forever()
+    except KeyboardInterrupt:
+        pass
+    print("\n%d requests not in the fixture" % server.misses)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    commands = parser.add_subparsers(dest="command", required=True)
+
+    record = commands.add_parser("record", help="record a session through a local proxy")
+    record.add_argument("-o", "--output", required=True, help="fixture file to write (gzip'd JSON lines)")
+    record.add_argument("--upstream", default=DEFAULT_UPSTREAM, help="site to record (default: %(default)s)")
+    record.add_argument("--port", type=int, default=8790)
+    record.add_argument("--max-body", type=int, default=DEFAULT_MAX_BODY,
+                        help="store larger non-text bodies as size and hash only, -1 keeps all "
+                             "(default: %(default)s)")
+    record.add_argument("--scrub", action="append", default=[],
+                        help="also replace this string (name, e-mail, roll number) everywhere (repeatable)")
+    record.add_argument("--verbose", action="store_true", help="log every request")
+
+    replay = commands.add_parser("replay", help="serve a recorded fixture")
+    replay.add_argument("fixture")
+    replay.add_argument("--port", type=int, default=8790)
+    replay.add_argument("--timing", default="none", help="none, recorded or fixed:MS[:KIBPS] (default: none)")
+    replay.add_argument("--verbose", action="store_true", help="log every request and miss")
+
+    args = parser.parse_args()
+    if args.command == "record":
+        record_main(args)
+    else:
+        try:
+            TimingModel(args.timing)
+        except ValueError as err:
+            parser.error(str(err))
+        replay_main(args)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,421 @@
+// Microbenchmarks of the CPU-side hot paths: response header parsing, file name
+// helpers, page title/login token extraction and the link-extraction pass of a
+// crawl. Every benchmark runs over the pages and headers of a corpus directory
+// (bench/corpus by default, or a directory of captured pages) and over a
+// synthetic course page scaled up to --links links (1 MB+ at the default).
+//
+//     make microbench
+//     bench/welearn_microbench --corpus DIR --min-time 1 --filter links
+//
+// Reports ns/op, MB/s of input and heap allocations per op. Allocations are
+// counted by wrapping malloc/calloc/realloc/strdup at link time, so only calls
+// made from the benchmark and libwelearn.a are seen (not those inside libc).
+
+#include "welearn_common.h"
+#include "welearn_context.h"
+#include "welearn_auth.h"
+#include "welearn_download.h"
+#include <dirent.h>
+#include <errno.h>
+#include <getopt.h>
+#include <time.h>
+
+#define DEFAULT_CORPUS_DIR "bench/corpus"
+#define DEFAULT_MIN_TIME 0.5
+#define DEFAULT_SYNTHETIC_LINKS 10000
+
+// Allocation counting (linked with -Wl,--wrap=malloc,...)
+static size_t alloc_count;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t nmemb, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+char *__real_strdup(const char *s);
+
+void *__wrap_malloc(size_t size) {
+    alloc_count++;
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t nmemb, size_t size) {
+    alloc_count++;
+    return __real_calloc(nmemb, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size) {
+    alloc_count++;
+    return __real_realloc(ptr, size);
+}
+
+char *__wrap_strdup(const char *s) {
+    alloc_count++;
+    return __real_strdup(s);
+}
+
+// Keeps results alive so the calls are not optimized away
+static volatile size_t sink;
+
+// Input of one benchmark
+struct BenchInput {
+    char **items;       // Pages, header lines, names or URLs
+    size_t *lengths;
+    size_t count;
+    size_t bytes;       // Sum of lengths
+};
+
+struct MicroBench {
+    const char *name;
+    void (*run)(const struct BenchInput *input);
+    const struct BenchInput *input;
+};
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void add_input(struct BenchInput *input, const char *data, size_t len) {
+    char **items = realloc(input->items, (input->count + 1) * sizeof(char *));
+    size_t *lengths = realloc(input->lengths, (input->count + 1) * sizeof(size_t));
+    char *copy = malloc(len + 1);
+    if (!items || !lengths || !copy) {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+    memcpy(copy, data, len);
+    copy[len] = '\0';
+    input->items = items;
+    input->lengths = lengths;
+    input->items[input->count] = copy;
+    input->lengths[input->count] = len;
+    input->count++;
+    input->bytes += len;
+}
+
+static void free_input(struct BenchInput *input) {
+    for (size_t i = 0; i < input->count; i++) free(input->items[i]);
+    free(input->items);
+    free(input->lengths);
+    memset(input, 0, sizeof(*input));
+}
+
+// Benchmark bodies: one op is one pass over all items of the input
+
+static void run_header_callback(const struct BenchInput *input) {
+    struct HeaderData headers;
+    memset(&headers, 0, sizeof(headers));
+    for (size_t i = 0; i < input->count; i++) {
+        write_header_callback(input->items[i], 1, input->lengths[i], &headers);
+        sink += (size_t)headers.filename[0];
+    }
+}
+
+static void run_sanitize_filename(const struct BenchInput *input) {
+    char output[MAX_FILENAME_LEN];
+    for (size_t i = 0; i < input->count; i++) {
+        sanitize_filename(input->items[i], output, sizeof(output));
+        sink += (size_t)output[0];
+    }
+}
+
+static void run_filename_from_url(const struct BenchInput *input) {
+    char filename[MAX_FILENAME_LEN];
+    for (size_t i = 0; i < input->count; i++) {
+        extract_filename_from_url(input->items[i], filename, sizeof(filename));
+        sink += (size_t)filename[0];
+    }
+}
+
+static void run_course_title(const struct BenchInput *input) {
+    for (size_t i = 0; i < input->count; i++) {
+        char *title = extract_course_title(input->items[i]);
+        if (title) sink += strlen(title);
+        free(title);
+    }
+}
+
+static void run_logintoken(const struct BenchInput *input) {
+    for (size_t i = 0; i < input->count; i++) {
+        char *token = extract_logintoken(input->items[i]);
+        if (token) sink += strlen(token);
+        free(token);
+    }
+}
+
+static void run_page_links(const struct BenchInput *input) {
+    for (size_t i = 0; i < input->count; i++) {
+        struct FileList list;
+        init_file_list(&list);
+        list_page_resources(input->items[i], "Course", &list, 0);
+        sink += list.count;
+        free_file_list(&list);
+    }
+}
+
+// Corpus loading
+
+static int compare_names(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+static char *read_file(const char *path, size_t *len) {
+    FILE *fp = fopen(path, "rb");
+    if (!fp) return NULL;
+    struct MemoryStruct data;
+    init_memory_struct(&data);
+    char buffer[65536];
+    size_t n;
+    while ((n = fread(buffer, 1, sizeof(buffer), fp)) > 0) {
+        if (write_memory_callback(buffer, 1, n, &data) != n) {
+            free(data.memory);
+            fclose(fp);
+            return NULL;
+        }
+    }
+    fclose(fp);
+    *len = data.size;
+    return data.memory;
+}
+
+// Split a header capture into lines as libcurl hands them to the callback
+// (one line each, CRLF terminated); blank lines separate responses
+static void add_header_lines(struct BenchInput *headers, const char *text) {
+    const char *line = text;
+    while (*line) {
+        const char *end = strchr(line, '\n');
+        size_t len = end ? (size_t)(end - line) : strlen(line);
+        if (len > 0 && line[len - 1] == '\r') len--;
+        char buffer[4096];
+        if (len > 0 && len + 2 < sizeof(buffer)) {
+            memcpy(buffer, line, len);
+            memcpy(buffer + len, "\r\n", 2);
+            add_input(headers, buffer, len + 2);
+        }
+        if (!end) break;
+        line = end + 1;
+    }
+}
+
+// Load *.html files as pages and *.txt files as header captures
+static int load_corpus(const char *dir, struct BenchInput *pages, struct BenchInput *headers) {
+    DIR *d = opendir(dir);
+    if (!d) {
+        fprintf(stderr, "Cannot open corpus directory %s: %s\n", dir, strerror(errno));
+        return -1;
+    }
+    char **names = NULL;
+    size_t count = 0;
+    struct dirent *entry;
+    while ((entry = readdir(d)) != NULL) {
+        const char *dot = strrchr(entry->d_name, '.');
+        if (!dot || (strcmp(dot, ".html") != 0 && strcmp(dot, ".htm") != 0 && strcmp(dot, ".txt") != 0)) continue;
+        char **grown = realloc(names, (count + 1) * sizeof(char *));
+        if (!grown) break;
+        names = grown;
+        names[count++] = strdup(entry->d_name);
+    }
+    closedir(d);
+    qsort(names, count, sizeof(char *), compare_names);
+
+    for (size_t i = 0; i < count; i++) {
+        char path[MAX_PATH_LEN];
+        snprintf(path, sizeof(path), "%s/%s", dir, names[i]);
+        size_t len = 0;
+        char *data = read_file(path, &len);
+        if (!data) {
+            fprintf(stderr, "Cannot read %s\n", path);
+        } else if (strcmp(strrchr(names[i], '.'), ".txt") == 0) {
+            add_header_lines(headers, data);
+        } else {
+            add_input(pages, data, len);
+        }
+        free(data);
+        free(names[i]);
+    }
+    free(names);
+    return 0;
+}
+
+// Names and URLs the crawl would pass to the naming helpers
+static void collect_link_names(const struct BenchInput *pages, struct BenchInput *names, struct BenchInput *urls) {
+    for (size_t i = 0; i < pages->count; i++) {
+        struct FileList list;
+        init_file_list(&list);
+        list_page_resources(pages->items[i], "Course", &list, 0);
+        for (size_t f = 0; f < list.count; f++) {
+            const struct FileInfo *file = &list.files[f];
+            if (file->is_folder) continue;
+            if (file->suggested_name[0]) add_input(names, file->suggested_name, strlen(file->suggested_name));
+            add_input(urls, file->url, strlen(file->url));
+        }
+        free_file_list(&list);
+    }
+}
+
+// A course page with link_count activity links in Moodle's markup: mostly
+// resources, some folders and other modules, the title up front and a login
+// token at the very end (the worst case for the token scan)
+static void build_synthetic_page(struct BenchInput *pages, size_t link_count) {
+    static const char *kinds[] = {"resource", "resource", "resource", "resource", "resource",
+                                  "resource", "resource", "folder", "forum", "assign"};
+    static const char *names[] = {"Lecture %zu - Introduction", "Tutorial sheet %zu (solutions)",
+                                  "Slides: week %zu", "Reference notes [%zu].pdf", "Problem set %zu / revised",
+                                  "Lab %zu: FFT & filtering"};
+    struct MemoryStruct page;
+    init_memory_struct(&page);
+    char chunk[2048];
+    int n = snprintf(chunk, sizeof(chunk),
+                     "<!DOCTYPE html>\n<html dir=\"ltr\" lang=\"en\">\n<head>\n"
+                     "    <title>Course: SYN1000 Synthetic course (%zu links) : WeLearn</title>\n</head>\n"
+                     "<body id=\"page-course-view-topics\" class=\"format-topics path-course\">\n"
+                     "<ul class=\"topics\">\n", link_count);
+    write_memory_callback(chunk, 1, (size_t)n, &page);
+    for (size_t i = 0; i < link_count; i++) {
+        const char *kind = kinds[i % (sizeof(kinds) / sizeof(kinds[0]))];
+        char name[256];
+        snprintf(name, sizeof(name), names[i % (sizeof(names) / sizeof(names[0]))], i);
+        if (i % 25 == 0) {
+            n = snprintf(chunk, sizeof(chunk), "<li id=\"section-%zu\" class=\"section course-section main\">"
+                         "<h3 class=\"sectionname\"><a href=\"https://welearn.iiserkol.ac.in/course/section.php?id=%zu\">"
+                         "Week %zu</a></h3>\n", i / 25, 70000 + i / 25, i / 25 + 1);
+            write_memory_callback(chunk, 1, (size_t)n, &page);
+        }
+        n = snprintf(chunk, sizeof(chunk),
+                     "<li class=\"activity activity-wrapper %s modtype_%s\" id=\"module-%zu\" data-for=\"cmitem\">\n"
+                     "  <div class=\"activity-item focus-control\" data-activityname=\"%s\" data-region=\"activity-card\">\n"
+                     "    <div class=\"activity-icon activityiconcontainer smaller courseicon\"><img src=\"https://"
+                     "welearn.iiserkol.ac.in/theme/image.php/boost/core/1712312345/f/pdf-24\" class=\"activityicon\" alt=\"\"></div>\n"
+                     "    <div class=\"activityname\"><a href=\"https://welearn.iiserkol.ac.in/mod/%s/view.php?id=%zu\" "
+                     "class=\" aalink stretched-link\"><span class=\"instancename\">%s <span class=\"accesshide \">"
+                     "File</span></span></a></div>\n  </div>\n</li>\n",
+                     kind, kind, 100000 + i, name, kind, 100000 + i, name);
+        write_memory_callback(chunk, 1, (size_t)n, &page);
+    }
+    n = snprintf(chunk, sizeof(chunk), "</ul>\n<input type=\"hidden\" name=\"logintoken\" "
+                 "value=\"kTqPl0wZ3mYbV8Xr2uGhN5cDf7EaJs1o\">\n</body>\n</html>\n");
+    write_memory_callback(chunk, 1, (size_t)n, &page);
+    if (page.memory) add_input(pages, page.memory, page.size);
+    free(page.memory);
+}
+
+// Run bench->run until min_time has passed (doubling the iteration count) and
+// print the last measurement
+static void run_benchmark(const struct MicroBench *bench, double min_time) {
+    if (bench->input->count == 0) {
+        printf("%-34s %12s\n", bench->name, "(no input)");
+        return;
+    }
+    bench->run(bench->input);  // Warm up caches
+
+    size_t iterations = 1;
+    double elapsed = 0.0;
+    size_t allocs = 0;
+    for (;;) {
+        size_t allocs_before = alloc_count;
+        double start = now_seconds();
+        for (size_t i = 0; i < iterations; i++) bench->run(bench->input);
+        elapsed = now_seconds() - start;
+        allocs = alloc_count - allocs_before;
+        if (elapsed >= min_time || iterations >= ((size_t)1 << 40)) break;
+        size_t next = elapsed > 0 ? (size_t)(iterations * (min_time * 1.2 / elapsed)) : iterations * 10;
+        if (next > iterations * 10) next = iterations * 10;
+        iterations = next > iterations ? next : iterations * 2;
+    }
+
+    double ns_per_op = elapsed * 1e9 / iterations;
+    double mb_per_s = elapsed > 0 ? bench->input->bytes * (double)iterations / elapsed / 1e6 : 0.0;
+    printf("%-34s %12.0f %10.1f %11.1f %10zu %9zu\n", bench->name, ns_per_op, mb_per_s,
+           (double)allocs / iterations, bench->input->count, bench->input->bytes);
+    fflush(stdout);
+}
+
+static void quiet_log(int level, const char *message, void *userdata) {
+    (void)level;
+    (void)message;
+    (void)userdata;
+}
+
+static void print_usage(const char *program) {
+    printf("Usage: %s [options]\n", program);
+    printf("  -c, --corpus DIR     Pages (*.html) and header captures (*.txt) to run over (default %s)\n",
+           DEFAULT_CORPUS_DIR);
+    printf("  -t, --min-time SEC   Minimum measured time per benchmark (default %.1f)\n", DEFAULT_MIN_TIME);
+    printf("  -n, --links N        Links on the synthetic page (default %d)\n", DEFAULT_SYNTHETIC_LINKS);
+    printf("  -f, --filter TEXT    Run only benchmarks whose name contains TEXT\n");
+    printf("  -h, --help           Show this help\n");
+}
+
+int main(int argc, char *argv[]) {
+    const char *corpus_dir = DEFAULT_CORPUS_DIR;
+    double min_time = DEFAULT_MIN_TIME;
+    long link_count = DEFAULT_SYNTHETIC_LINKS;
+    const char *filter = NULL;
+
+    static struct option long_options[] = {
+        {"corpus", required_argument, 0, 'c'},
+        {"min-time", required_argument, 0, 't'},
+        {"links", required_argument, 0, 'n'},
+        {"filter", required_argument, 0, 'f'},
+        {"help", no_argument, 0, 'h'},
+        {0, 0, 0, 0}
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "c:t:n:f:h", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'c': corpus_dir = optarg; break;
+            case 't': min_time = atof(optarg); break;
+            case 'n': link_count = atol(optarg); break;
+            case 'f': filter = optarg; break;
+            case 'h': print_usage(argv[0]); return 0;
+            default: print_usage(argv[0]); return 1;
+        }
+    }
+    if (min_time <= 0 || link_count < 1) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    // Missing titles and the like are expected on some inputs
+    welearn_context_current()->log = quiet_log;
+
+    struct BenchInput pages = {0}, headers = {0}, names = {0}, urls = {0};
+    struct BenchInput synthetic = {0}, synthetic_names = {0}, synthetic_urls = {0};
+    if (load_corpus(corpus_dir, &pages, &headers) != 0) return 1;
+    collect_link_names(&pages, &names, &urls);
+    build_synthetic_page(&synthetic, (size_t)link_count);
+    collect_link_names(&synthetic, &synthetic_names, &synthetic_urls);
+
+    const struct MicroBench benches[] = {
+        {"header/write_header_callback", run_header_callback, &headers},
+        {"name/sanitize_filename", run_sanitize_filename, &names},
+        {"name/extract_filename_from_url", run_filename_from_url, &urls},
+        {"page/extract_course_title", run_course_title, &pages},
+        {"page/extract_logintoken", run_logintoken, &pages},
+        {"page/links", run_page_links, &pages},
+        {"synthetic/sanitize_filename", run_sanitize_filename, &synthetic_names},
+        {"synthetic/extract_filename_from_url", run_filename_from_url, &synthetic_urls},
+        {"synthetic/extract_course_title", run_course_title, &synthetic},
+        {"synthetic/extract_logintoken", run_logintoken, &synthetic},
+        {"synthetic/links", run_page_links, &synthetic},
+    };
+
+    printf("Corpus %s: %zu pages (%.1f KB), %zu header lines, %zu links; synthetic page %.2f MB, %ld links\n\n",
+           corpus_dir, pages.count, pages.bytes / 1024.0, headers.count, urls.count,
+           synthetic.bytes / 1e6, link_count);
+    printf("%-34s %12s %10s %11s %10s %9s\n", "benchmark", "ns/op", "MB/s", "allocs/op", "items/op", "bytes/op");
+    printf("%.*s\n", 91, "-------------------------------------------------------------------------------------------");
+    for (size_t i = 0; i < sizeof(benches) / sizeof(benches[0]); i++) {
+        if (filter && !strstr(benches[i].name, filter)) continue;
+        run_benchmark(&benches[i], min_time);
+    }
+
+    free_input(&pages);
+    free_input(&headers);
+    free_input(&names);
+    free_input(&urls);
+    free_input(&synthetic);
+    free_input(&synthetic_names);
+    free_input(&synthetic_urls);
+    return 0;
+}
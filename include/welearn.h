@@ -0,0 +1,21 @@
+#ifndef WELEARN_H
+#define WELEARN_H
+
+// Public interface of libwelearn: include this one header when embedding the
+// downloader in another program and link with -lwelearn -lcurl -lpthread
+#include "welearn_common.h"
+#include "welearn_auth.h"
+#include "welearn_context.h"
+#include "welearn_crawl.h"
+#include "welearn_download.h"
+#include "welearn_store.h"
+#include "welearn_verify.h"
+#include "welearn_ratelimit.h"
+#include "welearn_adaptive.h"
+#include "welearn_schedule.h"
+#include "welearn_telemetry.h"
+#include "welearn_trace.h"
+#include "welearn_progress.h"
+#include "welearn_netcache.h"
+
+#endif // WELEARN_H
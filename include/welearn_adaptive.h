@@ -0,0 +1,40 @@
+#ifndef WELEARN_ADAPTIVE_H
+#define WELEARN_ADAPTIVE_H
+
+#include "welearn_common.h"
+
+#define ADAPTIVE_START_LIMIT 2
+#define ADAPTIVE_DEFAULT_MAX_LIMIT 32   // Ceiling when no --jobs is given
+#define ADAPTIVE_WINDOW_SECONDS 1.0     // Shortest measurement window
+#define ADAPTIVE_LATENCY_TOLERANCE 2.0  // First-byte time this many times the baseline means queueing
+#define ADAPTIVE_LATENCY_DECREASE 0.75
+#define ADAPTIVE_ERROR_DECREASE 0.5
+#define ADAPTIVE_GOODPUT_SLACK 0.05     // Goodput changes smaller than this count as flat
+#define ADAPTIVE_PROBE_LATENCY 1.25     // Flat goodput still probes upward below this latency factor
+
+// AIMD controller for the number of concurrent transfers. Completed transfers
+// are measured in windows; after each window the limit grows by one while the
+// aggregate goodput rises (or stays flat with no queueing yet), shrinks by a
+// quarter when the time to first byte inflates without a goodput gain, and
+// halves on errors (timeouts, 429, 5xx).
+// Not thread-safe: it belongs to one transfer engine.
+struct AdaptiveConcurrency {
+    int limit;          // Transfers allowed at once right now
+    int max_limit;
+    int peak_limit;
+    size_t adjustments;
+
+    double window_start;
+    size_t window_samples;
+    size_t window_errors;
+    double window_bytes;
+    double window_ttfb;   // Sum of first-byte times, seconds
+
+    double last_goodput;  // Bytes per second of the previous window
+    double base_ttfb;     // Lowest mean first-byte time seen (0 = none yet)
+};
+
+void adaptive_init(struct AdaptiveConcurrency *ac, int max_limit);
+void adaptive_record(struct AdaptiveConcurrency *ac, CURL *easy, CURLcode res, long http_code);
+
+#endif // WELEARN_ADAPTIVE_H
@@ -2,6 +2,37 @@
 #define WELEARN_AUTH_H
 
 #include "welearn_common.h"
+#include <pthread.h>
+
+// Paths below the site root (see welearn_base_url())
+#define WELEARN_LOGIN_PATH "/login/index.php"
+#define WELEARN_DASHBOARD_PATH "/my/"
+
+// Result codes of welearn_login()
+#define LOGIN_OK 0
+#define LOGIN_NETWORK_ERROR 1
+#define LOGIN_NO_TOKEN 2
+#define LOGIN_INVALID_CREDENTIALS 3
+#define LOGIN_SESSION_EXPIRED 4
+
+// Credentials kept for logging in again when the session expires mid-run
+struct WelearnSession {
+    CURL *curl;  // Handle whose cookies carry the session
+    char username[128];
+    char password[128];
+    int renewals;
+};
+
+// Session set up in the background while the user types credentials
+struct SessionWarmup {
+    CURL *curl;
+    pthread_t thread;
+    int started;
+    int dashboard_status;       // LOGIN_OK if the saved session was accepted
+    struct MemoryStruct page;   // Dashboard of the reused session
+    int token_status;           // LOGIN_OK if logintoken was fetched
+    char *logintoken;
+};
 
 // Authentication functions
 void encrypt_decrypt(char *text, char key);
@@ -9,5 +40,15 @@ void get_password(char *password, size_t size);
 int save_credentials(const char *username, const char *password, char key);
 int load_credentials(char *username, size_t user_size, char *password, size_t pass_size, char key);
 char *extract_logintoken(const char *html);
+int welearn_login(CURL *curl, const char *username, const char *password, struct MemoryStruct *dashboard);
+int welearn_page_is_login(const char *html, const char *effective_url);
+int welearn_fetch_dashboard(CURL *curl, struct MemoryStruct *dashboard);
+int welearn_resume_session(CURL *curl, const char *username, const char *password,
+                           struct MemoryStruct *dashboard, int *reused);
+int welearn_session_renew(void *session);
+void welearn_session_warmup_start(struct SessionWarmup *warmup, CURL *curl);
+int welearn_session_warmup_finish(struct SessionWarmup *warmup, const char *username, const char *password,
+                                  struct MemoryStruct *dashboard, int *reused);
+void welearn_session_warmup_cancel(struct SessionWarmup *warmup);
 
 #endif // WELEARN_AUTH_H
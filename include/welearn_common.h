@@ -11,9 +11,20 @@
 #define MAX_URL_LEN 2048
 #define MAX_FILENAME_LEN 256
 #define CRED_FILE "credentials.dat"
+#define WELEARN_DEFAULT_BASE_URL "https://welearn.iiserkol.ac.in"
+#define WELEARN_BASE_URL_ENV "WELEARN_BASE_URL"  // Overrides the default, e.g. for a local mock server
+#define WELEARN_USER_AGENT "Mozilla/5.0 (Windows NT 10.0; Win64; x64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/91.0.4472.124 Safari/537.36"
 #define ENCRYPTION_KEY 'S'
 #define INITIAL_VISITED_CAPACITY 50
 #define INITIAL_FILE_LIST_CAPACITY 100
+#define MAX_CONTENT_TYPE_LEN 128
+#define MAX_ETAG_LEN 128
+
+// Log levels of welearn_log()
+#define WELEARN_LOG_DEBUG 0
+#define WELEARN_LOG_INFO 1
+#define WELEARN_LOG_WARN 2
+#define WELEARN_LOG_ERROR 3
 
 // Cross-platform definitions
 #ifdef _WIN32
@@ -38,8 +49,17 @@ struct MemoryStruct {
 // Header data structure
 struct HeaderData {
     char filename[MAX_FILENAME_LEN];
+    char etag[MAX_ETAG_LEN];
+    long long range_total;  // Total size from "Content-Range: bytes a-b/total", 0 if absent
+    long status_code;       // Status of the most recent response line seen
+    int login_redirect;     // Some response of the chain redirected to the login page
 };
 
+// Metadata resolution state of a FileInfo entry
+#define META_UNKNOWN 0
+#define META_RESOLVED 1
+#define META_FAILED 2
+
 // Visited URLs tracking
 struct VisitedUrls {
     char **urls;
@@ -55,6 +75,14 @@ struct FileInfo {
     char suggested_name[MAX_FILENAME_LEN];
     int is_folder;
     int depth;  // For tree view indentation
+
+    // Filled in by prefetch_file_metadata(), valid when meta_state == META_RESOLVED
+    int meta_state;
+    long long size;  // -1 when the server did not report a length
+    char content_type[MAX_CONTENT_TYPE_LEN];
+    char remote_name[MAX_FILENAME_LEN];  // Content-Disposition filename
+    char etag[MAX_ETAG_LEN];
+    long remote_mtime;  // Last-Modified as a Unix timestamp, -1 if unknown
 };
 
 // List of files collected during scanning
@@ -88,5 +116,23 @@ void display_file_list(const struct FileList *list);
 char* sanitize_filename(const char* input_filename, char* output_filename, size_t output_size);
 void extract_filename_from_url(const char *url, char *filename, size_t size);
 int create_directory(const char *path);
+int create_directory_at(int dirfd, const char *path);
+void format_size(long long bytes, char *buffer, size_t size);
+int match_pattern_list(const char *patterns, const char *text);
+void fprint_json_string(FILE *fp, const char *s);
+
+// Logging through the calling thread's context (welearn_context.h). Levels
+// below welearn_log_level cost one comparison: the arguments are not even
+// evaluated.
+extern int welearn_log_level;
+#define welearn_log_enabled(level) ((level) >= __atomic_load_n(&welearn_log_level, __ATOMIC_RELAXED))
+#define welearn_log(level, ...) \
+    do { \
+        if (welearn_log_enabled(level)) welearn_log_write((level), __VA_ARGS__); \
+    } while (0)
+void welearn_log_write(int level, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+void welearn_log_set_level(int level);
+const char *welearn_base_url(void);
+void welearn_site_url(char *url, size_t size, const char *path);
 
 #endif // WELEARN_COMMON_H
@@ -0,0 +1,56 @@
+#ifndef WELEARN_CONTEXT_H
+#define WELEARN_CONTEXT_H
+
+#include "welearn_common.h"
+#include "welearn_store.h"
+#include "welearn_ratelimit.h"
+#include "welearn_transfer.h"
+#include "welearn_netcache.h"
+#include "welearn_schedule.h"
+#include "welearn_telemetry.h"
+#include "welearn_trace.h"
+#include "welearn_progress.h"
+
+// Called for every log line (without the trailing newline)
+typedef void (*welearn_log_callback)(int level, const char *message, void *userdata);
+
+// Called when a file download finishes; outcome is one of the DOWNLOAD_* values
+typedef void (*welearn_file_callback)(const char *url, const char *course_path, int outcome, void *userdata);
+
+// Everything one sync job needs. Library calls made on a thread use the context
+// bound to it with welearn_context_bind(), so several jobs can run in parallel
+// threads, each with its own session, download root and callbacks. Threads that
+// never bind one share a process-wide default (the CLI's single job).
+struct WelearnContext {
+    CURL *curl;                   // Logged-in session handle
+    const char *base_url;         // Site root; NULL: $WELEARN_BASE_URL or WELEARN_DEFAULT_BASE_URL
+    int root_fd;                  // Relative download paths resolve against it (AT_FDCWD = cwd)
+    int owns_root_fd;
+    struct ContentStore *store;   // Optional deduplication store
+    struct RateLimiter *limiter;  // Optional request pacing, may be shared between contexts
+    int resume;                   // Keep and continue partial downloads
+    transfer_reauth_callback renew;  // Optional re-login when the session expires
+    void *renew_data;
+    struct NetCache *net_cache;   // Optional DNS/TLS cache seeded into transfer engines
+    int event_loop;               // Event-driven transfer engines and concurrent crawl
+    int max_transfers;            // Pages in flight during an event-driven crawl (0 = default)
+    const struct SchedulePolicy *schedule;  // Optional download order and small-file lane
+    int adaptive;                 // Download batches tune their concurrency (max_parallel = ceiling)
+    int crawl_workers;            // Work-stealing crawl threads otherwise (0 = default)
+    int max_depth;                // Folder nesting followed below a course page (0 = default)
+    struct Telemetry *telemetry;  // Optional per-request timings, may be shared between contexts
+    struct TraceLog *trace;       // Optional timeline of the run, may be shared between contexts
+    struct ProgressStream *progress;  // Optional JSON-lines progress events, may be shared
+    welearn_log_callback log;     // NULL prints info to stdout and the rest to stderr
+    void *log_data;
+    welearn_file_callback on_file;  // Optional
+    void *file_data;
+};
+
+void welearn_context_init(struct WelearnContext *ctx);
+int welearn_context_open_root(struct WelearnContext *ctx, const char *dir);
+void welearn_context_cleanup(struct WelearnContext *ctx);
+struct WelearnContext *welearn_context_bind(struct WelearnContext *ctx);
+struct WelearnContext *welearn_context_current(void);
+
+#endif // WELEARN_CONTEXT_H
@@ -0,0 +1,78 @@
+#ifndef WELEARN_CRAWL_H
+#define WELEARN_CRAWL_H
+
+#include "welearn_common.h"
+#include "welearn_transfer.h"
+#include <pthread.h>
+
+#define CRAWL_DEFAULT_WORKERS 1
+#define CRAWL_MAX_WORKERS 32
+#define CRAWL_DEFAULT_MAX_DEPTH 16   // Folder nesting followed below a course page
+#define CRAWL_IDLE_WAIT_MS 50        // Idle workers re-check for work this often
+
+struct CrawlPool;
+struct CrawlWorker;
+struct WelearnContext;
+
+// Runs one task on a worker; may push more tasks with crawl_pool_push()
+typedef void (*crawl_task_callback)(struct CrawlWorker *worker, void *task, void *userdata);
+
+// Double-ended task queue of one worker. The owner pushes and pops at the
+// bottom (depth first, so the open part of the tree stays small); idle workers
+// steal from the top, which holds the oldest and usually largest subtrees.
+struct CrawlDeque {
+    void **tasks;
+    size_t top;
+    size_t bottom;
+    size_t capacity;
+    pthread_mutex_t lock;
+};
+
+struct CrawlWorker {
+    struct CrawlPool *pool;
+    size_t index;
+    struct CrawlDeque deque;
+    CURL *curl;          // This worker's handle; shares cookies with the other workers
+    pthread_t thread;
+    int thread_started;
+    unsigned int seed;   // Victim selection
+    size_t executed;
+    size_t stolen;
+};
+
+// Fixed set of crawl workers with per-worker deques and work stealing. With one
+// worker the tasks run on the calling thread with the session handle itself.
+struct CrawlPool {
+    struct CrawlWorker workers[CRAWL_MAX_WORKERS];
+    size_t worker_count;
+    crawl_task_callback run;
+    void *userdata;
+    struct WelearnContext *context;  // Bound on every worker thread while running
+
+    CURL *session;
+    CURLSH *share;       // Cookies, DNS and TLS sessions of the worker handles
+    pthread_mutex_t share_locks[CURL_LOCK_DATA_LAST];
+
+    // Session expiry: one worker logs in again, the others retry with the new cookies
+    transfer_reauth_callback reauth;
+    void *reauth_data;
+    pthread_mutex_t reauth_lock;
+    unsigned long session_generation;
+    int reauth_failed;
+
+    pthread_mutex_t idle_lock;
+    pthread_cond_t idle_cond;
+    size_t pending;      // Tasks pushed and not finished yet
+    size_t next_push;    // Round robin for tasks pushed from outside the pool
+};
+
+int crawl_pool_init(struct CrawlPool *pool, CURL *session, int worker_count,
+                    crawl_task_callback run, void *userdata);
+void crawl_pool_push(struct CrawlPool *pool, struct CrawlWorker *worker, void *task);
+void crawl_pool_run(struct CrawlPool *pool);
+void crawl_pool_cleanup(struct CrawlPool *pool);
+
+CURLcode crawl_fetch_page(struct CrawlWorker *worker, const char *url, struct MemoryStruct *page, long *http_code,
+                          int kind);
+
+#endif // WELEARN_CRAWL_H
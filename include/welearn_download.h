@@ -2,9 +2,50 @@
 #define WELEARN_DOWNLOAD_H
 
 #include "welearn_common.h"
+#include "welearn_store.h"
+#include "welearn_verify.h"
+#include "welearn_ratelimit.h"
+#include "welearn_transfer.h"
+#include "welearn_netcache.h"
+#include "welearn_schedule.h"
+
+struct ProgressStream;
+
+// Outcome of a single download
+#define DOWNLOAD_OK 0
+#define DOWNLOAD_SKIPPED 1       // Already present at its destination
+#define DOWNLOAD_UNCHANGED 2     // Server answered 304, kept or restored from the store
+#define DOWNLOAD_DEDUPLICATED 3  // Content already stored, linked instead of transferred
+#define DOWNLOAD_FAILED 4
+
+// Totals of a batch of downloads
+struct DownloadStats {
+    size_t downloaded;
+    size_t skipped;
+    size_t unchanged;
+    size_t deduplicated;
+    size_t failed;
+    long long bytes;  // Bytes of newly downloaded files
+    int concurrency;  // Transfers allowed at once when the batch ended
+};
 
 // Download functions
-void download_file(CURL *curl, const char *url, const char *course_path, const char* suggested_name);
+void download_set_content_store(struct ContentStore *store);
+void download_set_rate_limiter(struct RateLimiter *limiter);
+void download_set_resume(int enabled);
+void download_set_session_renewal(transfer_reauth_callback renew, void *userdata);
+void download_set_net_cache(struct NetCache *cache);
+void download_set_event_loop(int enabled, int max_transfers);
+void download_set_adaptive(int enabled);
+void download_set_schedule(const struct SchedulePolicy *policy);
+void download_set_crawl_limits(int workers, int max_depth);
+void download_set_telemetry(struct Telemetry *telemetry);
+void download_set_trace(struct TraceLog *trace);
+void download_set_progress(struct ProgressStream *progress);
+const char *download_outcome_name(int outcome);
+size_t redownload_failed_entries(CURL *curl, struct ContentStore *store, const struct VerifyResult *result);
+int download_file(CURL *curl, const char *url, const char *course_path, const char* suggested_name);
+int download_link_known_url(const char *url, const char *course_path);
 void process_page_for_resources(CURL *curl, const char *page_url, const char *course_path, struct VisitedUrls *visited);
 char* extract_course_title(const char *html);
 void extract_course_links_and_process(CURL *curl_handle, const char *html);
@@ -12,10 +53,42 @@ void extract_course_links_and_process(CURL *curl_handle, const char *html);
 // New scanning functions for collecting files
 void collect_page_resources(CURL *curl, const char *page_url, const char *course_name, 
                            struct VisitedUrls *visited, struct FileList *file_list, int depth);
+void list_page_resources(const char *html, const char *course_name, struct FileList *file_list, int depth);
 void scan_courses_and_collect_files(CURL *curl_handle, const char *html, struct FileList *file_list);
+int scan_courses_matching(CURL *curl_handle, const char *html, const char *course_patterns,
+                          struct FileList *file_list);
+
+// Incremental scanning for watch mode: course page fingerprints kept between polls
+struct CourseWatchEntry {
+    char url[MAX_URL_LEN];
+    char fingerprint[SHA256_HEX_LEN];
+};
+
+struct CourseWatchState {
+    struct CourseWatchEntry *entries;
+    size_t count;
+    size_t capacity;
+};
+
+void init_course_watch(struct CourseWatchState *watch);
+void free_course_watch(struct CourseWatchState *watch);
+int scan_changed_courses(CURL *curl_handle, const char *html, const char *course_patterns,
+                         struct CourseWatchState *watch, int force, struct FileList *file_list,
+                         size_t *failed_pages);
+
+// Metadata prefetch: concurrent HEAD requests filling size/type/name of each FileInfo.
+// The progress callback runs as each result arrives.
+typedef void (*metadata_progress_callback)(const struct FileInfo *file, size_t done, size_t total, void *userdata);
+size_t prefetch_file_metadata(CURL *curl, struct FileList *list, int max_parallel,
+                              metadata_progress_callback progress, void *userdata);
 
 // Interactive download functions
 void download_selected_files(CURL *curl, const struct FileList *list, const int *selections, 
                             size_t selection_count, const char *base_path);
 
+// Batch download over the transfer engine
+size_t download_files_parallel(CURL *curl, const struct FileList *list, const int *selections,
+                               size_t selection_count, const char *base_path, int max_parallel,
+                               struct DownloadStats *stats, int *outcomes);
+
 #endif // WELEARN_DOWNLOAD_H
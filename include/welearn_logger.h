@@ -0,0 +1,31 @@
+#ifndef WELEARN_LOGGER_H
+#define WELEARN_LOGGER_H
+
+#include "welearn_common.h"
+
+#define LOGGER_RING_SIZE (64 * 1024)  // Bytes of pending records per logging thread (power of two)
+#define LOGGER_FLUSH_MS 50            // Longest a record waits for the flusher
+
+// How the flusher writes records
+enum LoggerFormat {
+    LOGGER_TEXT,  // The message as logged
+    LOGGER_JSON   // {"t","level","thread","msg"} per line
+};
+
+// Asynchronous sink of the welearn_log() lines: info goes to stdout, the rest
+// to stderr. Each thread appends records (time, level, thread, message) to a
+// ring of its own without locks; a background thread merges the rings in time
+// order and writes them in batches. Warnings and errors, and info from the
+// thread that called logger_start(), flush the rings on the spot; call
+// logger_flush() after joining other threads that log. Full rings drop DEBUG
+// records (counted and reported) and make the other levels wait. Before
+// logger_start() and after logger_stop(), records are written synchronously.
+int logger_start(int format);
+void logger_stop(void);
+// Write everything logged so far
+void logger_flush(void);
+// Queue one formatted message of len bytes
+void logger_submit(int level, const char *message, size_t len);
+const char *logger_level_name(int level);
+
+#endif // WELEARN_LOGGER_H
@@ -0,0 +1,38 @@
+#ifndef WELEARN_METRICS_H
+#define WELEARN_METRICS_H
+
+#include "welearn_common.h"
+#include "welearn_telemetry.h"
+#include <pthread.h>
+#include <time.h>
+
+#define METRICS_FILE_INTERVAL 15  // Seconds between rewrites of the metrics file
+
+// Prometheus text exposition of a run's telemetry: requests by kind and status,
+// bytes, files by outcome and the bytes 304s and deduplication saved, retries,
+// re-logins, rate-limiter wait, and the transfers in flight and queued. A
+// background thread rewrites a file for node_exporter's textfile collector
+// and/or answers scrapes on 127.0.0.1.
+struct MetricsExporter {
+    struct Telemetry *telemetry;
+    const char *path;   // Metrics file, NULL for none
+    int listen_fd;      // -1 when not serving
+    int port;
+    time_t started;     // Wall clock start, exposed as welearn_start_time_seconds
+    int stop;
+    pthread_t thread;
+    int thread_started;
+};
+
+// Write the current metrics in the text format
+void metrics_write(struct Telemetry *t, time_t started, FILE *fp);
+// Replace path atomically (temp file + rename); 0 on success
+int metrics_write_file(struct Telemetry *t, time_t started, const char *path);
+
+// Start exporting t to path (may be NULL) and/or port (0 = no server). -1 when
+// the port or the thread failed; whatever could be started keeps running.
+int metrics_exporter_start(struct MetricsExporter *m, struct Telemetry *t, const char *path, int port);
+// Stop the thread and write the file a last time
+void metrics_exporter_stop(struct MetricsExporter *m);
+
+#endif // WELEARN_METRICS_H
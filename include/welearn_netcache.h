@@ -0,0 +1,64 @@
+#ifndef WELEARN_NETCACHE_H
+#define WELEARN_NETCACHE_H
+
+#include "welearn_common.h"
+#include <pthread.h>
+#include <time.h>
+
+#define NETCACHE_FILE "netcache.txt"
+#define NETCACHE_DNS_TTL 3600          // Seconds a resolved address is reused across runs
+#define NETCACHE_MAX_DNS 16
+#define NETCACHE_MAX_TLS 16
+#define NETCACHE_MAX_TICKET 8192       // Bytes of one serialized TLS session
+
+// TLS session export/import appeared in libcurl 8.12.0; older versions only
+// persist DNS results
+#if LIBCURL_VERSION_NUM >= 0x080c00
+#define NETCACHE_HAVE_TLS 1
+#else
+#define NETCACHE_HAVE_TLS 0
+#endif
+
+struct NetCacheHost {
+    char host[256];
+    long port;
+    char ip[64];
+    time_t expires;
+};
+
+struct NetCacheTicket {
+    char session_key[512];
+    unsigned char *shmac;
+    size_t shmac_len;
+    unsigned char *sdata;
+    size_t sdata_len;
+    time_t expires;
+};
+
+// Network state carried from one run to the next: resolved addresses and TLS
+// session tickets. Handles attached with net_cache_apply share one DNS cache,
+// TLS session cache and connection pool, also across threads. Handles with a
+// share of their own (transfer engines, crawl workers) keep their cookies and
+// connections there and get the addresses and TLS sessions through
+// net_cache_seed_share and net_cache_collect_share.
+struct NetCache {
+    char path[MAX_PATH_LEN];
+    struct NetCacheHost hosts[NETCACHE_MAX_DNS];
+    size_t host_count;
+    struct NetCacheTicket tickets[NETCACHE_MAX_TLS];
+    size_t ticket_count;
+    struct curl_slist *resolve;  // CURLOPT_RESOLVE entries built from hosts
+    CURLSH *share;               // DNS, TLS sessions and connections of attached handles
+    pthread_mutex_t locks[CURL_LOCK_DATA_LAST];
+    pthread_mutex_t lock;        // Guards hosts and tickets
+};
+
+int net_cache_load(struct NetCache *cache, const char *path);
+void net_cache_apply(struct NetCache *cache, CURL *curl);
+void net_cache_seed_share(struct NetCache *cache, CURLSH *share);
+void net_cache_record(struct NetCache *cache, CURL *curl);
+void net_cache_collect_share(struct NetCache *cache, CURLSH *share);
+int net_cache_save(struct NetCache *cache);
+void net_cache_free(struct NetCache *cache);
+
+#endif // WELEARN_NETCACHE_H
@@ -0,0 +1,64 @@
+#ifndef WELEARN_PROFILE_H
+#define WELEARN_PROFILE_H
+
+// Scoped timers and counters for the library's internal hot paths. Built with
+// -DWELEARN_PROFILE (make PROFILE=1) every scope adds its calls, time and
+// amount (bytes, items) to a table owned by the calling thread; the tables are
+// summed and printed to stderr at exit ($WELEARN_PROFILE_OUT appends them to a
+// file instead). In normal builds the macros expand to nothing.
+
+// Instrumented scopes, grouped by what they spend: CPU, disk or sleeping
+enum ProfileScope {
+    PROFILE_PARSE_LINKS,      // Resource and folder links of a course/folder page
+    PROFILE_PARSE_COURSES,    // Course links of the dashboard
+    PROFILE_PARSE_HEADERS,    // Response header lines
+    PROFILE_BUFFER_GROW,      // Growing a response body buffer (amount: bytes appended)
+    PROFILE_FILELIST_APPEND,  // Appending to a FileList
+    PROFILE_MKDIR,            // create_directory
+    PROFILE_STAT,             // Existence checks of downloads and stored objects
+    PROFILE_OPEN,             // Opening download, partial and manifest files
+    PROFILE_LIMITER_WAIT,     // Sleeping for a rate limiter token
+    PROFILE_PACE_SLEEP,       // Fixed pauses between requests without a limiter
+    PROFILE_SCOPE_COUNT
+};
+
+#ifdef WELEARN_PROFILE
+
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+struct ProfileSpan {
+    int scope;
+    uint64_t start;  // Nanoseconds, CLOCK_MONOTONIC
+};
+
+static inline uint64_t profile_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+void profile_span_end(struct ProfileSpan *span);
+void profile_count(int scope, long long amount);
+void profile_dump(FILE *fp);
+
+#define PROFILE_JOIN_(a, b) a##b
+#define PROFILE_JOIN(a, b) PROFILE_JOIN_(a, b)
+
+// Time from here to the end of the enclosing block
+#define PROFILE_SCOPE(scope) \
+    struct ProfileSpan PROFILE_JOIN(profile_span_, __LINE__) \
+        __attribute__((cleanup(profile_span_end))) = {(scope), profile_now()}
+
+// Add amount to the scope's counter
+#define PROFILE_COUNT(scope, amount) profile_count((scope), (long long)(amount))
+
+#else
+
+#define PROFILE_SCOPE(scope) ((void)0)
+#define PROFILE_COUNT(scope, amount) ((void)0)
+
+#endif // WELEARN_PROFILE
+
+#endif // WELEARN_PROFILE_H
@@ -0,0 +1,55 @@
+#ifndef WELEARN_PROGRESS_H
+#define WELEARN_PROGRESS_H
+
+#include "welearn_common.h"
+#include "welearn_download.h"
+#include <pthread.h>
+
+#define PROGRESS_BYTES_INTERVAL 0.5  // Seconds between byte events of one transfer
+
+// Machine-readable progress of a run, one JSON object per line:
+//   discovered  a scanned file and whether the filters selected it
+//   plan        files and known bytes about to be downloaded
+//   start       a file transfer began (resume offset included)
+//   bytes       bytes received so far, at most every PROGRESS_BYTES_INTERVAL per transfer
+//   done        a file finished: status, bytes and seconds
+//   summary     totals of a batch with its throughput
+// Every event carries "t", seconds since progress_init. Thread-safe; each line
+// is flushed so a reading process sees it at once.
+struct ProgressStream {
+    pthread_mutex_t lock;
+    FILE *out;
+    double started;
+};
+
+// One file transfer between its start and done events
+struct ProgressTransfer {
+    struct ProgressStream *stream;  // NULL when the run has no progress stream
+    const char *url;                // Must outlive the transfer
+    double started;
+    double last_event;
+    long long offset;               // Bytes resumed from an earlier attempt
+};
+
+void progress_init(struct ProgressStream *p, FILE *out);
+void progress_free(struct ProgressStream *p);
+double progress_now(void);  // Monotonic seconds
+
+// Scan results; account may be NULL (single account)
+void progress_discovered(struct ProgressStream *p, const char *account, const struct FileInfo *file, int selected);
+void progress_plan(struct ProgressStream *p, const char *account, size_t scanned, size_t selected, long long known_bytes);
+
+// Start tracking a transfer of url, offset bytes in; tr stays inactive when p is NULL
+void progress_transfer_begin(struct ProgressStream *p, struct ProgressTransfer *tr, const char *url,
+                             const char *name, long long offset);
+// CURLOPT_XFERINFOFUNCTION with a ProgressTransfer as CURLOPT_XFERINFODATA
+int progress_xferinfo(void *clientp, curl_off_t dltotal, curl_off_t dlnow, curl_off_t ultotal, curl_off_t ulnow);
+// A file finished with status (downloaded, skipped...); tr is NULL when no transfer was needed
+void progress_done(struct ProgressStream *p, const struct ProgressTransfer *tr, const char *url,
+                   const char *course, const char *status, long long bytes);
+
+// Totals of a batch that took seconds
+void progress_summary(struct ProgressStream *p, const char *account, const struct DownloadStats *stats,
+                      size_t selected, double seconds, int exit_code);
+
+#endif // WELEARN_PROGRESS_H
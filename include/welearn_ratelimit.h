@@ -0,0 +1,21 @@
+#ifndef WELEARN_RATELIMIT_H
+#define WELEARN_RATELIMIT_H
+
+#include <pthread.h>
+
+// Token bucket limiting how many requests per second are started.
+// Safe to share between threads.
+struct RateLimiter {
+    double rate;    // Tokens per second; <= 0 disables limiting
+    double burst;   // Bucket capacity
+    double tokens;
+    double last_refill;
+    pthread_mutex_t lock;
+};
+
+void rate_limiter_init(struct RateLimiter *limiter, double rate, double burst);
+void rate_limiter_destroy(struct RateLimiter *limiter);
+long rate_limiter_try_acquire(struct RateLimiter *limiter);
+void rate_limiter_acquire(struct RateLimiter *limiter);
+
+#endif // WELEARN_RATELIMIT_H
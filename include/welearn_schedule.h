@@ -0,0 +1,35 @@
+#ifndef WELEARN_SCHEDULE_H
+#define WELEARN_SCHEDULE_H
+
+#include "welearn_common.h"
+
+#define SCHEDULE_MAX_PRIORITY_PATTERNS 16
+#define SCHEDULE_SMALL_FILE_BYTES (8LL * 1024 * 1024)  // Files up to this size may use the small-file lane
+
+// Order in which selected files are downloaded
+enum ScheduleOrder {
+    SCHEDULE_LIST = 0,   // As selected (list order)
+    SCHEDULE_SMALLEST,   // Smallest known size first, unknown sizes last
+    SCHEDULE_NEWEST,     // Most recent Last-Modified first, unknown dates last
+    SCHEDULE_FAIR        // Round robin over courses, list order within each course
+};
+
+// How a batch is ordered and interleaved. Files matching a priority pattern
+// (by name or course) go before everything else, earlier patterns first; the
+// order decides within each priority class.
+struct SchedulePolicy {
+    int order;
+    const char *priority[SCHEDULE_MAX_PRIORITY_PATTERNS];  // Comma-separated globs each
+    size_t priority_count;
+    int small_lane;         // Parallel slots large files may not take (0 = no lane)
+    long long small_limit;  // Largest file counted as small
+};
+
+void schedule_policy_init(struct SchedulePolicy *policy);
+int schedule_order_from_name(const char *name);
+const char *schedule_order_name(int order);
+int schedule_is_small(const struct FileInfo *file, const struct SchedulePolicy *policy);
+size_t *schedule_selections(const struct FileList *list, const int *selections, size_t selection_count,
+                            const struct SchedulePolicy *policy);
+
+#endif // WELEARN_SCHEDULE_H
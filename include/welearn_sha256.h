@@ -0,0 +1,23 @@
+#ifndef WELEARN_SHA256_H
+#define WELEARN_SHA256_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SHA256_DIGEST_LEN 32
+#define SHA256_HEX_LEN 65  // 64 hex digits + terminator
+
+// Streaming SHA-256 state
+struct Sha256Context {
+    uint32_t state[8];
+    uint64_t bit_count;
+    uint8_t buffer[64];
+    size_t buffer_len;
+};
+
+void sha256_init(struct Sha256Context *ctx);
+void sha256_update(struct Sha256Context *ctx, const void *data, size_t len);
+void sha256_final(struct Sha256Context *ctx, uint8_t digest[SHA256_DIGEST_LEN]);
+void sha256_to_hex(const uint8_t digest[SHA256_DIGEST_LEN], char hex[SHA256_HEX_LEN]);
+
+#endif // WELEARN_SHA256_H
@@ -0,0 +1,85 @@
+#ifndef WELEARN_STORE_H
+#define WELEARN_STORE_H
+
+#include "welearn_common.h"
+#include "welearn_sha256.h"
+
+// Layout of the content-addressed store inside a download root
+#define STORE_DIR ".welearn"
+#define STORE_OBJECTS_DIR ".welearn/objects"
+#define STORE_MANIFEST_FILE ".welearn/manifest.tsv"
+#define STORE_QUARANTINE_DIR ".welearn/quarantine"  // Damaged files and objects moved aside by verify
+#define STORE_MANIFEST_HEADER "# welearn manifest v1"
+#define INITIAL_MANIFEST_CAPACITY 64
+#define MANIFEST_SAVE_INTERVAL 32  // Flush the manifest after this many new records
+
+// How a store object was materialized at its destination
+#define STORE_LINK_NONE 0
+#define STORE_LINK_REFLINK 1
+#define STORE_LINK_HARDLINK 2
+#define STORE_LINK_COPY 3
+
+// One downloaded file as recorded at download time
+struct ManifestEntry {
+    char sha256[SHA256_HEX_LEN];
+    long long size;
+    char etag[MAX_ETAG_LEN];
+    long remote_mtime;
+    long downloaded_at;
+    char url[MAX_URL_LEN];
+    char path[MAX_PATH_LEN];  // Relative to the download root
+};
+
+struct Manifest {
+    struct ManifestEntry *entries;
+    size_t count;
+    size_t capacity;
+    size_t unsaved;
+};
+
+// Content-addressed object store plus manifest for one download root
+struct ContentStore {
+    char root[MAX_PATH_LEN];
+    int dirfd;  // root and every store path resolve against it (AT_FDCWD = cwd)
+    struct Manifest manifest;
+};
+
+// Streams a download to a temporary file while hashing it
+struct HashedFileWriter {
+    FILE *fp;
+    int dirfd;  // temp_path is relative to it
+    char temp_path[MAX_PATH_LEN];
+    struct Sha256Context sha;
+    long long bytes;
+    long long resume_from;             // Bytes kept from an earlier attempt, 0 once confirmed
+    const struct HeaderData *headers;  // Response headers; a non-206 reply restarts a resume
+};
+
+// Store lifecycle
+int content_store_open(struct ContentStore *store, const char *root);
+int content_store_open_at(struct ContentStore *store, int dirfd, const char *root);
+int content_store_save(struct ContentStore *store);
+void content_store_close(struct ContentStore *store);
+
+// Manifest queries and updates
+const struct ManifestEntry *manifest_find_url(const struct Manifest *manifest, const char *url);
+const struct ManifestEntry *manifest_find_etag(const struct Manifest *manifest, const char *etag, long long size);
+const struct ManifestEntry *manifest_find_path(const struct Manifest *manifest, const char *path);
+int manifest_record(struct ContentStore *store, const struct ManifestEntry *entry);
+
+// Objects
+void content_store_object_path(const struct ContentStore *store, const char *sha256, char *path, size_t size);
+int content_store_has(const struct ContentStore *store, const char *sha256);
+int content_store_ingest(struct ContentStore *store, const char *temp_path, const char *sha256);
+int content_store_materialize(const struct ContentStore *store, const char *sha256, const char *dest_path);
+const char *content_store_relative_path(const struct ContentStore *store, const char *path);
+
+// Hashed download writer
+int hashed_writer_open(struct HashedFileWriter *writer, int dirfd, const char *dir);
+int hashed_writer_open_resumable(struct HashedFileWriter *writer, int dirfd, const char *dir, const char *key);
+size_t hashed_write_callback(void *ptr, size_t size, size_t nmemb, void *userp);
+int hashed_writer_finish(struct HashedFileWriter *writer, char sha256[SHA256_HEX_LEN]);
+void hashed_writer_discard(struct HashedFileWriter *writer);
+void hashed_writer_suspend(struct HashedFileWriter *writer);
+
+#endif // WELEARN_STORE_H
@@ -0,0 +1,122 @@
+#ifndef WELEARN_TELEMETRY_H
+#define WELEARN_TELEMETRY_H
+
+#include "welearn_common.h"
+#include <pthread.h>
+#include <stdint.h>
+
+#define TELEMETRY_SUB_BUCKETS 16  // Buckets per power of two: about 6% resolution
+#define TELEMETRY_BUCKET_COUNT (TELEMETRY_SUB_BUCKETS * 40)
+#define TELEMETRY_STATUS_COUNT 6   // Transport error, then 1xx to 5xx
+#define TELEMETRY_OUTCOME_COUNT 5  // DOWNLOAD_OK .. DOWNLOAD_FAILED
+
+// What a transfer was for
+enum TelemetryKind {
+    TELEMETRY_LOGIN,
+    TELEMETRY_DASHBOARD,
+    TELEMETRY_COURSE,
+    TELEMETRY_FOLDER,
+    TELEMETRY_FILE,
+    TELEMETRY_METADATA,   // HEAD or range probe for size and date
+    TELEMETRY_KIND_COUNT
+};
+
+// Where the time of one transfer went, from libcurl's timers
+enum TelemetryPhase {
+    TELEMETRY_DNS,        // Name lookup
+    TELEMETRY_CONNECT,    // TCP connect
+    TELEMETRY_TLS,        // TLS handshake
+    TELEMETRY_WAIT,       // Request sent until the first response byte
+    TELEMETRY_TRANSFER,   // First byte until the last
+    TELEMETRY_TOTAL,
+    TELEMETRY_PHASE_COUNT
+};
+
+// Run-wide events counted beside the per-request timings
+enum TelemetryCounter {
+    TELEMETRY_RETRIES,    // Requests sent again: after a re-login, or as a range probe after HEAD
+    TELEMETRY_RELOGINS,   // Session renewals
+    TELEMETRY_COUNTER_COUNT
+};
+
+// Log-linear histogram of microsecond values (HDR style): exact below 32 µs,
+// then TELEMETRY_SUB_BUCKETS buckets per power of two
+struct LatencyHistogram {
+    uint64_t counts[TELEMETRY_BUCKET_COUNT];
+    uint64_t count;
+    long long max;
+    double sum;
+};
+
+// One finished transfer
+struct TransferSample {
+    int kind;
+    long http_code;
+    int result;           // CURLcode
+    double start;         // Seconds since telemetry_init
+    long long phase_us[TELEMETRY_PHASE_COUNT];
+    long long redirect_us;
+    long long bytes;      // Body bytes received
+    double speed;         // Bytes per second
+    char *url;
+};
+
+struct TelemetryKindStats {
+    size_t requests;
+    size_t errors;        // Transport errors and HTTP status >= 400
+    size_t status[TELEMETRY_STATUS_COUNT];  // By status class, [0] = no response
+    long long bytes;
+    struct LatencyHistogram phases[TELEMETRY_PHASE_COUNT];
+};
+
+// Finished files by DOWNLOAD_* outcome
+struct TelemetryFileStats {
+    size_t files;
+    long long bytes;        // Body bytes received for them
+    long long saved_bytes;  // Transfer or disk space avoided (304, deduplicated, linked)
+};
+
+// Timing telemetry of every transfer in a run, plus the counters and gauges
+// the metrics exposition reads. Thread-safe: crawl workers, transfer engines
+// and account jobs record into the same instance.
+struct Telemetry {
+    pthread_mutex_t lock;
+    double started;
+    int keep_samples;     // Keep raw samples for telemetry_export()
+    struct TelemetryKindStats kinds[TELEMETRY_KIND_COUNT];
+    struct TelemetryFileStats outcomes[TELEMETRY_OUTCOME_COUNT];
+    size_t counters[TELEMETRY_COUNTER_COUNT];
+    double limiter_wait;  // Seconds requests were held back for rate-limiter tokens
+    int active;           // Transfers in flight
+    int queued;           // Requests waiting in transfer engine queues
+    struct TransferSample *samples;
+    size_t sample_count;
+    size_t sample_capacity;
+};
+
+void telemetry_init(struct Telemetry *t, int keep_samples);
+void telemetry_free(struct Telemetry *t);
+const char *telemetry_kind_name(int kind);
+
+// Record a finished transfer of the easy handle; t may be NULL
+void telemetry_record(struct Telemetry *t, int kind, CURL *easy, CURLcode res);
+// Same, into the telemetry of the context bound to this thread (if any)
+void telemetry_record_current(int kind, CURL *easy, CURLcode res);
+
+// Counters and gauges; t may be NULL
+void telemetry_count(struct Telemetry *t, int counter, size_t n);
+void telemetry_count_current(int counter, size_t n);
+void telemetry_add_limiter_wait(struct Telemetry *t, double seconds);
+void telemetry_transfers_changed(struct Telemetry *t, int active_delta, int queued_delta);
+void telemetry_record_file(struct Telemetry *t, int outcome, long long bytes, long long saved_bytes);
+
+long long latency_histogram_percentile(const struct LatencyHistogram *h, double percentile);
+// Values recorded up to value (to bucket resolution)
+uint64_t latency_histogram_count_at_most(const struct LatencyHistogram *h, long long value);
+
+// End-of-run summary: latency percentiles per kind and the share of each phase
+void telemetry_report(struct Telemetry *t, FILE *fp);
+// Raw samples as JSON when the path ends in .json, CSV otherwise; 0 on success
+int telemetry_export(struct Telemetry *t, const char *path);
+
+#endif // WELEARN_TELEMETRY_H
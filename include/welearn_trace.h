@@ -0,0 +1,55 @@
+#ifndef WELEARN_TRACE_H
+#define WELEARN_TRACE_H
+
+#include "welearn_common.h"
+#include <pthread.h>
+
+#define TRACE_MAX_THREADS 256  // Threads that can be given a name
+
+// One event of the Chrome Trace Event format
+struct TraceEvent {
+    char phase;          // 'X' complete span on a thread, 'b'/'e' async span
+    int tid;
+    unsigned long id;    // Async spans: the transfer they belong to
+    double ts;           // Seconds since trace_init
+    double dur;          // 'X' only
+    const char *cat;     // Static string
+    char *name;
+    char *url;           // Optional
+};
+
+// Timeline of a run in Chrome Trace Event JSON, for chrome://tracing or
+// ui.perfetto.dev. Blocking work (login, course and folder scans, parsing,
+// file writes, limiter sleeps) becomes spans on the thread that did it; every
+// transfer becomes an async span split into queued, connect, wait (time to
+// first byte) and transfer phases, since many overlap on one engine thread.
+// Thread-safe.
+struct TraceLog {
+    pthread_mutex_t lock;
+    double started;
+    struct TraceEvent *events;
+    size_t count;
+    size_t capacity;
+    unsigned long next_id;
+    char *thread_names[TRACE_MAX_THREADS];
+};
+
+void trace_init(struct TraceLog *t);
+void trace_free(struct TraceLog *t);
+double trace_now(void);  // Monotonic seconds, for the start of a span
+
+// Name the calling thread's track; t may be NULL
+void trace_name_thread(struct TraceLog *t, const char *name);
+// A span on the calling thread from start (trace_now()) until now; t may be NULL
+void trace_span(struct TraceLog *t, const char *cat, const char *name, double start, const char *url);
+// A finished transfer of the easy handle, queued at queued_at (0 = not queued); t may be NULL
+void trace_transfer(struct TraceLog *t, int kind, CURL *easy, double queued_at);
+
+// Same, into the trace of the context bound to this thread (if any)
+void trace_span_current(const char *cat, const char *name, double start, const char *url);
+void trace_transfer_current(int kind, CURL *easy);
+
+// Write the events as Chrome Trace Event JSON; 0 on success
+int trace_write(struct TraceLog *t, const char *path);
+
+#endif // WELEARN_TRACE_H
@@ -0,0 +1,104 @@
+#ifndef WELEARN_TRANSFER_H
+#define WELEARN_TRANSFER_H
+
+#include "welearn_common.h"
+#include "welearn_ratelimit.h"
+#include "welearn_adaptive.h"
+#include "welearn_telemetry.h"
+#include "welearn_trace.h"
+
+#define DEFAULT_MAX_TRANSFERS 8
+#define TRANSFER_PROBE_BODY_LIMIT 65536  // Abort range probes whose server ignored the Range header
+#define TRANSFER_EVENT_BATCH 64           // epoll events handled per wakeup in event-driven mode
+
+struct TransferRequest;
+
+// Called once per request when it finishes; the engine frees the request afterwards
+typedef void (*transfer_done_callback)(struct TransferRequest *req, CURLcode res, void *userdata);
+
+// Logs in again on behalf of the engine; returns 1 when the session is valid again
+typedef int (*transfer_reauth_callback)(void *userdata);
+
+// Body sink with the libcurl write callback signature
+typedef size_t (*transfer_write_callback)(void *contents, size_t size, size_t nmemb, void *userp);
+
+// A single transfer queued on the engine
+struct TransferRequest {
+    char url[MAX_URL_LEN];
+    int head_only;      // Send HEAD instead of GET
+    int range_probe;    // Send GET with "Range: bytes=0-0" (for servers that refuse HEAD)
+    struct curl_slist *extra_headers;   // Optional request headers, freed by the engine
+    transfer_write_callback write_fn;   // Optional body sink instead of the in-memory body
+    void *write_data;
+    curl_xferinfo_callback progress_fn;  // Optional byte progress (CURLOPT_XFERINFOFUNCTION)
+    void *progress_data;
+    int kind;           // TELEMETRY_* kind the timings are recorded under
+    double queued_at;   // trace_now() at submission, when the engine traces
+
+    // Results, valid inside the completion callback
+    long http_code;
+    char effective_url[MAX_URL_LEN];
+    char content_type[MAX_CONTENT_TYPE_LEN];
+    long long content_length;  // -1 if unknown
+    long filetime;             // Last-Modified, -1 if unknown
+    struct HeaderData headers;
+    struct MemoryStruct body;
+
+    transfer_done_callback on_done;
+    void *userdata;
+
+    // Engine bookkeeping
+    int replayed;  // Already sent again after a re-login
+    CURL *easy;
+    char errbuf[CURL_ERROR_SIZE];
+    struct TransferRequest *next;
+    struct TransferRequest *prev;  // In the active list only
+};
+
+// Drives many concurrent transfers over one curl_multi handle. All handles
+// share cookies, DNS cache, TLS sessions and the connection pool.
+struct TransferEngine {
+    CURLM *multi;
+    CURLSH *share;
+    int max_active;
+    int active;
+    struct TransferRequest *active_head;  // Requests with an easy handle in multi
+    struct RateLimiter *limiter;  // Optional, paces request starts
+    struct AdaptiveConcurrency *adaptive;  // Optional, picks how many of max_active are used
+    struct Telemetry *telemetry;  // Optional, records the timings of every finished request
+    struct TraceLog *trace;       // Optional, gets a span per request and per limiter sleep
+    struct curl_slist *resolve;   // Optional CURLOPT_RESOLVE entries for every handle
+    struct TransferRequest *queue_head;
+    struct TransferRequest *queue_tail;
+    double limited_since;         // trace_now() since the queue head waits for a limiter token, else 0
+
+    // Event-driven mode (Linux): curl reports the sockets and timeout it waits
+    // on, and one epoll loop drives all transfers with curl_multi_socket_action
+    // instead of polling every handle. Elsewhere the engine falls back to polling.
+    int event_driven;
+    int epoll_fd;
+    int timer_fd;
+
+    // Session expiry: requests answered with the login page are parked, the
+    // queue pauses until in-flight transfers drain, then reauth runs once on
+    // the session handle and the parked requests are replayed.
+    CURL *session;
+    transfer_reauth_callback reauth;  // Optional
+    void *reauth_data;
+    int reauth_pending;
+    struct TransferRequest *replay_head;
+    struct TransferRequest *replay_tail;
+    size_t relogins;
+};
+
+// Engine lifecycle
+int transfer_engine_init(struct TransferEngine *engine, CURL *session, int max_active);
+void transfer_engine_cleanup(struct TransferEngine *engine);
+
+// Requests
+struct TransferRequest *transfer_request_new(const char *url, transfer_done_callback on_done, void *userdata);
+void transfer_request_free(struct TransferRequest *req);
+void transfer_engine_submit(struct TransferEngine *engine, struct TransferRequest *req);
+void transfer_engine_run(struct TransferEngine *engine);
+
+#endif // WELEARN_TRANSFER_H
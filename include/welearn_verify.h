@@ -0,0 +1,38 @@
+#ifndef WELEARN_VERIFY_H
+#define WELEARN_VERIFY_H
+
+#include "welearn_common.h"
+#include "welearn_store.h"
+
+#define VERIFY_HASH_WINDOW (64LL * 1024 * 1024)  // Bytes mapped at a time while hashing
+
+// Outcome for one manifest entry
+#define VERIFY_OK 0
+#define VERIFY_MISSING 1
+#define VERIFY_SIZE_MISMATCH 2
+#define VERIFY_HASH_MISMATCH 3
+#define VERIFY_READ_ERROR 4
+
+struct VerifyResult {
+    int *status;        // One VERIFY_* value per manifest entry
+    size_t entries;
+    size_t ok;
+    size_t missing;
+    size_t size_mismatch;
+    size_t hash_mismatch;
+    size_t errors;
+    size_t restored;    // Repaired locally from an intact store object
+    size_t quarantined; // Damaged files and objects moved to STORE_QUARANTINE_DIR
+    size_t queued;      // Still broken, need a re-download
+    size_t files_hashed;
+    long long bytes_hashed;
+    double seconds;
+};
+
+// Verification of a download tree against its manifest
+int verify_download_tree(struct ContentStore *store, int threads, struct VerifyResult *result);
+size_t repair_from_store(struct ContentStore *store, struct VerifyResult *result);
+void print_verify_summary(const struct VerifyResult *result);
+void free_verify_result(struct VerifyResult *result);
+
+#endif // WELEARN_VERIFY_H
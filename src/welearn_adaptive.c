@@ -0,0 +1,85 @@
+#include "../include/welearn_adaptive.h"
+#include "../include/welearn_context.h"
+#include <time.h>
+
+static double monotonic_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+void adaptive_init(struct AdaptiveConcurrency *ac, int max_limit) {
+    memset(ac, 0, sizeof(*ac));
+    ac->max_limit = max_limit > 0 ? max_limit : 1;
+    ac->limit = ac->max_limit < ADAPTIVE_START_LIMIT ? ac->max_limit : ADAPTIVE_START_LIMIT;
+    ac->peak_limit = ac->limit;
+    ac->window_start = monotonic_seconds();
+}
+
+static void set_limit(struct AdaptiveConcurrency *ac, int limit, double goodput, double ttfb) {
+    if (limit < 1) limit = 1;
+    if (limit > ac->max_limit) limit = ac->max_limit;
+    if (limit == ac->limit) return;
+
+    welearn_log(WELEARN_LOG_DEBUG, "Concurrency %d -> %d (%.1f KB/s, first byte %.0f ms)\n",
+                ac->limit, limit, goodput / 1024.0, ttfb * 1000.0);
+    ac->limit = limit;
+    ac->adjustments++;
+    if (limit > ac->peak_limit) ac->peak_limit = limit;
+}
+
+// Decide on the next limit from the window that just ended
+static void close_window(struct AdaptiveConcurrency *ac, double now) {
+    double elapsed = now - ac->window_start;
+    double goodput = elapsed > 0 ? ac->window_bytes / elapsed : 0;
+    double ttfb = ac->window_samples > 0 ? ac->window_ttfb / (double)ac->window_samples : 0;
+    int gained = goodput > ac->last_goodput * (1.0 + ADAPTIVE_GOODPUT_SLACK);
+    int held = goodput >= ac->last_goodput * (1.0 - ADAPTIVE_GOODPUT_SLACK);
+    int queueing = ac->base_ttfb > 0 && ttfb > ac->base_ttfb * ADAPTIVE_PROBE_LATENCY;
+
+    if (ac->window_errors > 0) {
+        set_limit(ac, (int)(ac->limit * ADAPTIVE_ERROR_DECREASE), goodput, ttfb);
+    } else if (ac->base_ttfb > 0 && ttfb > ac->base_ttfb * ADAPTIVE_LATENCY_TOLERANCE && !gained) {
+        set_limit(ac, (int)(ac->limit * ADAPTIVE_LATENCY_DECREASE), goodput, ttfb);
+    } else if (gained || (held && !queueing)) {
+        set_limit(ac, ac->limit + 1, goodput, ttfb);
+    }
+
+    // The baseline follows the fastest window, drifting up slowly so a route
+    // that got slower for good does not keep the limit down forever
+    if (ac->window_samples > 0 && ac->window_errors == 0) {
+        if (ac->base_ttfb <= 0 || ttfb < ac->base_ttfb) {
+            ac->base_ttfb = ttfb;
+        } else {
+            ac->base_ttfb += (ttfb - ac->base_ttfb) * 0.05;
+        }
+    }
+    ac->last_goodput = goodput;
+    ac->window_start = now;
+    ac->window_samples = ac->window_errors = 0;
+    ac->window_bytes = ac->window_ttfb = 0;
+}
+
+// Feed one finished transfer into the controller
+void adaptive_record(struct AdaptiveConcurrency *ac, CURL *easy, CURLcode res, long http_code) {
+    if (!ac || !easy) return;
+
+    curl_off_t bytes = 0;
+    curl_off_t ttfb_us = 0;
+    curl_easy_getinfo(easy, CURLINFO_SIZE_DOWNLOAD_T, &bytes);
+    curl_easy_getinfo(easy, CURLINFO_STARTTRANSFER_TIME_T, &ttfb_us);
+
+    ac->window_samples++;
+    ac->window_bytes += (double)bytes;
+    ac->window_ttfb += (double)ttfb_us / 1e6;
+    if (res == CURLE_OPERATION_TIMEDOUT || res == CURLE_COULDNT_CONNECT || res == CURLE_RECV_ERROR ||
+        http_code == 429 || http_code >= 500) {
+        ac->window_errors++;
+    }
+
+    // A window covers every slot at least once, so one large file does not decide alone
+    double now = monotonic_seconds();
+    if (now - ac->window_start >= ADAPTIVE_WINDOW_SECONDS && ac->window_samples >= (size_t)ac->limit) {
+        close_window(ac, now);
+    }
+}
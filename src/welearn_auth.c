@@ -1,5 +1,9 @@
 #include "../include/welearn_auth.h"
+#include "../include/welearn_telemetry.h"
+#include "../include/welearn_trace.h"
 #include <ctype.h>
+#include <errno.h>
+#include <pthread.h>
 
 #ifdef _WIN32
 #include <conio.h>
@@ -62,14 +66,14 @@ void get_password(char *password, size_t size) {
 int save_credentials(const char *username, const char *password, char key) {
     FILE *fp = fopen(CRED_FILE, "wb");
     if (!fp) {
-        perror("DEBUG: Error opening credentials file for writing");
+        welearn_log(WELEARN_LOG_ERROR, "Error opening credentials file for writing: %s\n", strerror(errno));
         return 0;
     }
 
     char *enc_user = strdup(username);
     char *enc_pass = strdup(password);
     if (!enc_user || !enc_pass) {
-        perror("DEBUG: strdup failed in save_credentials");
+        welearn_log(WELEARN_LOG_ERROR, "strdup failed in save_credentials: %s\n", strerror(errno));
         free(enc_user);
         free(enc_pass);
         fclose(fp);
@@ -101,7 +105,7 @@ int load_credentials(char *username, size_t user_size, char *password, size_t pa
 
     if (fgets(user_buf, sizeof(user_buf), fp) == NULL ||
         fgets(pass_buf, sizeof(pass_buf), fp) == NULL) {
-        fprintf(stderr, "DEBUG: Error reading from credentials file or file is corrupt.\n");
+        welearn_log(WELEARN_LOG_ERROR, "Error reading from credentials file or file is corrupt.\n");
         fclose(fp);
         return 0;
     }
@@ -120,7 +124,7 @@ int load_credentials(char *username, size_t user_size, char *password, size_t pa
     password[pass_size - 1] = '\0';
 
     if (strlen(user_buf) >= user_size || strlen(pass_buf) >= pass_size) {
-        fprintf(stderr, "DEBUG: Warning: Loaded credentials might be truncated.\n");
+        welearn_log(WELEARN_LOG_WARN, "Warning: Loaded credentials might be truncated.\n");
     }
 
     // Credentials loaded - silent operation for cleaner output
@@ -147,10 +151,353 @@ char *extract_logintoken(const char *html) {
     size_t len = end - start;
     char *token = malloc(len + 1);
     if (!token) {
-        fprintf(stderr, "Error: Memory allocation failed for logintoken\n");
+        welearn_log(WELEARN_LOG_ERROR, "Error: Memory allocation failed for logintoken\n");
         return NULL;
     }
     strncpy(token, start, len);
     token[len] = '\0';
     return token;
 }
+
+// GET the login form (this also opens the connection and sets the session
+// cookie the token is bound to). On LOGIN_OK *logintoken must be freed.
+static int fetch_login_token(CURL *curl, char **logintoken) {
+    char errbuf[CURL_ERROR_SIZE] = {0};
+    struct MemoryStruct login_page;
+    init_memory_struct(&login_page);
+    *logintoken = NULL;
+
+    char login_url[MAX_URL_LEN];
+    welearn_site_url(login_url, sizeof(login_url), WELEARN_LOGIN_PATH);
+    curl_easy_setopt(curl, CURLOPT_URL, login_url);
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_memory_callback);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)&login_page);
+    curl_easy_setopt(curl, CURLOPT_HTTPGET, 1L);
+    curl_easy_setopt(curl, CURLOPT_FAILONERROR, 0L);
+    curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, errbuf);
+
+    CURLcode res = curl_easy_perform(curl);
+    telemetry_record_current(TELEMETRY_LOGIN, curl, res);
+    trace_transfer_current(TELEMETRY_LOGIN, curl);
+    curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, NULL);
+    long http_code = 0;
+    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code);
+    if (res != CURLE_OK || http_code >= 400) {
+        welearn_log(WELEARN_LOG_ERROR, "Failed to fetch login page: %s (HTTP %ld) %s\n",
+                curl_easy_strerror(res), http_code, errbuf);
+        free(login_page.memory);
+        return LOGIN_NETWORK_ERROR;
+    }
+
+    *logintoken = extract_logintoken(login_page.memory);
+    free(login_page.memory);
+    return *logintoken ? LOGIN_OK : LOGIN_NO_TOKEN;
+}
+
+// The cookie jar may be shared between accounts, so a login records whose session it
+// holds in a cookie for a reserved domain that is never sent to any server
+#define SESSION_OWNER_DOMAIN "welearn-owner.invalid"
+#define SESSION_OWNER_COOKIE "WelearnSessionOwner"
+
+static void stamp_session_owner(CURL *curl, const char *username) {
+    if (strpbrk(username, "\t\r\n")) return;  // Not representable: the session will not be reused
+    char line[512];
+    int n = snprintf(line, sizeof(line), "%s\tFALSE\t/\tFALSE\t0\t%s\t%s",
+                     SESSION_OWNER_DOMAIN, SESSION_OWNER_COOKIE, username);
+    if (n < 0 || n >= (int)sizeof(line)) return;
+    curl_easy_setopt(curl, CURLOPT_COOKIELIST, line);
+}
+
+// Whether the saved session was created by logging in as username
+static int session_owned_by(CURL *curl, const char *username) {
+    if (!username) return 0;
+    struct curl_slist *cookies = NULL;
+    if (curl_easy_getinfo(curl, CURLINFO_COOKIELIST, &cookies) != CURLE_OK) return 0;
+
+    char prefix[256];
+    int n = snprintf(prefix, sizeof(prefix), "%s\t", SESSION_OWNER_DOMAIN);
+    int owned = 0;
+    for (struct curl_slist *c = cookies; c && n > 0 && n < (int)sizeof(prefix); c = c->next) {
+        if (strncmp(c->data, prefix, (size_t)n) != 0) continue;
+        // domain, subdomains, path, secure, expiry, name, value
+        const char *field = c->data;
+        for (int i = 0; i < 5 && field; i++) {
+            field = strchr(field, '\t');
+            if (field) field++;
+        }
+        if (!field) continue;
+        size_t name_len = strlen(SESSION_OWNER_COOKIE);
+        if (strncmp(field, SESSION_OWNER_COOKIE, name_len) == 0 && field[name_len] == '\t') {
+            owned = strcmp(field + name_len + 1, username) == 0;
+        }
+    }
+    curl_slist_free_all(cookies);
+    return owned;
+}
+
+// Drop a session that belongs to someone else so the login starts clean
+static void discard_foreign_session(CURL *curl, const char *username) {
+    welearn_log(WELEARN_LOG_INFO, "Saved session is not for %s, logging in again\n", username ? username : "this user");
+    curl_easy_setopt(curl, CURLOPT_COOKIELIST, "ALL");
+}
+
+// POST the credentials with a token from fetch_login_token()
+static int post_login(CURL *curl, const char *username, const char *password, const char *logintoken,
+                      struct MemoryStruct *dashboard) {
+    char errbuf[CURL_ERROR_SIZE] = {0};
+    char *escaped_username = curl_easy_escape(curl, username, 0);
+    char *escaped_password = curl_easy_escape(curl, password, 0);
+    if (!escaped_username || !escaped_password) {
+        curl_free(escaped_username);
+        curl_free(escaped_password);
+        return LOGIN_NETWORK_ERROR;
+    }
+
+    char post_fields[1024];
+    snprintf(post_fields, sizeof(post_fields), "username=%s&password=%s&logintoken=%s",
+             escaped_username, escaped_password, logintoken);
+    curl_free(escaped_username);
+    curl_free(escaped_password);
+
+    char login_url[MAX_URL_LEN];
+    welearn_site_url(login_url, sizeof(login_url), WELEARN_LOGIN_PATH);
+    curl_easy_setopt(curl, CURLOPT_URL, login_url);
+    curl_easy_setopt(curl, CURLOPT_POST, 1L);
+    curl_easy_setopt(curl, CURLOPT_POSTFIELDS, post_fields);
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_memory_callback);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)dashboard);
+    curl_easy_setopt(curl, CURLOPT_REFERER, login_url);
+    curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, errbuf);
+
+    CURLcode res = curl_easy_perform(curl);
+    telemetry_record_current(TELEMETRY_LOGIN, curl, res);
+    trace_transfer_current(TELEMETRY_LOGIN, curl);
+
+    // post_fields goes out of scope: make sure the handle does not keep pointing at it
+    curl_easy_setopt(curl, CURLOPT_POSTFIELDS, NULL);
+    curl_easy_setopt(curl, CURLOPT_HTTPGET, 1L);
+    curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, NULL);
+    memset(post_fields, 0, sizeof(post_fields));
+
+    if (res != CURLE_OK) {
+        welearn_log(WELEARN_LOG_ERROR, "Login POST failed: %s %s\n", curl_easy_strerror(res), errbuf);
+        return LOGIN_NETWORK_ERROR;
+    }
+
+    if (strstr(dashboard->memory, "Invalid login, please try again") || strstr(dashboard->memory, "loginerrors")) {
+        return LOGIN_INVALID_CREDENTIALS;
+    }
+    if (!strstr(dashboard->memory, "/login/logout.php")) {
+        welearn_log(WELEARN_LOG_ERROR, "Warning: Login might have failed - Logout link not found on the resulting page.\n");
+    }
+    stamp_session_owner(curl, username);
+    return LOGIN_OK;
+}
+
+// Log in with the token + POST round trips; on success dashboard holds the landing page HTML
+int welearn_login(CURL *curl, const char *username, const char *password, struct MemoryStruct *dashboard) {
+    if (!curl || !username || !password || !dashboard) return LOGIN_NETWORK_ERROR;
+
+    double started = trace_now();
+    char *logintoken = NULL;
+    int status = fetch_login_token(curl, &logintoken);
+    if (status == LOGIN_OK) {
+        status = post_login(curl, username, password, logintoken, dashboard);
+        free(logintoken);
+    }
+    trace_span_current("session", "login", started, NULL);
+    return status;
+}
+
+// Moodle answers requests of an expired session with (a redirect to) the login form
+int welearn_page_is_login(const char *html, const char *effective_url) {
+    if (effective_url && strstr(effective_url, "/login/index.php")) return 1;
+    if (!html) return 0;
+    return strstr(html, "name=\"logintoken\"") != NULL && strstr(html, "/login/logout.php") == NULL;
+}
+
+// Fetch the dashboard with the current cookies. Returns LOGIN_OK with the page in
+// dashboard, LOGIN_SESSION_EXPIRED if the server wants a new login, or LOGIN_NETWORK_ERROR.
+int welearn_fetch_dashboard(CURL *curl, struct MemoryStruct *dashboard) {
+    if (!curl || !dashboard) return LOGIN_NETWORK_ERROR;
+
+    char errbuf[CURL_ERROR_SIZE] = {0};
+    char dashboard_url[MAX_URL_LEN];
+    welearn_site_url(dashboard_url, sizeof(dashboard_url), WELEARN_DASHBOARD_PATH);
+    curl_easy_setopt(curl, CURLOPT_URL, dashboard_url);
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_memory_callback);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)dashboard);
+    curl_easy_setopt(curl, CURLOPT_HTTPGET, 1L);
+    curl_easy_setopt(curl, CURLOPT_FAILONERROR, 0L);
+    curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, errbuf);
+
+    CURLcode res = curl_easy_perform(curl);
+    telemetry_record_current(TELEMETRY_DASHBOARD, curl, res);
+    trace_transfer_current(TELEMETRY_DASHBOARD, curl);
+    curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, NULL);
+
+    long http_code = 0;
+    char *effective_url = NULL;
+    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code);
+    curl_easy_getinfo(curl, CURLINFO_EFFECTIVE_URL, &effective_url);
+    if (res != CURLE_OK || http_code >= 500) {
+        welearn_log(WELEARN_LOG_ERROR, "Failed to fetch dashboard: %s (HTTP %ld) %s\n",
+                curl_easy_strerror(res), http_code, errbuf);
+        return LOGIN_NETWORK_ERROR;
+    }
+    if (http_code >= 400 || welearn_page_is_login(dashboard->memory, effective_url)) {
+        return LOGIN_SESSION_EXPIRED;
+    }
+    return LOGIN_OK;
+}
+
+// Whether the cookie engine holds a Moodle session cookie worth probing
+static int has_session_cookie(CURL *curl) {
+    struct curl_slist *cookies = NULL;
+    if (curl_easy_getinfo(curl, CURLINFO_COOKIELIST, &cookies) != CURLE_OK) return 0;
+
+    int found = 0;
+    for (struct curl_slist *c = cookies; c && !found; c = c->next) {
+        found = strstr(c->data, "\tMoodleSession") != NULL;
+    }
+    curl_slist_free_all(cookies);
+    return found;
+}
+
+// Reuse the session saved in the cookie jar if the server still accepts it,
+// otherwise log in. *reused (optional) tells which path was taken.
+int welearn_resume_session(CURL *curl, const char *username, const char *password,
+                           struct MemoryStruct *dashboard, int *reused) {
+    if (reused) *reused = 0;
+    if (!curl || !dashboard) return LOGIN_NETWORK_ERROR;
+
+    if (has_session_cookie(curl)) {
+        if (!session_owned_by(curl, username)) {
+            discard_foreign_session(curl, username);
+        } else {
+            int status = welearn_fetch_dashboard(curl, dashboard);
+            if (status == LOGIN_OK) {
+                if (reused) *reused = 1;
+                return LOGIN_OK;
+            }
+            free(dashboard->memory);
+            init_memory_struct(dashboard);
+        }
+    }
+
+    int status = welearn_login(curl, username, password, dashboard);
+    if (status == LOGIN_OK) {
+        // Write the new session out now so the next run can reuse it even if this one is killed
+        curl_easy_setopt(curl, CURLOPT_COOKIELIST, "FLUSH");
+    }
+    return status;
+}
+
+// Log in again with the stored credentials (a session_renew_callback).
+// Returns 1 on success.
+int welearn_session_renew(void *session) {
+    struct WelearnSession *ws = (struct WelearnSession *)session;
+    if (!ws || !ws->curl) return 0;
+
+    welearn_log(WELEARN_LOG_INFO, "Session expired, logging in again...\n");
+    struct MemoryStruct page;
+    init_memory_struct(&page);
+    int status = welearn_login(ws->curl, ws->username, ws->password, &page);
+    free(page.memory);
+    if (status != LOGIN_OK) {
+        welearn_log(WELEARN_LOG_ERROR, "Re-login failed (status %d)\n", status);
+        return 0;
+    }
+    curl_easy_setopt(ws->curl, CURLOPT_COOKIELIST, "FLUSH");
+    ws->renewals++;
+    telemetry_count_current(TELEMETRY_RELOGINS, 1);
+    return 1;
+}
+
+// Background half of the warm-up: probe the saved session, otherwise fetch a login token.
+// Either request pays DNS, TCP and TLS setup while the user is still typing.
+static void *session_warmup_thread(void *arg) {
+    struct SessionWarmup *warmup = (struct SessionWarmup *)arg;
+
+    if (has_session_cookie(warmup->curl)) {
+        warmup->dashboard_status = welearn_fetch_dashboard(warmup->curl, &warmup->page);
+        if (warmup->dashboard_status == LOGIN_OK) return NULL;
+        free(warmup->page.memory);
+        init_memory_struct(&warmup->page);
+    }
+    warmup->token_status = fetch_login_token(warmup->curl, &warmup->logintoken);
+    return NULL;
+}
+
+// Start warming up the session on curl in the background. The handle must not be
+// used by anyone else until welearn_session_warmup_finish/cancel.
+void welearn_session_warmup_start(struct SessionWarmup *warmup, CURL *curl) {
+    memset(warmup, 0, sizeof(*warmup));
+    warmup->curl = curl;
+    warmup->dashboard_status = LOGIN_SESSION_EXPIRED;
+    warmup->token_status = LOGIN_NETWORK_ERROR;
+    init_memory_struct(&warmup->page);
+    warmup->started = curl && pthread_create(&warmup->thread, NULL, session_warmup_thread, warmup) == 0;
+}
+
+static void session_warmup_join(struct SessionWarmup *warmup) {
+    if (!warmup->started) return;
+    pthread_join(warmup->thread, NULL);
+    warmup->started = 0;
+}
+
+// Finish what welearn_session_warmup_start began, with the same results as
+// welearn_resume_session(): reuse the probed session or POST the credentials
+// with the prefetched token. Falls back to a full login if the warm-up failed.
+int welearn_session_warmup_finish(struct SessionWarmup *warmup, const char *username, const char *password,
+                                  struct MemoryStruct *dashboard, int *reused) {
+    if (reused) *reused = 0;
+    if (!warmup || !dashboard) return LOGIN_NETWORK_ERROR;
+    if (!warmup->curl) return LOGIN_NETWORK_ERROR;
+
+    int ran = warmup->started;
+    session_warmup_join(warmup);
+    if (!ran) {
+        return welearn_resume_session(warmup->curl, username, password, dashboard, reused);
+    }
+
+    if (has_session_cookie(warmup->curl) && !session_owned_by(warmup->curl, username)) {
+        // The probe and the prefetched token belong to another account's session
+        welearn_session_warmup_cancel(warmup);
+        discard_foreign_session(warmup->curl, username);
+        int status = welearn_login(warmup->curl, username, password, dashboard);
+        if (status == LOGIN_OK) {
+            curl_easy_setopt(warmup->curl, CURLOPT_COOKIELIST, "FLUSH");
+        }
+        return status;
+    }
+    if (warmup->dashboard_status == LOGIN_OK) {
+        free(dashboard->memory);
+        *dashboard = warmup->page;
+        init_memory_struct(&warmup->page);
+        if (reused) *reused = 1;
+        return LOGIN_OK;
+    }
+
+    int status;
+    if (warmup->token_status == LOGIN_OK) {
+        status = post_login(warmup->curl, username, password, warmup->logintoken, dashboard);
+    } else {
+        status = welearn_login(warmup->curl, username, password, dashboard);
+    }
+    welearn_session_warmup_cancel(warmup);
+    if (status == LOGIN_OK) {
+        curl_easy_setopt(warmup->curl, CURLOPT_COOKIELIST, "FLUSH");
+    }
+    return status;
+}
+
+// Wait for the background requests and drop their results
+void welearn_session_warmup_cancel(struct SessionWarmup *warmup) {
+    if (!warmup) return;
+    session_warmup_join(warmup);
+    free(warmup->page.memory);
+    init_memory_struct(&warmup->page);
+    free(warmup->logintoken);
+    warmup->logintoken = NULL;
+}
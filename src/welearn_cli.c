@@ -1,7 +1,16 @@
 #include "../include/welearn_common.h"
 #include "../include/welearn_auth.h"
+#include "../include/welearn_context.h"
+#include "../include/welearn_crawl.h"
 #include "../include/welearn_download.h"
+#include "../include/welearn_metrics.h"
+#include "../include/welearn_logger.h"
+#include "../include/welearn_transfer.h"
 #include <ctype.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
 
 // Helper function to get user input for download directory
 void get_download_directory(char *path, size_t size) {
@@ -60,13 +69,1311 @@ int parse_selections(const char *input, int **selections, size_t max_files) {
     return idx;
 }
 
-int main(void) {
+// Progress line for the metadata prefetch, updated as results arrive
+static void print_metadata_progress(const struct FileInfo *file, size_t done, size_t total, void *userdata) {
+    (void)file;
+    (void)userdata;
+    printf("\rResolving file details: %zu/%zu", done, total);
+    fflush(stdout);
+}
+
+// Exit codes of batch mode
+#define BATCH_EXIT_OK 0
+#define BATCH_EXIT_PARTIAL 1   // Some files failed to download
+#define BATCH_EXIT_USAGE 2
+#define BATCH_EXIT_AUTH 3
+#define BATCH_EXIT_NETWORK 4
+#define BATCH_EXIT_IO 5
+#define MAX_FILTER_PATTERNS 32
+#define DEFAULT_FULL_CHECK_EVERY 12
+#define MAX_ACCOUNTS 32
+
+// Command line options of batch mode
+struct BatchOptions {
+    const char *output;
+    const char *courses;
+    const char *include[MAX_FILTER_PATTERNS];
+    size_t include_count;
+    const char *exclude[MAX_FILTER_PATTERNS];
+    size_t exclude_count;
+    int jobs;
+    int adaptive;  // Tune the number of parallel downloads, --jobs is the ceiling
+    struct SchedulePolicy schedule;  // Download order, priorities and small-file lane
+    double rate;  // Requests per second, 0 = unlimited
+    int resume;
+    int dry_run;
+    int json;
+    int watch_minutes;  // Poll interval of watch mode, 0 = single run
+    int full_every;     // Re-check already downloaded files every N polls
+    const char *accounts;  // File listing several accounts to sync concurrently
+    int event_loop;     // Drive transfers from one epoll loop and crawl concurrently
+    int crawl_workers;  // Work-stealing crawl threads (without --event-loop)
+    int max_depth;      // Folder nesting followed below a course page
+    int timings;        // Report request timings by kind at the end
+    const char *timings_file;  // Also write every request's timings here (CSV, or JSON for *.json)
+    const char *trace_file;    // Write a Chrome Trace Event timeline of the run here
+    int progress_jsonl;        // Stream progress events as JSON lines on stdout
+    const char *metrics_file;  // Keep Prometheus metrics of the run in this file
+    int metrics_port;          // Serve Prometheus metrics on 127.0.0.1:PORT, 0 = off
+    int log_level;             // Lowest WELEARN_LOG_* level printed
+    int log_format;            // LOGGER_TEXT or LOGGER_JSON
+    int verify;                // Check DIR against its manifest instead of syncing
+    int repair;                // With verify: restore or re-download damaged files
+};
+
+static void print_batch_usage(FILE *fp, const char *prog) {
+    fprintf(fp, "Usage: %s [OPTIONS]\n", prog);
+    fprintf(fp, "Run without options for the interactive menu.\n\n");
+    fprintf(fp, "Batch options:\n");
+    fprintf(fp, "  -o, --output DIR       Download into DIR (default: .)\n");
+    fprintf(fp, "  -c, --courses PATTERN  Only scan courses whose title or URL matches (comma-separated globs)\n");
+    fprintf(fp, "  -i, --include GLOB     Only download files whose name matches (repeatable)\n");
+    fprintf(fp, "  -x, --exclude GLOB     Skip files whose name matches (repeatable)\n");
+    fprintf(fp, "  -j, --jobs N           Parallel downloads (default: %d)\n", DEFAULT_MAX_TRANSFERS);
+    fprintf(fp, "      --adaptive         Tune parallel downloads to the connection, up to --jobs\n");
+    fprintf(fp, "                         (default ceiling with --adaptive: %d)\n", ADAPTIVE_DEFAULT_MAX_LIMIT);
+    fprintf(fp, "      --order ORDER      Download order: list, smallest, newest or fair (round robin over\n");
+    fprintf(fp, "                         courses) (default: list)\n");
+    fprintf(fp, "  -p, --priority GLOB    Download files whose name or course matches first (repeatable,\n");
+    fprintf(fp, "                         earlier patterns first)\n");
+    fprintf(fp, "      --small-lane N     Keep N parallel slots for files up to %lld MB so large files\n",
+            SCHEDULE_SMALL_FILE_BYTES / (1024 * 1024));
+    fprintf(fp, "                         cannot hold them up (default: 0)\n");
+    fprintf(fp, "  -r, --rate N           Start at most N requests per second (default: unlimited)\n");
+    fprintf(fp, "      --resume           Keep partial downloads and continue them on the next run\n");
+    fprintf(fp, "      --event-loop       Fetch course and folder pages concurrently (up to --jobs) from one\n");
+    fprintf(fp, "                         event loop instead of one blocking request at a time\n");
+    fprintf(fp, "      --crawl-workers N  Crawl folder trees with N threads sharing the work (default: %d)\n",
+            CRAWL_DEFAULT_WORKERS);
+    fprintf(fp, "      --max-depth N      Follow folders at most N levels below a course page (default: %d)\n",
+            CRAWL_DEFAULT_MAX_DEPTH);
+    fprintf(fp, "      --timings          Report request latencies by kind (login, course, folder, file...)\n");
+    fprintf(fp, "      --timings-file FILE\n");
+    fprintf(fp, "                         Also write the timings of every request to FILE (CSV, or JSON\n");
+    fprintf(fp, "                         when FILE ends in .json)\n");
+    fprintf(fp, "      --trace FILE       Write a timeline of the run to FILE (Chrome Trace Event JSON, open\n");
+    fprintf(fp, "                         it in ui.perfetto.dev or chrome://tracing)\n");
+    fprintf(fp, "  -n, --dry-run          Show what would be downloaded without downloading\n");
+    fprintf(fp, "      --json             Print the result as JSON on stdout (logs go to stderr)\n");
+    fprintf(fp, "      --progress FORMAT  Progress output: text (default) or jsonl, one JSON event per line\n");
+    fprintf(fp, "                         on stdout (discovered, start, bytes, done, summary; logs go to stderr)\n");
+    fprintf(fp, "      --metrics-file FILE\n");
+    fprintf(fp, "                         Keep Prometheus metrics of the run in FILE, rewritten every %d s\n",
+            METRICS_FILE_INTERVAL);
+    fprintf(fp, "                         (for node_exporter's textfile collector)\n");
+    fprintf(fp, "      --metrics-port PORT\n");
+    fprintf(fp, "                         Serve Prometheus metrics on http://127.0.0.1:PORT/metrics\n");
+    fprintf(fp, "      --log-level LEVEL  Print log lines from LEVEL up: debug (default), info, warn or error\n");
+    fprintf(fp, "      --log-format FORMAT\n");
+    fprintf(fp, "                         Diagnostics on stderr as text (default) or json, one object per line\n");
+    fprintf(fp, "                         with time, level, thread and message\n");
+    fprintf(fp, "  -w, --watch MINUTES    Keep running and poll for new files every MINUTES\n");
+    fprintf(fp, "      --full-every N     In watch mode, re-check all files every N polls (default: %d, 0 = never)\n",
+            DEFAULT_FULL_CHECK_EVERY);
+    fprintf(fp, "  -a, --accounts FILE    Sync every account in FILE (\"username password\" per line) concurrently,\n");
+    fprintf(fp, "                         each into DIR/<username>; shared files are downloaded once\n");
+    fprintf(fp, "      --verify           Check the files in DIR against its manifest instead of syncing\n");
+    fprintf(fp, "                         (no login); exit 1 if any file is missing or damaged\n");
+    fprintf(fp, "      --repair           With --verify: move damaged files to %s, restore them from\n",
+            STORE_QUARANTINE_DIR);
+    fprintf(fp, "                         the store, and log in to re-download the rest\n");
+    fprintf(fp, "  -h, --help             Show this help\n\n");
+    fprintf(fp, "Credentials come from WELEARN_USERNAME/WELEARN_PASSWORD or the saved credentials file.\n");
+    fprintf(fp, "%s points the client at another Moodle site (default: %s).\n",
+            WELEARN_BASE_URL_ENV, WELEARN_DEFAULT_BASE_URL);
+    fprintf(fp, "Exit codes: 0 success, 1 some downloads failed (--verify: files still damaged), 2 usage error,\n");
+    fprintf(fp, "            3 authentication error, 4 network error, 5 local I/O error\n");
+}
+
+// WELEARN_LOG_* level named by a --log-level value, -1 if unknown
+static int parse_log_level(const char *name) {
+    for (int level = WELEARN_LOG_DEBUG; level <= WELEARN_LOG_ERROR; level++) {
+        if (strcmp(name, logger_level_name(level)) == 0) return level;
+    }
+    return -1;
+}
+
+// Parse batch mode options. Returns 1 to continue, 0 when --help was shown, -1 on error.
+static int parse_batch_options(int argc, char **argv, struct BatchOptions *opts) {
+    static const struct option long_options[] = {
+        {"output", required_argument, NULL, 'o'},
+        {"courses", required_argument, NULL, 'c'},
+        {"include", required_argument, NULL, 'i'},
+        {"exclude", required_argument, NULL, 'x'},
+        {"jobs", required_argument, NULL, 'j'},
+        {"adaptive", no_argument, NULL, 'A'},
+        {"order", required_argument, NULL, 'O'},
+        {"priority", required_argument, NULL, 'p'},
+        {"small-lane", required_argument, NULL, 'L'},
+        {"rate", required_argument, NULL, 'r'},
+        {"resume", no_argument, NULL, 'R'},
+        {"dry-run", no_argument, NULL, 'n'},
+        {"json", no_argument, NULL, 'J'},
+        {"progress", required_argument, NULL, 'P'},
+        {"watch", required_argument, NULL, 'w'},
+        {"full-every", required_argument, NULL, 'F'},
+        {"accounts", required_argument, NULL, 'a'},
+        {"event-loop", no_argument, NULL, 'E'},
+        {"crawl-workers", required_argument, NULL, 'W'},
+        {"max-depth", required_argument, NULL, 'D'},
+        {"timings", no_argument, NULL, 'T'},
+        {"timings-file", required_argument, NULL, 'U'},
+        {"trace", required_argument, NULL, 'Y'},
+        {"metrics-file", required_argument, NULL, 'M'},
+        {"metrics-port", required_argument, NULL, 'N'},
+        {"log-level", required_argument, NULL, 'l'},
+        {"log-format", required_argument, NULL, 'G'},
+        {"verify", no_argument, NULL, 'V'},
+        {"repair", no_argument, NULL, 'X'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0}
+    };
+
+    memset(opts, 0, sizeof(*opts));
+    opts->output = ".";
+    opts->jobs = DEFAULT_MAX_TRANSFERS;
+    opts->full_every = DEFAULT_FULL_CHECK_EVERY;
+    opts->crawl_workers = CRAWL_DEFAULT_WORKERS;
+    opts->max_depth = CRAWL_DEFAULT_MAX_DEPTH;
+    schedule_policy_init(&opts->schedule);
+
+    int opt;
+    char *end;
+    int jobs_given = 0;
+    while ((opt = getopt_long(argc, argv, "o:c:i:x:j:p:r:w:a:nh", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'o': opts->output = optarg; break;
+            case 'c': opts->courses = optarg; break;
+            case 'i':
+                if (opts->include_count >= MAX_FILTER_PATTERNS) {
+                    fprintf(stderr, "Too many --include patterns (max %d)\n", MAX_FILTER_PATTERNS);
+                    return -1;
+                }
+                opts->include[opts->include_count++] = optarg;
+                break;
+            case 'x':
+                if (opts->exclude_count >= MAX_FILTER_PATTERNS) {
+                    fprintf(stderr, "Too many --exclude patterns (max %d)\n", MAX_FILTER_PATTERNS);
+                    return -1;
+                }
+                opts->exclude[opts->exclude_count++] = optarg;
+                break;
+            case 'j':
+                opts->jobs = (int)strtol(optarg, &end, 10);
+                if (*end != '\0' || opts->jobs < 1) {
+                    fprintf(stderr, "Invalid --jobs value: %s\n", optarg);
+                    return -1;
+                }
+                jobs_given = 1;
+                break;
+            case 'A': opts->adaptive = 1; break;
+            case 'O':
+                opts->schedule.order = schedule_order_from_name(optarg);
+                if (opts->schedule.order < 0) {
+                    fprintf(stderr, "Invalid --order value: %s (list, smallest, newest or fair)\n", optarg);
+                    return -1;
+                }
+                break;
+            case 'p':
+                if (opts->schedule.priority_count >= SCHEDULE_MAX_PRIORITY_PATTERNS) {
+                    fprintf(stderr, "Too many --priority patterns (max %d)\n", SCHEDULE_MAX_PRIORITY_PATTERNS);
+                    return -1;
+                }
+                opts->schedule.priority[opts->schedule.priority_count++] = optarg;
+                break;
+            case 'L':
+                opts->schedule.small_lane = (int)strtol(optarg, &end, 10);
+                if (*end != '\0' || opts->schedule.small_lane < 0) {
+                    fprintf(stderr, "Invalid --small-lane value: %s\n", optarg);
+                    return -1;
+                }
+                break;
+            case 'r':
+                opts->rate = strtod(optarg, &end);
+                if (*end != '\0' || opts->rate < 0) {
+                    fprintf(stderr, "Invalid --rate value: %s\n", optarg);
+                    return -1;
+                }
+                break;
+            case 'R': opts->resume = 1; break;
+            case 'n': opts->dry_run = 1; break;
+            case 'J': opts->json = 1; break;
+            case 'P':
+                if (strcmp(optarg, "jsonl") == 0) {
+                    opts->progress_jsonl = 1;
+                } else if (strcmp(optarg, "text") == 0) {
+                    opts->progress_jsonl = 0;
+                } else {
+                    fprintf(stderr, "Invalid --progress value: %s (text or jsonl)\n", optarg);
+                    return -1;
+                }
+                break;
+            case 'w':
+                opts->watch_minutes = (int)strtol(optarg, &end, 10);
+                if (*end != '\0' || opts->watch_minutes < 1) {
+                    fprintf(stderr, "Invalid --watch interval: %s\n", optarg);
+                    return -1;
+                }
+                break;
+            case 'F':
+                opts->full_every = (int)strtol(optarg, &end, 10);
+                if (*end != '\0' || opts->full_every < 0) {
+                    fprintf(stderr, "Invalid --full-every value: %s\n", optarg);
+                    return -1;
+                }
+                break;
+            case 'a': opts->accounts = optarg; break;
+            case 'E': opts->event_loop = 1; break;
+            case 'W':
+                opts->crawl_workers = (int)strtol(optarg, &end, 10);
+                if (*end != '\0' || opts->crawl_workers < 1 || opts->crawl_workers > CRAWL_MAX_WORKERS) {
+                    fprintf(stderr, "Invalid --crawl-workers value: %s (1-%d)\n", optarg, CRAWL_MAX_WORKERS);
+                    return -1;
+                }
+                break;
+            case 'D':
+                opts->max_depth = (int)strtol(optarg, &end, 10);
+                if (*end != '\0' || opts->max_depth < 1) {
+                    fprintf(stderr, "Invalid --max-depth value: %s\n", optarg);
+                    return -1;
+                }
+                break;
+            case 'T': opts->timings = 1; break;
+            case 'U':
+                opts->timings = 1;
+                opts->timings_file = optarg;
+                break;
+            case 'Y': opts->trace_file = optarg; break;
+            case 'M': opts->metrics_file = optarg; break;
+            case 'N':
+                opts->metrics_port = (int)strtol(optarg, &end, 10);
+                if (*end != '\0' || opts->metrics_port < 1 || opts->metrics_port > 65535) {
+                    fprintf(stderr, "Invalid --metrics-port value: %s (1-65535)\n", optarg);
+                    return -1;
+                }
+                break;
+            case 'l':
+                opts->log_level = parse_log_level(optarg);
+                if (opts->log_level < 0) {
+                    fprintf(stderr, "Invalid --log-level value: %s (debug, info, warn or error)\n", optarg);
+                    return -1;
+                }
+                break;
+            case 'G':
+                if (strcmp(optarg, "json") == 0) {
+                    opts->log_format = LOGGER_JSON;
+                } else if (strcmp(optarg, "text") == 0) {
+                    opts->log_format = LOGGER_TEXT;
+                } else {
+                    fprintf(stderr, "Invalid --log-format value: %s (text or json)\n", optarg);
+                    return -1;
+                }
+                break;
+            case 'V': opts->verify = 1; break;
+            case 'X': opts->repair = 1; break;
+            case 'h':
+                print_batch_usage(stdout, argv[0]);
+                return 0;
+            default:
+                print_batch_usage(stderr, argv[0]);
+                return -1;
+        }
+    }
+    if (optind < argc) {
+        fprintf(stderr, "Unexpected argument: %s\n", argv[optind]);
+        print_batch_usage(stderr, argv[0]);
+        return -1;
+    }
+    if (opts->accounts && opts->watch_minutes > 0) {
+        fprintf(stderr, "--accounts cannot be combined with --watch\n");
+        return -1;
+    }
+    if (opts->repair && !opts->verify) {
+        fprintf(stderr, "--repair needs --verify\n");
+        return -1;
+    }
+    if (opts->verify && (opts->accounts || opts->watch_minutes > 0 || opts->dry_run || opts->json ||
+                         opts->progress_jsonl)) {
+        fprintf(stderr, "--verify cannot be combined with --accounts, --watch, --dry-run, --json or --progress\n");
+        return -1;
+    }
+    if (opts->json && opts->progress_jsonl) {
+        fprintf(stderr, "--json cannot be combined with --progress=jsonl (both write to stdout)\n");
+        return -1;
+    }
+    if (opts->adaptive && !jobs_given) opts->jobs = ADAPTIVE_DEFAULT_MAX_LIMIT;
+    return 1;
+}
+
+// Check a file name (link name, server name or course/name path) against the filters
+static int file_passes_filters(const struct BatchOptions *opts, const struct FileInfo *file) {
+    const char *names[3];
+    char course_path[MAX_FILENAME_LEN * 2 + 2];
+    size_t name_count = 0;
+    names[name_count++] = file->filename;
+    if (file->remote_name[0]) names[name_count++] = file->remote_name;
+    snprintf(course_path, sizeof(course_path), "%s/%s", file->course_name,
+             file->remote_name[0] ? file->remote_name : file->filename);
+    names[name_count++] = course_path;
+
+    for (size_t p = 0; p < opts->exclude_count; p++) {
+        for (size_t n = 0; n < name_count; n++) {
+            if (match_pattern_list(opts->exclude[p], names[n])) return 0;
+        }
+    }
+    if (opts->include_count == 0) return 1;
+    for (size_t p = 0; p < opts->include_count; p++) {
+        for (size_t n = 0; n < name_count; n++) {
+            if (match_pattern_list(opts->include[p], names[n])) return 1;
+        }
+    }
+    return 0;
+}
+
+// Machine-readable result of a batch run
+static void write_batch_json(FILE *fp, const struct BatchOptions *opts, const char *account,
+                             const struct FileList *list, const int *selections, size_t selection_count,
+                             const int *outcomes, const struct DownloadStats *stats, int exit_code) {
+    fprintf(fp, "{");
+    if (account) {
+        fprintf(fp, "\"account\":");
+        fprint_json_string(fp, account);
+        fprintf(fp, ",");
+    }
+    fprintf(fp, "\"output\":");
+    fprint_json_string(fp, opts->output);
+    fprintf(fp, ",\"dry_run\":%s,\"files\":[", opts->dry_run ? "true" : "false");
+    for (size_t i = 0; i < selection_count; i++) {
+        const struct FileInfo *file = &list->files[selections[i] - 1];
+        fprintf(fp, "%s\n  {\"course\":", i > 0 ? "," : "");
+        fprint_json_string(fp, file->course_name);
+        fprintf(fp, ",\"name\":");
+        fprint_json_string(fp, file->remote_name[0] ? file->remote_name : file->filename);
+        fprintf(fp, ",\"url\":");
+        fprint_json_string(fp, file->url);
+        fprintf(fp, ",\"size\":%lld,\"status\":", file->meta_state == META_RESOLVED ? file->size : -1LL);
+        fprint_json_string(fp, opts->dry_run ? "planned" : download_outcome_name(outcomes[i]));
+        fprintf(fp, "}");
+    }
+    fprintf(fp, "\n],\"summary\":{\"selected\":%zu,\"downloaded\":%zu,\"skipped\":%zu,\"unchanged\":%zu,"
+                "\"deduplicated\":%zu,\"failed\":%zu,\"bytes\":%lld,\"concurrency\":%d},\"exit_code\":%d}\n",
+            selection_count, stats->downloaded, stats->skipped, stats->unchanged,
+            stats->deduplicated, stats->failed, stats->bytes, stats->concurrency, exit_code);
+    fflush(fp);
+}
+
+static volatile sig_atomic_t stop_requested = 0;
+
+static void handle_stop_signal(int sig) {
+    (void)sig;
+    stop_requested = 1;
+}
+
+// New handle for one logged-in session, with its own cookie jar
+static CURL *new_session_handle(const char *cookie_file) {
+    CURL *curl = curl_easy_init();
+    if (!curl) return NULL;
+    curl_easy_setopt(curl, CURLOPT_COOKIEJAR, cookie_file);
+    curl_easy_setopt(curl, CURLOPT_COOKIEFILE, cookie_file);
+    // Load the jar now: the saved session is inspected before the first transfer
+    curl_easy_setopt(curl, CURLOPT_COOKIELIST, "RELOAD");
+    curl_easy_setopt(curl, CURLOPT_USERAGENT, WELEARN_USER_AGENT);
+    curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+    curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 1L);
+    curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, 2L);
+    return curl;
+}
+
+static const char *login_failure_reason(int login_status) {
+    return login_status == LOGIN_INVALID_CREDENTIALS ? "invalid username or password" :
+           login_status == LOGIN_NO_TOKEN ? "login token not found" : "network error";
+}
+
+// Scan the dashboard's courses into candidates (files only). Between full checks of
+// watch mode only URLs that were never downloaded are candidates. Returns the scanned file count;
+// *failed_pages gets the number of course and folder pages that could not be fetched.
+static size_t collect_batch_candidates(CURL *curl, const struct BatchOptions *opts, const char *dashboard_html,
+                                       struct CourseWatchState *watch, int force, struct FileList *candidates,
+                                       size_t *failed_pages) {
+    struct FileList file_list;
+    init_file_list(&file_list);
+
+    int courses = scan_changed_courses(curl, dashboard_html, opts->courses, watch, force, &file_list, failed_pages);
+    if (*failed_pages > 0) {
+        fprintf(stderr, "%zu course or folder page(s) could not be fetched, their files are missing.\n",
+                *failed_pages);
+    }
+    if (courses == 0 && !watch) {
+        fprintf(stderr, "No courses %s.\n", opts->courses ? "matched the --courses pattern" : "found on the dashboard");
+    }
+
+    struct ContentStore store;
+    int have_store = watch && !force && content_store_open(&store, opts->output);
+    for (size_t i = 0; i < file_list.count; i++) {
+        const struct FileInfo *file = &file_list.files[i];
+        if (file->is_folder) continue;
+        if (have_store && manifest_find_url(&store.manifest, file->url)) continue;
+        add_file_to_list(candidates, file->filename, file->url, file->course_name, file->suggested_name, 0, file->depth);
+    }
+    if (have_store) content_store_close(&store);
+
+    // Server-side names and sizes make the filters, the dry run and size- or
+    // date-based scheduling meaningful
+    int schedule_needs_metadata = opts->schedule.order == SCHEDULE_SMALLEST ||
+                                  opts->schedule.order == SCHEDULE_NEWEST || opts->schedule.small_lane > 0;
+    if (candidates->count > 0 &&
+        (opts->dry_run || opts->include_count > 0 || opts->exclude_count > 0 || schedule_needs_metadata)) {
+        size_t resolved = prefetch_file_metadata(curl, candidates, opts->jobs, NULL, NULL);
+        printf("Resolved details for %zu file(s).\n", resolved);
+    }
+
+    size_t scanned = file_list.count;
+    free_file_list(&file_list);
+    return scanned;
+}
+
+// Pick the candidates that pass the filters. selections (1-based) and outcomes must hold
+// candidates->count entries. Returns the selection count; *planned_bytes gets the known size.
+static size_t select_batch_files(const struct BatchOptions *opts, const struct FileList *candidates,
+                                 int *selections, int *outcomes, long long *planned_bytes) {
+    size_t selection_count = 0;
+    *planned_bytes = 0;
+    for (size_t i = 0; i < candidates->count; i++) {
+        const struct FileInfo *file = &candidates->files[i];
+        if (!file_passes_filters(opts, file)) continue;
+        outcomes[selection_count] = DOWNLOAD_FAILED;
+        selections[selection_count++] = (int)(i + 1);
+        if (file->meta_state == META_RESOLVED && file->size > 0) *planned_bytes += file->size;
+    }
+    return selection_count;
+}
+
+// Stream the scan result (if progress events are on): every candidate with
+// whether the filters selected it, then the plan. selections is ascending.
+static void report_scan_progress(const char *account, const struct FileList *candidates, const int *selections,
+                                 size_t selection_count, size_t scanned, long long planned_bytes) {
+    struct ProgressStream *progress = welearn_context_current()->progress;
+    if (!progress) return;
+    size_t next = 0;
+    for (size_t i = 0; i < candidates->count; i++) {
+        int selected = next < selection_count && (size_t)selections[next] == i + 1;
+        if (selected) next++;
+        progress_discovered(progress, account, &candidates->files[i], selected);
+    }
+    progress_plan(progress, account, scanned, selection_count, planned_bytes);
+}
+
+// One scan + download pass. In watch mode (watch != NULL) unchanged courses are
+// skipped and, unless force is set, files already in the manifest are not re-checked.
+static int batch_sync_once(CURL *curl, const struct BatchOptions *opts, const char *dashboard_html,
+                           struct CourseWatchState *watch, int force, FILE *json_out) {
+    int exit_code = BATCH_EXIT_OK;
+    struct FileList candidates;
+    init_file_list(&candidates);
+    int *selections = NULL;
+    int *outcomes = NULL;
+    size_t selection_count = 0;
+    struct DownloadStats stats = {0};
+    double started = progress_now();
+
+    size_t failed_pages = 0;
+    size_t scanned = collect_batch_candidates(curl, opts, dashboard_html, watch, force, &candidates, &failed_pages);
+
+    selections = malloc((candidates.count ? candidates.count : 1) * sizeof(int));
+    outcomes = malloc((candidates.count ? candidates.count : 1) * sizeof(int));
+    if (!selections || !outcomes) {
+        perror("Failed to allocate selection");
+        exit_code = BATCH_EXIT_IO;
+        goto sync_cleanup;
+    }
+    long long planned_bytes = 0;
+    selection_count = select_batch_files(opts, &candidates, selections, outcomes, &planned_bytes);
+    printf("%zu of %zu file(s) selected.\n", selection_count, scanned);
+    report_scan_progress(NULL, &candidates, selections, selection_count, scanned, planned_bytes);
+
+    if (opts->dry_run) {
+        char size_str[32];
+        for (size_t i = 0; i < selection_count; i++) {
+            const struct FileInfo *file = &candidates.files[selections[i] - 1];
+            format_size(file->meta_state == META_RESOLVED ? file->size : -1, size_str, sizeof(size_str));
+            printf("  would download: %s/%s (%s)\n", file->course_name,
+                   file->remote_name[0] ? file->remote_name : file->filename, size_str);
+        }
+        format_size(planned_bytes, size_str, sizeof(size_str));
+        printf("Dry run: %zu file(s), %s known size.\n", selection_count, size_str);
+    } else if (selection_count > 0) {
+        download_files_parallel(curl, &candidates, selections, selection_count, opts->output,
+                                opts->jobs, &stats, outcomes);
+        char bytes_str[32];
+        format_size(stats.bytes, bytes_str, sizeof(bytes_str));
+        printf("Downloaded %zu (%s), unchanged %zu, deduplicated %zu, skipped %zu, failed %zu\n",
+               stats.downloaded, bytes_str, stats.unchanged, stats.deduplicated, stats.skipped, stats.failed);
+        if (stats.failed > 0) exit_code = BATCH_EXIT_PARTIAL;
+    }
+    if (failed_pages > 0) exit_code = BATCH_EXIT_NETWORK;  // The scan itself is incomplete
+
+sync_cleanup:
+    progress_summary(welearn_context_current()->progress, NULL, &stats, selection_count,
+                     progress_now() - started, exit_code);
+    if (json_out) {
+        write_batch_json(json_out, opts, NULL, &candidates, selections, selection_count, outcomes, &stats, exit_code);
+    }
+    free(selections);
+    free(outcomes);
+    free_file_list(&candidates);
+    return exit_code;
+}
+
+// Sleep for the poll interval, waking early when a stop signal arrives
+static void wait_for_next_poll(int seconds) {
+    for (int i = 0; i < seconds && !stop_requested; i++) {
+        sleep(1);
+    }
+}
+
+// One account of a multi-account sync. Each has its own handle and cookie jar;
+// the store, rate limiter and DNS/TLS cache are shared, and so is the
+// connection pool of the session handles.
+struct AccountSync {
+    char username[128];
+    char password[128];
+    char base_path[MAX_PATH_LEN];  // Output directory of this account
+    struct BatchOptions opts;      // Batch options with output = base_path
+    struct NetCache *net_cache;
+    CURL *curl;
+    struct WelearnSession session;
+    struct WelearnContext context;  // Bound by every thread working for this account
+    struct FileList candidates;
+    size_t scanned;
+    int *selections;         // 1-based into candidates
+    int *outcomes;
+    unsigned char *shared;   // Per selection: an earlier account downloads the same URL
+    size_t selection_count;
+    long long planned_bytes;
+    struct DownloadStats stats;
+    size_t failed_pages;     // Course and folder pages the scan could not fetch
+    int exit_code;
+    pthread_t thread;
+    int thread_started;
+};
+
+// A selected URL of some account, sorted to find files several accounts share
+struct AccountFileRef {
+    const char *url;
+    size_t account;
+    size_t selection;
+};
+
+// Read "username password" lines ('#' starts a comment). Returns the account count, -1 on error.
+static int load_accounts(const char *path, struct AccountSync *accounts, size_t max_accounts) {
+    FILE *fp = fopen(path, "r");
+    if (!fp) {
+        perror("Failed to open accounts file");
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fileno(fp), &st) == 0 && (st.st_mode & 077)) {
+        fprintf(stderr, "Warning: %s is readable by other users; consider chmod 600.\n", path);
+    }
+
+    char line[512];
+    size_t count = 0;
+    unsigned long line_no = 0;
+    while (fgets(line, sizeof(line), fp)) {
+        line_no++;
+        char *hash = strchr(line, '#');
+        if (hash) *hash = '\0';
+        char user[128];
+        char pass[128];
+        int fields = sscanf(line, "%127s %127s", user, pass);
+        if (fields <= 0) continue;
+        if (fields != 2) {
+            fprintf(stderr, "%s:%lu: expected \"username password\"\n", path, line_no);
+            fclose(fp);
+            return -1;
+        }
+        if (count == max_accounts) {
+            fprintf(stderr, "Too many accounts in %s (max %zu)\n", path, max_accounts);
+            fclose(fp);
+            return -1;
+        }
+        memset(&accounts[count], 0, sizeof(accounts[count]));
+        snprintf(accounts[count].username, sizeof(accounts[count].username), "%s", user);
+        snprintf(accounts[count].password, sizeof(accounts[count].password), "%s", pass);
+        count++;
+    }
+    memset(line, 0, sizeof(line));
+    fclose(fp);
+    return (int)count;
+}
+
+// Label the calling thread in the trace (if any) with the account and phase
+static void name_account_thread(const struct AccountSync *account, const char *phase) {
+    char name[160];
+    snprintf(name, sizeof(name), "%s %s", phase, account->username);
+    trace_name_thread(account->context.trace, name);
+}
+
+// Phase 1, one thread per account: log in, scan the courses, select files
+static void *account_scan_thread(void *arg) {
+    struct AccountSync *account = (struct AccountSync *)arg;
+    welearn_context_bind(&account->context);
+    name_account_thread(account, "scan");
+
+    char safe_name[MAX_FILENAME_LEN];
+    char cookie_file[MAX_FILENAME_LEN + 16];
+    sanitize_filename(account->username, safe_name, sizeof(safe_name));
+    snprintf(cookie_file, sizeof(cookie_file), "cookies-%s.txt", safe_name);
+    account->curl = new_session_handle(cookie_file);
+    if (!account->curl) {
+        account->exit_code = BATCH_EXIT_NETWORK;
+        return NULL;
+    }
+    net_cache_apply(account->net_cache, account->curl);
+
+    struct MemoryStruct dashboard;
+    init_memory_struct(&dashboard);
+    int reused = 0;
+    int login_status = welearn_resume_session(account->curl, account->username, account->password,
+                                              &dashboard, &reused);
+    if (login_status != LOGIN_OK) {
+        fprintf(stderr, "[%s] Login failed (%s).\n", account->username, login_failure_reason(login_status));
+        account->exit_code = login_status == LOGIN_INVALID_CREDENTIALS ? BATCH_EXIT_AUTH : BATCH_EXIT_NETWORK;
+        free(dashboard.memory);
+        return NULL;
+    }
+    printf(reused ? "[%s] Reusing saved session.\n" : "[%s] Logged in.\n", account->username);
+
+    account->session.curl = account->curl;
+    snprintf(account->session.username, sizeof(account->session.username), "%s", account->username);
+    snprintf(account->session.password, sizeof(account->session.password), "%s", account->password);
+    account->context.curl = account->curl;
+    download_set_session_renewal(welearn_session_renew, &account->session);
+
+    init_file_list(&account->candidates);
+    account->scanned = collect_batch_candidates(account->curl, &account->opts, dashboard.memory, NULL, 1,
+                                                &account->candidates, &account->failed_pages);
+    free(dashboard.memory);
+
+    size_t slots = account->candidates.count ? account->candidates.count : 1;
+    account->selections = malloc(slots * sizeof(int));
+    account->outcomes = malloc(slots * sizeof(int));
+    account->shared = calloc(slots, 1);
+    if (!account->selections || !account->outcomes || !account->shared) {
+        perror("Failed to allocate selection");
+        account->exit_code = BATCH_EXIT_IO;
+        return NULL;
+    }
+    account->selection_count = select_batch_files(&account->opts, &account->candidates, account->selections,
+                                                  account->outcomes, &account->planned_bytes);
+    printf("[%s] %zu of %zu file(s) selected.\n", account->username, account->selection_count, account->scanned);
+    report_scan_progress(account->username, &account->candidates, account->selections, account->selection_count,
+                         account->scanned, account->planned_bytes);
+    return NULL;
+}
+
+static int compare_account_file_refs(const void *a, const void *b) {
+    const struct AccountFileRef *ra = (const struct AccountFileRef *)a;
+    const struct AccountFileRef *rb = (const struct AccountFileRef *)b;
+    int cmp = strcmp(ra->url, rb->url);
+    if (cmp != 0) return cmp;
+    if (ra->account != rb->account) return ra->account < rb->account ? -1 : 1;
+    return ra->selection < rb->selection ? -1 : ra->selection > rb->selection;
+}
+
+// Give every URL selected by several accounts to the first of them; the others link
+// the stored copy afterwards. Returns the number of shared selections.
+static size_t plan_shared_downloads(struct AccountSync *accounts, size_t account_count) {
+    size_t total = 0;
+    for (size_t a = 0; a < account_count; a++) {
+        if (accounts[a].exit_code == BATCH_EXIT_OK) total += accounts[a].selection_count;
+    }
+    if (total == 0) return 0;
+
+    struct AccountFileRef *refs = malloc(total * sizeof(struct AccountFileRef));
+    if (!refs) return 0;  // Without a plan every account simply downloads its own files
+    size_t n = 0;
+    for (size_t a = 0; a < account_count; a++) {
+        if (accounts[a].exit_code != BATCH_EXIT_OK) continue;
+        for (size_t i = 0; i < accounts[a].selection_count; i++) {
+            refs[n].url = accounts[a].candidates.files[accounts[a].selections[i] - 1].url;
+            refs[n].account = a;
+            refs[n].selection = i;
+            n++;
+        }
+    }
+    qsort(refs, n, sizeof(struct AccountFileRef), compare_account_file_refs);
+
+    size_t shared = 0;
+    for (size_t r = 1; r < n; r++) {
+        if (strcmp(refs[r - 1].url, refs[r].url) == 0) {
+            accounts[refs[r].account].shared[refs[r].selection] = 1;
+            shared++;
+        }
+    }
+    free(refs);
+    return shared;
+}
+
+// Download the selections with (own != 0) or without (own == 0) the shared flag
+static void download_account_subset(struct AccountSync *account, int own) {
+    int *subset = malloc((account->selection_count ? account->selection_count : 1) * sizeof(int));
+    int *subset_outcomes = malloc((account->selection_count ? account->selection_count : 1) * sizeof(int));
+    size_t *origin = malloc((account->selection_count ? account->selection_count : 1) * sizeof(size_t));
+    if (!subset || !subset_outcomes || !origin) {
+        perror("Failed to allocate download subset");
+        free(subset);
+        free(subset_outcomes);
+        free(origin);
+        account->exit_code = BATCH_EXIT_IO;
+        return;
+    }
+
+    size_t count = 0;
+    for (size_t i = 0; i < account->selection_count; i++) {
+        if ((account->shared[i] == 0) != (own != 0)) continue;
+        const struct FileInfo *file = &account->candidates.files[account->selections[i] - 1];
+        if (!own) {
+            // Downloaded by another account in phase 2: link it, fall back to a download
+            char course_path[MAX_PATH_LEN];
+            int outcome = DOWNLOAD_FAILED;
+            if (snprintf(course_path, sizeof(course_path), "%s/%s", account->base_path,
+                         file->course_name) < (int)sizeof(course_path)) {
+                create_directory(course_path);
+                outcome = download_link_known_url(file->url, course_path);
+            }
+            if (outcome != DOWNLOAD_FAILED) {
+                progress_done(account->context.progress, NULL, file->url, file->course_name,
+                              download_outcome_name(outcome), 0);
+                account->outcomes[i] = outcome;
+                if (outcome == DOWNLOAD_SKIPPED) {
+                    account->stats.skipped++;
+                } else {
+                    account->stats.deduplicated++;
+                }
+                continue;
+            }
+        }
+        subset[count] = account->selections[i];
+        origin[count] = i;
+        count++;
+    }
+
+    if (count > 0) {
+        struct DownloadStats stats;
+        download_files_parallel(account->curl, &account->candidates, subset, count, account->base_path,
+                                account->opts.jobs, &stats, subset_outcomes);
+        for (size_t k = 0; k < count; k++) {
+            account->outcomes[origin[k]] = subset_outcomes[k];
+        }
+        account->stats.downloaded += stats.downloaded;
+        account->stats.skipped += stats.skipped;
+        account->stats.unchanged += stats.unchanged;
+        account->stats.deduplicated += stats.deduplicated;
+        account->stats.failed += stats.failed;
+        account->stats.bytes += stats.bytes;
+    }
+    free(subset);
+    free(subset_outcomes);
+    free(origin);
+}
+
+// Phase 2: files this account is the first to select
+static void *account_download_thread(void *arg) {
+    struct AccountSync *account = (struct AccountSync *)arg;
+    welearn_context_bind(&account->context);
+    name_account_thread(account, "download");
+    download_account_subset(account, 1);
+    return NULL;
+}
+
+// Phase 3: files another account downloaded in phase 2
+static void *account_link_thread(void *arg) {
+    struct AccountSync *account = (struct AccountSync *)arg;
+    welearn_context_bind(&account->context);
+    name_account_thread(account, "link");
+    download_account_subset(account, 0);
+    return NULL;
+}
+
+// Run fn on one thread per account that is still healthy, then wait for all of them
+static void run_account_threads(struct AccountSync *accounts, size_t account_count, void *(*fn)(void *)) {
+    for (size_t a = 0; a < account_count; a++) {
+        if (accounts[a].exit_code != BATCH_EXIT_OK) continue;
+        accounts[a].thread_started = pthread_create(&accounts[a].thread, NULL, fn, &accounts[a]) == 0;
+        if (!accounts[a].thread_started) {
+            // No thread available: run it here, without keeping its context bound
+            struct WelearnContext *own = welearn_context_bind(NULL);
+            fn(&accounts[a]);
+            welearn_context_bind(own);
+        }
+    }
+    for (size_t a = 0; a < account_count; a++) {
+        if (accounts[a].thread_started) {
+            pthread_join(accounts[a].thread, NULL);
+            accounts[a].thread_started = 0;
+        }
+    }
+    logger_flush();
+}
+
+static int telemetry_wanted(const struct BatchOptions *opts) {
+    return opts->timings || opts->metrics_file || opts->metrics_port > 0;
+}
+
+// Record telemetry for --timings and the metrics exporter; a metrics endpoint
+// that cannot be opened is reported but does not stop the run
+static void start_telemetry(const struct BatchOptions *opts, struct Telemetry *telemetry,
+                            struct MetricsExporter *metrics) {
+    telemetry_init(telemetry, opts->timings_file != NULL);
+    download_set_telemetry(telemetry);
+    memset(metrics, 0, sizeof(*metrics));
+    metrics->listen_fd = -1;
+    if (!opts->metrics_file && opts->metrics_port == 0) return;
+    if (metrics_exporter_start(metrics, telemetry, opts->metrics_file, opts->metrics_port) != 0) {
+        fprintf(stderr, "Metrics export is incomplete, see the log above\n");
+    }
+}
+
+// Stop the exporter, print the timing report (to stderr with --json) and export the raw samples
+static void finish_telemetry(const struct BatchOptions *opts, struct Telemetry *telemetry,
+                             struct MetricsExporter *metrics) {
+    download_set_telemetry(NULL);
+    metrics_exporter_stop(metrics);
+    if (opts->timings) {
+        telemetry_report(telemetry, stdout);
+        if (opts->timings_file && telemetry_export(telemetry, opts->timings_file) == 0) {
+            printf("Request timings written to %s\n", opts->timings_file);
+        }
+    }
+    telemetry_free(telemetry);
+}
+
+static void start_trace(struct TraceLog *trace) {
+    trace_init(trace);
+    trace_name_thread(trace, "main");
+    download_set_trace(trace);
+}
+
+static void finish_trace(const struct BatchOptions *opts, struct TraceLog *trace) {
+    download_set_trace(NULL);
+    if (trace_write(trace, opts->trace_file) == 0) {
+        printf("Trace of %zu event(s) written to %s\n", trace->count, opts->trace_file);
+    }
+    trace_free(trace);
+}
+
+static void finish_progress(struct ProgressStream *progress) {
+    download_set_progress(NULL);
+    progress_free(progress);
+}
+
+// Batch mode for several accounts: scan all of them concurrently, download every
+// shared URL once, then link it into the other accounts' trees
+static int run_accounts(const struct BatchOptions *opts, FILE *json_out) {
+    struct AccountSync *accounts = calloc(MAX_ACCOUNTS, sizeof(struct AccountSync));
+    if (!accounts) {
+        perror("Failed to allocate accounts");
+        return BATCH_EXIT_IO;
+    }
+    int loaded = load_accounts(opts->accounts, accounts, MAX_ACCOUNTS);
+    if (loaded <= 0) {
+        if (loaded == 0) fprintf(stderr, "No accounts in %s\n", opts->accounts);
+        free(accounts);
+        return loaded == 0 ? BATCH_EXIT_USAGE : BATCH_EXIT_IO;
+    }
+    size_t account_count = (size_t)loaded;
+
+    if (!opts->dry_run && !create_directory(opts->output)) {
+        fprintf(stderr, "Failed to create download directory: %s\n", opts->output);
+        free(accounts);
+        return BATCH_EXIT_IO;
+    }
+
+    curl_global_init(CURL_GLOBAL_ALL);
+    struct NetCache net_cache;
+    net_cache_load(&net_cache, NETCACHE_FILE);
+
+    // One store at the output root: accounts' trees live below it and share objects
+    struct ContentStore store;
+    int have_store = !opts->dry_run && content_store_open(&store, opts->output);
+    if (have_store) download_set_content_store(&store);
+
+    struct RateLimiter limiter;
+    int use_limiter = opts->rate > 0;
+    if (use_limiter) {
+        rate_limiter_init(&limiter, opts->rate, opts->jobs);
+        download_set_rate_limiter(&limiter);
+    }
+    download_set_resume(opts->resume);
+    download_set_event_loop(opts->event_loop, opts->jobs);
+    download_set_crawl_limits(opts->crawl_workers, opts->max_depth);
+    download_set_adaptive(opts->adaptive);
+    download_set_schedule(&opts->schedule);
+    download_set_net_cache(&net_cache);
+    struct Telemetry telemetry;
+    struct MetricsExporter metrics;
+    if (telemetry_wanted(opts)) start_telemetry(opts, &telemetry, &metrics);
+    struct TraceLog trace;
+    if (opts->trace_file) start_trace(&trace);
+
+    for (size_t a = 0; a < account_count; a++) {
+        struct AccountSync *account = &accounts[a];
+        char safe_name[MAX_FILENAME_LEN];
+        sanitize_filename(account->username, safe_name, sizeof(safe_name));
+        snprintf(account->base_path, sizeof(account->base_path), "%s/%s", opts->output, safe_name);
+        account->opts = *opts;
+        account->opts.output = account->base_path;
+        account->net_cache = &net_cache;
+        account->context = *welearn_context_current();  // Shared store, limiter, net cache and resume setting
+        account->context.owns_root_fd = 0;
+        if (!opts->dry_run && !create_directory(account->base_path)) {
+            fprintf(stderr, "Failed to create download directory: %s\n", account->base_path);
+            account->exit_code = BATCH_EXIT_IO;
+        }
+    }
+
+    printf("Syncing %zu account(s) into %s\n", account_count, opts->output);
+    double started = progress_now();
+    run_account_threads(accounts, account_count, account_scan_thread);
+    size_t shared = plan_shared_downloads(accounts, account_count);
+    printf("%zu selected file(s) are shared between accounts and will be downloaded once.\n", shared);
+
+    if (opts->dry_run) {
+        for (size_t a = 0; a < account_count; a++) {
+            struct AccountSync *account = &accounts[a];
+            char size_str[32];
+            for (size_t i = 0; i < account->selection_count; i++) {
+                const struct FileInfo *file = &account->candidates.files[account->selections[i] - 1];
+                format_size(file->meta_state == META_RESOLVED ? file->size : -1, size_str, sizeof(size_str));
+                printf("  [%s] would %s: %s/%s (%s)\n", account->username,
+                       account->shared[i] ? "link" : "download", file->course_name,
+                       file->remote_name[0] ? file->remote_name : file->filename, size_str);
+            }
+        }
+    } else {
+        run_account_threads(accounts, account_count, account_download_thread);
+        run_account_threads(accounts, account_count, account_link_thread);
+    }
+
+    int exit_code = BATCH_EXIT_OK;
+    for (size_t a = 0; a < account_count; a++) {
+        struct AccountSync *account = &accounts[a];
+        if (account->exit_code == BATCH_EXIT_OK && account->stats.failed > 0) {
+            account->exit_code = BATCH_EXIT_PARTIAL;
+        }
+        if (account->exit_code <= BATCH_EXIT_PARTIAL && account->failed_pages > 0) {
+            account->exit_code = BATCH_EXIT_NETWORK;
+        }
+        if (account->exit_code > exit_code) exit_code = account->exit_code;
+
+        char bytes_str[32];
+        format_size(account->stats.bytes, bytes_str, sizeof(bytes_str));
+        printf("[%s] Downloaded %zu (%s), unchanged %zu, deduplicated %zu, skipped %zu, failed %zu\n",
+               account->username, account->stats.downloaded, bytes_str, account->stats.unchanged,
+               account->stats.deduplicated, account->stats.skipped, account->stats.failed);
+        progress_summary(welearn_context_current()->progress, account->username, &account->stats,
+                         account->selection_count, progress_now() - started, account->exit_code);
+        if (json_out) {
+            write_batch_json(json_out, &account->opts, account->username, &account->candidates,
+                             account->selections, account->selections ? account->selection_count : 0,
+                             account->outcomes, &account->stats, account->exit_code);
+        }
+    }
+
+    if (telemetry_wanted(opts)) finish_telemetry(opts, &telemetry, &metrics);
+    if (opts->trace_file) finish_trace(opts, &trace);
+    download_set_rate_limiter(NULL);
+    if (use_limiter) rate_limiter_destroy(&limiter);
+    if (have_store) {
+        download_set_content_store(NULL);
+        content_store_close(&store);
+    }
+    download_set_net_cache(NULL);
+    for (size_t a = 0; a < account_count; a++) {
+        struct AccountSync *account = &accounts[a];
+        if (account->curl) {
+            net_cache_record(&net_cache, account->curl);
+            curl_easy_cleanup(account->curl);
+        }
+        free_file_list(&account->candidates);
+        free(account->selections);
+        free(account->outcomes);
+        free(account->shared);
+    }
+    net_cache_save(&net_cache);
+    net_cache_free(&net_cache);
+    memset(accounts, 0, MAX_ACCOUNTS * sizeof(struct AccountSync));
+    free(accounts);
+    curl_global_cleanup();
+    return exit_code;
+}
+
+// Non-interactive mode: login, scan, filter and download without reading stdin
+// Credentials from WELEARN_USERNAME/WELEARN_PASSWORD or the saved file; 0 if there are none
+static int load_batch_credentials(char *username, size_t username_size, char *password, size_t password_size) {
+    const char *env_user = getenv("WELEARN_USERNAME");
+    const char *env_pass = getenv("WELEARN_PASSWORD");
+    if (env_user && env_pass && env_user[0] && env_pass[0]) {
+        snprintf(username, username_size, "%s", env_user);
+        snprintf(password, password_size, "%s", env_pass);
+        return 1;
+    }
+    if (load_credentials(username, username_size, password, password_size, ENCRYPTION_KEY)) return 1;
+    fprintf(stderr, "No credentials: set WELEARN_USERNAME and WELEARN_PASSWORD or save them in interactive mode.\n");
+    return 0;
+}
+
+// --verify: check the output directory against its manifest without logging in.
+// With --repair, damaged files are restored from the store where possible; the
+// client logs in only if some still have to be downloaded again.
+static int run_verify(const struct BatchOptions *opts) {
+    struct ContentStore store;
+    if (!content_store_open(&store, opts->output)) {
+        fprintf(stderr, "Failed to open download directory: %s\n", opts->output);
+        return BATCH_EXIT_IO;
+    }
+    printf("Verifying %zu file(s) in %s...\n", store.manifest.count, opts->output);
+    struct VerifyResult result;
+    if (!verify_download_tree(&store, 0, &result)) {
+        content_store_close(&store);
+        return BATCH_EXIT_IO;
+    }
+    if (opts->repair) repair_from_store(&store, &result);
+    print_verify_summary(&result);
+
+    int exit_code = BATCH_EXIT_OK;
+    size_t damaged = result.queued;
+    if (damaged > 0 && opts->repair) {
+        char username[128] = "";
+        char password[128] = "";
+        CURL *curl = NULL;
+        struct MemoryStruct dashboard;
+        init_memory_struct(&dashboard);
+        curl_global_init(CURL_GLOBAL_ALL);
+
+        struct RateLimiter limiter;
+        int use_limiter = opts->rate > 0;
+        if (use_limiter) {
+            rate_limiter_init(&limiter, opts->rate, 1);
+            download_set_rate_limiter(&limiter);
+        }
+        int reused = 0;
+        int login_status = LOGIN_NETWORK_ERROR;
+        if (!load_batch_credentials(username, sizeof(username), password, sizeof(password))) {
+            exit_code = BATCH_EXIT_AUTH;
+        } else if (!(curl = new_session_handle("cookies.txt"))) {
+            fprintf(stderr, "Failed to initialize libcurl\n");
+            exit_code = BATCH_EXIT_NETWORK;
+        } else if ((login_status = welearn_resume_session(curl, username, password, &dashboard, &reused)) != LOGIN_OK) {
+            fprintf(stderr, "Login failed (%s).\n", login_failure_reason(login_status));
+            exit_code = login_status == LOGIN_INVALID_CREDENTIALS ? BATCH_EXIT_AUTH : BATCH_EXIT_NETWORK;
+        } else {
+            printf(reused ? "Reusing saved session for %s.\n" : "Logged in as %s.\n", username);
+            struct WelearnSession session = {curl, "", "", 0};
+            snprintf(session.username, sizeof(session.username), "%s", username);
+            snprintf(session.password, sizeof(session.password), "%s", password);
+            download_set_session_renewal(welearn_session_renew, &session);
+            damaged -= redownload_failed_entries(curl, &store, &result);
+            download_set_session_renewal(NULL, NULL);
+        }
+        memset(password, 0, sizeof(password));
+        free(dashboard.memory);
+        download_set_rate_limiter(NULL);
+        if (use_limiter) rate_limiter_destroy(&limiter);
+        if (curl) curl_easy_cleanup(curl);
+        curl_global_cleanup();
+    }
+
+    if (damaged > 0) {
+        printf("%zu file(s) are still missing or damaged.\n", damaged);
+        if (exit_code == BATCH_EXIT_OK) exit_code = BATCH_EXIT_PARTIAL;
+    } else {
+        printf("All files verified.\n");
+    }
+    free_verify_result(&result);
+    content_store_close(&store);
+    return exit_code;
+}
+
+static int run_batch(int argc, char **argv) {
+    struct BatchOptions opts;
+    int parsed = parse_batch_options(argc, argv, &opts);
+    if (parsed <= 0) {
+        return parsed == 0 ? BATCH_EXIT_OK : BATCH_EXIT_USAGE;
+    }
+    welearn_log_set_level(opts.log_level);
+    logger_start(opts.log_format);
+    if (opts.verify) return run_verify(&opts);
+
+    // JSON (or the progress events) goes to the real stdout; everything the
+    // library prints goes to stderr
+    FILE *machine_out = NULL;
+    if (opts.json || opts.progress_jsonl) {
+        fflush(stdout);
+        int json_fd = dup(STDOUT_FILENO);
+        if (json_fd < 0 || dup2(STDERR_FILENO, STDOUT_FILENO) < 0 || !(machine_out = fdopen(json_fd, "w"))) {
+            perror("Failed to set up JSON output");
+            return BATCH_EXIT_IO;
+        }
+    }
+    FILE *json_out = opts.json ? machine_out : NULL;
+    struct ProgressStream progress;
+    if (opts.progress_jsonl) {
+        progress_init(&progress, machine_out);
+        download_set_progress(&progress);
+    }
+
+    if (opts.accounts) {
+        int rc = run_accounts(&opts, json_out);
+        if (opts.progress_jsonl) finish_progress(&progress);
+        if (machine_out) fclose(machine_out);
+        return rc;
+    }
+
+    char username[128] = "";
+    char password[128] = "";
+    if (!load_batch_credentials(username, sizeof(username), password, sizeof(password))) {
+        return BATCH_EXIT_AUTH;
+    }
+
+    if (!opts.dry_run && !create_directory(opts.output)) {
+        fprintf(stderr, "Failed to create download directory: %s\n", opts.output);
+        return BATCH_EXIT_IO;
+    }
+
+    curl_global_init(CURL_GLOBAL_ALL);
+    CURL *curl = new_session_handle("cookies.txt");
+    if (!curl) {
+        fprintf(stderr, "Failed to initialize libcurl\n");
+        curl_global_cleanup();
+        return BATCH_EXIT_NETWORK;
+    }
+
+    // Reuse addresses and TLS sessions from the previous run (cron runs are short)
+    struct NetCache net_cache;
+    net_cache_load(&net_cache, NETCACHE_FILE);
+    net_cache_apply(&net_cache, curl);
+    download_set_net_cache(&net_cache);
+
+    struct RateLimiter limiter;
+    int use_limiter = opts.rate > 0;
+    if (use_limiter) {
+        rate_limiter_init(&limiter, opts.rate, opts.jobs);
+        download_set_rate_limiter(&limiter);
+    }
+    download_set_resume(opts.resume);
+    download_set_event_loop(opts.event_loop, opts.jobs);
+    download_set_crawl_limits(opts.crawl_workers, opts.max_depth);
+    download_set_adaptive(opts.adaptive);
+    download_set_schedule(&opts.schedule);
+    struct Telemetry telemetry;
+    struct MetricsExporter metrics;
+    if (telemetry_wanted(&opts)) start_telemetry(&opts, &telemetry, &metrics);
+    struct TraceLog trace;
+    if (opts.trace_file) start_trace(&trace);
+
+    int exit_code = BATCH_EXIT_OK;
+    struct MemoryStruct dashboard;
+    init_memory_struct(&dashboard);
+
+    int reused = 0;
+    int login_status = welearn_resume_session(curl, username, password, &dashboard, &reused);
+    if (login_status == LOGIN_OK) {
+        printf(reused ? "Reusing saved session for %s.\n" : "Logged in as %s.\n", username);
+    } else {
+        fprintf(stderr, "Login failed (%s).\n", login_failure_reason(login_status));
+        exit_code = login_status == LOGIN_INVALID_CREDENTIALS ? BATCH_EXIT_AUTH : BATCH_EXIT_NETWORK;
+        goto batch_cleanup;
+    }
+
+    // Log in again without interrupting the run if the session expires mid-sync
+    struct WelearnSession session = {curl, "", "", 0};
+    snprintf(session.username, sizeof(session.username), "%s", username);
+    snprintf(session.password, sizeof(session.password), "%s", password);
+    download_set_session_renewal(welearn_session_renew, &session);
+
+    if (opts.watch_minutes <= 0) {
+        exit_code = batch_sync_once(curl, &opts, dashboard.memory, NULL, 1, json_out);
+        goto batch_cleanup;
+    }
+
+    // Watch mode: keep this session, poll on a schedule, fetch only what is new
+    signal(SIGINT, handle_stop_signal);
+    signal(SIGTERM, handle_stop_signal);
+    struct CourseWatchState watch;
+    init_course_watch(&watch);
+    printf("Watching for new files every %d minute(s); full check every %d poll(s).\n",
+           opts.watch_minutes, opts.full_every);
+
+    for (unsigned long poll = 0; !stop_requested; poll++) {
+        if (poll > 0) {
+            wait_for_next_poll(opts.watch_minutes * 60);
+            if (stop_requested) break;
+
+            free(dashboard.memory);
+            init_memory_struct(&dashboard);
+            int status = welearn_fetch_dashboard(curl, &dashboard);
+            if (status == LOGIN_SESSION_EXPIRED) {
+                printf("Session expired, logging in again...\n");
+                free(dashboard.memory);
+                init_memory_struct(&dashboard);
+                status = welearn_login(curl, username, password, &dashboard);
+                if (status == LOGIN_INVALID_CREDENTIALS) {
+                    fprintf(stderr, "Login failed (invalid username or password), stopping.\n");
+                    exit_code = BATCH_EXIT_AUTH;
+                    break;
+                }
+            }
+            if (status != LOGIN_OK) {
+                fprintf(stderr, "Poll %lu skipped: server not reachable.\n", poll);
+                continue;
+            }
+        }
+
+        int force = opts.full_every > 0 && poll % (unsigned long)opts.full_every == 0;
+        time_t now = time(NULL);
+        printf("\n=== Poll %lu (%s check) at %s", poll, force ? "full" : "incremental", ctime(&now));
+        int rc = batch_sync_once(curl, &opts, dashboard.memory, &watch, force, json_out);
+        if (rc == BATCH_EXIT_IO) {
+            exit_code = rc;
+            break;
+        }
+        fflush(stdout);
+    }
+    free_course_watch(&watch);
+    printf("Watch mode stopped.\n");
+
+batch_cleanup:
+    download_set_session_renewal(NULL, NULL);
+    memset(password, 0, sizeof(password));
+    if (opts.progress_jsonl) finish_progress(&progress);
+    if (machine_out) fclose(machine_out);
+    free(dashboard.memory);
+    if (telemetry_wanted(&opts)) finish_telemetry(&opts, &telemetry, &metrics);
+    if (opts.trace_file) finish_trace(&opts, &trace);
+    download_set_rate_limiter(NULL);
+    if (use_limiter) rate_limiter_destroy(&limiter);
+    download_set_net_cache(NULL);
+    net_cache_record(&net_cache, curl);
+    net_cache_save(&net_cache);
+    curl_easy_cleanup(curl);
+    net_cache_free(&net_cache);
+    curl_global_cleanup();
+    return exit_code;
+}
+
+int main(int argc, char **argv) {
+    if (argc > 1) {
+        return run_batch(argc, argv);
+    }
+
     CURL *curl;
-    CURLcode res;
     char username[128];
     char password[128];
     char errbuf[CURL_ERROR_SIZE] = {0};
 
+    logger_start(LOGGER_TEXT);
     curl_global_init(CURL_GLOBAL_ALL);
     curl = curl_easy_init();
     if (!curl) {
@@ -76,12 +1383,24 @@ int main(void) {
 
     curl_easy_setopt(curl, CURLOPT_COOKIEJAR, "cookies.txt");
     curl_easy_setopt(curl, CURLOPT_COOKIEFILE, "cookies.txt");
-    curl_easy_setopt(curl, CURLOPT_USERAGENT, "Mozilla/5.0 (Windows NT 10.0; Win64; x64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/91.0.4472.124 Safari/537.36");
+    // Load the jar now: the saved session is inspected before the first transfer
+    curl_easy_setopt(curl, CURLOPT_COOKIELIST, "RELOAD");
+    curl_easy_setopt(curl, CURLOPT_USERAGENT, WELEARN_USER_AGENT);
     curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
     curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 1L);
     curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, 2L);
     curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, errbuf);
 
+    struct NetCache net_cache;
+    net_cache_load(&net_cache, NETCACHE_FILE);
+    net_cache_apply(&net_cache, curl);
+    download_set_net_cache(&net_cache);
+
+    // Connect and fetch the login token while the user is typing; curl belongs
+    // to the warm-up thread until welearn_session_warmup_finish
+    struct SessionWarmup warmup;
+    welearn_session_warmup_start(&warmup, curl);
+
     if (!load_credentials(username, sizeof(username), password, sizeof(password), ENCRYPTION_KEY)) {
         printf("Credentials not found or failed to load.\nPlease enter your WeLearn credentials:\n");
         printf("Username: ");
@@ -115,94 +1434,33 @@ int main(void) {
         printf("Using saved credentials for user: %s\n", username);
     }
 
-    const char *login_url = "https://welearn.iiserkol.ac.in/login/index.php";
     struct MemoryStruct login_page_content;
     init_memory_struct(&login_page_content);
 
-    curl_easy_setopt(curl, CURLOPT_URL, login_url);
-    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_memory_callback);
-    curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)&login_page_content);
-    curl_easy_setopt(curl, CURLOPT_HTTPGET, 1L);
-    curl_easy_setopt(curl, CURLOPT_FAILONERROR, 0L);
-
-    printf("Fetching login page to get token...\n");
-    res = curl_easy_perform(curl);
-    if (res != CURLE_OK) {
-        fprintf(stderr, "curl_easy_perform() failed for login page: %s\n", curl_easy_strerror(res));
-        fprintf(stderr, "Curl error details: %s\n", errbuf);
-        free(login_page_content.memory);
-        goto cleanup;
+    int reused = 0;
+    int login_status = welearn_session_warmup_finish(&warmup, username, password, &login_page_content, &reused);
+    if (reused) {
+        printf("Saved session is still valid, skipping login.\n");
     }
-    long http_code_login_page = 0;
-    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code_login_page);
-    if (http_code_login_page >= 400) {
-        fprintf(stderr, "HTTP error %ld fetching login page.\n", http_code_login_page);
-        free(login_page_content.memory);
-        goto cleanup;
-    }
-
-    char *logintoken = extract_logintoken(login_page_content.memory);
-    if (!logintoken) {
+    if (login_status == LOGIN_NO_TOKEN) {
         fprintf(stderr, "Failed to extract logintoken. Check if login page structure changed.\n");
-        free(login_page_content.memory);
-        goto cleanup;
-    }
-    printf("Login token extracted successfully.\n");
-
-    char *escaped_username = curl_easy_escape(curl, username, 0);
-    char *escaped_password = curl_easy_escape(curl, password, 0);
-    if (!escaped_username || !escaped_password) {
-        fprintf(stderr, "Failed to URL-encode credentials\n");
-        free(login_page_content.memory);
-        free(logintoken);
-        goto cleanup;
-    }
-
-    char post_fields[1024];
-    snprintf(post_fields, sizeof(post_fields), "username=%s&password=%s&logintoken=%s",
-             escaped_username, escaped_password, logintoken);
-
-    free(login_page_content.memory);
-    init_memory_struct(&login_page_content);
-
-    curl_easy_setopt(curl, CURLOPT_URL, login_url);
-    curl_easy_setopt(curl, CURLOPT_POST, 1L);
-    curl_easy_setopt(curl, CURLOPT_POSTFIELDS, post_fields);
-    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_memory_callback);
-    curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)&login_page_content);
-    curl_easy_setopt(curl, CURLOPT_REFERER, login_url);
-    curl_easy_setopt(curl, CURLOPT_FAILONERROR, 0L);
-
-    printf("Attempting login...\n");
-    errbuf[0] = '\0';
-    res = curl_easy_perform(curl);
-
-    curl_free(escaped_username);
-    curl_free(escaped_password);
-    free(logintoken);
-    logintoken = NULL;
-
-    if (res != CURLE_OK) {
-        fprintf(stderr, "curl_easy_perform() failed during login POST: %s\n", curl_easy_strerror(res));
-        fprintf(stderr, "Curl error details: %s\n", errbuf);
-        free(login_page_content.memory);
-        goto cleanup;
-    }
-
-    long http_code_login_post = 0;
-    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code_login_post);
-
-    if (strstr(login_page_content.memory, "Invalid login, please try again") || strstr(login_page_content.memory, "loginerrors")) {
+    } else if (login_status == LOGIN_INVALID_CREDENTIALS) {
         fprintf(stderr, "Login failed! Please check your username and password.\n");
+    } else if (login_status != LOGIN_OK) {
+        fprintf(stderr, "Login request failed. Check your network connection.\n");
+    }
+    if (login_status != LOGIN_OK) {
         free(login_page_content.memory);
         goto cleanup;
     }
-    if (!strstr(login_page_content.memory, "/login/logout.php")) {
-        fprintf(stderr, "Warning: Login might have failed - Logout link not found on the resulting page.\n");
-    }
 
     printf("Login successful!\n");
 
+    struct WelearnSession session = {curl, "", "", 0};
+    snprintf(session.username, sizeof(session.username), "%s", username);
+    snprintf(session.password, sizeof(session.password), "%s", password);
+    download_set_session_renewal(welearn_session_renew, &session);
+
     // NEW INTERACTIVE MODE
     printf("\n===========================================\n");
     printf("  WeLearn File Download Manager\n");
@@ -210,7 +1468,8 @@ int main(void) {
     printf("\nChoose an option:\n");
     printf("1. Download all files (old behavior)\n");
     printf("2. Select specific files to download (new)\n");
-    printf("\nEnter choice (1 or 2): ");
+    printf("3. Verify an existing download directory\n");
+    printf("\nEnter choice (1, 2 or 3): ");
     fflush(stdout);
     
     char choice[10];
@@ -233,6 +1492,17 @@ int main(void) {
             goto cleanup;
         }
         
+        // Optionally resolve sizes, types and real filenames before display
+        printf("\nFetch file sizes and types before selection? (y/N): ");
+        fflush(stdout);
+        char meta_choice[10];
+        if (fgets(meta_choice, sizeof(meta_choice), stdin) != NULL &&
+            (meta_choice[0] == 'y' || meta_choice[0] == 'Y')) {
+            size_t resolved = prefetch_file_metadata(curl, &file_list, DEFAULT_MAX_TRANSFERS,
+                                                     print_metadata_progress, NULL);
+            printf("\nResolved details for %zu file(s).\n", resolved);
+        }
+        
         // Display files
         printf("\nHow would you like to view the files?\n");
         printf("1. Tree view (hierarchical)\n");
@@ -316,6 +1586,28 @@ int main(void) {
         
         free_file_list(&file_list);
         
+    } else if (choice[0] == '3') {
+        // VERIFY MODE: check a download tree against its manifest, repair what is broken
+        char download_path[MAX_PATH_LEN];
+        get_download_directory(download_path, sizeof(download_path));
+
+        struct ContentStore store;
+        if (!content_store_open(&store, download_path)) {
+            fprintf(stderr, "Failed to open download directory: %s\n", download_path);
+            free(login_page_content.memory);
+            goto cleanup;
+        }
+
+        printf("\nVerifying %zu file(s) in %s...\n", store.manifest.count, download_path);
+        struct VerifyResult result;
+        if (verify_download_tree(&store, 0, &result)) {
+            repair_from_store(&store, &result);
+            print_verify_summary(&result);
+            redownload_failed_entries(curl, &store, &result);
+            free_verify_result(&result);
+        }
+        content_store_close(&store);
+
     } else {
         // OLD MODE: Download everything immediately
         printf("\nDownloading all files to current directory...\n");
@@ -325,8 +1617,13 @@ int main(void) {
     free(login_page_content.memory);
 
 cleanup:
-    if (logintoken) free(logintoken);
+    welearn_session_warmup_cancel(&warmup);
+    download_set_session_renewal(NULL, NULL);
+    download_set_net_cache(NULL);
+    net_cache_record(&net_cache, curl);
+    net_cache_save(&net_cache);
     curl_easy_cleanup(curl);
+    net_cache_free(&net_cache);
     curl_global_cleanup();
     printf("\nProgram finished.\n");
     return EXIT_SUCCESS;
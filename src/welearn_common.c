@@ -1,14 +1,18 @@
+#define _GNU_SOURCE  // FNM_CASEFOLD
 #include "../include/welearn_common.h"
+#include "../include/welearn_profile.h"
 #include <errno.h>
 #include <ctype.h>
 #include <time.h>
+#include <fcntl.h>
+#include <fnmatch.h>
 
 // Initialize memory structure for libcurl callbacks
 void init_memory_struct(struct MemoryStruct *chunk) {
     chunk->size = 0;
     chunk->memory = malloc(1);
     if (chunk->memory == NULL) {
-        fprintf(stderr, "DEBUG: malloc() failed in init_memory_struct\n");
+        welearn_log(WELEARN_LOG_ERROR, "malloc() failed in init_memory_struct\n");
         exit(EXIT_FAILURE);
     }
     chunk->memory[0] = '\0';
@@ -18,10 +22,12 @@ void init_memory_struct(struct MemoryStruct *chunk) {
 size_t write_memory_callback(void *contents, size_t size, size_t nmemb, void *userp) {
     size_t realsize = size * nmemb;
     struct MemoryStruct *mem = (struct MemoryStruct *)userp;
+    PROFILE_SCOPE(PROFILE_BUFFER_GROW);
+    PROFILE_COUNT(PROFILE_BUFFER_GROW, realsize);
 
     char *ptr = realloc(mem->memory, mem->size + realsize + 1);
     if (ptr == NULL) {
-        fprintf(stderr, "DEBUG: realloc() failed in write_memory_callback\n");
+        welearn_log(WELEARN_LOG_ERROR, "realloc() failed in write_memory_callback\n");
         return 0;
     }
 
@@ -37,6 +43,49 @@ size_t write_memory_callback(void *contents, size_t size, size_t nmemb, void *us
 size_t write_header_callback(char *buffer, size_t size, size_t nitems, void *userdata) {
     size_t total_size = size * nitems;
     struct HeaderData *header_data = (struct HeaderData *)userdata;
+    PROFILE_SCOPE(PROFILE_PARSE_HEADERS);
+
+    // A new status line starts the headers of the next response in a redirect chain
+    if (strncmp(buffer, "HTTP/", 5) == 0) {
+        header_data->filename[0] = '\0';
+        header_data->etag[0] = '\0';
+        header_data->range_total = 0;
+        const char *code = memchr(buffer, ' ', total_size);
+        header_data->status_code = code ? strtol(code + 1, NULL, 10) : 0;
+        return total_size;
+    }
+
+    if (strncasecmp(buffer, "ETag:", 5) == 0) {
+        const char *value = buffer + 5;
+        while (value < buffer + total_size && (*value == ' ' || *value == '\t')) value++;
+        size_t len = 0;
+        while (value + len < buffer + total_size && value[len] != '\r' && value[len] != '\n') len++;
+        if (len < sizeof(header_data->etag)) {
+            memcpy(header_data->etag, value, len);
+            header_data->etag[len] = '\0';
+        }
+        return total_size;
+    }
+
+    // Moodle sends requests of an expired session to the login form
+    if (strncasecmp(buffer, "Location:", 9) == 0) {
+        char location[MAX_URL_LEN];
+        size_t len = total_size - 9 < sizeof(location) - 1 ? total_size - 9 : sizeof(location) - 1;
+        memcpy(location, buffer + 9, len);
+        location[len] = '\0';
+        if (strstr(location, "/login/index.php")) {
+            header_data->login_redirect = 1;
+        }
+        return total_size;
+    }
+
+    if (strncasecmp(buffer, "Content-Range:", 14) == 0) {
+        const char *slash = memchr(buffer, '/', total_size);
+        if (slash && isdigit((unsigned char)slash[1])) {
+            header_data->range_total = strtoll(slash + 1, NULL, 10);
+        }
+        return total_size;
+    }
 
     if (strncasecmp(buffer, "Content-Disposition:", 20) == 0) {
         char *filename_ptr = strstr(buffer, "filename*=");
@@ -114,7 +163,7 @@ size_t write_header_callback(char *buffer, size_t size, size_t nitems, void *use
 size_t write_data_callback(void *ptr, size_t size, size_t nmemb, FILE *stream) {
     size_t written = fwrite(ptr, size, nmemb, stream);
     if (written < nmemb && ferror(stream)) {
-        fprintf(stderr, "DEBUG: fwrite error: %s\n", strerror(errno));
+        welearn_log(WELEARN_LOG_ERROR, "fwrite error: %s\n", strerror(errno));
         clearerr(stream);
     }
     return written;
@@ -124,7 +173,7 @@ size_t write_data_callback(void *ptr, size_t size, size_t nmemb, FILE *stream) {
 void init_visited_urls(struct VisitedUrls *visited) {
     visited->urls = malloc(INITIAL_VISITED_CAPACITY * sizeof(char*));
     if (!visited->urls) {
-        perror("DEBUG: Failed to allocate initial visited URL list");
+        welearn_log(WELEARN_LOG_ERROR, "Failed to allocate initial visited URL list: %s\n", strerror(errno));
         exit(EXIT_FAILURE);
     }
     visited->count = 0;
@@ -137,7 +186,7 @@ int add_visited_url(struct VisitedUrls *visited, const char *url) {
         size_t new_capacity = visited->capacity * 2;
         char **new_urls = realloc(visited->urls, new_capacity * sizeof(char*));
         if (!new_urls) {
-            perror("DEBUG: Failed to reallocate visited URL list");
+            welearn_log(WELEARN_LOG_ERROR, "Failed to reallocate visited URL list: %s\n", strerror(errno));
             return 0;
         }
         visited->urls = new_urls;
@@ -146,7 +195,7 @@ int add_visited_url(struct VisitedUrls *visited, const char *url) {
 
     visited->urls[visited->count] = strdup(url);
     if (!visited->urls[visited->count]) {
-        perror("DEBUG: Failed to duplicate URL string for visited list");
+        welearn_log(WELEARN_LOG_ERROR, "Failed to duplicate URL string for visited list: %s\n", strerror(errno));
         return 0;
     }
     visited->count++;
@@ -234,26 +283,103 @@ void extract_filename_from_url(const char *url, char *filename, size_t size) {
 
 // Create directory if it doesn't exist
 int create_directory(const char *path) {
+    return create_directory_at(AT_FDCWD, path);
+}
+
+// Create a directory (relative paths resolve against dirfd) if it doesn't exist
+int create_directory_at(int dirfd, const char *path) {
+    PROFILE_SCOPE(PROFILE_MKDIR);
     struct stat st = {0};
-    if (stat(path, &st) == -1) {
-        if (MKDIR(path) != 0) {
+    if (fstatat(dirfd, path, &st, 0) == -1) {
+        if (mkdirat(dirfd, path, 0777) != 0) {
             if (errno == EEXIST) {
                 return 1;
             }
-            perror("DEBUG: Error creating directory");
-            fprintf(stderr, "DEBUG: Failed path: %s (errno: %d)\n", path, errno);
+            welearn_log(WELEARN_LOG_ERROR, "Error creating directory: %s\n", strerror(errno));
+            welearn_log(WELEARN_LOG_ERROR, "Failed path: %s (errno: %d)\n", path, errno);
             return 0;
         }
-        printf("Created directory: %s\n", path);
+        welearn_log(WELEARN_LOG_INFO, "Created directory: %s\n", path);
     } else {
         if (!S_ISDIR(st.st_mode)) {
-            fprintf(stderr, "DEBUG: Error: Path exists but is not a directory: %s\n", path);
+            welearn_log(WELEARN_LOG_ERROR, "Error: Path exists but is not a directory: %s\n", path);
             return 0;
         }
     }
     return 1;
 }
 
+// Format a byte count as a short human-readable string (e.g. "1.4 MB")
+void format_size(long long bytes, char *buffer, size_t size) {
+    if (!buffer || size == 0) return;
+    if (bytes < 0) {
+        snprintf(buffer, size, "?");
+        return;
+    }
+
+    const char *units[] = {"B", "KB", "MB", "GB", "TB"};
+    double value = (double)bytes;
+    int unit = 0;
+    while (value >= 1024.0 && unit < 4) {
+        value /= 1024.0;
+        unit++;
+    }
+
+    if (unit == 0) {
+        snprintf(buffer, size, "%lld B", bytes);
+    } else {
+        snprintf(buffer, size, "%.1f %s", value, units[unit]);
+    }
+}
+
+// Case-insensitive match of text against comma-separated glob patterns
+int match_pattern_list(const char *patterns, const char *text) {
+    if (!patterns || !text) return 0;
+
+    char pattern[MAX_FILENAME_LEN];
+    const char *p = patterns;
+    while (*p) {
+        size_t len = strcspn(p, ",");
+        while (len > 0 && isspace((unsigned char)*p)) {
+            p++;
+            len--;
+        }
+        size_t trimmed = len;
+        while (trimmed > 0 && isspace((unsigned char)p[trimmed - 1])) {
+            trimmed--;
+        }
+        if (trimmed > 0 && trimmed < sizeof(pattern)) {
+            memcpy(pattern, p, trimmed);
+            pattern[trimmed] = '\0';
+            if (fnmatch(pattern, text, FNM_CASEFOLD) == 0) return 1;
+        }
+        p += len;
+        if (*p == ',') p++;
+    }
+    return 0;
+}
+
+// Write s as a quoted JSON string
+void fprint_json_string(FILE *fp, const char *s) {
+    fputc('"', fp);
+    for (const unsigned char *c = (const unsigned char *)(s ? s : ""); *c; c++) {
+        switch (*c) {
+            case '"': fputs("\\\"", fp); break;
+            case '\\': fputs("\\\\", fp); break;
+            case '\n': fputs("\\n", fp); break;
+            case '\r': fputs("\\r", fp); break;
+            case '\t': fputs("\\t", fp); break;
+            default:
+                if (*c < 0x20) {
+                    fprintf(fp, "\\u%04x", *c);
+                } else {
+                    fputc(*c, fp);
+                }
+        }
+    }
+    fputc('"', fp);
+}
+
 // Initialize file list
 void init_file_list(struct FileList *list) {
     if (!list) return;
@@ -270,7 +396,8 @@ void init_file_list(struct FileList *list) {
 int add_file_to_list(struct FileList *list, const char *filename, const char *url, 
                      const char *course_name, const char *suggested_name, int is_folder, int depth) {
     if (!list || !filename || !url || !course_name) return 0;
-    
+    PROFILE_SCOPE(PROFILE_FILELIST_APPEND);
+
     // Resize if necessary
     if (list->count >= list->capacity) {
         size_t new_capacity = list->capacity * 2;
@@ -303,6 +430,13 @@ int add_file_to_list(struct FileList *list, const char *filename, const char *ur
     
     file->is_folder = is_folder;
     file->depth = depth;
+
+    file->meta_state = META_UNKNOWN;
+    file->size = -1;
+    file->content_type[0] = '\0';
+    file->remote_name[0] = '\0';
+    file->etag[0] = '\0';
+    file->remote_mtime = -1;
     list->count++;
     
     return 1;
@@ -318,6 +452,46 @@ void free_file_list(struct FileList *list) {
     }
 }
 
+// Build a short "(size, type) -> server name" suffix for a file with resolved metadata
+static void describe_file_metadata(const struct FileInfo *file, char *buffer, size_t size) {
+    buffer[0] = '\0';
+    if (file->is_folder || file->meta_state != META_RESOLVED) return;
+
+    char size_str[32];
+    format_size(file->size, size_str, sizeof(size_str));
+
+    // Show only the subtype of the MIME type, without parameters
+    char type[MAX_CONTENT_TYPE_LEN] = "";
+    const char *slash = strchr(file->content_type, '/');
+    const char *type_start = slash ? slash + 1 : file->content_type;
+    size_t type_len = strcspn(type_start, "; ");
+    if (type_len > 0 && type_len < sizeof(type)) {
+        memcpy(type, type_start, type_len);
+        type[type_len] = '\0';
+    }
+
+    int written = snprintf(buffer, size, "  (%s%s%s)", size_str, type[0] ? ", " : "", type);
+    if (written > 0 && (size_t)written < size && file->remote_name[0] &&
+        strcmp(file->remote_name, file->filename) != 0) {
+        snprintf(buffer + written, size - written, " -> %s", file->remote_name);
+    }
+}
+
+// Sum the sizes of all non-folder entries whose size is known
+static long long total_known_size(const struct FileList *list, size_t *known_count) {
+    long long total = 0;
+    size_t known = 0;
+    for (size_t i = 0; i < list->count; i++) {
+        const struct FileInfo *file = &list->files[i];
+        if (!file->is_folder && file->meta_state == META_RESOLVED && file->size >= 0) {
+            total += file->size;
+            known++;
+        }
+    }
+    if (known_count) *known_count = known;
+    return total;
+}
+
 // Display files in tree format
 // Note: Uses Unicode emoji characters (📚📁📄) for visual clarity.
 // These work on most modern terminals (Linux, macOS, Windows Terminal).
@@ -351,10 +525,20 @@ void display_file_tree(const struct FileList *list) {
         if (file->is_folder) {
             printf("📁 [%zu] %s (folder)\n", i + 1, file->filename);
         } else {
-            printf("📄 [%zu] %s\n", i + 1, file->filename);
+            char details[MAX_FILENAME_LEN + 64];
+            describe_file_metadata(file, details, sizeof(details));
+            printf("📄 [%zu] %s%s\n", i + 1, file->filename, details);
         }
     }
     printf("\n========================================\n");
+
+    size_t known = 0;
+    long long total = total_known_size(list, &known);
+    if (known > 0) {
+        char total_str[32];
+        format_size(total, total_str, sizeof(total_str));
+        printf("Total size: %s (%zu file(s) with known size)\n", total_str, known);
+    }
 }
 
 // Display files in simple list format
@@ -367,14 +551,27 @@ void display_file_list(const struct FileList *list) {
     printf("\n========================================\n");
     printf("Files Available for Download (List View)\n");
     printf("========================================\n");
-    printf("%-5s %-30s %-40s\n", "No.", "Course", "Filename");
+    printf("%-5s %-30s %-40s %10s\n", "No.", "Course", "Filename", "Size");
     printf("----------------------------------------\n");
     
     for (size_t i = 0; i < list->count; i++) {
         const struct FileInfo *file = &list->files[i];
         const char *type = file->is_folder ? " (folder)" : "";
-        printf("[%-3zu] %-30.30s %-40.40s%s\n", i + 1, file->course_name, file->filename, type);
+        char size_str[32] = "";
+        if (!file->is_folder && file->meta_state == META_RESOLVED) {
+            format_size(file->size, size_str, sizeof(size_str));
+        }
+        printf("[%-3zu] %-30.30s %-40.40s %10s%s\n", i + 1, file->course_name, file->filename, size_str, type);
     }
     printf("========================================\n");
-    printf("Total: %zu file(s)\n", list->count);
+
+    size_t known = 0;
+    long long total = total_known_size(list, &known);
+    if (known > 0) {
+        char total_str[32];
+        format_size(total, total_str, sizeof(total_str));
+        printf("Total: %zu file(s), %s in %zu file(s) with known size\n", list->count, total_str, known);
+    } else {
+        printf("Total: %zu file(s)\n", list->count);
+    }
 }
@@ -0,0 +1,96 @@
+#include "../include/welearn_context.h"
+#include "../include/welearn_logger.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdarg.h>
+
+// Used by threads that never bound a context
+static struct WelearnContext default_context = {.root_fd = AT_FDCWD};
+
+static __thread struct WelearnContext *bound_context = NULL;
+
+void welearn_context_init(struct WelearnContext *ctx) {
+    if (!ctx) return;
+    memset(ctx, 0, sizeof(*ctx));
+    ctx->root_fd = AT_FDCWD;
+}
+
+// Use dir (created if missing) as the download root of the context
+int welearn_context_open_root(struct WelearnContext *ctx, const char *dir) {
+    if (!ctx || !dir) return 0;
+    if (!create_directory(dir)) return 0;
+
+    int fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        welearn_log(WELEARN_LOG_ERROR, "Cannot open download root %s: %s\n", dir, strerror(errno));
+        return 0;
+    }
+    if (ctx->owns_root_fd) close(ctx->root_fd);
+    ctx->root_fd = fd;
+    ctx->owns_root_fd = 1;
+    return 1;
+}
+
+void welearn_context_cleanup(struct WelearnContext *ctx) {
+    if (!ctx) return;
+    if (ctx->owns_root_fd) close(ctx->root_fd);
+    ctx->root_fd = AT_FDCWD;
+    ctx->owns_root_fd = 0;
+}
+
+// Make ctx the context of the calling thread (NULL: back to the default).
+// Returns the previously bound one so nested jobs can restore it.
+struct WelearnContext *welearn_context_bind(struct WelearnContext *ctx) {
+    struct WelearnContext *previous = bound_context;
+    bound_context = ctx;
+    return previous;
+}
+
+struct WelearnContext *welearn_context_current(void) {
+    return bound_context ? bound_context : &default_context;
+}
+
+// Root of the Moodle site the context talks to, without a trailing slash
+// as long as it was configured without one
+const char *welearn_base_url(void) {
+    struct WelearnContext *ctx = welearn_context_current();
+    if (ctx->base_url && ctx->base_url[0]) return ctx->base_url;
+    const char *env = getenv(WELEARN_BASE_URL_ENV);
+    return env && env[0] ? env : WELEARN_DEFAULT_BASE_URL;
+}
+
+// Absolute URL of a site-relative path such as "/my/"
+void welearn_site_url(char *url, size_t size, const char *path) {
+    const char *base = welearn_base_url();
+    size_t base_len = strlen(base);
+    if (base_len > 0 && base[base_len - 1] == '/' && path[0] == '/') base_len--;
+    snprintf(url, size, "%.*s%s", (int)base_len, base, path);
+}
+
+int welearn_log_level = WELEARN_LOG_DEBUG;
+
+void welearn_log_set_level(int level) {
+    __atomic_store_n(&welearn_log_level, level, __ATOMIC_RELAXED);
+}
+
+// Format a message and hand it to the context's logger, or without one to the
+// asynchronous logger (info to stdout, the rest to stderr)
+void welearn_log_write(int level, const char *fmt, ...) {
+    struct WelearnContext *ctx = welearn_context_current();
+    va_list args;
+    va_start(args, fmt);
+
+    char message[2048];
+    int len = vsnprintf(message, sizeof(message), fmt, args);
+    va_end(args);
+    if (len < 0) return;
+    if ((size_t)len >= sizeof(message)) len = (int)sizeof(message) - 1;
+    if (!ctx->log) {
+        logger_submit(level, message, (size_t)len);
+        return;
+    }
+    char *start = message + strspn(message, "\n");
+    size_t start_len = strlen(start);
+    while (start_len > 0 && start[start_len - 1] == '\n') start[--start_len] = '\0';
+    ctx->log(level, start, ctx->log_data);
+}
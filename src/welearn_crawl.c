@@ -0,0 +1,349 @@
+#include "../include/welearn_crawl.h"
+#include "../include/welearn_auth.h"
+#include "../include/welearn_context.h"
+#include "../include/welearn_logger.h"
+#include <errno.h>
+#include <time.h>
+
+static void lock_share(CURL *handle, curl_lock_data data, curl_lock_access access, void *userptr) {
+    (void)handle;
+    (void)access;
+    pthread_mutex_lock(&((struct CrawlPool *)userptr)->share_locks[data]);
+}
+
+static void unlock_share(CURL *handle, curl_lock_data data, void *userptr) {
+    (void)handle;
+    pthread_mutex_unlock(&((struct CrawlPool *)userptr)->share_locks[data]);
+}
+
+// Copy the cookies of the session handle into the workers' share
+static void import_session_cookies(struct CrawlPool *pool) {
+    struct curl_slist *cookies = NULL;
+    if (curl_easy_getinfo(pool->session, CURLINFO_COOKIELIST, &cookies) != CURLE_OK || !cookies) {
+        return;
+    }
+    CURL *seed = curl_easy_init();
+    if (seed) {
+        curl_easy_setopt(seed, CURLOPT_SHARE, pool->share);
+        for (struct curl_slist *c = cookies; c; c = c->next) {
+            curl_easy_setopt(seed, CURLOPT_COOKIELIST, c->data);
+        }
+        curl_easy_cleanup(seed);
+    }
+    curl_slist_free_all(cookies);
+}
+
+static CURL *new_worker_handle(struct CrawlPool *pool) {
+    CURL *curl = curl_easy_init();
+    if (!curl) return NULL;
+    curl_easy_setopt(curl, CURLOPT_SHARE, pool->share);
+    curl_easy_setopt(curl, CURLOPT_COOKIEFILE, "");
+    curl_easy_setopt(curl, CURLOPT_USERAGENT, WELEARN_USER_AGENT);
+    curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 1L);
+    curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, 2L);
+    curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 1L);
+    return curl;
+}
+
+static int deque_init(struct CrawlDeque *deque) {
+    deque->capacity = 64;
+    deque->top = deque->bottom = 0;
+    deque->tasks = malloc(deque->capacity * sizeof(void *));
+    pthread_mutex_init(&deque->lock, NULL);
+    return deque->tasks != NULL;
+}
+
+static int deque_push_bottom(struct CrawlDeque *deque, void *task) {
+    pthread_mutex_lock(&deque->lock);
+    if (deque->bottom == deque->capacity) {
+        // Slide the live part down before growing
+        size_t live = deque->bottom - deque->top;
+        if (deque->top > 0) {
+            memmove(deque->tasks, deque->tasks + deque->top, live * sizeof(void *));
+            deque->top = 0;
+            deque->bottom = live;
+        }
+        if (deque->bottom == deque->capacity) {
+            void **tasks = realloc(deque->tasks, deque->capacity * 2 * sizeof(void *));
+            if (!tasks) {
+                pthread_mutex_unlock(&deque->lock);
+                return 0;
+            }
+            deque->tasks = tasks;
+            deque->capacity *= 2;
+        }
+    }
+    deque->tasks[deque->bottom++] = task;
+    pthread_mutex_unlock(&deque->lock);
+    return 1;
+}
+
+static void *deque_pop_bottom(struct CrawlDeque *deque) {
+    void *task = NULL;
+    pthread_mutex_lock(&deque->lock);
+    if (deque->bottom > deque->top) {
+        task = deque->tasks[--deque->bottom];
+        if (deque->bottom == deque->top) deque->top = deque->bottom = 0;
+    }
+    pthread_mutex_unlock(&deque->lock);
+    return task;
+}
+
+static void *deque_steal_top(struct CrawlDeque *deque) {
+    void *task = NULL;
+    // A busy victim is skipped rather than waited for
+    if (pthread_mutex_trylock(&deque->lock) != 0) return NULL;
+    if (deque->bottom > deque->top) {
+        task = deque->tasks[deque->top++];
+        if (deque->bottom == deque->top) deque->top = deque->bottom = 0;
+    }
+    pthread_mutex_unlock(&deque->lock);
+    return task;
+}
+
+// Set up worker_count workers (clamped to 1..CRAWL_MAX_WORKERS) crawling with
+// the cookies of session
+int crawl_pool_init(struct CrawlPool *pool, CURL *session, int worker_count,
+                    crawl_task_callback run, void *userdata) {
+    if (!pool || !session || !run) return 0;
+    memset(pool, 0, sizeof(*pool));
+    if (worker_count < 1) worker_count = 1;
+    if (worker_count > CRAWL_MAX_WORKERS) worker_count = CRAWL_MAX_WORKERS;
+    pool->worker_count = (size_t)worker_count;
+    pool->run = run;
+    pool->userdata = userdata;
+    pool->session = session;
+    pthread_mutex_init(&pool->reauth_lock, NULL);
+    pthread_mutex_init(&pool->idle_lock, NULL);
+    pthread_cond_init(&pool->idle_cond, NULL);
+    for (int i = 0; i < CURL_LOCK_DATA_LAST; i++) {
+        pthread_mutex_init(&pool->share_locks[i], NULL);
+    }
+
+    if (pool->worker_count > 1) {
+        pool->share = curl_share_init();
+        if (!pool->share) {
+            crawl_pool_cleanup(pool);
+            return 0;
+        }
+        curl_share_setopt(pool->share, CURLSHOPT_LOCKFUNC, lock_share);
+        curl_share_setopt(pool->share, CURLSHOPT_UNLOCKFUNC, unlock_share);
+        curl_share_setopt(pool->share, CURLSHOPT_USERDATA, pool);
+        curl_share_setopt(pool->share, CURLSHOPT_SHARE, CURL_LOCK_DATA_COOKIE);
+        curl_share_setopt(pool->share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+        curl_share_setopt(pool->share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+        import_session_cookies(pool);
+    }
+
+    for (size_t i = 0; i < pool->worker_count; i++) {
+        struct CrawlWorker *worker = &pool->workers[i];
+        worker->pool = pool;
+        worker->index = i;
+        worker->seed = (unsigned int)(i * 2654435761u + 1);
+        worker->curl = pool->worker_count > 1 ? new_worker_handle(pool) : session;
+        if (!deque_init(&worker->deque) || !worker->curl) {
+            welearn_log(WELEARN_LOG_ERROR, "Failed to set up crawl worker %zu\n", i);
+            crawl_pool_cleanup(pool);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Queue a task on a worker's deque (NULL: from outside the pool, spread round robin)
+void crawl_pool_push(struct CrawlPool *pool, struct CrawlWorker *worker, void *task) {
+    if (!pool || !task) return;
+    if (!worker) worker = &pool->workers[pool->next_push++ % pool->worker_count];
+
+    pthread_mutex_lock(&pool->idle_lock);
+    pool->pending++;
+    pthread_mutex_unlock(&pool->idle_lock);
+
+    if (!deque_push_bottom(&worker->deque, task)) {
+        // Out of memory: run it right away rather than lose it
+        pool->run(worker, task, pool->userdata);
+        pthread_mutex_lock(&pool->idle_lock);
+        pool->pending--;
+        pthread_mutex_unlock(&pool->idle_lock);
+        return;
+    }
+    pthread_cond_signal(&pool->idle_cond);
+}
+
+// Own deque first, then the top of the other workers' deques starting at a random victim
+static void *find_task(struct CrawlWorker *worker) {
+    void *task = deque_pop_bottom(&worker->deque);
+    if (task) return task;
+
+    struct CrawlPool *pool = worker->pool;
+    size_t start = (size_t)rand_r(&worker->seed) % pool->worker_count;
+    for (size_t i = 0; i < pool->worker_count; i++) {
+        struct CrawlWorker *victim = &pool->workers[(start + i) % pool->worker_count];
+        if (victim == worker) continue;
+        task = deque_steal_top(&victim->deque);
+        if (task) {
+            worker->stolen++;
+            return task;
+        }
+    }
+    return NULL;
+}
+
+static void *crawl_worker_main(void *arg) {
+    struct CrawlWorker *worker = (struct CrawlWorker *)arg;
+    struct CrawlPool *pool = worker->pool;
+    welearn_context_bind(pool->context);  // Same store, logger and limits as the caller
+    if (worker != &pool->workers[0]) {
+        char name[32];
+        snprintf(name, sizeof(name), "crawl worker %zu", (size_t)(worker - pool->workers));
+        trace_name_thread(pool->context->trace, name);
+    }
+
+    for (;;) {
+        void *task = find_task(worker);
+        if (task) {
+            pool->run(worker, task, pool->userdata);
+            worker->executed++;
+            pthread_mutex_lock(&pool->idle_lock);
+            if (--pool->pending == 0) pthread_cond_broadcast(&pool->idle_cond);
+            pthread_mutex_unlock(&pool->idle_lock);
+            continue;
+        }
+
+        // Nothing to take: done once no task is queued or running anywhere,
+        // otherwise wait for a running task to push more
+        pthread_mutex_lock(&pool->idle_lock);
+        if (pool->pending == 0) {
+            pthread_mutex_unlock(&pool->idle_lock);
+            break;
+        }
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += CRAWL_IDLE_WAIT_MS * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        pthread_cond_timedwait(&pool->idle_cond, &pool->idle_lock, &deadline);
+        pthread_mutex_unlock(&pool->idle_lock);
+    }
+    return NULL;
+}
+
+// Run until every task, including those pushed by running tasks, has finished.
+// The calling thread works as worker 0.
+void crawl_pool_run(struct CrawlPool *pool) {
+    if (!pool || pool->worker_count == 0) return;
+    pool->context = welearn_context_current();
+
+    for (size_t i = 1; i < pool->worker_count; i++) {
+        struct CrawlWorker *worker = &pool->workers[i];
+        worker->thread_started = pthread_create(&worker->thread, NULL, crawl_worker_main, worker) == 0;
+    }
+    struct WelearnContext *own = welearn_context_bind(pool->context);
+    crawl_worker_main(&pool->workers[0]);
+    welearn_context_bind(own);
+    for (size_t i = 1; i < pool->worker_count; i++) {
+        struct CrawlWorker *worker = &pool->workers[i];
+        if (worker->thread_started) {
+            pthread_join(worker->thread, NULL);
+            worker->thread_started = 0;
+        }
+    }
+    logger_flush();  // The workers' progress lines, before the caller prints its own
+}
+
+void crawl_pool_cleanup(struct CrawlPool *pool) {
+    if (!pool) return;
+    for (size_t i = 0; i < pool->worker_count; i++) {
+        struct CrawlWorker *worker = &pool->workers[i];
+        if (worker->curl && worker->curl != pool->session) curl_easy_cleanup(worker->curl);
+        worker->curl = NULL;
+        free(worker->deque.tasks);
+        worker->deque.tasks = NULL;
+        pthread_mutex_destroy(&worker->deque.lock);
+    }
+    if (pool->share) {
+        curl_share_cleanup(pool->share);
+        pool->share = NULL;
+    }
+    for (int i = 0; i < CURL_LOCK_DATA_LAST; i++) {
+        pthread_mutex_destroy(&pool->share_locks[i]);
+    }
+    pthread_mutex_destroy(&pool->reauth_lock);
+    pthread_mutex_destroy(&pool->idle_lock);
+    pthread_cond_destroy(&pool->idle_cond);
+    pool->worker_count = 0;
+}
+
+// Log in again once for all workers. A worker whose request failed under an
+// older session only retries: someone else already renewed it.
+static int renew_pool_session(struct CrawlPool *pool, unsigned long seen_generation) {
+    pthread_mutex_lock(&pool->reauth_lock);
+    int ok = 1;
+    if (pool->session_generation == seen_generation) {
+        ok = !pool->reauth_failed && pool->reauth && pool->reauth(pool->reauth_data);
+        if (ok) {
+            pool->session_generation++;
+            if (pool->share) import_session_cookies(pool);
+        } else {
+            pool->reauth_failed = 1;
+        }
+    } else {
+        ok = !pool->reauth_failed;
+    }
+    pthread_mutex_unlock(&pool->reauth_lock);
+    return ok;
+}
+
+// GET a page with the worker's handle. A page that turns out to be the login
+// form renews the session once; if that fails the result is CURLE_LOGIN_DENIED.
+// Timings are recorded under kind (TELEMETRY_*).
+CURLcode crawl_fetch_page(struct CrawlWorker *worker, const char *url, struct MemoryStruct *page, long *http_code,
+                          int kind) {
+    struct CrawlPool *pool = worker->pool;
+    CURL *curl = worker->curl;
+    char errbuf[CURL_ERROR_SIZE];
+
+    for (int attempt = 0; ; attempt++) {
+        pthread_mutex_lock(&pool->reauth_lock);
+        unsigned long generation = pool->session_generation;
+        pthread_mutex_unlock(&pool->reauth_lock);
+
+        errbuf[0] = '\0';
+        curl_easy_setopt(curl, CURLOPT_URL, url);
+        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_memory_callback);
+        curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)page);
+        curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+        curl_easy_setopt(curl, CURLOPT_HTTPGET, 1L);
+        curl_easy_setopt(curl, CURLOPT_FAILONERROR, 0L);
+        curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, errbuf);
+
+        struct Telemetry *telemetry = welearn_context_current()->telemetry;
+        telemetry_transfers_changed(telemetry, 1, 0);
+        CURLcode res = curl_easy_perform(curl);
+        telemetry_transfers_changed(telemetry, -1, 0);
+        telemetry_record(telemetry, kind, curl, res);
+        trace_transfer_current(kind, curl);
+        curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, NULL);
+        *http_code = 0;
+        curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, http_code);
+        if (res != CURLE_OK) {
+            welearn_log(WELEARN_LOG_ERROR, "Failed to fetch page %s: %s\n", url,
+                        errbuf[0] ? errbuf : curl_easy_strerror(res));
+            return res;
+        }
+
+        char *effective_url = NULL;
+        curl_easy_getinfo(curl, CURLINFO_EFFECTIVE_URL, &effective_url);
+        if (!welearn_page_is_login(page->memory, effective_url)) return CURLE_OK;
+
+        free(page->memory);
+        init_memory_struct(page);
+        if (attempt > 0 || !renew_pool_session(pool, generation)) {
+            welearn_log(WELEARN_LOG_ERROR, "Session expired while fetching %s\n", url);
+            return CURLE_LOGIN_DENIED;
+        }
+        telemetry_count(telemetry, TELEMETRY_RETRIES, 1);
+    }
+}
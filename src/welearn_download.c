@@ -1,192 +1,590 @@
 #include "../include/welearn_download.h"
 #include "../include/welearn_auth.h"
+#include "../include/welearn_context.h"
+#include "../include/welearn_crawl.h"
+#include "../include/welearn_transfer.h"
+#include "../include/welearn_store.h"
+#include "../include/welearn_verify.h"
+#include "../include/welearn_ratelimit.h"
+#include "../include/welearn_profile.h"
 #include <ctype.h>
+#include <errno.h>
+#include <pthread.h>
 #include <time.h>
 #include <sys/stat.h>
 
-// Download a file from a given URL
-void download_file(CURL *curl, const char *url, const char *course_path, const char* suggested_name) {
-    if (!curl || !url || !course_path) return;
+// Settings (store, limiter, session, callbacks) of the job running on this thread
+static inline struct WelearnContext *ctx(void) {
+    return welearn_context_current();
+}
 
-    printf("Attempting to download resource: %s\n", url);
+// Serializes manifest and object access when several contexts share one store
+static pthread_mutex_t store_lock = PTHREAD_MUTEX_INITIALIZER;
 
-    FILE *fp = NULL;
-    char filepath[MAX_PATH_LEN];
-    char filename[MAX_FILENAME_LEN] = {0};
-    struct HeaderData header_data = {0};
-    char final_url[MAX_URL_LEN] = {0};
+// The setters below configure the context bound to the calling thread (the
+// process-wide default when none is bound).
 
-    curl_easy_setopt(curl, CURLOPT_URL, url);
-    curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
-    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_memory_callback);
-    curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, write_header_callback);
-    curl_easy_setopt(curl, CURLOPT_HEADERDATA, &header_data);
+// Select the store that downloads are deduplicated against; NULL disables deduplication
+void download_set_content_store(struct ContentStore *store) {
+    ctx()->store = store;
+}
 
-    struct MemoryStruct temp_data;
-    init_memory_struct(&temp_data);
-    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &temp_data);
+// Select the rate limiter that paces crawl and download requests; without one
+// the crawl sleeps between requests as before
+void download_set_rate_limiter(struct RateLimiter *limiter) {
+    ctx()->limiter = limiter;
+}
 
-    curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 1L);
-    curl_easy_setopt(curl, CURLOPT_FAILONERROR, 0L);
-    curl_easy_setopt(curl, CURLOPT_HTTPGET, 1L);
-    
-    char errbuf[CURL_ERROR_SIZE] = {0};
-    curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, errbuf);
+// Keep partial downloads across failures and continue them with Range requests
+void download_set_resume(int enabled) {
+    ctx()->resume = enabled;
+}
 
-    CURLcode res = curl_easy_perform(curl);
+// Select how downloads renew an expired session (e.g. welearn_session_renew);
+// NULL leaves expired requests failing
+void download_set_session_renewal(transfer_reauth_callback renew, void *userdata) {
+    ctx()->renew = renew;
+    ctx()->renew_data = userdata;
+}
 
-    curl_easy_getinfo(curl, CURLINFO_EFFECTIVE_URL, final_url);
-    long http_code = 0;
-    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code);
+// Addresses and TLS sessions remembered from earlier runs, NULL when not used
+void download_set_net_cache(struct NetCache *cache) {
+    ctx()->net_cache = cache;
+}
+
+// Drive transfer engines from one epoll loop and crawl course pages
+// concurrently (max_transfers at a time) instead of one blocking request each
+void download_set_event_loop(int enabled, int max_transfers) {
+    ctx()->event_loop = enabled;
+    ctx()->max_transfers = max_transfers;
+}
+
+// Let download batches tune their concurrency between 1 and max_parallel
+// from measured goodput and latency instead of always using max_parallel
+void download_set_adaptive(int enabled) {
+    ctx()->adaptive = enabled;
+}
+
+// Order and interleave download batches by policy; NULL downloads in list order.
+// The policy must stay valid while downloads run.
+void download_set_schedule(const struct SchedulePolicy *policy) {
+    ctx()->schedule = policy;
+}
+
+// Record the timings of every crawl and download request into telemetry;
+// NULL stops recording
+void download_set_telemetry(struct Telemetry *telemetry) {
+    ctx()->telemetry = telemetry;
+}
+
+// Record a timeline of the run (spans per thread and per request) into trace;
+// NULL stops recording
+void download_set_trace(struct TraceLog *trace) {
+    ctx()->trace = trace;
+}
+
+// Crawl folder trees with this many work-stealing workers, at most max_depth
+// folders deep (0 keeps the defaults)
+void download_set_crawl_limits(int workers, int max_depth) {
+    ctx()->crawl_workers = workers;
+    ctx()->max_depth = max_depth;
+}
+
+// Name of a DOWNLOAD_* outcome, as used in machine-readable output
+const char *download_outcome_name(int outcome) {
+    switch (outcome) {
+        case DOWNLOAD_OK: return "downloaded";
+        case DOWNLOAD_SKIPPED: return "skipped";
+        case DOWNLOAD_UNCHANGED: return "unchanged";
+        case DOWNLOAD_DEDUPLICATED: return "deduplicated";
+        default: return "failed";
+    }
+}
+
+// Stream JSON-lines progress events of downloads to progress; NULL stops them
+void download_set_progress(struct ProgressStream *progress) {
+    ctx()->progress = progress;
+}
+
+// Report a finished file to the context's callback, progress stream and
+// telemetry. transfer is NULL when the file needed no request; saved_bytes is
+// the transfer or disk space a 304 or deduplication avoided.
+static int report_file(const struct ProgressTransfer *transfer, const char *url, const char *course_path,
+                       int outcome, long long bytes, long long saved_bytes) {
+    struct WelearnContext *c = ctx();
+    if (c->on_file) c->on_file(url, course_path, outcome, c->file_data);
+    progress_done(c->progress, transfer, url, course_path, download_outcome_name(outcome), bytes);
+    telemetry_record_file(c->telemetry, outcome, bytes, saved_bytes);
+    return outcome;
+}
+
+// Hand the session renewal and the network cache to a transfer engine
+static void engine_use_session_settings(struct TransferEngine *engine) {
+    engine->reauth = ctx()->renew;
+    engine->reauth_data = ctx()->renew_data;
+    engine->event_driven = ctx()->event_loop;
+    engine->telemetry = ctx()->telemetry;
+    engine->trace = ctx()->trace;
+    if (ctx()->net_cache) {
+        engine->resolve = ctx()->net_cache->resolve;
+        net_cache_seed_share(ctx()->net_cache, engine->share);
+    }
+}
+
+// Keep the TLS sessions the engine negotiated for the next run
+static void engine_finish(struct TransferEngine *engine) {
+    if (ctx()->net_cache) net_cache_collect_share(ctx()->net_cache, engine->share);
+    transfer_engine_cleanup(engine);
+}
+
+// GET a page into page. If the server answers with the login form, renew the
+// session once and fetch again; a page that still needs a login is never
+// returned as content (CURLE_LOGIN_DENIED). kind is the TELEMETRY_* kind.
+static CURLcode fetch_page(CURL *curl, const char *url, struct MemoryStruct *page, char *errbuf, int kind) {
+    for (int attempt = 0; ; attempt++) {
+        curl_easy_setopt(curl, CURLOPT_URL, url);
+        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_memory_callback);
+        curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)page);
+        curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+        curl_easy_setopt(curl, CURLOPT_HTTPGET, 1L);
+        curl_easy_setopt(curl, CURLOPT_FAILONERROR, 0L);
+        curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, errbuf);
+
+        telemetry_transfers_changed(ctx()->telemetry, 1, 0);
+        CURLcode res = curl_easy_perform(curl);
+        telemetry_transfers_changed(ctx()->telemetry, -1, 0);
+        telemetry_record(ctx()->telemetry, kind, curl, res);
+        trace_transfer(ctx()->trace, kind, curl, 0);
+        if (res != CURLE_OK) return res;
+
+        char *effective_url = NULL;
+        curl_easy_getinfo(curl, CURLINFO_EFFECTIVE_URL, &effective_url);
+        if (!welearn_page_is_login(page->memory, effective_url)) return CURLE_OK;
+
+        free(page->memory);
+        init_memory_struct(page);
+        if (attempt > 0 || !ctx()->renew || !ctx()->renew(ctx()->renew_data)) {
+            welearn_log(WELEARN_LOG_ERROR, "Session expired while fetching %s\n", url);
+            return CURLE_LOGIN_DENIED;
+        }
+        telemetry_count(ctx()->telemetry, TELEMETRY_RETRIES, 1);
+    }
+}
+
+// Whether a path below the download root exists
+static int exists_at_root(const char *path) {
+    PROFILE_SCOPE(PROFILE_STAT);
+    struct stat st;
+    return fstatat(ctx()->root_fd, path, &st, 0) == 0;
+}
+
+// Wait before the next request: limiter token if one is set, fixed delay otherwise
+static void pace_requests(int default_seconds) {
+    double started = trace_now();
+    if (ctx()->limiter) {
+        rate_limiter_acquire(ctx()->limiter);
+        telemetry_add_limiter_wait(ctx()->telemetry, trace_now() - started);
+        if (trace_now() - started >= 0.001) trace_span(ctx()->trace, "sleep", "limiter", started, NULL);
+    } else {
+        PROFILE_SCOPE(PROFILE_PACE_SLEEP);
+        SLEEP(default_seconds);
+        trace_span(ctx()->trace, "sleep", "pause", started, NULL);
+    }
+}
+
+// Materialize stored content at filepath and record it in the manifest
+static int link_from_store(const char *sha256, long long size, const char *url, const char *filepath,
+                           const char *etag, long remote_mtime) {
+    pthread_mutex_lock(&store_lock);
+    int method = content_store_materialize(ctx()->store, sha256, filepath);
+    if (method == STORE_LINK_NONE) {
+        pthread_mutex_unlock(&store_lock);
+        welearn_log(WELEARN_LOG_ERROR, "Failed to materialize %s from store\n", filepath);
+        return STORE_LINK_NONE;
+    }
+
+    struct ManifestEntry entry = {0};
+    strncpy(entry.sha256, sha256, sizeof(entry.sha256) - 1);
+    entry.size = size;
+    strncpy(entry.etag, etag ? etag : "", sizeof(entry.etag) - 1);
+    entry.remote_mtime = remote_mtime;
+    entry.downloaded_at = (long)time(NULL);
+    strncpy(entry.url, url, sizeof(entry.url) - 1);
+    strncpy(entry.path, content_store_relative_path(ctx()->store, filepath), sizeof(entry.path) - 1);
+    manifest_record(ctx()->store, &entry);
+    pthread_mutex_unlock(&store_lock);
+    return method;
+}
+
+// Human-readable name of a materialization method
+static const char *link_method_name(int method) {
+    switch (method) {
+        case STORE_LINK_REFLINK: return "reflink";
+        case STORE_LINK_HARDLINK: return "hardlink";
+        case STORE_LINK_COPY: return "copy";
+        default: return "none";
+    }
+}
+
+// State of one file download, shared by the blocking and the parallel path
+struct DownloadJob {
+    char url[MAX_URL_LEN];
+    char course_path[MAX_PATH_LEN];
+    char suggested_name[MAX_FILENAME_LEN];
+    struct ManifestEntry known;  // Stored copy of this URL, valid when has_known is set
+    int has_known;
+    struct HashedFileWriter writer;
+    struct ProgressTransfer progress;
+};
+
+// What a finished job did not have to transfer or store again
+static long long job_saved_bytes(const struct DownloadJob *job, int outcome) {
+    if (outcome == DOWNLOAD_UNCHANGED) return job->has_known ? job->known.size : 0;
+    if (outcome == DOWNLOAD_DEDUPLICATED) return job->writer.bytes;
+    return 0;
+}
+
+// Prepare a download: conditional/range headers and the temp file. Returns the
+// request headers through *headers (may be NULL) and 0 if the job cannot start.
+static int download_job_begin(struct DownloadJob *job, const char *url, const char *course_path,
+                              const char *suggested_name, struct curl_slist **headers) {
+    memset(job, 0, sizeof(*job));
+    *headers = NULL;
+    strncpy(job->url, url, sizeof(job->url) - 1);
+    strncpy(job->course_path, course_path, sizeof(job->course_path) - 1);
+    if (suggested_name) strncpy(job->suggested_name, suggested_name, sizeof(job->suggested_name) - 1);
+
+    // If this URL is already in the store, only transfer it when the server copy changed
+    if (ctx()->store) {
+        pthread_mutex_lock(&store_lock);
+        const struct ManifestEntry *known = manifest_find_url(&ctx()->store->manifest, url);
+        if (known && known->etag[0] != '\0' && content_store_has(ctx()->store, known->sha256)) {
+            job->known = *known;
+            job->has_known = 1;
+        }
+        pthread_mutex_unlock(&store_lock);
+    }
+
+    int opened;
+    if (ctx()->resume) {
+        // Partial files are named after the URL so the next run finds them again
+        struct Sha256Context sha;
+        uint8_t digest[SHA256_DIGEST_LEN];
+        char key[SHA256_HEX_LEN];
+        sha256_init(&sha);
+        sha256_update(&sha, url, strlen(url));
+        sha256_final(&sha, digest);
+        sha256_to_hex(digest, key);
+        key[16] = '\0';
+        opened = hashed_writer_open_resumable(&job->writer, ctx()->root_fd, course_path, key);
+    } else {
+        opened = hashed_writer_open(&job->writer, ctx()->root_fd, course_path);
+    }
+    if (!opened) return 0;
+
+    progress_transfer_begin(ctx()->progress, &job->progress, job->url, suggested_name, job->writer.resume_from);
+
+    char header[MAX_ETAG_LEN + 32];
+    if (job->writer.resume_from > 0) {
+        welearn_log(WELEARN_LOG_INFO, "--> Resuming at byte %lld\n", job->writer.resume_from);
+        snprintf(header, sizeof(header), "Range: bytes=%lld-", job->writer.resume_from);
+        *headers = curl_slist_append(*headers, header);
+    } else if (job->has_known) {
+        snprintf(header, sizeof(header), "If-None-Match: %s", job->known.etag);
+        *headers = curl_slist_append(*headers, header);
+    }
+    return 1;
+}
+
+// Finish a download once the transfer is over: name it, store it, link it into place
+static int download_job_finish(struct DownloadJob *job, CURLcode res, long http_code, const char *final_url,
+                               long remote_mtime, const struct HeaderData *header_data, const char *errbuf) {
+    char filepath[MAX_PATH_LEN];
+    char filename[MAX_FILENAME_LEN] = {0};
+    const char *url = job->url;
+    const char *course_path = job->course_path;
+    const char *suggested_name = job->suggested_name;
+    struct HashedFileWriter *writer = &job->writer;
+
+    if (header_data->login_redirect || (final_url && strstr(final_url, "/login/index.php"))) {
+        welearn_log(WELEARN_LOG_ERROR, "Server answered %s with the login page (session expired)\n", url);
+        if (ctx()->resume) {
+            hashed_writer_suspend(writer);
+        } else {
+            hashed_writer_discard(writer);
+        }
+        return DOWNLOAD_FAILED;
+    }
 
     if (res != CURLE_OK) {
-        fprintf(stderr, "DEBUG: curl_easy_perform() failed for URL %s: %s\n", url, curl_easy_strerror(res));
-        fprintf(stderr, "DEBUG: Curl error details: %s\n", errbuf);
-        free(temp_data.memory);
-        goto download_cleanup;
+        welearn_log(WELEARN_LOG_ERROR, "curl_easy_perform() failed for URL %s: %s\n", url, curl_easy_strerror(res));
+        welearn_log(WELEARN_LOG_ERROR, "Curl error details: %s\n", errbuf ? errbuf : "");
+        if (ctx()->resume) {
+            hashed_writer_suspend(writer);
+        } else {
+            hashed_writer_discard(writer);
+        }
+        return DOWNLOAD_FAILED;
+    }
+
+    if (http_code == 304 && job->has_known) {
+        // Unchanged on the server: restore from the store without transferring anything
+        const struct ManifestEntry *known = &job->known;
+        hashed_writer_discard(writer);
+        const char *stored_name = strrchr(known->path, '/');
+        const char *name = stored_name ? stored_name + 1 : known->path;
+        if (snprintf(filepath, sizeof(filepath), "%s/%s", course_path, name) >= (int)sizeof(filepath)) {
+            welearn_log(WELEARN_LOG_ERROR, "Path too long: %s/%s\n", course_path, name);
+            return DOWNLOAD_FAILED;
+        }
+        if (exists_at_root(filepath)) {
+            welearn_log(WELEARN_LOG_INFO, "File unchanged on server, skipping: %s\n", filepath);
+            return DOWNLOAD_UNCHANGED;
+        }
+        int method = link_from_store(known->sha256, known->size, url, filepath, known->etag, known->remote_mtime);
+        if (method == STORE_LINK_NONE) return DOWNLOAD_FAILED;
+        welearn_log(WELEARN_LOG_INFO, "File unchanged on server, restored from store (%s): %s\n", link_method_name(method), filepath);
+        return DOWNLOAD_UNCHANGED;
     }
 
     if (http_code >= 400) {
-        fprintf(stderr, "DEBUG: HTTP error %ld received for URL: %s\n", http_code, url);
-        free(temp_data.memory);
-        goto download_cleanup;
+        welearn_log(WELEARN_LOG_ERROR, "HTTP error %ld received for URL: %s\n", http_code, url);
+        hashed_writer_discard(writer);
+        return DOWNLOAD_FAILED;
     }
 
     // Determine filename
-    if (strlen(header_data.filename) > 0) {
-        strncpy(filename, header_data.filename, sizeof(filename) - 1);
-        filename[sizeof(filename) - 1] = '\0';
-        printf("--> Using filename from header: %s\n", filename);
+    if (strlen(header_data->filename) > 0) {
+        snprintf(filename, sizeof(filename), "%s", header_data->filename);
+        welearn_log(WELEARN_LOG_INFO, "--> Using filename from header: %s\n", filename);
     } else if (suggested_name && strlen(suggested_name) > 0) {
         char sanitized_suggested[MAX_FILENAME_LEN];
         sanitize_filename(suggested_name, sanitized_suggested, sizeof(sanitized_suggested));
         strncpy(filename, sanitized_suggested, sizeof(filename) - 1);
         filename[sizeof(filename) - 1] = '\0';
-        printf("--> Using suggested filename (sanitized): %s\n", filename);
+        welearn_log(WELEARN_LOG_INFO, "--> Using suggested filename (sanitized): %s\n", filename);
     } else {
         extract_filename_from_url(final_url, filename, sizeof(filename));
-        printf("--> Using filename from final URL: %s\n", filename);
+        welearn_log(WELEARN_LOG_INFO, "--> Using filename from final URL: %s\n", filename);
     }
 
     if (strlen(filename) == 0) {
         snprintf(filename, sizeof(filename), "download_%ld.unknown", (long)time(NULL));
-        printf("--> WARNING: Could not determine filename, using generic: %s\n", filename);
+        welearn_log(WELEARN_LOG_INFO, "--> WARNING: Could not determine filename, using generic: %s\n", filename);
     }
 
-    snprintf(filepath, sizeof(filepath), "%s/%s", course_path, filename);
+    if (snprintf(filepath, sizeof(filepath), "%s/%s", course_path, filename) >= (int)sizeof(filepath)) {
+        welearn_log(WELEARN_LOG_ERROR, "Path too long: %s/%s\n", course_path, filename);
+        hashed_writer_discard(writer);
+        return DOWNLOAD_FAILED;
+    }
 
-    struct stat st;
-    if (stat(filepath, &st) == 0) {
-        printf("File already exists, skipping: %s\n", filepath);
-        free(temp_data.memory);
-        goto download_cleanup;
-    }
-
-    fp = fopen(filepath, "wb");
-    if (!fp) {
-        perror("DEBUG: Error opening file for writing");
-        fprintf(stderr, "DEBUG: Failed path: %s\n", filepath);
-        free(temp_data.memory);
-        goto download_cleanup;
-    }
-
-    if (temp_data.size > 0) {
-        size_t written = fwrite(temp_data.memory, 1, temp_data.size, fp);
-        if (written < temp_data.size) {
-            fprintf(stderr, "DEBUG: Error writing data to file: wrote %zu of %zu bytes.\n", written, temp_data.size);
-            perror("DEBUG: fwrite error");
-            fclose(fp);
-            remove(filepath);
-            free(temp_data.memory);
-            goto download_cleanup;
-        }
-        printf("Successfully downloaded: %s\n", filepath);
-    } else if (res == CURLE_OK && http_code < 400) {
-        fclose(fp);
-        fp = NULL;
-        struct stat st_check;
-        if (stat(filepath, &st_check) != 0) {
-            fp = fopen(filepath, "wb");
-            if (fp) fclose(fp);
-            fp = NULL;
-        }
-        printf("Successfully downloaded (0 bytes): %s\n", filepath);
+    if (exists_at_root(filepath)) {
+        welearn_log(WELEARN_LOG_INFO, "File already exists, skipping: %s\n", filepath);
+        hashed_writer_discard(writer);
+        return DOWNLOAD_SKIPPED;
+    }
+
+    char sha256[SHA256_HEX_LEN];
+    if (!hashed_writer_finish(writer, sha256)) {
+        hashed_writer_discard(writer);
+        return DOWNLOAD_FAILED;
+    }
+
+    if (ctx()->store) {
+        pthread_mutex_lock(&store_lock);
+        int duplicate = content_store_has(ctx()->store, sha256);
+        int ingested = content_store_ingest(ctx()->store, writer->temp_path, sha256);
+        pthread_mutex_unlock(&store_lock);
+        if (!ingested) {
+            hashed_writer_discard(writer);
+            return DOWNLOAD_FAILED;
+        }
+        int method = link_from_store(sha256, writer->bytes, url, filepath, header_data->etag, remote_mtime);
+        if (method == STORE_LINK_NONE) {
+            return DOWNLOAD_FAILED;
+        }
+        if (duplicate) {
+            welearn_log(WELEARN_LOG_INFO, "Duplicate of stored content, linked (%s): %s\n", link_method_name(method), filepath);
+            return DOWNLOAD_DEDUPLICATED;
+        } else if (writer->bytes > 0) {
+            welearn_log(WELEARN_LOG_INFO, "Successfully downloaded: %s\n", filepath);
+        } else {
+            welearn_log(WELEARN_LOG_INFO, "Successfully downloaded (0 bytes): %s\n", filepath);
+        }
     } else {
-        fprintf(stderr, "DEBUG: No data received or error occurred before writing.\n");
-        if (fp) fclose(fp);
-        fp = NULL;
-        remove(filepath);
-        free(temp_data.memory);
-        goto download_cleanup;
+        if (renameat(ctx()->root_fd, writer->temp_path, ctx()->root_fd, filepath) != 0) {
+            welearn_log(WELEARN_LOG_ERROR, "Error moving download into place: %s\n", strerror(errno));
+            welearn_log(WELEARN_LOG_ERROR, "Failed path: %s\n", filepath);
+            hashed_writer_discard(writer);
+            return DOWNLOAD_FAILED;
+        }
+        welearn_log(WELEARN_LOG_INFO, "Successfully downloaded: %s\n", filepath);
+    }
+    return DOWNLOAD_OK;
+}
+
+// Download a file from a given URL; returns one of the DOWNLOAD_* outcomes
+int download_file(CURL *curl, const char *url, const char *course_path, const char* suggested_name) {
+    if (!curl || !url || !course_path) return DOWNLOAD_FAILED;
+
+    welearn_log(WELEARN_LOG_INFO, "Attempting to download resource: %s\n", url);
+
+    struct HeaderData header_data = {0};
+    char final_url[MAX_URL_LEN] = {0};
+    struct curl_slist *request_headers = NULL;
+    struct DownloadJob *job = malloc(sizeof(struct DownloadJob));
+    if (!job) {
+        welearn_log(WELEARN_LOG_ERROR, "Failed to allocate download job: %s\n", strerror(errno));
+        return DOWNLOAD_FAILED;
+    }
+    if (!download_job_begin(job, url, course_path, suggested_name, &request_headers)) {
+        curl_slist_free_all(request_headers);
+        free(job);
+        return report_file(NULL, url, course_path, DOWNLOAD_FAILED, 0, 0);
+    }
+    job->writer.headers = &header_data;
+
+    char errbuf[CURL_ERROR_SIZE] = {0};
+    CURLcode res;
+    for (int attempt = 0; ; attempt++) {
+        curl_easy_setopt(curl, CURLOPT_URL, url);
+        curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, hashed_write_callback);
+        curl_easy_setopt(curl, CURLOPT_WRITEDATA, &job->writer);
+        curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, write_header_callback);
+        curl_easy_setopt(curl, CURLOPT_HEADERDATA, &header_data);
+        curl_easy_setopt(curl, CURLOPT_HTTPHEADER, request_headers);
+        curl_easy_setopt(curl, CURLOPT_FILETIME, 1L);
+
+        curl_easy_setopt(curl, CURLOPT_NOPROGRESS, job->progress.stream ? 0L : 1L);
+        curl_easy_setopt(curl, CURLOPT_XFERINFOFUNCTION, progress_xferinfo);
+        curl_easy_setopt(curl, CURLOPT_XFERINFODATA, &job->progress);
+        curl_easy_setopt(curl, CURLOPT_FAILONERROR, 0L);
+        curl_easy_setopt(curl, CURLOPT_HTTPGET, 1L);
+        curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, errbuf);
+
+        telemetry_transfers_changed(ctx()->telemetry, 1, 0);
+        res = curl_easy_perform(curl);
+        telemetry_transfers_changed(ctx()->telemetry, -1, 0);
+        telemetry_record(ctx()->telemetry, TELEMETRY_FILE, curl, res);
+        trace_transfer(ctx()->trace, TELEMETRY_FILE, curl, 0);
+
+        // Redirected to the login form: the writer refused the body, so log in and try again
+        if (!header_data.login_redirect || attempt > 0 || !ctx()->renew) break;
+        curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, NULL);
+        curl_easy_setopt(curl, CURLOPT_HEADERDATA, NULL);
+        curl_easy_setopt(curl, CURLOPT_HTTPHEADER, NULL);
+        if (!ctx()->renew(ctx()->renew_data)) break;
+        telemetry_count(ctx()->telemetry, TELEMETRY_RETRIES, 1);
+        memset(&header_data, 0, sizeof(header_data));
+        errbuf[0] = '\0';
+    }
+
+    char *effective_url = NULL;
+    if (curl_easy_getinfo(curl, CURLINFO_EFFECTIVE_URL, &effective_url) == CURLE_OK && effective_url) {
+        strncpy(final_url, effective_url, sizeof(final_url) - 1);
     }
+    long http_code = 0;
+    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code);
+    long remote_mtime = -1;
+    curl_easy_getinfo(curl, CURLINFO_FILETIME, &remote_mtime);
 
-    if (fp) fclose(fp);
-    free(temp_data.memory);
+    double write_started = trace_now();
+    int outcome = download_job_finish(job, res, http_code, final_url, remote_mtime, &header_data, errbuf);
+    trace_span(ctx()->trace, "disk", "write", write_started, url);
 
-download_cleanup:
     curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_memory_callback);
     curl_easy_setopt(curl, CURLOPT_WRITEDATA, NULL);
     curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, NULL);
     curl_easy_setopt(curl, CURLOPT_HEADERDATA, NULL);
+    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, NULL);
     curl_easy_setopt(curl, CURLOPT_HTTPGET, 1L);
     curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, NULL);
+    curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 1L);
+    curl_easy_setopt(curl, CURLOPT_XFERINFODATA, NULL);
+    curl_slist_free_all(request_headers);
+    report_file(&job->progress, url, course_path, outcome, job->writer.bytes, job_saved_bytes(job, outcome));
+    free(job);
+    return outcome;
 }
 
-// Fetch a page and process it for resource and folder links
-void process_page_for_resources(CURL *curl, const char *page_url, const char *course_path, struct VisitedUrls *visited) {
-    if (!curl || !page_url || !course_path || !visited) return;
+// Skip the transfer of a file whose prefetched ETag/size is already in the store
+static int download_from_store_if_known(const struct FileInfo *file, const char *course_path) {
+    if (!ctx()->store || file->meta_state != META_RESOLVED || file->etag[0] == '\0') return 0;
 
-    if (is_url_visited(visited, page_url)) {
-        printf("DEBUG: URL already processed, skipping: %s\n", page_url);
-        return;
-    }
+    // Copy the entry out: manifest_record may move the entries array
+    struct ManifestEntry known;
+    pthread_mutex_lock(&store_lock);
+    const struct ManifestEntry *found = manifest_find_etag(&ctx()->store->manifest, file->etag, file->size);
+    int usable = found && content_store_has(ctx()->store, found->sha256);
+    if (usable) known = *found;
+    pthread_mutex_unlock(&store_lock);
+    if (!usable) return 0;
 
-    if (!add_visited_url(visited, page_url)) {
-        fprintf(stderr, "DEBUG: Failed to add URL to visited list, cannot proceed: %s\n", page_url);
-        return;
+    char filepath[MAX_PATH_LEN];
+    const char *stored_name = strrchr(known.path, '/');
+    const char *name = file->remote_name[0] ? file->remote_name : (stored_name ? stored_name + 1 : known.path);
+    if (snprintf(filepath, sizeof(filepath), "%s/%s", course_path, name) >= (int)sizeof(filepath)) return 0;
+
+    if (exists_at_root(filepath)) {
+        welearn_log(WELEARN_LOG_INFO, "File already exists, skipping: %s\n", filepath);
+        return 1;
     }
-    printf("Processing page for resources: %s\n", page_url);
 
-    CURLcode res;
-    struct MemoryStruct page_content;
-    init_memory_struct(&page_content);
+    int method = link_from_store(known.sha256, known.size, file->url, filepath, file->etag, file->remote_mtime);
+    if (method == STORE_LINK_NONE) return 0;
+    welearn_log(WELEARN_LOG_INFO, "Content already stored, linked without download (%s): %s\n", link_method_name(method), filepath);
+    return 1;
+}
 
-    curl_easy_setopt(curl, CURLOPT_URL, page_url);
-    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_memory_callback);
-    curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)&page_content);
-    curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
-    curl_easy_setopt(curl, CURLOPT_HTTPGET, 1L);
-    curl_easy_setopt(curl, CURLOPT_FAILONERROR, 0L);
-    
-    char errbuf[CURL_ERROR_SIZE] = {0};
-    curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, errbuf);
+// Link the stored copy of a URL another account already downloaded into course_path,
+// without a request. Returns DOWNLOAD_DEDUPLICATED, DOWNLOAD_SKIPPED or DOWNLOAD_FAILED
+// (not in the store: the caller has to download it).
+int download_link_known_url(const char *url, const char *course_path) {
+    if (!ctx()->store || !url || !course_path) return DOWNLOAD_FAILED;
 
-    res = curl_easy_perform(curl);
+    struct ManifestEntry known;
+    pthread_mutex_lock(&store_lock);
+    const struct ManifestEntry *found = manifest_find_url(&ctx()->store->manifest, url);
+    int usable = found && content_store_has(ctx()->store, found->sha256);
+    if (usable) known = *found;
+    pthread_mutex_unlock(&store_lock);
+    if (!usable) return DOWNLOAD_FAILED;
 
-    if (res != CURLE_OK) {
-        fprintf(stderr, "DEBUG: curl_easy_perform() failed while fetching page %s: %s\n", page_url, curl_easy_strerror(res));
-        fprintf(stderr, "DEBUG: Curl error details: %s\n", errbuf);
-        free(page_content.memory);
-        curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, NULL);
-        return;
+    char filepath[MAX_PATH_LEN];
+    const char *stored_name = strrchr(known.path, '/');
+    if (snprintf(filepath, sizeof(filepath), "%s/%s", course_path,
+                 stored_name ? stored_name + 1 : known.path) >= (int)sizeof(filepath)) {
+        return DOWNLOAD_FAILED;
     }
 
-    long http_code = 0;
-    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code);
-    if (http_code >= 400) {
-        fprintf(stderr, "DEBUG: HTTP error %ld while fetching page %s\n", http_code, page_url);
-        free(page_content.memory);
-        curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, NULL);
-        return;
+    if (exists_at_root(filepath)) {
+        telemetry_record_file(ctx()->telemetry, DOWNLOAD_SKIPPED, 0, 0);
+        return DOWNLOAD_SKIPPED;
     }
-    curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, NULL);
 
-    const char *html_ptr = page_content.memory;
-    const char *base_url = "https://welearn.iiserkol.ac.in";
+    int method = link_from_store(known.sha256, known.size, url, filepath, known.etag, known.remote_mtime);
+    if (method == STORE_LINK_NONE) return DOWNLOAD_FAILED;
+    welearn_log(WELEARN_LOG_INFO, "Shared with another account, linked (%s): %s\n", link_method_name(method), filepath);
+    telemetry_record_file(ctx()->telemetry, DOWNLOAD_DEDUPLICATED, 0, known.size);
+    return DOWNLOAD_DEDUPLICATED;
+}
+
+// Kinds of links a course or folder page is crawled for
+#define PAGE_LINK_RESOURCE 0
+#define PAGE_LINK_FOLDER 1
+
+// Find the next resource or folder link of a page at or after html_ptr. Fills
+// the absolute URL, the link text and the kind; returns the position to
+// continue from, or NULL when the page has no more such links.
+static const char *next_page_link(const char *html_ptr, char full_url[MAX_URL_LEN],
+                                  char suggested_name[MAX_FILENAME_LEN], int *kind) {
+    PROFILE_SCOPE(PROFILE_PARSE_LINKS);
 
     while (html_ptr != NULL && *html_ptr != '\0') {
         const char *link_start = strstr(html_ptr, "<a ");
-        if (!link_start) break;
+        if (!link_start) return NULL;
 
         const char *href_start = strstr(link_start, "href=\"");
         if (!href_start) {
@@ -199,92 +597,189 @@ void process_page_for_resources(CURL *curl, const char *page_url, const char *co
             html_ptr = href_start;
             continue;
         }
+        html_ptr = href_end + 1;
 
         size_t url_len = href_end - href_start;
         char current_url[MAX_URL_LEN];
-        if (url_len < sizeof(current_url) && url_len > 0) {
-            strncpy(current_url, href_start, url_len);
-            current_url[url_len] = '\0';
+        if (url_len >= sizeof(current_url) || url_len == 0 || href_start[0] == '#') continue;
+        strncpy(current_url, href_start, url_len);
+        current_url[url_len] = '\0';
+
+        if (strstr(current_url, "/mod/resource/view.php?id=") || strstr(current_url, "/pluginfile.php/")) {
+            *kind = PAGE_LINK_RESOURCE;
+        } else if (strstr(current_url, "/mod/folder/view.php?id=")) {
+            *kind = PAGE_LINK_FOLDER;
+        } else {
+            continue;
+        }
 
-            char suggested_name[MAX_FILENAME_LEN] = "";
-            const char* tag_end = strchr(href_end, '>');
-            if (tag_end) {
-                const char* text_start = tag_end + 1;
-                const char* text_end = strstr(text_start, "</a>");
-                if (text_end && text_start < text_end) {
-                    size_t text_len = text_end - text_start;
-                    while (text_len > 0 && isspace((unsigned char)*text_start)) {
-                        text_start++;
-                        text_len--;
-                    }
-                    while (text_len > 0 && isspace((unsigned char)text_start[text_len - 1])) {
-                        text_len--;
-                    }
+        if (strncmp(current_url, "http", 4) != 0) {
+            welearn_site_url(full_url, MAX_URL_LEN, current_url);
+        } else {
+            strncpy(full_url, current_url, MAX_URL_LEN - 1);
+            full_url[MAX_URL_LEN - 1] = '\0';
+        }
 
-                    const char* inner_tag_start = strchr(text_start, '<');
-                    if (inner_tag_start != NULL && inner_tag_start < text_start + text_len) {
-                        const char* inner_tag_end = strchr(inner_tag_start, '>');
-                        if(inner_tag_end && inner_tag_end < text_start + text_len) {
-                            if (inner_tag_end + 1 < text_end) {
-                                text_start = inner_tag_end + 1;
-                                text_len = text_end - text_start;
-                                while (text_len > 0 && isspace((unsigned char)*text_start)) {
-                                    text_start++;
-                                    text_len--;
-                                }
-                                while (text_len > 0 && isspace((unsigned char)text_start[text_len - 1])) {
-                                    text_len--;
-                                }
-                            } else {
-                                text_len = 0;
+        // Suggested name from the link text, skipping one leading inner tag (icons)
+        suggested_name[0] = '\0';
+        const char* tag_end = strchr(href_end, '>');
+        if (tag_end) {
+            const char* text_start = tag_end + 1;
+            const char* text_end = strstr(text_start, "</a>");
+            if (text_end && text_start < text_end) {
+                size_t text_len = text_end - text_start;
+                while (text_len > 0 && isspace((unsigned char)*text_start)) {
+                    text_start++;
+                    text_len--;
+                }
+                while (text_len > 0 && isspace((unsigned char)text_start[text_len - 1])) {
+                    text_len--;
+                }
+
+                const char* inner_tag_start = strchr(text_start, '<');
+                if (inner_tag_start != NULL && inner_tag_start < text_start + text_len) {
+                    const char* inner_tag_end = strchr(inner_tag_start, '>');
+                    if(inner_tag_end && inner_tag_end < text_start + text_len) {
+                        if (inner_tag_end + 1 < text_end) {
+                            text_start = inner_tag_end + 1;
+                            text_len = text_end - text_start;
+                            while (text_len > 0 && isspace((unsigned char)*text_start)) {
+                                text_start++;
+                                text_len--;
+                            }
+                            while (text_len > 0 && isspace((unsigned char)text_start[text_len - 1])) {
+                                text_len--;
                             }
                         } else {
                             text_len = 0;
                         }
-                    }
-
-                    if (text_len > 0 && text_len < sizeof(suggested_name)) {
-                        strncpy(suggested_name, text_start, text_len);
-                        suggested_name[text_len] = '\0';
+                    } else {
+                        text_len = 0;
                     }
                 }
-            }
 
-            if ((strstr(current_url, "/mod/resource/view.php?id=") || strstr(current_url, "/pluginfile.php/")) && current_url[0] != '#') {
-                char full_url[MAX_URL_LEN];
-                if (strncmp(current_url, "http", 4) != 0) {
-                    snprintf(full_url, sizeof(full_url), "%s%s", base_url, current_url);
-                } else {
-                    strncpy(full_url, current_url, sizeof(full_url)-1);
-                    full_url[sizeof(full_url)-1] = '\0';
-                }
-                download_file(curl, full_url, course_path, suggested_name);
-                SLEEP(1);
-            }
-            else if (strstr(current_url, "/mod/folder/view.php?id=") && current_url[0] != '#') {
-                char full_url[MAX_URL_LEN];
-                if (strncmp(current_url, "http", 4) != 0) {
-                    snprintf(full_url, sizeof(full_url), "%s%s", base_url, current_url);
-                } else {
-                    strncpy(full_url, current_url, sizeof(full_url)-1);
-                    full_url[sizeof(full_url)-1] = '\0';
+                if (text_len > 0 && text_len < MAX_FILENAME_LEN) {
+                    strncpy(suggested_name, text_start, text_len);
+                    suggested_name[text_len] = '\0';
                 }
-                printf("--- Entering Folder: %s ---\n", full_url);
-                process_page_for_resources(curl, full_url, course_path, visited);
-                printf("--- Exiting Folder: %s ---\n", full_url);
-                SLEEP(1);
             }
         }
-        html_ptr = href_end + 1;
+        return html_ptr;
+    }
+    return NULL;
+}
+
+// Folder nesting followed below a course page
+static int crawl_max_depth(void) {
+    return ctx()->max_depth > 0 ? ctx()->max_depth : CRAWL_DEFAULT_MAX_DEPTH;
+}
+
+// A page being processed by process_page_for_resources, with its parse position
+struct PageFrame {
+    char url[MAX_URL_LEN];
+    struct MemoryStruct page;
+    const char *cursor;
+    double started;  // trace_now() when the page was opened
+};
+
+// Fetch a page into a frame unless it was visited already; returns 1 when it is ready to parse
+static int open_page_frame(CURL *curl, struct PageFrame *frame, const char *page_url, struct VisitedUrls *visited,
+                           int kind) {
+    if (is_url_visited(visited, page_url)) {
+        welearn_log(WELEARN_LOG_DEBUG, "URL already processed, skipping: %s\n", page_url);
+        return 0;
+    }
+    if (!add_visited_url(visited, page_url)) {
+        welearn_log(WELEARN_LOG_ERROR, "Failed to add URL to visited list, cannot proceed: %s\n", page_url);
+        return 0;
+    }
+    welearn_log(WELEARN_LOG_INFO, "Processing page for resources: %s\n", page_url);
+
+    strncpy(frame->url, page_url, sizeof(frame->url) - 1);
+    frame->url[sizeof(frame->url) - 1] = '\0';
+    init_memory_struct(&frame->page);
+    frame->cursor = NULL;
+    frame->started = trace_now();
+
+    char errbuf[CURL_ERROR_SIZE] = {0};
+    CURLcode res = fetch_page(curl, page_url, &frame->page, errbuf, kind);
+    curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, NULL);
+    if (res != CURLE_OK) {
+        welearn_log(WELEARN_LOG_ERROR, "curl_easy_perform() failed while fetching page %s: %s\n", page_url, curl_easy_strerror(res));
+        welearn_log(WELEARN_LOG_ERROR, "Curl error details: %s\n", errbuf);
+        free(frame->page.memory);
+        return 0;
+    }
+
+    long http_code = 0;
+    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code);
+    if (http_code >= 400) {
+        welearn_log(WELEARN_LOG_ERROR, "HTTP error %ld while fetching page %s\n", http_code, page_url);
+        free(frame->page.memory);
+        return 0;
+    }
+    frame->cursor = frame->page.memory;
+    return 1;
+}
+
+// Fetch a page and download its resources, descending into folders as their
+// links come up. Open folders are an explicit stack of frames (at most the
+// maximum depth), so deep trees do not grow the call stack.
+void process_page_for_resources(CURL *curl, const char *page_url, const char *course_path, struct VisitedUrls *visited) {
+    if (!curl || !page_url || !course_path || !visited) return;
+
+    int max_depth = crawl_max_depth();
+    struct PageFrame *frames = calloc((size_t)max_depth + 1, sizeof(struct PageFrame));
+    if (!frames) {
+        welearn_log(WELEARN_LOG_ERROR, "Failed to allocate page frames: %s\n", strerror(errno));
+        return;
+    }
+    if (!open_page_frame(curl, &frames[0], page_url, visited, TELEMETRY_COURSE)) {
+        free(frames);
+        return;
     }
 
-    free(page_content.memory);
+    int depth = 0;
+    char full_url[MAX_URL_LEN];
+    char suggested_name[MAX_FILENAME_LEN];
+    int kind;
+    for (;;) {
+        struct PageFrame *frame = &frames[depth];
+        frame->cursor = next_page_link(frame->cursor, full_url, suggested_name, &kind);
+        if (!frame->cursor) {
+            // Page done: resume the folder's parent where it left off
+            free(frame->page.memory);
+            trace_span(ctx()->trace, "crawl", depth == 0 ? "course" : "folder", frame->started, frame->url);
+            if (depth == 0) break;
+            depth--;
+            welearn_log(WELEARN_LOG_INFO, "--- Exiting Folder: %s ---\n", frame->url);
+            pace_requests(1);
+            continue;
+        }
+
+        if (kind == PAGE_LINK_RESOURCE) {
+            download_file(curl, full_url, course_path, suggested_name);
+            pace_requests(1);
+        } else if (depth >= max_depth) {
+            welearn_log(WELEARN_LOG_INFO, "Folder nested deeper than %d levels, not descending: %s\n", max_depth, full_url);
+        } else {
+            welearn_log(WELEARN_LOG_INFO, "--- Entering Folder: %s ---\n", full_url);
+            if (open_page_frame(curl, &frames[depth + 1], full_url, visited, TELEMETRY_FOLDER)) {
+                depth++;
+            } else {
+                welearn_log(WELEARN_LOG_INFO, "--- Exiting Folder: %s ---\n", full_url);
+                pace_requests(1);
+            }
+        }
+    }
+    free(frames);
 }
 
+
 // Extract course title from HTML <title> tag
 char* extract_course_title(const char *html) {
     if (!html) {
-        fprintf(stderr, "DEBUG: extract_course_title called with NULL html\n");
+        welearn_log(WELEARN_LOG_ERROR, "extract_course_title called with NULL html\n");
         return NULL;
     }
 
@@ -293,14 +788,14 @@ char* extract_course_title(const char *html) {
 
     const char *start = strstr(html, title_start_tag);
     if (!start) {
-        fprintf(stderr, "DEBUG: <title> tag start not found.\n");
+        welearn_log(WELEARN_LOG_ERROR, "<title> tag start not found.\n");
         return NULL;
     }
     start += strlen(title_start_tag);
 
     const char *end = strstr(start, title_end_tag);
     if (!end) {
-        fprintf(stderr, "DEBUG: </title> tag end not found.\n");
+        welearn_log(WELEARN_LOG_ERROR, "</title> tag end not found.\n");
         return NULL;
     }
 
@@ -317,13 +812,13 @@ char* extract_course_title(const char *html) {
 
     size_t len = end - start;
     if (len == 0) {
-        fprintf(stderr, "DEBUG: Extracted title length is zero.\n");
+        welearn_log(WELEARN_LOG_ERROR, "Extracted title length is zero.\n");
         return NULL;
     }
 
     char *title = malloc(len + 1);
     if (!title) {
-        perror("DEBUG: malloc failed for course title");
+        welearn_log(WELEARN_LOG_ERROR, "malloc failed for course title: %s\n", strerror(errno));
         return NULL;
     }
     strncpy(title, start, len);
@@ -335,7 +830,7 @@ char* extract_course_title(const char *html) {
     }
     if (*trimmed_start == 0) {
         free(title);
-        fprintf(stderr, "DEBUG: Extracted title was all whitespace after trimming.\n");
+        welearn_log(WELEARN_LOG_ERROR, "Extracted title was all whitespace after trimming.\n");
         return NULL;
     }
 
@@ -351,7 +846,7 @@ char* extract_course_title(const char *html) {
     free(title);
 
     if (strlen(sanitized_title) == 0) {
-        fprintf(stderr, "DEBUG: Sanitized title is empty.\n");
+        welearn_log(WELEARN_LOG_ERROR, "Sanitized title is empty.\n");
         return NULL;
     }
     return strdup(sanitized_title);
@@ -361,26 +856,30 @@ char* extract_course_title(const char *html) {
 void extract_course_links_and_process(CURL *curl_handle, const char *html) {
     if (!html || !curl_handle) return;
 
-    printf("\n--- Extracting and Processing Course Links ---\n");
+    welearn_log(WELEARN_LOG_INFO, "\n--- Extracting and Processing Course Links ---\n");
 
     struct VisitedUrls visited_list;
     init_visited_urls(&visited_list);
 
+    // Deduplicate against the store in the current directory unless the caller set one
+    struct ContentStore store;
+    int own_store = !ctx()->store && content_store_open_at(&store, ctx()->root_fd, ".");
+    if (own_store) ctx()->store = &store;
+
     const char *mycourses_marker = "data-key=\"mycourses\"";
     const char *search_start_ptr = strstr(html, mycourses_marker);
     const char *html_ptr = NULL;
 
     if (!search_start_ptr) {
-        fprintf(stderr, "DEBUG: Could not find the 'My courses' marker ('%s') in the dashboard HTML. Searching from beginning.\n", mycourses_marker);
+        welearn_log(WELEARN_LOG_ERROR, "Could not find the 'My courses' marker ('%s') in the dashboard HTML. Searching from beginning.\n", mycourses_marker);
         html_ptr = html;
     } else {
-        printf("DEBUG: Found 'My courses' marker. Starting search for course links from this point.\n");
+        welearn_log(WELEARN_LOG_DEBUG, "Found 'My courses' marker. Starting search for course links from this point.\n");
         html_ptr = search_start_ptr + strlen(mycourses_marker);
     }
 
     const char *specific_link_tag_start = "<a class=\"list-group-item list-group-item-action \" href=\"";
     const char *course_url_pattern = "/course/view.php?id=";
-    const char *base_url = "https://welearn.iiserkol.ac.in";
     int found_courses = 0;
 
     while (html_ptr != NULL && *html_ptr != '\0') {
@@ -406,30 +905,21 @@ void extract_course_links_and_process(CURL *curl_handle, const char *html) {
 
                 char full_course_url[MAX_URL_LEN];
                 if (strncmp(current_url, "http", 4) != 0) {
-                    printf("DEBUG: Warning - Course link seems relative: %s. Prepending base URL.\n", current_url);
-                    snprintf(full_course_url, sizeof(full_course_url), "%s%s", base_url, current_url);
+                    welearn_log(WELEARN_LOG_DEBUG, "Warning - Course link seems relative: %s. Prepending base URL.\n", current_url);
+                    welearn_site_url(full_course_url, sizeof(full_course_url), current_url);
                 } else {
                     strncpy(full_course_url, current_url, sizeof(full_course_url) - 1);
                     full_course_url[sizeof(full_course_url) - 1] = '\0';
                 }
 
-                printf("\nFound Course Link: %s\n", full_course_url);
+                welearn_log(WELEARN_LOG_INFO, "\nFound Course Link: %s\n", full_course_url);
 
                 CURLcode res;
                 struct MemoryStruct course_page_content;
                 init_memory_struct(&course_page_content);
 
-                curl_easy_setopt(curl_handle, CURLOPT_URL, full_course_url);
-                curl_easy_setopt(curl_handle, CURLOPT_WRITEFUNCTION, write_memory_callback);
-                curl_easy_setopt(curl_handle, CURLOPT_WRITEDATA, (void *)&course_page_content);
-                curl_easy_setopt(curl_handle, CURLOPT_FOLLOWLOCATION, 1L);
-                curl_easy_setopt(curl_handle, CURLOPT_HTTPGET, 1L);
-                curl_easy_setopt(curl_handle, CURLOPT_FAILONERROR, 0L);
-                
                 char errbuf_course[CURL_ERROR_SIZE] = {0};
-                curl_easy_setopt(curl_handle, CURLOPT_ERRORBUFFER, errbuf_course);
-
-                res = curl_easy_perform(curl_handle);
+                res = fetch_page(curl_handle, full_course_url, &course_page_content, errbuf_course, TELEMETRY_COURSE);
 
                 if (res == CURLE_OK) {
                     long http_code = 0;
@@ -437,18 +927,18 @@ void extract_course_links_and_process(CURL *curl_handle, const char *html) {
                     if (http_code < 400) {
                         char *course_title = extract_course_title(course_page_content.memory);
                         if (course_title && strlen(course_title) > 0) {
-                            printf("Processing Course: %s\n", course_title);
+                            welearn_log(WELEARN_LOG_INFO, "Processing Course: %s\n", course_title);
 
                             char course_path[MAX_PATH_LEN];
                             snprintf(course_path, sizeof(course_path), "./%s", course_title);
-                            if (create_directory(course_path)) {
+                            if (create_directory_at(ctx()->root_fd, course_path)) {
                                 process_page_for_resources(curl_handle, full_course_url, course_path, &visited_list);
                             } else {
-                                fprintf(stderr, "DEBUG: Failed to create directory for course: %s (Path: %s)\n", course_title, course_path);
+                                welearn_log(WELEARN_LOG_ERROR, "Failed to create directory for course: %s (Path: %s)\n", course_title, course_path);
                             }
                             free(course_title);
                         } else {
-                            fprintf(stderr, "DEBUG: Could not extract a valid title for course: %s\n", full_course_url);
+                            welearn_log(WELEARN_LOG_ERROR, "Could not extract a valid title for course: %s\n", full_course_url);
                             const char* id_param = "?id=";
                             const char* id_start = strstr(full_course_url, id_param);
                             char default_dir_name[64] = "course_unknown";
@@ -467,27 +957,27 @@ void extract_course_links_and_process(CURL *curl_handle, const char *html) {
                             }
                             char sanitized_default_name[MAX_PATH_LEN];
                             sanitize_filename(default_dir_name, sanitized_default_name, sizeof(sanitized_default_name));
-                            printf("DEBUG: Using default directory name: %s\n", sanitized_default_name);
+                            welearn_log(WELEARN_LOG_DEBUG, "Using default directory name: %s\n", sanitized_default_name);
 
                             char course_path[MAX_PATH_LEN];
                             snprintf(course_path, sizeof(course_path), "./%s", sanitized_default_name);
-                            if (create_directory(course_path)) {
+                            if (create_directory_at(ctx()->root_fd, course_path)) {
                                 process_page_for_resources(curl_handle, full_course_url, course_path, &visited_list);
                             } else {
-                                fprintf(stderr, "DEBUG: Failed to create default directory: %s\n", course_path);
+                                welearn_log(WELEARN_LOG_ERROR, "Failed to create default directory: %s\n", course_path);
                             }
                         }
                     } else {
-                        fprintf(stderr, "DEBUG: HTTP error %ld fetching course page: %s\n", http_code, full_course_url);
+                        welearn_log(WELEARN_LOG_ERROR, "HTTP error %ld fetching course page: %s\n", http_code, full_course_url);
                     }
                 } else {
-                    fprintf(stderr, "DEBUG: curl_easy_perform() failed for course page %s: %s\n", full_course_url, curl_easy_strerror(res));
-                    fprintf(stderr, "DEBUG: Curl error details: %s\n", errbuf_course);
+                    welearn_log(WELEARN_LOG_ERROR, "curl_easy_perform() failed for course page %s: %s\n", full_course_url, curl_easy_strerror(res));
+                    welearn_log(WELEARN_LOG_ERROR, "Curl error details: %s\n", errbuf_course);
                 }
                 curl_easy_setopt(curl_handle, CURLOPT_ERRORBUFFER, NULL);
 
                 free(course_page_content.memory);
-                SLEEP(2);
+                pace_requests(2);
             }
         }
 
@@ -495,272 +985,630 @@ void extract_course_links_and_process(CURL *curl_handle, const char *html) {
     }
 
     if (found_courses == 0) {
-        printf("DEBUG: No course links matching the specific pattern ('%s' containing '%s') were found after the 'My courses' marker.\n", specific_link_tag_start, course_url_pattern);
+        welearn_log(WELEARN_LOG_DEBUG, "No course links matching the specific pattern ('%s' containing '%s') were found after the 'My courses' marker.\n", specific_link_tag_start, course_url_pattern);
         if (search_start_ptr == html) {
-            printf("DEBUG: Also searched from the beginning of the page.\n");
+            welearn_log(WELEARN_LOG_DEBUG, "Also searched from the beginning of the page.\n");
         }
     } else {
-        printf("DEBUG: Found and initiated processing for %d course links.\n", found_courses);
+        welearn_log(WELEARN_LOG_DEBUG, "Found and initiated processing for %d course links.\n", found_courses);
     }
 
-    printf("\n--- Finished Processing Course Links ---\n");
+    welearn_log(WELEARN_LOG_INFO, "\n--- Finished Processing Course Links ---\n");
 
+    if (own_store) {
+        content_store_close(&store);
+        ctx()->store = NULL;
+    }
     free_visited_urls(&visited_list);
 }
 
-// Collect resources from a page without downloading
-void collect_page_resources(CURL *curl, const char *page_url, const char *course_name, 
-                           struct VisitedUrls *visited, struct FileList *file_list, int depth) {
-    if (!curl || !page_url || !course_name || !visited || !file_list) return;
-    
-    // Check if URL has already been visited
-    if (is_url_visited(visited, page_url)) {
-        return;
+// Called for every folder link found while collecting a page; depth is the folder contents' depth
+typedef void (*folder_link_callback)(const char *folder_url, int depth, void *data);
+
+// Collect the resource and folder links of an already fetched page; folders are
+// listed and handed to on_folder (if any), which fetches their contents
+static void collect_resources_from_html(const char *html, const char *course_name, struct FileList *file_list,
+                                        int depth, folder_link_callback on_folder, void *data) {
+    const char *html_ptr = html;
+    char full_url[MAX_URL_LEN];
+    char suggested_name[MAX_FILENAME_LEN];
+    int kind;
+
+    while ((html_ptr = next_page_link(html_ptr, full_url, suggested_name, &kind)) != NULL) {
+        if (kind == PAGE_LINK_RESOURCE) {
+            // Determine filename
+            char filename[MAX_FILENAME_LEN];
+            if (strlen(suggested_name) > 0) {
+                char sanitized[MAX_FILENAME_LEN];
+                sanitize_filename(suggested_name, sanitized, sizeof(sanitized));
+                strncpy(filename, sanitized, sizeof(filename)-1);
+                filename[sizeof(filename)-1] = '\0';
+            } else {
+                extract_filename_from_url(full_url, filename, sizeof(filename));
+            }
+            add_file_to_list(file_list, filename, full_url, course_name, suggested_name, 0, depth);
+        } else {
+            const char *folder_name = strlen(suggested_name) > 0 ? suggested_name : "Folder";
+            add_file_to_list(file_list, folder_name, full_url, course_name, suggested_name, 1, depth);
+
+            // Collect the folder's contents below it
+            if (on_folder) on_folder(full_url, depth + 1, data);
+        }
     }
-    
-    // Add URL to visited list
-    if (!add_visited_url(visited, page_url)) {
-        return;
+}
+
+// List the resource and folder links of an already fetched page without following
+// the folders (the link-extraction pass of a crawl on its own)
+void list_page_resources(const char *html, const char *course_name, struct FileList *file_list, int depth) {
+    if (!html || !file_list) return;
+    collect_resources_from_html(html, course_name ? course_name : "", file_list, depth, NULL, NULL);
+}
+
+// Scan all courses and collect files
+void scan_courses_and_collect_files(CURL *curl_handle, const char *html, struct FileList *file_list) {
+    scan_changed_courses(curl_handle, html, NULL, NULL, 1, file_list, NULL);
+}
+
+// Scan the courses whose title or URL matches course_patterns (comma-separated
+// globs, NULL for all) and collect their files. Returns the number of courses scanned.
+int scan_courses_matching(CURL *curl_handle, const char *html, const char *course_patterns,
+                          struct FileList *file_list) {
+    return scan_changed_courses(curl_handle, html, course_patterns, NULL, 1, file_list, NULL);
+}
+
+void init_course_watch(struct CourseWatchState *watch) {
+    if (!watch) return;
+    watch->entries = NULL;
+    watch->count = 0;
+    watch->capacity = 0;
+}
+
+void free_course_watch(struct CourseWatchState *watch) {
+    if (!watch) return;
+    free(watch->entries);
+    init_course_watch(watch);
+}
+
+// Fingerprint of the activity links of a course page. Moodle pages embed a
+// per-session sesskey, so hashing the whole page would always differ.
+static void fingerprint_course_page(const char *html, char fingerprint[SHA256_HEX_LEN]) {
+    struct Sha256Context sha;
+    uint8_t digest[SHA256_DIGEST_LEN];
+    sha256_init(&sha);
+
+    const char *p = html;
+    while (p && (p = strstr(p, "<a ")) != NULL) {
+        const char *href = strstr(p, "href=\"");
+        if (!href) break;
+        href += strlen("href=\"");
+        const char *href_end = strchr(href, '"');
+        if (!href_end) break;
+
+        size_t len = (size_t)(href_end - href);
+        char url[MAX_URL_LEN];
+        if (len >= sizeof(url)) len = sizeof(url) - 1;
+        memcpy(url, href, len);
+        url[len] = '\0';
+        if (strstr(url, "/mod/") || strstr(url, "/pluginfile.php/")) {
+            sha256_update(&sha, href, len);
+            // Include the link text so renamed resources count as changes
+            const char *text_end = strstr(href_end, "</a>");
+            if (text_end && text_end - href_end < 4096) {
+                sha256_update(&sha, href_end, (size_t)(text_end - href_end));
+            }
+        }
+        p = href_end + 1;
     }
-    
-    CURLcode res;
-    struct MemoryStruct page_content;
-    init_memory_struct(&page_content);
-    
-    curl_easy_setopt(curl, CURLOPT_URL, page_url);
-    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_memory_callback);
-    curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)&page_content);
-    curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
-    curl_easy_setopt(curl, CURLOPT_HTTPGET, 1L);
-    curl_easy_setopt(curl, CURLOPT_FAILONERROR, 0L);
-    
-    char errbuf[CURL_ERROR_SIZE] = {0};
-    curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, errbuf);
-    
-    res = curl_easy_perform(curl);
-    
-    if (res != CURLE_OK) {
-        free(page_content.memory);
-        curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, NULL);
-        return;
+
+    sha256_final(&sha, digest);
+    sha256_to_hex(digest, fingerprint);
+}
+
+// Remember the fingerprint of a course page; returns 1 if it differs from the last poll
+static int update_course_watch(struct CourseWatchState *watch, const char *course_url, const char *fingerprint) {
+    for (size_t i = 0; i < watch->count; i++) {
+        if (strcmp(watch->entries[i].url, course_url) == 0) {
+            if (strcmp(watch->entries[i].fingerprint, fingerprint) == 0) return 0;
+            strcpy(watch->entries[i].fingerprint, fingerprint);
+            return 1;
+        }
     }
-    
-    long http_code = 0;
-    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code);
-    if (http_code >= 400) {
-        free(page_content.memory);
-        curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, NULL);
-        return;
+
+    if (watch->count == watch->capacity) {
+        size_t capacity = watch->capacity ? watch->capacity * 2 : 16;
+        struct CourseWatchEntry *entries = realloc(watch->entries, capacity * sizeof(struct CourseWatchEntry));
+        if (!entries) return 1;
+        watch->entries = entries;
+        watch->capacity = capacity;
     }
-    curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, NULL);
-    
-    const char *html_ptr = page_content.memory;
-    const char *base_url = "https://welearn.iiserkol.ac.in";
-    
+    struct CourseWatchEntry *entry = &watch->entries[watch->count++];
+    memset(entry, 0, sizeof(*entry));
+    snprintf(entry->url, sizeof(entry->url), "%s", course_url);
+    strcpy(entry->fingerprint, fingerprint);
+    return 1;
+}
+
+// Find the next course link of the dashboard at or after html_ptr. Returns the
+// position to continue from, or NULL when there are no more links.
+static const char *next_course_link(const char *html_ptr, char full_course_url[MAX_URL_LEN]) {
+    PROFILE_SCOPE(PROFILE_PARSE_COURSES);
+    const char *specific_link_tag_start = "<a class=\"list-group-item list-group-item-action \" href=\"";
+    const char *course_url_pattern = "/course/view.php?id=";
+
     while (html_ptr != NULL && *html_ptr != '\0') {
-        const char *link_start = strstr(html_ptr, "<a ");
-        if (!link_start) break;
+        const char *link_tag_start = strstr(html_ptr, specific_link_tag_start);
+        if (!link_tag_start) return NULL;
         
-        const char *href_start = strstr(link_start, "href=\"");
-        if (!href_start) {
-            html_ptr = link_start + 3;
-            continue;
-        }
-        href_start += strlen("href=\"");
-        const char *href_end = strchr(href_start, '"');
-        if (!href_end) {
-            html_ptr = href_start;
+        const char *link_start = link_tag_start + strlen(specific_link_tag_start);
+        const char *link_end = strchr(link_start, '"');
+        if (!link_end) {
+            html_ptr = link_start;
             continue;
         }
+        html_ptr = link_end + 1;
         
-        size_t url_len = href_end - href_start;
+        size_t url_len = link_end - link_start;
         char current_url[MAX_URL_LEN];
-        if (url_len < sizeof(current_url) && url_len > 0) {
-            strncpy(current_url, href_start, url_len);
-            current_url[url_len] = '\0';
-            
-            // Extract suggested name from link text
-            char suggested_name[MAX_FILENAME_LEN] = "";
-            const char* tag_end = strchr(href_end, '>');
-            if (tag_end) {
-                const char* text_start = tag_end + 1;
-                const char* text_end = strstr(text_start, "</a>");
-                if (text_end && text_start < text_end) {
-                    size_t text_len = text_end - text_start;
-                    while (text_len > 0 && isspace((unsigned char)*text_start)) {
-                        text_start++;
-                        text_len--;
-                    }
-                    while (text_len > 0 && isspace((unsigned char)text_start[text_len - 1])) {
-                        text_len--;
-                    }
-                    
-                    const char* inner_tag_start = strchr(text_start, '<');
-                    if (inner_tag_start != NULL && inner_tag_start < text_start + text_len) {
-                        const char* inner_tag_end = strchr(inner_tag_start, '>');
-                        if(inner_tag_end && inner_tag_end < text_start + text_len) {
-                            if (inner_tag_end + 1 < text_end) {
-                                text_start = inner_tag_end + 1;
-                                text_len = text_end - text_start;
-                                while (text_len > 0 && isspace((unsigned char)*text_start)) {
-                                    text_start++;
-                                    text_len--;
-                                }
-                                while (text_len > 0 && isspace((unsigned char)text_start[text_len - 1])) {
-                                    text_len--;
-                                }
-                            } else {
-                                text_len = 0;
-                            }
-                        } else {
-                            text_len = 0;
-                        }
-                    }
-                    
-                    if (text_len > 0 && text_len < sizeof(suggested_name)) {
-                        strncpy(suggested_name, text_start, text_len);
-                        suggested_name[text_len] = '\0';
-                    }
-                }
-            }
-            
-            // Check if it's a resource link
-            if ((strstr(current_url, "/mod/resource/view.php?id=") || strstr(current_url, "/pluginfile.php/")) && current_url[0] != '#') {
-                char full_url[MAX_URL_LEN];
-                if (strncmp(current_url, "http", 4) != 0) {
-                    snprintf(full_url, sizeof(full_url), "%s%s", base_url, current_url);
-                } else {
-                    strncpy(full_url, current_url, sizeof(full_url)-1);
-                    full_url[sizeof(full_url)-1] = '\0';
-                }
-                
-                // Determine filename
-                char filename[MAX_FILENAME_LEN];
-                if (strlen(suggested_name) > 0) {
-                    char sanitized[MAX_FILENAME_LEN];
-                    sanitize_filename(suggested_name, sanitized, sizeof(sanitized));
-                    strncpy(filename, sanitized, sizeof(filename)-1);
-                    filename[sizeof(filename)-1] = '\0';
-                } else {
-                    extract_filename_from_url(full_url, filename, sizeof(filename));
-                }
-                
-                // Add to file list
-                add_file_to_list(file_list, filename, full_url, course_name, suggested_name, 0, depth);
-            }
-            // Check if it's a folder link
-            else if (strstr(current_url, "/mod/folder/view.php?id=") && current_url[0] != '#') {
-                char full_url[MAX_URL_LEN];
-                if (strncmp(current_url, "http", 4) != 0) {
-                    snprintf(full_url, sizeof(full_url), "%s%s", base_url, current_url);
-                } else {
-                    strncpy(full_url, current_url, sizeof(full_url)-1);
-                    full_url[sizeof(full_url)-1] = '\0';
-                }
-                
-                // Add folder to list
-                char folder_name[MAX_FILENAME_LEN];
-                if (strlen(suggested_name) > 0) {
-                    strncpy(folder_name, suggested_name, sizeof(folder_name)-1);
-                    folder_name[sizeof(folder_name)-1] = '\0';
-                } else {
-                    snprintf(folder_name, sizeof(folder_name), "Folder");
-                }
-                add_file_to_list(file_list, folder_name, full_url, course_name, suggested_name, 1, depth);
-                
-                // Recursively collect from folder
-                collect_page_resources(curl, full_url, course_name, visited, file_list, depth + 1);
+        if (url_len >= sizeof(current_url) || url_len == 0) continue;
+        strncpy(current_url, link_start, url_len);
+        current_url[url_len] = '\0';
+        if (!strstr(current_url, course_url_pattern)) continue;
+
+        if (strncmp(current_url, "http", 4) != 0) {
+            welearn_site_url(full_course_url, MAX_URL_LEN, current_url);
+        } else {
+            strncpy(full_course_url, current_url, MAX_URL_LEN - 1);
+            full_course_url[MAX_URL_LEN - 1] = '\0';
+        }
+        return html_ptr;
+    }
+    return NULL;
+}
+
+// Decide whether the files of a fetched course page should be collected (course
+// filter, watch state). Returns the course title to collect them under, or NULL.
+static char *accept_course_page(const char *html, const char *course_url, const char *course_patterns,
+                                struct CourseWatchState *watch, int force) {
+    char *course_title = extract_course_title(html);
+    if (!course_title || strlen(course_title) == 0) {
+        free(course_title);
+        return NULL;
+    }
+    if (course_patterns && !match_pattern_list(course_patterns, course_title) &&
+        !match_pattern_list(course_patterns, course_url)) {
+        welearn_log(WELEARN_LOG_INFO, "  Skipping course (filtered out): %s\n", course_title);
+        free(course_title);
+        return NULL;
+    }
+    int changed = 1;
+    if (watch) {
+        char fingerprint[SHA256_HEX_LEN];
+        fingerprint_course_page(html, fingerprint);
+        changed = update_course_watch(watch, course_url, fingerprint);
+    }
+    if (!changed && !force) {
+        welearn_log(WELEARN_LOG_INFO, "  Unchanged since last poll: %s\n", course_title);
+        free(course_title);
+        return NULL;
+    }
+    return course_title;
+}
+
+// One fetched page of a crawl. Its links are kept in page order and the pages
+// of its folders hang below it, so the flattened result is in document order
+// no matter in which order (or on which worker) the pages are fetched.
+struct CrawlPage {
+    struct FileList items;
+    size_t parent_index;             // Folder entry of the parent page this page lists
+    struct CrawlPage *first_child;   // Folder pages, in the order of their entries
+    struct CrawlPage *last_child;
+    struct CrawlPage *next_sibling;
+    struct CrawlPage *target;        // Folder already claimed elsewhere: the page that fetched it
+    int emitted;
+};
+
+// Folder page fetched by the crawl. A folder linked from several places is
+// fetched once, by whichever link is parsed first, but listed where it comes
+// first in document order, as a one-at-a-time crawl would list it.
+struct CrawlFolder {
+    char *url;
+    struct CrawlPage *page;
+};
+
+// A crawl of course and folder pages, driven either by one event-driven
+// transfer engine or by a pool of work-stealing crawl workers
+struct AsyncCrawl {
+    struct TransferEngine *engine;   // Event-driven mode
+    struct CrawlPool *pool;          // Worker mode
+    pthread_mutex_t lock;            // visited, watch and scanned, shared by the workers
+    struct VisitedUrls *visited;
+    const char *course_patterns;
+    struct CourseWatchState *watch;
+    int force;
+    int scanned;
+    size_t failed;              // Pages that could not be fetched
+    int max_depth;
+    struct CrawlPage *courses;  // One per course link, in dashboard order
+    size_t course_count;
+    struct CrawlFolder *folders;     // Every folder page node, claimed or not
+    size_t folder_count;
+    size_t folder_capacity;
+};
+
+// One page to fetch: which page its links go to
+struct CrawlFetch {
+    struct AsyncCrawl *crawl;
+    struct CrawlPage *page;
+    struct CrawlWorker *worker;  // Worker running it (worker mode)
+    int is_course;
+    int depth;
+    char url[MAX_URL_LEN];
+    char course_name[MAX_FILENAME_LEN];
+};
+
+static void on_crawl_page_done(struct TransferRequest *req, CURLcode res, void *userdata);
+
+static void count_failed_page(struct AsyncCrawl *crawl) {
+    pthread_mutex_lock(&crawl->lock);
+    crawl->failed++;
+    pthread_mutex_unlock(&crawl->lock);
+}
+
+static void init_async_crawl(struct AsyncCrawl *crawl, struct VisitedUrls *visited, const char *course_patterns,
+                             struct CourseWatchState *watch, int force) {
+    memset(crawl, 0, sizeof(*crawl));
+    pthread_mutex_init(&crawl->lock, NULL);
+    crawl->visited = visited;
+    crawl->course_patterns = course_patterns;
+    crawl->watch = watch;
+    crawl->force = force;
+    crawl->max_depth = crawl_max_depth();
+}
+
+static struct CrawlPage *new_crawl_page(void) {
+    struct CrawlPage *page = calloc(1, sizeof(struct CrawlPage));
+    if (page) init_file_list(&page->items);
+    return page;
+}
+
+// Queue a page on the engine or on the current worker's deque
+static void submit_crawl_fetch(struct AsyncCrawl *crawl, struct CrawlWorker *worker, struct CrawlPage *page,
+                               const char *url, int is_course, int depth, const char *course_name) {
+    struct CrawlFetch *fetch = calloc(1, sizeof(struct CrawlFetch));
+    if (!fetch) return;
+    fetch->crawl = crawl;
+    fetch->page = page;
+    fetch->is_course = is_course;
+    fetch->depth = depth;
+    strncpy(fetch->url, url, sizeof(fetch->url) - 1);
+    if (course_name) strncpy(fetch->course_name, course_name, sizeof(fetch->course_name) - 1);
+
+    if (crawl->pool) {
+        crawl_pool_push(crawl->pool, worker, fetch);
+        return;
+    }
+    struct TransferRequest *req = transfer_request_new(url, on_crawl_page_done, fetch);
+    if (!req) {
+        free(fetch);
+        return;
+    }
+    req->kind = is_course ? TELEMETRY_COURSE : TELEMETRY_FOLDER;
+    transfer_engine_submit(crawl->engine, req);
+}
+
+// Remember a folder node; called with crawl->lock held
+static struct CrawlPage *add_crawl_folder(struct AsyncCrawl *crawl, const char *url, struct CrawlPage *target) {
+    if (crawl->folder_count >= crawl->folder_capacity) {
+        size_t new_capacity = crawl->folder_capacity ? crawl->folder_capacity * 2 : 16;
+        struct CrawlFolder *folders = realloc(crawl->folders, new_capacity * sizeof(struct CrawlFolder));
+        if (!folders) return NULL;
+        crawl->folders = folders;
+        crawl->folder_capacity = new_capacity;
+    }
+    struct CrawlPage *page = new_crawl_page();
+    char *copy = strdup(url);
+    if (!page || !copy) {
+        free(page);
+        free(copy);
+        return NULL;
+    }
+    page->target = target;
+    crawl->folders[crawl->folder_count].url = copy;
+    crawl->folders[crawl->folder_count].page = page;
+    crawl->folder_count++;
+    return page;
+}
+
+static struct CrawlPage *find_crawl_folder(const struct AsyncCrawl *crawl, const char *url) {
+    for (size_t i = 0; i < crawl->folder_count; i++) {
+        if (!crawl->folders[i].page->target && strcmp(crawl->folders[i].url, url) == 0) {
+            return crawl->folders[i].page;
+        }
+    }
+    return NULL;
+}
+
+// Folder link seen while parsing: queue its page instead of fetching it now.
+// A folder claimed by another link only gets a node pointing at that page.
+static void collect_folder_later(const char *folder_url, int depth, void *data) {
+    struct CrawlFetch *parent = (struct CrawlFetch *)data;
+    struct AsyncCrawl *crawl = parent->crawl;
+    if (depth > crawl->max_depth) {
+        welearn_log(WELEARN_LOG_INFO, "Folder nested deeper than %d levels, not descending: %s\n",
+                    crawl->max_depth, folder_url);
+        return;
+    }
+
+    pthread_mutex_lock(&crawl->lock);
+    struct CrawlPage *page = NULL;
+    int fresh = 0;
+    struct CrawlPage *claimed = find_crawl_folder(crawl, folder_url);
+    if (claimed) {
+        page = add_crawl_folder(crawl, folder_url, claimed);
+    } else if (!is_url_visited(crawl->visited, folder_url) && add_visited_url(crawl->visited, folder_url)) {
+        page = add_crawl_folder(crawl, folder_url, NULL);
+        fresh = page != NULL;
+    }
+    pthread_mutex_unlock(&crawl->lock);
+    if (!page) return;
+
+    page->parent_index = parent->page->items.count - 1;
+    if (parent->page->last_child) {
+        parent->page->last_child->next_sibling = page;
+    } else {
+        parent->page->first_child = page;
+    }
+    parent->page->last_child = page;
+    if (fresh) submit_crawl_fetch(crawl, parent->worker, page, folder_url, 0, depth, parent->course_name);
+}
+
+// A course or folder page arrived: parse it and queue the folders it links to
+static void parse_crawl_page(struct CrawlFetch *fetch, const char *html) {
+    struct AsyncCrawl *crawl = fetch->crawl;
+    double started = trace_now();
+    if (!fetch->is_course) {
+        collect_resources_from_html(html, fetch->course_name, &fetch->page->items, fetch->depth,
+                                    collect_folder_later, fetch);
+        trace_span(ctx()->trace, "crawl", "parse", started, fetch->url);
+        return;
+    }
+
+    pthread_mutex_lock(&crawl->lock);
+    char *course_title = accept_course_page(html, fetch->url, crawl->course_patterns, crawl->watch, crawl->force);
+    if (course_title) crawl->scanned++;
+    pthread_mutex_unlock(&crawl->lock);
+
+    if (course_title) {
+        welearn_log(WELEARN_LOG_INFO, "  Found course: %s\n", course_title);
+        strncpy(fetch->course_name, course_title, sizeof(fetch->course_name) - 1);
+        collect_resources_from_html(html, course_title, &fetch->page->items, 0, collect_folder_later, fetch);
+    }
+    free(course_title);
+    trace_span(ctx()->trace, "crawl", "parse", started, fetch->url);
+}
+
+// Event-driven mode: completion callback of a page request
+static void on_crawl_page_done(struct TransferRequest *req, CURLcode res, void *userdata) {
+    struct CrawlFetch *fetch = (struct CrawlFetch *)userdata;
+
+    if (res != CURLE_OK || req->http_code >= 400 || !req->body.memory) {
+        if (res != CURLE_OK) {
+            welearn_log(WELEARN_LOG_ERROR, "Failed to fetch page %s: %s\n", req->url,
+                        req->errbuf[0] ? req->errbuf : curl_easy_strerror(res));
+        }
+        count_failed_page(fetch->crawl);
+    } else if (welearn_page_is_login(req->body.memory, req->effective_url)) {
+        welearn_log(WELEARN_LOG_ERROR, "Session expired while fetching %s\n", req->url);
+        count_failed_page(fetch->crawl);
+    } else {
+        parse_crawl_page(fetch, req->body.memory);
+    }
+    free(fetch);
+}
+
+// Worker mode: fetch and parse one page on a crawl worker
+static void run_crawl_task(struct CrawlWorker *worker, void *task, void *userdata) {
+    (void)userdata;
+    struct CrawlFetch *fetch = (struct CrawlFetch *)task;
+    fetch->worker = worker;
+
+    struct MemoryStruct page;
+    init_memory_struct(&page);
+    long http_code = 0;
+    double started = trace_now();
+    int kind = fetch->is_course ? TELEMETRY_COURSE : TELEMETRY_FOLDER;
+    if (crawl_fetch_page(worker, fetch->url, &page, &http_code, kind) == CURLE_OK && http_code < 400 && page.memory) {
+        parse_crawl_page(fetch, page.memory);
+    } else {
+        count_failed_page(fetch->crawl);
+    }
+    free(page.memory);
+    trace_span(ctx()->trace, "crawl", telemetry_kind_name(kind), started, fetch->url);
+    if (fetch->is_course) pace_requests(1);
+    free(fetch);
+}
+
+// Append a page's links to file_list, each folder followed by its contents.
+// A folder page is listed only where it is reached first, at the depth and under
+// the course of that place (course_name NULL and depth < 0 keep the page's own).
+// Recursion is bounded by the maximum folder depth.
+static void flatten_crawl_page(const struct AsyncCrawl *crawl, struct CrawlPage *page, struct FileList *file_list,
+                               int depth, const char *course_name) {
+    if (page->target) page = page->target;
+    if (page->emitted) return;
+    page->emitted = 1;
+
+    struct CrawlPage *child = page->first_child;
+    for (size_t i = 0; i < page->items.count; i++) {
+        const struct FileInfo *file = &page->items.files[i];
+        const char *name = course_name ? course_name : file->course_name;
+        int file_depth = depth < 0 ? file->depth : depth;
+        add_file_to_list(file_list, file->filename, file->url, name, file->suggested_name,
+                         file->is_folder, file_depth);
+        for (; child && child->parent_index == i; child = child->next_sibling) {
+            if (file_depth + 1 <= crawl->max_depth) {
+                flatten_crawl_page(crawl, child, file_list, file_depth + 1, name);
             }
         }
-        html_ptr = href_end + 1;
     }
-    
-    free(page_content.memory);
 }
 
-// Scan all courses and collect files
-void scan_courses_and_collect_files(CURL *curl_handle, const char *html, struct FileList *file_list) {
-    if (!html || !curl_handle || !file_list) return;
-    
-    printf("\n--- Scanning Courses for Files ---\n");
+// Free the folder pages and the course pages' lists once flattened
+static void free_crawl_pages(struct AsyncCrawl *crawl, struct CrawlPage *roots, size_t root_count) {
+    for (size_t i = 0; i < root_count; i++) free_file_list(&roots[i].items);
+    for (size_t i = 0; i < crawl->folder_count; i++) {
+        free_file_list(&crawl->folders[i].page->items);
+        free(crawl->folders[i].page);
+        free(crawl->folders[i].url);
+    }
+    free(crawl->folders);
+    crawl->folders = NULL;
+    crawl->folder_count = crawl->folder_capacity = 0;
+}
+
+// Set up the engine (event-driven mode) or worker pool that fetches the pages of a crawl
+static int start_crawl(struct AsyncCrawl *crawl, CURL *curl_handle, struct TransferEngine *engine,
+                       struct CrawlPool *pool) {
+    if (ctx()->event_loop) {
+        if (!transfer_engine_init(engine, curl_handle, ctx()->max_transfers)) return 0;
+        engine->limiter = ctx()->limiter;
+        engine_use_session_settings(engine);
+        crawl->engine = engine;
+        return 1;
+    }
+    if (!crawl_pool_init(pool, curl_handle, ctx()->crawl_workers, run_crawl_task, crawl)) return 0;
+    pool->reauth = ctx()->renew;
+    pool->reauth_data = ctx()->renew_data;
+    // A single worker crawls with the session handle, which has the cache already
+    if (ctx()->net_cache && pool->share) {
+        net_cache_seed_share(ctx()->net_cache, pool->share);
+        for (size_t i = 0; i < pool->worker_count && ctx()->net_cache->resolve; i++) {
+            curl_easy_setopt(pool->workers[i].curl, CURLOPT_RESOLVE, ctx()->net_cache->resolve);
+        }
+    }
+    crawl->pool = pool;
+    return 1;
+}
+
+static void finish_crawl(struct AsyncCrawl *crawl) {
+    if (crawl->engine) {
+        transfer_engine_run(crawl->engine);
+        engine_finish(crawl->engine);
+    } else if (crawl->pool) {
+        crawl_pool_run(crawl->pool);
+        size_t stolen = 0;
+        for (size_t i = 0; i < crawl->pool->worker_count; i++) stolen += crawl->pool->workers[i].stolen;
+        if (crawl->pool->worker_count > 1) {
+            welearn_log(WELEARN_LOG_DEBUG, "%zu crawl workers, %zu page(s) stolen\n",
+                        crawl->pool->worker_count, stolen);
+        }
+        if (ctx()->net_cache && crawl->pool->share) net_cache_collect_share(ctx()->net_cache, crawl->pool->share);
+        crawl_pool_cleanup(crawl->pool);
+    }
+    pthread_mutex_destroy(&crawl->lock);
+}
+
+// Collect resources from a page and its folders without downloading. Pages are
+// fetched as tasks (see start_crawl) rather than by recursion.
+void collect_page_resources(CURL *curl, const char *page_url, const char *course_name, 
+                           struct VisitedUrls *visited, struct FileList *file_list, int depth) {
+    if (!curl || !page_url || !course_name || !visited || !file_list) return;
+    if (is_url_visited(visited, page_url) || !add_visited_url(visited, page_url)) return;
+
+    struct AsyncCrawl crawl;
+    struct TransferEngine engine;
+    struct CrawlPool pool;
+    struct CrawlPage root;
+    memset(&root, 0, sizeof(root));
+    init_file_list(&root.items);
+    init_async_crawl(&crawl, visited, NULL, NULL, 1);
+    if (!start_crawl(&crawl, curl, &engine, &pool)) {
+        pthread_mutex_destroy(&crawl.lock);
+        free_file_list(&root.items);
+        return;
+    }
+    double started = trace_now();
+    submit_crawl_fetch(&crawl, NULL, &root, page_url, 0, depth, course_name);
+    finish_crawl(&crawl);
+    trace_span(ctx()->trace, "crawl", "scan", started, page_url);
+    flatten_crawl_page(&crawl, &root, file_list, -1, NULL);
+    free_crawl_pages(&crawl, &root, 1);
+}
+
+// Scan matching courses. With a watch state, courses whose page did not change
+// since the previous call are skipped unless force is set (their folders are
+// not re-fetched either). Returns the number of courses whose files were collected;
+// *failed_pages (optional) gets the number of pages that could not be fetched.
+// Course and folder pages are fetched concurrently, by the event loop or by the
+// crawl workers; the file list keeps the dashboard and page order either way.
+int scan_changed_courses(CURL *curl_handle, const char *html, const char *course_patterns,
+                         struct CourseWatchState *watch, int force, struct FileList *file_list,
+                         size_t *failed_pages) {
+    if (failed_pages) *failed_pages = 0;
+    if (!html || !curl_handle || !file_list) return 0;
     
+    welearn_log(WELEARN_LOG_INFO, "\n--- Scanning Courses for Files ---\n");
+
     struct VisitedUrls visited_list;
     init_visited_urls(&visited_list);
-    
+    struct AsyncCrawl crawl;
+    struct TransferEngine engine;
+    struct CrawlPool pool;
+    init_async_crawl(&crawl, &visited_list, course_patterns, watch, force);
+
     const char *mycourses_marker = "data-key=\"mycourses\"";
     const char *search_start_ptr = strstr(html, mycourses_marker);
-    const char *html_ptr = search_start_ptr ? search_start_ptr + strlen(mycourses_marker) : html;
-    
-    const char *specific_link_tag_start = "<a class=\"list-group-item list-group-item-action \" href=\"";
-    const char *course_url_pattern = "/course/view.php?id=";
-    const char *base_url = "https://welearn.iiserkol.ac.in";
-    
-    while (html_ptr != NULL && *html_ptr != '\0') {
-        const char *link_tag_start = strstr(html_ptr, specific_link_tag_start);
-        if (!link_tag_start) break;
-        
-        const char *link_start = link_tag_start + strlen(specific_link_tag_start);
-        const char *link_end = strchr(link_start, '"');
-        if (!link_end) {
-            html_ptr = link_start;
+    const char *start = search_start_ptr ? search_start_ptr + strlen(mycourses_marker) : html;
+
+    size_t links = 0;
+    char full_course_url[MAX_URL_LEN];
+    for (const char *p = start; (p = next_course_link(p, full_course_url)) != NULL; ) links++;
+    crawl.courses = calloc(links ? links : 1, sizeof(struct CrawlPage));
+    if (!crawl.courses || !start_crawl(&crawl, curl_handle, &engine, &pool)) {
+        if (failed_pages) *failed_pages = links;
+        free(crawl.courses);
+        pthread_mutex_destroy(&crawl.lock);
+        free_visited_urls(&visited_list);
+        return 0;
+    }
+
+    double started = trace_now();
+    for (const char *p = start; (p = next_course_link(p, full_course_url)) != NULL; ) {
+        if (is_url_visited(&visited_list, full_course_url) || !add_visited_url(&visited_list, full_course_url)) {
             continue;
         }
-        
-        size_t url_len = link_end - link_start;
-        char current_url[MAX_URL_LEN];
-        if (url_len < sizeof(current_url) && url_len > 0) {
-            strncpy(current_url, link_start, url_len);
-            current_url[url_len] = '\0';
-            
-            if (strstr(current_url, course_url_pattern)) {
-                char full_course_url[MAX_URL_LEN];
-                if (strncmp(current_url, "http", 4) != 0) {
-                    snprintf(full_course_url, sizeof(full_course_url), "%s%s", base_url, current_url);
-                } else {
-                    strncpy(full_course_url, current_url, sizeof(full_course_url) - 1);
-                    full_course_url[sizeof(full_course_url) - 1] = '\0';
-                }
-                
-                printf("Scanning course: %s\n", full_course_url);
-                
-                // Fetch course page
-                CURLcode res;
-                struct MemoryStruct course_page_content;
-                init_memory_struct(&course_page_content);
-                
-                curl_easy_setopt(curl_handle, CURLOPT_URL, full_course_url);
-                curl_easy_setopt(curl_handle, CURLOPT_WRITEFUNCTION, write_memory_callback);
-                curl_easy_setopt(curl_handle, CURLOPT_WRITEDATA, (void *)&course_page_content);
-                curl_easy_setopt(curl_handle, CURLOPT_FOLLOWLOCATION, 1L);
-                curl_easy_setopt(curl_handle, CURLOPT_HTTPGET, 1L);
-                curl_easy_setopt(curl_handle, CURLOPT_FAILONERROR, 0L);
-                
-                res = curl_easy_perform(curl_handle);
-                
-                if (res == CURLE_OK) {
-                    long http_code = 0;
-                    curl_easy_getinfo(curl_handle, CURLINFO_RESPONSE_CODE, &http_code);
-                    if (http_code < 400) {
-                        char *course_title = extract_course_title(course_page_content.memory);
-                        if (course_title && strlen(course_title) > 0) {
-                            printf("  Found course: %s\n", course_title);
-                            collect_page_resources(curl_handle, full_course_url, course_title, &visited_list, file_list, 0);
-                            free(course_title);
-                        }
-                    }
-                }
-                
-                free(course_page_content.memory);
-                SLEEP(1);
-            }
-        }
-        
-        html_ptr = link_end + 1;
+        struct CrawlPage *page = &crawl.courses[crawl.course_count++];
+        init_file_list(&page->items);
+        welearn_log(WELEARN_LOG_INFO, "Scanning course: %s\n", full_course_url);
+        submit_crawl_fetch(&crawl, NULL, page, full_course_url, 1, 0, NULL);
+    }
+    finish_crawl(&crawl);
+    trace_span(ctx()->trace, "crawl", "scan", started, NULL);
+
+    for (size_t i = 0; i < crawl.course_count; i++) {
+        flatten_crawl_page(&crawl, &crawl.courses[i], file_list, -1, NULL);
     }
+    free_crawl_pages(&crawl, crawl.courses, crawl.course_count);
+    free(crawl.courses);
     
-    printf("--- Scan Complete: Found %zu file(s) ---\n\n", file_list->count);
+    welearn_log(WELEARN_LOG_INFO, "--- Scan Complete: Found %zu file(s) ---\n\n", file_list->count);
     
     free_visited_urls(&visited_list);
+    if (failed_pages) *failed_pages = crawl.failed;
+    return crawl.scanned;
+}
+
+// Mention a non-default schedule before a batch starts
+static void log_schedule(const struct SchedulePolicy *policy) {
+    if (!policy || (policy->order == SCHEDULE_LIST && policy->priority_count == 0 && policy->small_lane <= 0)) return;
+    char lane[96] = "";
+    if (policy->small_lane > 0) {
+        char limit_str[32];
+        format_size(policy->small_limit, limit_str, sizeof(limit_str));
+        snprintf(lane, sizeof(lane), ", %d slot(s) kept for files up to %s", policy->small_lane, limit_str);
+    }
+    welearn_log(WELEARN_LOG_INFO, "Download order: %s, %zu priority pattern(s)%s\n",
+                schedule_order_name(policy->order), policy->priority_count, lane);
 }
 
 // Download selected files
@@ -768,13 +1616,43 @@ void download_selected_files(CURL *curl, const struct FileList *list, const int
                             size_t selection_count, const char *base_path) {
     if (!curl || !list || !selections || selection_count == 0) return;
     
-    printf("\n--- Starting Downloads ---\n");
-    printf("Download location: %s\n\n", base_path);
-    
+    welearn_log(WELEARN_LOG_INFO, "\n--- Starting Downloads ---\n");
+    welearn_log(WELEARN_LOG_INFO, "Download location: %s\n", base_path);
+
+    // Report the size of the selection when metadata was prefetched
+    long long total_bytes = 0;
+    size_t known = 0;
     for (size_t i = 0; i < selection_count; i++) {
+        int file_idx = selections[i] - 1;
+        if (file_idx < 0 || (size_t)file_idx >= list->count) continue;
+        const struct FileInfo *file = &list->files[file_idx];
+        if (!file->is_folder && file->meta_state == META_RESOLVED && file->size >= 0) {
+            total_bytes += file->size;
+            known++;
+        }
+    }
+    if (known > 0) {
+        char total_str[32];
+        format_size(total_bytes, total_str, sizeof(total_str));
+        welearn_log(WELEARN_LOG_INFO, "Total size: %s (%zu of %zu file(s) with known size)\n", total_str, known, selection_count);
+    }
+    welearn_log(WELEARN_LOG_INFO, "\n");
+
+    size_t *order = schedule_selections(list, selections, selection_count, ctx()->schedule);
+    if (!order) return;
+    log_schedule(ctx()->schedule);
+
+    // Deduplicate against the store in the download directory unless the caller set one
+    struct ContentStore store;
+    int own_store = !ctx()->store && content_store_open_at(&store, ctx()->root_fd, base_path);
+    if (own_store) ctx()->store = &store;
+    double started = trace_now();
+
+    for (size_t n = 0; n < selection_count; n++) {
+        size_t i = order[n];
         int file_idx = selections[i] - 1;  // Convert 1-based to 0-based
         if (file_idx < 0 || (size_t)file_idx >= list->count) {
-            printf("Warning: Invalid selection %d, skipping.\n", selections[i]);
+            welearn_log(WELEARN_LOG_INFO, "Warning: Invalid selection %d, skipping.\n", selections[i]);
             continue;
         }
         
@@ -782,20 +1660,436 @@ void download_selected_files(CURL *curl, const struct FileList *list, const int
         
         // Skip folders
         if (file->is_folder) {
-            printf("Skipping folder: %s\n", file->filename);
+            welearn_log(WELEARN_LOG_INFO, "Skipping folder: %s\n", file->filename);
             continue;
         }
         
         // Create course directory under base path
         char course_path[MAX_PATH_LEN];
         snprintf(course_path, sizeof(course_path), "%s/%s", base_path, file->course_name);
-        create_directory(course_path);
+        create_directory_at(ctx()->root_fd, course_path);
         
         // Download the file
-        printf("\n[%zu/%zu] Downloading: %s\n", i + 1, selection_count, file->filename);
+        welearn_log(WELEARN_LOG_INFO, "\n[%zu/%zu] Downloading: %s\n", n + 1, selection_count, file->filename);
+        if (download_from_store_if_known(file, course_path)) {
+            continue;
+        }
         download_file(curl, file->url, course_path, file->suggested_name);
-        SLEEP(1);
+        pace_requests(1);
+    }
+    free(order);
+    trace_span(ctx()->trace, "download", "downloads", started, NULL);
+
+    if (own_store) {
+        content_store_close(&store);
+        ctx()->store = NULL;
     }
     
-    printf("\n--- Downloads Complete ---\n");
+    welearn_log(WELEARN_LOG_INFO, "\n--- Downloads Complete ---\n");
+}
+
+// Count one outcome in the batch statistics
+static void record_download_outcome(struct DownloadStats *stats, int outcome, long long bytes) {
+    if (!stats) return;
+    switch (outcome) {
+        case DOWNLOAD_OK: stats->downloaded++; stats->bytes += bytes; break;
+        case DOWNLOAD_SKIPPED: stats->skipped++; break;
+        case DOWNLOAD_UNCHANGED: stats->unchanged++; break;
+        case DOWNLOAD_DEDUPLICATED: stats->deduplicated++; break;
+        default: stats->failed++; break;
+    }
+}
+
+// State shared by the parallel download callbacks
+struct ParallelDownload {
+    struct TransferEngine *engine;
+    const struct FileList *list;
+    const int *selections;
+    size_t selection_count;
+    const char *base_path;
+    size_t *order;       // Selections in schedule order
+    size_t next_small;   // Next position in order holding a small file (small-file lane)
+    size_t next_large;   // Next position in order holding any other file
+    size_t submitted;
+    size_t in_flight;    // Jobs submitted and not finished yet
+    size_t large_in_flight;
+    size_t window;       // Jobs kept in flight; bounds the memory held by DownloadJobs
+    const struct SchedulePolicy *policy;  // NULL: list order, no lane
+    struct DownloadStats *stats;
+    int *outcomes;
+};
+
+// One in-flight file of a parallel batch
+struct ParallelSlot {
+    struct ParallelDownload *batch;
+    size_t selection;
+    int large;
+    struct DownloadJob job;
+};
+
+static void submit_next_downloads(struct ParallelDownload *batch);
+
+// transfer is the finished job's progress, NULL when the file was resolved without a request
+static void finish_parallel_slot(struct ParallelDownload *batch, size_t selection, int outcome, long long bytes,
+                                 long long saved_bytes, const struct ProgressTransfer *transfer) {
+    record_download_outcome(batch->stats, outcome, bytes);
+    if (batch->outcomes) batch->outcomes[selection] = outcome;
+
+    int file_idx = batch->selections[selection] - 1;
+    if (file_idx >= 0 && (size_t)file_idx < batch->list->count) {
+        const struct FileInfo *file = &batch->list->files[file_idx];
+        report_file(transfer, file->url, file->course_name, outcome, bytes, saved_bytes);
+    }
+}
+
+// Completion of one parallel download: finish the job and refill the window
+static void on_parallel_download_done(struct TransferRequest *req, CURLcode res, void *userdata) {
+    struct ParallelSlot *slot = (struct ParallelSlot *)userdata;
+    struct ParallelDownload *batch = slot->batch;
+
+    double write_started = trace_now();
+    int outcome = download_job_finish(&slot->job, res, req->http_code, req->effective_url,
+                                      req->filetime, &req->headers, req->errbuf);
+    trace_span(ctx()->trace, "disk", "write", write_started, req->url);
+    finish_parallel_slot(batch, slot->selection, outcome, slot->job.writer.bytes,
+                         job_saved_bytes(&slot->job, outcome), &slot->job.progress);
+    if (slot->large) batch->large_in_flight--;
+    free(slot);
+
+    batch->in_flight--;
+    submit_next_downloads(batch);
+}
+
+// Whether the selection can only use the slots outside the small-file lane
+static int is_large_selection(const struct ParallelDownload *batch, size_t selection) {
+    if (!batch->policy || batch->policy->small_lane <= 0) return 0;
+    int file_idx = batch->selections[selection] - 1;
+    if (file_idx < 0 || (size_t)file_idx >= batch->list->count) return 0;
+    return !schedule_is_small(&batch->list->files[file_idx], batch->policy);
+}
+
+static size_t skip_to_lane(const struct ParallelDownload *batch, size_t pos, int large) {
+    while (pos < batch->selection_count && is_large_selection(batch, batch->order[pos]) != large) pos++;
+    return pos;
+}
+
+// Next selection in schedule order, passing over large files while they
+// already fill every slot outside the small-file lane. Returns 0 when nothing
+// can be submitted now.
+static int next_scheduled_selection(struct ParallelDownload *batch, size_t *selection, int *large) {
+    batch->next_small = skip_to_lane(batch, batch->next_small, 0);
+    batch->next_large = skip_to_lane(batch, batch->next_large, 1);
+
+    size_t large_slots = 0;
+    if (batch->next_large < batch->selection_count) {
+        int limit = batch->engine->max_active;
+        if (batch->engine->adaptive && batch->engine->adaptive->limit < limit) limit = batch->engine->adaptive->limit;
+        limit -= batch->policy->small_lane;
+        large_slots = limit > 1 ? (size_t)limit : 1;
+    }
+
+    int take_large = batch->next_large < batch->selection_count && batch->large_in_flight < large_slots &&
+                     (batch->next_large < batch->next_small || batch->next_small >= batch->selection_count);
+    if (take_large) {
+        *selection = batch->order[batch->next_large++];
+        *large = 1;
+        return 1;
+    }
+    if (batch->next_small < batch->selection_count) {
+        *selection = batch->order[batch->next_small++];
+        *large = 0;
+        return 1;
+    }
+    return 0;
+}
+
+// Submit selections until the window is full; files resolved locally never reach the network
+static void submit_next_downloads(struct ParallelDownload *batch) {
+    size_t selection;
+    int large;
+    while (batch->in_flight < batch->window && next_scheduled_selection(batch, &selection, &large)) {
+        batch->submitted++;
+        int file_idx = batch->selections[selection] - 1;
+        if (file_idx < 0 || (size_t)file_idx >= batch->list->count) {
+            finish_parallel_slot(batch, selection, DOWNLOAD_FAILED, 0, 0, NULL);
+            continue;
+        }
+        const struct FileInfo *file = &batch->list->files[file_idx];
+        if (file->is_folder) {
+            finish_parallel_slot(batch, selection, DOWNLOAD_SKIPPED, 0, 0, NULL);
+            continue;
+        }
+
+        char course_path[MAX_PATH_LEN];
+        snprintf(course_path, sizeof(course_path), "%s/%s", batch->base_path, file->course_name);
+        if (!create_directory_at(ctx()->root_fd, course_path)) {
+            finish_parallel_slot(batch, selection, DOWNLOAD_FAILED, 0, 0, NULL);
+            continue;
+        }
+
+        welearn_log(WELEARN_LOG_INFO, "[%zu/%zu] Queued: %s\n", batch->submitted, batch->selection_count, file->filename);
+        if (download_from_store_if_known(file, course_path)) {
+            finish_parallel_slot(batch, selection, DOWNLOAD_DEDUPLICATED, 0, file->size > 0 ? file->size : 0, NULL);
+            continue;
+        }
+
+        struct ParallelSlot *slot = malloc(sizeof(struct ParallelSlot));
+        struct TransferRequest *req = slot ? transfer_request_new(file->url, on_parallel_download_done, slot) : NULL;
+        struct curl_slist *headers = NULL;
+        if (!req || !download_job_begin(&slot->job, file->url, course_path, file->suggested_name, &headers)) {
+            curl_slist_free_all(headers);
+            transfer_request_free(req);
+            free(slot);
+            finish_parallel_slot(batch, selection, DOWNLOAD_FAILED, 0, 0, NULL);
+            continue;
+        }
+        slot->batch = batch;
+        slot->selection = selection;
+        slot->large = large;
+        slot->job.writer.headers = &req->headers;
+        req->extra_headers = headers;
+        req->kind = TELEMETRY_FILE;
+        req->write_fn = hashed_write_callback;
+        req->write_data = &slot->job.writer;
+        if (slot->job.progress.stream) {
+            req->progress_fn = progress_xferinfo;
+            req->progress_data = &slot->job.progress;
+        }
+        batch->in_flight++;
+        if (large) batch->large_in_flight++;
+        transfer_engine_submit(batch->engine, req);
+    }
+}
+
+// Download the selected files over up to max_parallel concurrent transfers.
+// outcomes (optional) receives one DOWNLOAD_* value per selection.
+// Returns the number of failed downloads.
+size_t download_files_parallel(CURL *curl, const struct FileList *list, const int *selections,
+                               size_t selection_count, const char *base_path, int max_parallel,
+                               struct DownloadStats *stats, int *outcomes) {
+    struct DownloadStats local_stats;
+    if (!stats) stats = &local_stats;
+    memset(stats, 0, sizeof(*stats));
+    if (!curl || !list || !selections || selection_count == 0 || !base_path) return 0;
+
+    size_t *order = schedule_selections(list, selections, selection_count, ctx()->schedule);
+    struct TransferEngine engine;
+    if (!order || !transfer_engine_init(&engine, curl, max_parallel)) {
+        free(order);
+        stats->failed = selection_count;
+        return selection_count;
+    }
+    engine.limiter = ctx()->limiter;
+    engine_use_session_settings(&engine);
+    struct AdaptiveConcurrency adaptive;
+    if (ctx()->adaptive) {
+        adaptive_init(&adaptive, engine.max_active);
+        engine.adaptive = &adaptive;
+    }
+
+    // Deduplicate against the store in the download directory unless the caller set one
+    struct ContentStore store;
+    int own_store = !ctx()->store && content_store_open_at(&store, ctx()->root_fd, base_path);
+    if (own_store) ctx()->store = &store;
+
+    if (engine.adaptive) {
+        welearn_log(WELEARN_LOG_INFO, "\n--- Starting %zu Download(s), adaptive up to %d in parallel ---\n",
+                    selection_count, engine.max_active);
+    } else {
+        welearn_log(WELEARN_LOG_INFO, "\n--- Starting %zu Download(s), %d in parallel ---\n", selection_count, engine.max_active);
+    }
+    log_schedule(ctx()->schedule);
+    struct ParallelDownload batch;
+    memset(&batch, 0, sizeof(batch));
+    batch.engine = &engine;
+    batch.list = list;
+    batch.selections = selections;
+    batch.selection_count = selection_count;
+    batch.base_path = base_path;
+    batch.order = order;
+    batch.window = (size_t)engine.max_active * 2;
+    batch.policy = ctx()->schedule;
+    batch.stats = stats;
+    batch.outcomes = outcomes;
+    double started = trace_now();
+    submit_next_downloads(&batch);
+    transfer_engine_run(&engine);
+    trace_span(ctx()->trace, "download", "downloads", started, NULL);
+    stats->concurrency = engine.adaptive ? adaptive.limit : engine.max_active;
+    if (engine.adaptive) {
+        welearn_log(WELEARN_LOG_INFO, "Adaptive concurrency settled at %d transfer(s) (peak %d, %zu adjustment(s))\n",
+                    adaptive.limit, adaptive.peak_limit, adaptive.adjustments);
+    }
+    engine_finish(&engine);
+    free(order);
+
+    if (own_store) {
+        content_store_close(&store);
+        ctx()->store = NULL;
+    }
+
+    welearn_log(WELEARN_LOG_INFO, "\n--- Downloads Complete ---\n");
+    return stats->failed;
+}
+
+// State shared by the metadata prefetch callbacks
+struct MetadataPrefetch {
+    struct TransferEngine *engine;
+    struct FileList *list;
+    size_t total;
+    size_t done;
+    metadata_progress_callback progress;
+    void *userdata;
+};
+
+// Per-file callback context: which entry of the list a request resolves
+struct MetadataSlot {
+    struct MetadataPrefetch *prefetch;
+    size_t index;
+};
+
+static void on_metadata_done(struct TransferRequest *req, CURLcode res, void *userdata);
+
+// Queue a HEAD (or ranged GET) request for one file of the list
+static void submit_metadata_request(struct MetadataSlot *slot, int range_probe) {
+    struct MetadataPrefetch *prefetch = slot->prefetch;
+    struct TransferRequest *req = transfer_request_new(prefetch->list->files[slot->index].url, on_metadata_done, slot);
+    if (!req) return;
+    req->head_only = !range_probe;
+    req->range_probe = range_probe;
+    req->kind = TELEMETRY_METADATA;
+    transfer_engine_submit(prefetch->engine, req);
+}
+
+// Record the response of a metadata request in its FileInfo
+static void on_metadata_done(struct TransferRequest *req, CURLcode res, void *userdata) {
+    struct MetadataSlot *slot = (struct MetadataSlot *)userdata;
+    struct MetadataPrefetch *prefetch = slot->prefetch;
+    struct FileInfo *file = &prefetch->list->files[slot->index];
+
+    long long size = req->range_probe && req->headers.range_total > 0 ? req->headers.range_total : req->content_length;
+
+    int login_page = req->headers.login_redirect || strstr(req->effective_url, "/login/index.php") != NULL;
+
+    // Some servers refuse HEAD or omit the length; retry once as a zero-length range request
+    if (!login_page && !req->range_probe &&
+        (res != CURLE_OK || req->http_code == 405 || req->http_code == 501 || size < 0)) {
+        telemetry_count(prefetch->engine->telemetry, TELEMETRY_RETRIES, 1);
+        submit_metadata_request(slot, 1);
+        return;
+    }
+
+    if (res == CURLE_OK && req->http_code < 400 && !login_page) {
+        file->size = size;
+        strncpy(file->content_type, req->content_type, sizeof(file->content_type) - 1);
+        file->content_type[sizeof(file->content_type) - 1] = '\0';
+        strncpy(file->remote_name, req->headers.filename, sizeof(file->remote_name) - 1);
+        file->remote_name[sizeof(file->remote_name) - 1] = '\0';
+        strncpy(file->etag, req->headers.etag, sizeof(file->etag) - 1);
+        file->etag[sizeof(file->etag) - 1] = '\0';
+        file->remote_mtime = req->filetime;
+        file->meta_state = META_RESOLVED;
+    } else {
+        file->meta_state = META_FAILED;
+    }
+
+    prefetch->done++;
+    if (prefetch->progress) {
+        prefetch->progress(file, prefetch->done, prefetch->total, prefetch->userdata);
+    }
+}
+
+// Resolve size, type and server-side filename of every file in the list
+size_t prefetch_file_metadata(CURL *curl, struct FileList *list, int max_parallel,
+                              metadata_progress_callback progress, void *userdata) {
+    if (!curl || !list || list->count == 0) return 0;
+
+    struct MetadataSlot *slots = malloc(list->count * sizeof(struct MetadataSlot));
+    if (!slots) {
+        welearn_log(WELEARN_LOG_ERROR, "Failed to allocate metadata prefetch slots: %s\n", strerror(errno));
+        return 0;
+    }
+
+    struct TransferEngine engine;
+    if (!transfer_engine_init(&engine, curl, max_parallel)) {
+        free(slots);
+        return 0;
+    }
+    engine.limiter = ctx()->limiter;
+    engine_use_session_settings(&engine);
+
+    struct MetadataPrefetch prefetch = {&engine, list, 0, 0, progress, userdata};
+    for (size_t i = 0; i < list->count; i++) {
+        slots[i].prefetch = &prefetch;
+        slots[i].index = i;
+        if (!list->files[i].is_folder && list->files[i].meta_state == META_UNKNOWN) {
+            prefetch.total++;
+        }
+    }
+    for (size_t i = 0; i < list->count; i++) {
+        if (!list->files[i].is_folder && list->files[i].meta_state == META_UNKNOWN) {
+            submit_metadata_request(&slots[i], 0);
+        }
+    }
+
+    double started = trace_now();
+    transfer_engine_run(&engine);
+    trace_span(ctx()->trace, "download", "metadata", started, NULL);
+    engine_finish(&engine);
+    free(slots);
+
+    size_t resolved = 0;
+    for (size_t i = 0; i < list->count; i++) {
+        if (list->files[i].meta_state == META_RESOLVED) resolved++;
+    }
+    return resolved;
+}
+
+// Re-download manifest entries that failed verification and could not be restored
+// locally. Returns how many of them were downloaded again.
+size_t redownload_failed_entries(CURL *curl, struct ContentStore *store, const struct VerifyResult *result) {
+    if (!curl || !store || !result || !result->status || result->queued == 0) return 0;
+
+    welearn_log(WELEARN_LOG_INFO, "\n--- Re-downloading %zu damaged or missing file(s) ---\n", result->queued);
+
+    struct ContentStore *previous_store = ctx()->store;
+    ctx()->store = store;
+
+    size_t attempted = 0;
+    size_t repaired = 0;
+    for (size_t i = 0; i < result->entries && i < store->manifest.count; i++) {
+        if (result->status[i] == VERIFY_OK) continue;
+
+        // Copy out: downloading records new entries and may move the manifest
+        char url[MAX_URL_LEN];
+        char relative[MAX_PATH_LEN];
+        strncpy(url, store->manifest.entries[i].url, sizeof(url) - 1);
+        url[sizeof(url) - 1] = '\0';
+        strncpy(relative, store->manifest.entries[i].path, sizeof(relative) - 1);
+        relative[sizeof(relative) - 1] = '\0';
+
+        char course_path[MAX_PATH_LEN];
+        const char *name = relative;
+        char *slash = strrchr(relative, '/');
+        if (slash) {
+            *slash = '\0';
+            name = slash + 1;
+            if (snprintf(course_path, sizeof(course_path), "%s/%s", store->root, relative) >= (int)sizeof(course_path)) {
+                welearn_log(WELEARN_LOG_ERROR, "Path too long, not re-downloading: %s/%s\n", store->root, relative);
+                continue;
+            }
+        } else {
+            snprintf(course_path, sizeof(course_path), "%s", store->root);
+        }
+        create_directory_at(ctx()->root_fd, course_path);
+
+        welearn_log(WELEARN_LOG_INFO, "\n[%zu/%zu] Re-downloading: %s\n", ++attempted, result->queued, name);
+        int outcome = download_file(curl, url, course_path, name);
+        if (outcome == DOWNLOAD_OK || outcome == DOWNLOAD_DEDUPLICATED) repaired++;
+        pace_requests(1);
+    }
+
+    ctx()->store = previous_store;
+    welearn_log(WELEARN_LOG_INFO, "\n--- Re-download Complete ---\n");
+    return repaired;
 }
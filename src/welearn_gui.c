@@ -1,9 +1,9 @@
 #include <gtk/gtk.h>
 #include "../include/welearn_common.h"
 #include "../include/welearn_auth.h"
+#include "../include/welearn_context.h"
 #include "../include/welearn_download.h"
 #include <pthread.h>
-#include <unistd.h>  // For chdir, getcwd
 
 // Application state
 typedef struct {
@@ -22,10 +22,17 @@ typedef struct {
     char username[128];
     char password[128];
     char download_path[MAX_PATH_LEN];
-    int is_downloading;
+    int is_downloading;  // Atomic: read by the UI, cleared by the download thread
     pthread_t download_thread;
+    // Worker -> UI queue, drained by a frame-clock tick while a download runs
+    struct UiLogLine *pending_log;            // Lock-free stack, newest first
+    char *pending_status;                     // Latest status not shown yet
+    struct ProgressUpdate *pending_progress;  // Latest progress not shown yet
+    guint tick_id;
 } AppState;
 
+#define LOG_VIEW_MAX_LINES 5000  // Older lines are dropped from the log view
+
 // Progress milestones
 #define PROGRESS_START 0.1
 #define PROGRESS_LOGIN 0.3
@@ -39,17 +46,17 @@ typedef struct {
     char password[128];
 } DownloadThreadData;
 
-// Data structures for idle callbacks
-typedef struct {
-    AppState *app;
-    char *message;
-} StatusUpdateData;
+// A log line posted by a worker thread
+struct UiLogLine {
+    struct UiLogLine *next;
+    char text[];
+};
 
-typedef struct {
-    AppState *app;
+// A progress bar value posted by a worker thread
+struct ProgressUpdate {
     double fraction;
     char *text;
-} ProgressUpdateData;
+};
 
 // Forward declarations
 static void append_log(AppState *app, const char *message);
@@ -57,21 +64,38 @@ static void update_status(AppState *app, const char *status);
 static void update_progress(AppState *app, double fraction, const char *text);
 static void on_folder_selected(GObject *source, GAsyncResult *result, gpointer user_data);
 
-// Append text to log view
-static void append_log(AppState *app, const char *message) {
+// Append newline-terminated lines to the log view in one insert, trim the
+// oldest lines and scroll to the bottom. UI thread only.
+static void append_log_text(AppState *app, const char *text) {
     GtkTextIter iter;
-    
+    gtk_text_buffer_get_end_iter(app->log_buffer, &iter);
+    gtk_text_buffer_insert(app->log_buffer, &iter, text, -1);
+
+    int excess = gtk_text_buffer_get_line_count(app->log_buffer) - LOG_VIEW_MAX_LINES;
+    if (excess > 0) {
+        GtkTextIter start, cut;
+        gtk_text_buffer_get_start_iter(app->log_buffer, &start);
+        gtk_text_buffer_get_iter_at_line(app->log_buffer, &cut, excess);
+        gtk_text_buffer_delete(app->log_buffer, &start, &cut);
+    }
+
+    // Auto-scroll to bottom
+    gtk_text_buffer_get_end_iter(app->log_buffer, &iter);
+    GtkTextMark *mark = gtk_text_buffer_get_mark(app->log_buffer, "log-end");
+    if (!mark) {
+        mark = gtk_text_buffer_create_mark(app->log_buffer, "log-end", &iter, FALSE);
+    } else {
+        gtk_text_buffer_move_mark(app->log_buffer, mark, &iter);
+    }
+    gtk_text_view_scroll_mark_onscreen(GTK_TEXT_VIEW(app->log_textview), mark);
+}
+
+// Append text to log view; UI thread only, workers use post_log()
+static void append_log(AppState *app, const char *message) {
     // Create message with newline to avoid iterator invalidation issues
     char *msg_with_newline = g_strdup_printf("%s\n", message);
-    
-    gtk_text_buffer_get_end_iter(app->log_buffer, &iter);
-    gtk_text_buffer_insert(app->log_buffer, &iter, msg_with_newline, -1);
-    
+    append_log_text(app, msg_with_newline);
     g_free(msg_with_newline);
-    
-    // Auto-scroll to bottom
-    GtkTextMark *mark = gtk_text_buffer_get_insert(app->log_buffer);
-    gtk_text_view_scroll_to_mark(GTK_TEXT_VIEW(app->log_textview), mark, 0.0, FALSE, 0.0, 0.0);
 }
 
 // Update status label
@@ -90,39 +114,88 @@ static void update_progress(AppState *app, double fraction, const char *text) {
     }
 }
 
-// Idle callback wrappers for thread-safe UI updates
-static gboolean idle_update_status(gpointer data) {
-    StatusUpdateData *update_data = (StatusUpdateData *)data;
-    update_status(update_data->app, update_data->message);
-    g_free(update_data->message);
-    g_free(update_data);
-    return G_SOURCE_REMOVE;
-}
-
-static gboolean idle_update_progress(gpointer data) {
-    ProgressUpdateData *update_data = (ProgressUpdateData *)data;
-    update_progress(update_data->app, update_data->fraction, update_data->text);
-    if (update_data->text) {
-        g_free(update_data->text);
+// Helper functions to post UI updates from background threads: lock-free,
+// shown on the next frame. Log lines are queued; status and progress only keep
+// the latest value.
+static void post_log(AppState *app, const char *message) {
+    size_t len = strlen(message);
+    struct UiLogLine *line = g_malloc(sizeof(struct UiLogLine) + len + 1);
+    memcpy(line->text, message, len + 1);
+    line->next = __atomic_load_n(&app->pending_log, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&app->pending_log, &line->next, line, 1,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
     }
-    g_free(update_data);
-    return G_SOURCE_REMOVE;
 }
 
-// Helper functions to schedule UI updates from background thread
 static void schedule_status_update(AppState *app, const char *status) {
-    StatusUpdateData *data = g_malloc(sizeof(StatusUpdateData));
-    data->app = app;
-    data->message = g_strdup(status);
-    g_idle_add(idle_update_status, data);
+    g_free(__atomic_exchange_n(&app->pending_status, g_strdup(status), __ATOMIC_ACQ_REL));
+}
+
+// Library log lines of the download thread, shown in the log view
+static void on_library_log(int level, const char *message, void *userdata) {
+    if (level == WELEARN_LOG_DEBUG || message[0] == '\0') return;
+    post_log((AppState *)userdata, message);
 }
 
 static void schedule_progress_update(AppState *app, double fraction, const char *text) {
-    ProgressUpdateData *data = g_malloc(sizeof(ProgressUpdateData));
-    data->app = app;
-    data->fraction = fraction;
-    data->text = text ? g_strdup(text) : NULL;
-    g_idle_add(idle_update_progress, data);
+    struct ProgressUpdate *update = g_malloc(sizeof(struct ProgressUpdate));
+    update->fraction = fraction;
+    update->text = text ? g_strdup(text) : NULL;
+    struct ProgressUpdate *old = __atomic_exchange_n(&app->pending_progress, update, __ATOMIC_ACQ_REL);
+    if (old) {
+        g_free(old->text);
+        g_free(old);
+    }
+}
+
+// Show what the workers posted since the last frame: one text insert for all
+// queued log lines, the latest status and progress
+static void flush_ui_updates(AppState *app) {
+    char *status = __atomic_exchange_n(&app->pending_status, NULL, __ATOMIC_ACQ_REL);
+    if (status) {
+        update_status(app, status);
+        g_free(status);
+    }
+    struct ProgressUpdate *progress = __atomic_exchange_n(&app->pending_progress, NULL, __ATOMIC_ACQ_REL);
+    if (progress) {
+        update_progress(app, progress->fraction, progress->text);
+        g_free(progress->text);
+        g_free(progress);
+    }
+
+    struct UiLogLine *line = __atomic_exchange_n(&app->pending_log, NULL, __ATOMIC_ACQUIRE);
+    if (!line) return;
+    struct UiLogLine *oldest_first = NULL;
+    while (line) {
+        struct UiLogLine *next = line->next;
+        line->next = oldest_first;
+        oldest_first = line;
+        line = next;
+    }
+    GString *batch = g_string_new(NULL);
+    for (line = oldest_first; line; ) {
+        struct UiLogLine *next = line->next;
+        g_string_append(batch, line->text);
+        g_string_append_c(batch, '\n');
+        g_free(line);
+        line = next;
+    }
+    append_log_text(app, batch->str);
+    g_string_free(batch, TRUE);
+}
+
+// Frame-clock tick while a download runs; stops after the last updates
+static gboolean on_ui_tick(GtkWidget *widget, GdkFrameClock *frame_clock, gpointer user_data) {
+    (void)widget;
+    (void)frame_clock;
+    AppState *app = (AppState *)user_data;
+    int finished = !__atomic_load_n(&app->is_downloading, __ATOMIC_ACQUIRE);
+    flush_ui_updates(app);
+    if (finished) {
+        app->tick_id = 0;
+        return G_SOURCE_REMOVE;
+    }
+    return G_SOURCE_CONTINUE;
 }
 
 // Download thread function
@@ -131,143 +204,82 @@ static void* download_thread_func(void *data) {
     AppState *app = thread_data->app;
     
     schedule_status_update(app, "Logging in...");
-    schedule_progress_update(app, PROGRESS_START, "Fetching login page...");
-    
-    char errbuf[CURL_ERROR_SIZE] = {0};
-    curl_easy_setopt(app->curl, CURLOPT_ERRORBUFFER, errbuf);
+    schedule_progress_update(app, PROGRESS_START, "Checking saved session...");
     
-    // Fetch login page
-    append_log(app, "Fetching login page...");
-    const char *login_url = "https://welearn.iiserkol.ac.in/login/index.php";
+    // Reuse the session in cookies.txt when the server still accepts it
+    post_log(app, "Checking saved session...");
     struct MemoryStruct login_page_content;
     init_memory_struct(&login_page_content);
-    
-    curl_easy_setopt(app->curl, CURLOPT_URL, login_url);
-    curl_easy_setopt(app->curl, CURLOPT_WRITEFUNCTION, write_memory_callback);
-    curl_easy_setopt(app->curl, CURLOPT_WRITEDATA, (void *)&login_page_content);
-    curl_easy_setopt(app->curl, CURLOPT_HTTPGET, 1L);
-    curl_easy_setopt(app->curl, CURLOPT_FAILONERROR, 0L);
-    
-    CURLcode res = curl_easy_perform(app->curl);
-    if (res != CURLE_OK) {
-        append_log(app, "Failed to fetch login page");
-        free(login_page_content.memory);
-        schedule_status_update(app, "Error: Failed to fetch login page");
-        app->is_downloading = 0;
-        free(thread_data);
-        return NULL;
-    }
-    
-    long http_code = 0;
-    curl_easy_getinfo(app->curl, CURLINFO_RESPONSE_CODE, &http_code);
-    if (http_code >= 400) {
-        append_log(app, "HTTP error fetching login page");
+    int reused = 0;
+    int login_status = welearn_resume_session(app->curl, thread_data->username, thread_data->password,
+                                              &login_page_content, &reused);
+    
+    if (login_status != LOGIN_OK) {
+        const char *reason = login_status == LOGIN_INVALID_CREDENTIALS ? "Invalid credentials" :
+                             login_status == LOGIN_NO_TOKEN ? "Failed to extract login token" :
+                             "Login request failed";
+        char err_msg[128];
+        snprintf(err_msg, sizeof(err_msg), "Error: %s", reason);
+        post_log(app, reason);
         free(login_page_content.memory);
-        schedule_status_update(app, "Error: HTTP error fetching login page");
-        app->is_downloading = 0;
+        schedule_status_update(app, err_msg);
+        __atomic_store_n(&app->is_downloading, 0, __ATOMIC_RELEASE);
         free(thread_data);
         return NULL;
     }
     
-    char *logintoken = extract_logintoken(login_page_content.memory);
-    if (!logintoken) {
-        append_log(app, "Failed to extract login token");
-        free(login_page_content.memory);
-        schedule_status_update(app, "Error: Failed to extract login token");
-        app->is_downloading = 0;
-        free(thread_data);
-        return NULL;
+    schedule_progress_update(app, PROGRESS_LOGIN, "Logged in");
+    if (reused) {
+        post_log(app, "Saved session is still valid, skipped login");
     }
-    
-    append_log(app, "Login token extracted successfully");
-    schedule_progress_update(app, PROGRESS_LOGIN, "Logging in...");
-    
-    // Perform login
-    char *escaped_username = curl_easy_escape(app->curl, thread_data->username, 0);
-    char *escaped_password = curl_easy_escape(app->curl, thread_data->password, 0);
-    
-    char post_fields[1024];
-    snprintf(post_fields, sizeof(post_fields), "username=%s&password=%s&logintoken=%s",
-             escaped_username, escaped_password, logintoken);
-    
-    free(login_page_content.memory);
-    init_memory_struct(&login_page_content);
-    
-    curl_easy_setopt(app->curl, CURLOPT_URL, login_url);
-    curl_easy_setopt(app->curl, CURLOPT_POST, 1L);
-    curl_easy_setopt(app->curl, CURLOPT_POSTFIELDS, post_fields);
-    curl_easy_setopt(app->curl, CURLOPT_WRITEFUNCTION, write_memory_callback);
-    curl_easy_setopt(app->curl, CURLOPT_WRITEDATA, (void *)&login_page_content);
-    curl_easy_setopt(app->curl, CURLOPT_REFERER, login_url);
-    
-    append_log(app, "Attempting login...");
-    res = curl_easy_perform(app->curl);
-    
-    curl_free(escaped_username);
-    curl_free(escaped_password);
-    free(logintoken);
-    
-    if (res != CURLE_OK) {
-        append_log(app, "Login request failed");
-        free(login_page_content.memory);
-        schedule_status_update(app, "Error: Login request failed");
-        app->is_downloading = 0;
-        free(thread_data);
-        return NULL;
-    }
-    
-    if (strstr(login_page_content.memory, "Invalid login, please try again") || 
-        strstr(login_page_content.memory, "loginerrors")) {
-        append_log(app, "Login failed! Invalid credentials");
+    post_log(app, "Login successful!");
+
+    // Downloads of this thread go below the chosen folder and log into the view;
+    // the process working directory is left alone
+    struct WelearnContext context;
+    welearn_context_init(&context);
+    const char *root = strlen(app->download_path) > 0 ? app->download_path : ".";
+    if (!welearn_context_open_root(&context, root)) {
+        char err_msg[MAX_PATH_LEN + 50];
+        snprintf(err_msg, sizeof(err_msg), "Error: Could not open download folder: %s", root);
+        post_log(app, err_msg);
+        schedule_status_update(app, "Error: Invalid download folder");
+        __atomic_store_n(&app->is_downloading, 0, __ATOMIC_RELEASE);
         free(login_page_content.memory);
-        schedule_status_update(app, "Error: Invalid credentials");
-        app->is_downloading = 0;
         free(thread_data);
         return NULL;
     }
-    
-    append_log(app, "Login successful!");
+    context.curl = app->curl;
+    context.log = on_library_log;
+    context.log_data = app;
+    welearn_context_bind(&context);
+
+    // Log in again transparently if the session expires during the download
+    struct WelearnSession session = {app->curl, "", "", 0};
+    snprintf(session.username, sizeof(session.username), "%s", thread_data->username);
+    snprintf(session.password, sizeof(session.password), "%s", thread_data->password);
+    download_set_session_renewal(welearn_session_renew, &session);
     schedule_status_update(app, "Extracting courses...");
     schedule_progress_update(app, PROGRESS_PROCESSING, "Processing courses...");
-    append_log(app, "Extracting and processing courses...");
-    
-    // Change to download directory
-    char original_dir[MAX_PATH_LEN];
-    if (getcwd(original_dir, sizeof(original_dir)) == NULL) {
-        append_log(app, "Warning: Could not get current directory");
-    }
-    
-    if (strlen(app->download_path) > 0 && strcmp(app->download_path, ".") != 0) {
-        if (chdir(app->download_path) != 0) {
-            char err_msg[MAX_PATH_LEN + 50];
-            snprintf(err_msg, sizeof(err_msg), "Error: Could not change to download folder: %s", app->download_path);
-            append_log(app, err_msg);
-            schedule_status_update(app, "Error: Invalid download folder");
-            app->is_downloading = 0;
-            free(login_page_content.memory);
-            free(thread_data);
-            return NULL;
-        }
+    post_log(app, "Extracting and processing courses...");
+    if (strcmp(root, ".") != 0) {
         char log_msg[MAX_PATH_LEN + 50];
-        snprintf(log_msg, sizeof(log_msg), "Downloading to: %s", app->download_path);
-        append_log(app, log_msg);
+        snprintf(log_msg, sizeof(log_msg), "Downloading to: %s", root);
+        post_log(app, log_msg);
     }
-    
+
     // Process courses
     extract_course_links_and_process(app->curl, login_page_content.memory);
-    
-    // Restore original directory
-    if (strlen(original_dir) > 0 && chdir(original_dir) != 0) {
-        append_log(app, "Warning: Could not restore original directory");
-    }
-    
+    welearn_context_bind(NULL);
+    welearn_context_cleanup(&context);
+
     free(login_page_content.memory);
     
-    append_log(app, "Download complete!");
+    post_log(app, "Download complete!");
     schedule_status_update(app, "Download complete!");
     schedule_progress_update(app, PROGRESS_COMPLETE, "Completed");
     
-    app->is_downloading = 0;
+    __atomic_store_n(&app->is_downloading, 0, __ATOMIC_RELEASE);
     free(thread_data);
     return NULL;
 }
@@ -326,7 +338,7 @@ static void on_folder_selected(GObject *source, GAsyncResult *result, gpointer u
 static void on_login_clicked(GtkButton *button, gpointer user_data) {
     AppState *app = (AppState *)user_data;
     
-    if (app->is_downloading) {
+    if (__atomic_load_n(&app->is_downloading, __ATOMIC_ACQUIRE)) {
         append_log(app, "Download already in progress!");
         return;
     }
@@ -350,9 +362,12 @@ static void on_login_clicked(GtkButton *button, gpointer user_data) {
     gtk_text_buffer_set_text(app->log_buffer, "", -1);
     
     // Start download in background thread
-    app->is_downloading = 1;
+    __atomic_store_n(&app->is_downloading, 1, __ATOMIC_RELEASE);
     update_status(app, "Logging in...");
     update_progress(app, PROGRESS_START, "Processing...");
+    if (app->tick_id == 0) {
+        app->tick_id = gtk_widget_add_tick_callback(app->window, on_ui_tick, app, NULL);
+    }
     
     DownloadThreadData *thread_data = g_malloc(sizeof(DownloadThreadData));
     thread_data->app = app;
@@ -391,6 +406,8 @@ static void activate(GtkApplication *gtk_app, gpointer user_data) {
     
     curl_easy_setopt(app->curl, CURLOPT_COOKIEJAR, "cookies.txt");
     curl_easy_setopt(app->curl, CURLOPT_COOKIEFILE, "cookies.txt");
+    // Load the jar now: the saved session is inspected before the first transfer
+    curl_easy_setopt(app->curl, CURLOPT_COOKIELIST, "RELOAD");
     curl_easy_setopt(app->curl, CURLOPT_USERAGENT, "Mozilla/5.0 (Windows NT 10.0; Win64; x64) AppleWebKit/537.36");
     curl_easy_setopt(app->curl, CURLOPT_FOLLOWLOCATION, 1L);
     curl_easy_setopt(app->curl, CURLOPT_SSL_VERIFYPEER, 1L);
@@ -503,6 +520,7 @@ static void activate(GtkApplication *gtk_app, gpointer user_data) {
 }
 
 int main(int argc, char **argv) {
+    welearn_log_set_level(WELEARN_LOG_INFO);  // The log view shows no debug lines: skip formatting them
     GtkApplication *app = gtk_application_new("com.welearn.downloader", G_APPLICATION_DEFAULT_FLAGS);
     g_signal_connect(app, "activate", G_CALLBACK(activate), NULL);
     int status = g_application_run(G_APPLICATION(app), argc, argv);
@@ -0,0 +1,306 @@
+#include "../include/welearn_logger.h"
+#include <pthread.h>
+#include <stdint.h>
+#include <time.h>
+
+#define LOGGER_PAD (-1)   // Record level filling the end of a ring
+#define LOGGER_MAX_RECORD (LOGGER_RING_SIZE / 4)
+
+// Header of a record in a ring; the NUL-terminated message follows. Records
+// are 8-byte aligned, so a pad needs only size and level to fit.
+struct LogRecord {
+    uint32_t size;    // Header and message, rounded up to 8
+    int32_t level;
+    double time;      // Seconds since logger_start
+};
+
+// Single-producer ring of one thread: the owner advances head, the flusher tail
+struct LogRing {
+    char *buf;
+    size_t head;
+    size_t tail;
+    size_t dropped;   // DEBUG records that did not fit
+    size_t drained;   // Head the current drain stops at (drain_lock)
+    int in_use;       // Owned by a live thread
+    int id;           // Thread number in JSON records
+    struct LogRing *next;
+};
+
+static struct {
+    pthread_mutex_t lock;        // Registration of rings
+    pthread_mutex_t drain_lock;  // One consumer at a time
+    pthread_mutex_t wake_lock;
+    pthread_cond_t wake;
+    int wake_pending;
+    struct LogRing *rings;       // Grows only; rings are reused, never freed
+    int ring_count;
+    pthread_t thread;
+    pthread_t owner;             // Thread that started the logger
+    int running;
+    int stop;
+    int format;
+    double started;
+    FILE *out;                   // Buffered duplicate of stderr
+    int exit_hook;
+} logger = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .drain_lock = PTHREAD_MUTEX_INITIALIZER,
+    .wake_lock = PTHREAD_MUTEX_INITIALIZER,
+    .wake = PTHREAD_COND_INITIALIZER,
+};
+
+static pthread_key_t ring_key;
+static pthread_once_t ring_key_once = PTHREAD_ONCE_INIT;
+static __thread struct LogRing *thread_ring;
+
+static double logger_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+const char *logger_level_name(int level) {
+    switch (level) {
+        case WELEARN_LOG_DEBUG: return "debug";
+        case WELEARN_LOG_INFO: return "info";
+        case WELEARN_LOG_WARN: return "warn";
+        default: return "error";
+    }
+}
+
+// Thread exit: the ring may be claimed by the next thread that logs, the
+// flusher still drains what is left in it
+static void release_ring(void *arg) {
+    struct LogRing *ring = (struct LogRing *)arg;
+    __atomic_store_n(&ring->in_use, 0, __ATOMIC_RELEASE);
+}
+
+static void make_ring_key(void) {
+    pthread_key_create(&ring_key, release_ring);
+}
+
+// The calling thread's ring, claiming a released one or adding a new one; NULL when out of memory
+static struct LogRing *current_ring(void) {
+    if (thread_ring) return thread_ring;
+    pthread_once(&ring_key_once, make_ring_key);
+
+    struct LogRing *ring = __atomic_load_n(&logger.rings, __ATOMIC_ACQUIRE);
+    for (; ring; ring = ring->next) {
+        int expected = 0;
+        if (__atomic_compare_exchange_n(&ring->in_use, &expected, 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) break;
+    }
+    if (!ring) {
+        ring = calloc(1, sizeof(*ring));
+        if (ring) ring->buf = malloc(LOGGER_RING_SIZE);
+        if (!ring || !ring->buf) {
+            free(ring);
+            return NULL;
+        }
+        ring->in_use = 1;
+        pthread_mutex_lock(&logger.lock);
+        ring->id = ++logger.ring_count;
+        ring->next = logger.rings;
+        __atomic_store_n(&logger.rings, ring, __ATOMIC_RELEASE);
+        pthread_mutex_unlock(&logger.lock);
+    }
+    pthread_setspecific(ring_key, ring);
+    thread_ring = ring;
+    return ring;
+}
+
+static void drain(void);
+
+static void wake_flusher(void) {
+    if (__atomic_exchange_n(&logger.wake_pending, 1, __ATOMIC_ACQ_REL)) return;
+    pthread_mutex_lock(&logger.wake_lock);
+    pthread_cond_signal(&logger.wake);
+    pthread_mutex_unlock(&logger.wake_lock);
+}
+
+void logger_submit(int level, const char *message, size_t len) {
+    struct LogRing *ring = __atomic_load_n(&logger.running, __ATOMIC_ACQUIRE) ? current_ring() : NULL;
+    if (!ring) {
+        fwrite(message, 1, len, level == WELEARN_LOG_INFO ? stdout : stderr);
+        return;
+    }
+    if (sizeof(struct LogRecord) + len + 1 > LOGGER_MAX_RECORD) len = LOGGER_MAX_RECORD - sizeof(struct LogRecord) - 1;
+    size_t need = (sizeof(struct LogRecord) + len + 1 + 7) & ~(size_t)7;
+    double now = logger_now() - logger.started;
+
+    for (;;) {
+        size_t head = ring->head;
+        size_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+        size_t pos = head & (LOGGER_RING_SIZE - 1);
+        size_t contiguous = LOGGER_RING_SIZE - pos;
+        size_t pad = need > contiguous ? contiguous : 0;
+        if (LOGGER_RING_SIZE - (head - tail) >= pad + need) {
+            if (pad) {
+                struct LogRecord *filler = (struct LogRecord *)(ring->buf + pos);
+                filler->size = (uint32_t)pad;
+                filler->level = LOGGER_PAD;
+                pos = 0;
+            }
+            struct LogRecord *record = (struct LogRecord *)(ring->buf + pos);
+            record->size = (uint32_t)need;
+            record->level = level;
+            record->time = now;
+            memcpy(record + 1, message, len);
+            ((char *)(record + 1))[len] = '\0';
+            __atomic_store_n(&ring->head, head + pad + need, __ATOMIC_RELEASE);
+            // Warnings and errors are written before returning, so they stay in
+            // order with what the caller prints to stderr next. So is info from
+            // the thread that started the logger, which prints to stdout itself;
+            // other threads leave theirs to the flusher.
+            if (level >= WELEARN_LOG_WARN ||
+                (level == WELEARN_LOG_INFO && pthread_equal(pthread_self(), logger.owner))) {
+                drain();
+            } else if (head + pad + need - tail > LOGGER_RING_SIZE / 2) {
+                wake_flusher();
+            }
+            return;
+        }
+        if (level == WELEARN_LOG_DEBUG) {
+            __atomic_add_fetch(&ring->dropped, 1, __ATOMIC_RELAXED);
+            wake_flusher();
+            return;
+        }
+        wake_flusher();
+        struct timespec pause = {0, 1000000L};
+        nanosleep(&pause, NULL);
+    }
+}
+
+static void write_record(int level, double time, int thread, char *text) {
+    if (level == WELEARN_LOG_INFO) {  // Progress for the user, as logged
+        fputs(text, stdout);
+        return;
+    }
+    if (logger.format == LOGGER_TEXT) {
+        fputs(text, logger.out);
+        return;
+    }
+    text += strspn(text, "\n");
+    size_t len = strlen(text);
+    while (len > 0 && text[len - 1] == '\n') text[--len] = '\0';
+    if (len == 0) return;
+    fprintf(logger.out, "{\"t\":%.6f,\"level\":\"%s\",\"thread\":%d,\"msg\":", time, logger_level_name(level), thread);
+    fprint_json_string(logger.out, text);
+    fputs("}\n", logger.out);
+}
+
+// Skip the pad at the tail of a ring; the record there, or NULL when the ring is drained up to head
+static struct LogRecord *next_record(struct LogRing *ring, size_t head) {
+    while (ring->tail != head) {
+        struct LogRecord *record = (struct LogRecord *)(ring->buf + (ring->tail & (LOGGER_RING_SIZE - 1)));
+        if (record->level != LOGGER_PAD) return record;
+        __atomic_store_n(&ring->tail, ring->tail + record->size, __ATOMIC_RELEASE);
+    }
+    return NULL;
+}
+
+// Write every record published so far, oldest first across threads
+static void drain(void) {
+    pthread_mutex_lock(&logger.drain_lock);
+    if (!logger.out) {  // Stopped meanwhile
+        pthread_mutex_unlock(&logger.drain_lock);
+        return;
+    }
+    struct LogRing *first = __atomic_load_n(&logger.rings, __ATOMIC_ACQUIRE);
+    for (struct LogRing *ring = first; ring; ring = ring->next) {
+        size_t dropped = __atomic_exchange_n(&ring->dropped, 0, __ATOMIC_RELAXED);
+        if (dropped == 0) continue;
+        char note[128];
+        snprintf(note, sizeof(note), "%zu debug line(s) dropped, the log could not keep up\n", dropped);
+        write_record(WELEARN_LOG_WARN, logger_now() - logger.started, ring->id, note);
+    }
+
+    // Heads are read once, records published later wait for the next pass
+    for (struct LogRing *ring = first; ring; ring = ring->next) {
+        ring->drained = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    }
+    for (;;) {
+        struct LogRing *oldest = NULL;
+        struct LogRecord *record = NULL;
+        for (struct LogRing *ring = first; ring; ring = ring->next) {
+            struct LogRecord *candidate = next_record(ring, ring->drained);
+            if (candidate && (!record || candidate->time < record->time)) {
+                oldest = ring;
+                record = candidate;
+            }
+        }
+        if (!record) break;
+        write_record(record->level, record->time, oldest->id, (char *)(record + 1));
+        __atomic_store_n(&oldest->tail, oldest->tail + record->size, __ATOMIC_RELEASE);
+    }
+    fflush(logger.out);
+    pthread_mutex_unlock(&logger.drain_lock);
+}
+
+static void *flusher_thread(void *arg) {
+    (void)arg;
+    for (;;) {
+        pthread_mutex_lock(&logger.wake_lock);
+        if (!logger.stop && !__atomic_load_n(&logger.wake_pending, __ATOMIC_ACQUIRE)) {
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_nsec += LOGGER_FLUSH_MS * 1000000L;
+            if (deadline.tv_nsec >= 1000000000L) {
+                deadline.tv_sec++;
+                deadline.tv_nsec -= 1000000000L;
+            }
+            pthread_cond_timedwait(&logger.wake, &logger.wake_lock, &deadline);
+        }
+        int stop = logger.stop;
+        __atomic_store_n(&logger.wake_pending, 0, __ATOMIC_RELEASE);
+        pthread_mutex_unlock(&logger.wake_lock);
+        drain();
+        if (stop) return NULL;
+    }
+}
+
+int logger_start(int format) {
+    if (__atomic_load_n(&logger.running, __ATOMIC_ACQUIRE)) return 0;
+    int fd = dup(STDERR_FILENO);
+    logger.out = fd >= 0 ? fdopen(fd, "w") : NULL;
+    if (!logger.out) {
+        if (fd >= 0) close(fd);
+        fprintf(stderr, "Warning: Cannot start the logger, logging synchronously\n");
+        return -1;
+    }
+    setvbuf(logger.out, NULL, _IOFBF, 64 * 1024);
+    logger.format = format;
+    logger.started = logger_now();
+    logger.owner = pthread_self();
+    logger.stop = 0;
+    if (pthread_create(&logger.thread, NULL, flusher_thread, NULL) != 0) {
+        fclose(logger.out);
+        logger.out = NULL;
+        fprintf(stderr, "Warning: Cannot start the logger, logging synchronously\n");
+        return -1;
+    }
+    __atomic_store_n(&logger.running, 1, __ATOMIC_RELEASE);
+    if (!logger.exit_hook) {
+        atexit(logger_stop);
+        logger.exit_hook = 1;
+    }
+    return 0;
+}
+
+void logger_stop(void) {
+    if (!__atomic_load_n(&logger.running, __ATOMIC_ACQUIRE)) return;
+    __atomic_store_n(&logger.running, 0, __ATOMIC_RELEASE);
+    pthread_mutex_lock(&logger.wake_lock);
+    logger.stop = 1;
+    pthread_cond_signal(&logger.wake);
+    pthread_mutex_unlock(&logger.wake_lock);
+    pthread_join(logger.thread, NULL);
+    drain();
+    pthread_mutex_lock(&logger.drain_lock);
+    fclose(logger.out);
+    logger.out = NULL;
+    pthread_mutex_unlock(&logger.drain_lock);
+}
+
+void logger_flush(void) {
+    if (__atomic_load_n(&logger.running, __ATOMIC_ACQUIRE)) drain();
+}
@@ -0,0 +1,227 @@
+#include "../include/welearn_metrics.h"
+#include "../include/welearn_download.h"
+#include <errno.h>
+#include <poll.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+// Upper bounds of the request duration histogram, in seconds
+static const double duration_buckets[] = {0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10, 30};
+static const char *status_names[TELEMETRY_STATUS_COUNT] = {"error", "1xx", "2xx", "3xx", "4xx", "5xx"};
+
+static void write_header(FILE *fp, const char *name, const char *type, const char *help) {
+    fprintf(fp, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+// Called with t->lock held
+static void write_metrics_locked(struct Telemetry *t, time_t started, FILE *fp) {
+    write_header(fp, "welearn_requests_total", "counter", "HTTP requests by kind and status class.");
+    for (int k = 0; k < TELEMETRY_KIND_COUNT; k++) {
+        for (int s = 0; s < TELEMETRY_STATUS_COUNT; s++) {
+            if (t->kinds[k].status[s] == 0) continue;
+            fprintf(fp, "welearn_requests_total{kind=\"%s\",status=\"%s\"} %zu\n",
+                    telemetry_kind_name(k), status_names[s], t->kinds[k].status[s]);
+        }
+    }
+
+    write_header(fp, "welearn_received_bytes_total", "counter", "Response body bytes received by request kind.");
+    for (int k = 0; k < TELEMETRY_KIND_COUNT; k++) {
+        fprintf(fp, "welearn_received_bytes_total{kind=\"%s\"} %lld\n", telemetry_kind_name(k), t->kinds[k].bytes);
+    }
+
+    write_header(fp, "welearn_request_duration_seconds", "histogram", "Total time of requests by kind.");
+    size_t bucket_count = sizeof(duration_buckets) / sizeof(duration_buckets[0]);
+    for (int k = 0; k < TELEMETRY_KIND_COUNT; k++) {
+        const struct LatencyHistogram *h = &t->kinds[k].phases[TELEMETRY_TOTAL];
+        if (h->count == 0) continue;
+        const char *kind = telemetry_kind_name(k);
+        for (size_t b = 0; b < bucket_count; b++) {
+            fprintf(fp, "welearn_request_duration_seconds_bucket{kind=\"%s\",le=\"%g\"} %llu\n", kind,
+                    duration_buckets[b],
+                    (unsigned long long)latency_histogram_count_at_most(h, (long long)(duration_buckets[b] * 1e6)));
+        }
+        fprintf(fp, "welearn_request_duration_seconds_bucket{kind=\"%s\",le=\"+Inf\"} %llu\n", kind,
+                (unsigned long long)h->count);
+        fprintf(fp, "welearn_request_duration_seconds_sum{kind=\"%s\"} %.6f\n", kind, h->sum / 1e6);
+        fprintf(fp, "welearn_request_duration_seconds_count{kind=\"%s\"} %llu\n", kind, (unsigned long long)h->count);
+    }
+
+    write_header(fp, "welearn_files_total", "counter", "Finished files by outcome.");
+    for (int o = 0; o < TELEMETRY_OUTCOME_COUNT; o++) {
+        fprintf(fp, "welearn_files_total{outcome=\"%s\"} %zu\n", download_outcome_name(o), t->outcomes[o].files);
+    }
+    write_header(fp, "welearn_file_bytes_total", "counter", "Body bytes received for finished files by outcome.");
+    for (int o = 0; o < TELEMETRY_OUTCOME_COUNT; o++) {
+        fprintf(fp, "welearn_file_bytes_total{outcome=\"%s\"} %lld\n", download_outcome_name(o), t->outcomes[o].bytes);
+    }
+    write_header(fp, "welearn_saved_bytes_total", "counter",
+                 "Bytes not transferred or stored again thanks to 304 answers and deduplication.");
+    fprintf(fp, "welearn_saved_bytes_total{outcome=\"%s\"} %lld\n", download_outcome_name(DOWNLOAD_UNCHANGED),
+            t->outcomes[DOWNLOAD_UNCHANGED].saved_bytes);
+    fprintf(fp, "welearn_saved_bytes_total{outcome=\"%s\"} %lld\n", download_outcome_name(DOWNLOAD_DEDUPLICATED),
+            t->outcomes[DOWNLOAD_DEDUPLICATED].saved_bytes);
+
+    write_header(fp, "welearn_retries_total", "counter", "Requests sent again after a re-login or a refused HEAD.");
+    fprintf(fp, "welearn_retries_total %zu\n", t->counters[TELEMETRY_RETRIES]);
+    write_header(fp, "welearn_relogins_total", "counter", "Session renewals after the server logged the client out.");
+    fprintf(fp, "welearn_relogins_total %zu\n", t->counters[TELEMETRY_RELOGINS]);
+    write_header(fp, "welearn_limiter_wait_seconds_total", "counter",
+                 "Time requests were held back waiting for rate-limiter tokens.");
+    fprintf(fp, "welearn_limiter_wait_seconds_total %.6f\n", t->limiter_wait);
+
+    write_header(fp, "welearn_active_transfers", "gauge", "Transfers in flight.");
+    fprintf(fp, "welearn_active_transfers %d\n", t->active);
+    write_header(fp, "welearn_queued_requests", "gauge", "Requests waiting in transfer engine queues.");
+    fprintf(fp, "welearn_queued_requests %d\n", t->queued);
+    write_header(fp, "welearn_start_time_seconds", "gauge", "Start of the run, seconds since the epoch.");
+    fprintf(fp, "welearn_start_time_seconds %lld\n", (long long)started);
+}
+
+void metrics_write(struct Telemetry *t, time_t started, FILE *fp) {
+    pthread_mutex_lock(&t->lock);
+    write_metrics_locked(t, started, fp);
+    pthread_mutex_unlock(&t->lock);
+}
+
+// The metrics as one string, rendered under the lock; NULL when out of memory
+static char *render_metrics(struct Telemetry *t, time_t started, size_t *len) {
+    char *text = NULL;
+    FILE *fp = open_memstream(&text, len);
+    if (!fp) return NULL;
+    metrics_write(t, started, fp);
+    if (fclose(fp) != 0) {
+        free(text);
+        return NULL;
+    }
+    return text;
+}
+
+int metrics_write_file(struct Telemetry *t, time_t started, const char *path) {
+    char temp_path[MAX_PATH_LEN];
+    snprintf(temp_path, sizeof(temp_path), "%s.tmp", path);
+    FILE *fp = fopen(temp_path, "w");
+    if (!fp) {
+        welearn_log(WELEARN_LOG_ERROR, "Cannot write metrics to %s: %s\n", temp_path, strerror(errno));
+        return -1;
+    }
+    metrics_write(t, started, fp);
+    if (fclose(fp) != 0 || rename(temp_path, path) != 0) {
+        welearn_log(WELEARN_LOG_ERROR, "Cannot write metrics to %s: %s\n", path, strerror(errno));
+        unlink(temp_path);
+        return -1;
+    }
+    return 0;
+}
+
+// Answer one scrape: /metrics (or /) with the metrics, anything else with 404
+static void serve_scrape(struct MetricsExporter *m, int fd) {
+    struct timeval timeout = {1, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    char request[1024];
+    ssize_t n = recv(fd, request, sizeof(request) - 1, 0);
+    if (n <= 0) return;
+    request[n] = '\0';
+
+    int found = strncmp(request, "GET /metrics ", 13) == 0 || strncmp(request, "GET / ", 6) == 0;
+    size_t len = 0;
+    char *body = found ? render_metrics(m->telemetry, m->started, &len) : NULL;
+    char header[256];
+    int header_len;
+    if (body) {
+        header_len = snprintf(header, sizeof(header),
+                              "HTTP/1.1 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\n"
+                              "Content-Length: %zu\r\nConnection: close\r\n\r\n", len);
+    } else {
+        header_len = snprintf(header, sizeof(header),
+                              "HTTP/1.1 %s\r\nContent-Length: 0\r\nConnection: close\r\n\r\n",
+                              found ? "500 Internal Server Error" : "404 Not Found");
+    }
+    send(fd, header, (size_t)header_len, MSG_NOSIGNAL);
+    for (size_t sent = 0; body && sent < len; ) {
+        ssize_t w = send(fd, body + sent, len - sent, MSG_NOSIGNAL);
+        if (w <= 0) break;
+        sent += (size_t)w;
+    }
+    free(body);
+}
+
+static void *exporter_thread(void *arg) {
+    struct MetricsExporter *m = (struct MetricsExporter *)arg;
+    time_t next_write = time(NULL) + METRICS_FILE_INTERVAL;
+    while (!__atomic_load_n(&m->stop, __ATOMIC_ACQUIRE)) {
+        if (m->listen_fd >= 0) {
+            struct pollfd pfd = {m->listen_fd, POLLIN, 0};
+            if (poll(&pfd, 1, 250) > 0) {
+                int fd = accept(m->listen_fd, NULL, NULL);
+                if (fd >= 0) {
+                    serve_scrape(m, fd);
+                    close(fd);
+                }
+            }
+        } else {
+            struct timespec ts = {0, 250000000L};
+            nanosleep(&ts, NULL);
+        }
+        if (m->path && time(NULL) >= next_write) {
+            metrics_write_file(m->telemetry, m->started, m->path);
+            next_write = time(NULL) + METRICS_FILE_INTERVAL;
+        }
+    }
+    return NULL;
+}
+
+// Listen on 127.0.0.1:port; -1 on error
+static int open_listener(int port) {
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+    int on = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons((uint16_t)port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(fd, 8) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int metrics_exporter_start(struct MetricsExporter *m, struct Telemetry *t, const char *path, int port) {
+    memset(m, 0, sizeof(*m));
+    m->telemetry = t;
+    m->path = path;
+    m->port = port;
+    m->listen_fd = -1;
+    m->started = time(NULL);
+
+    int rc = 0;
+    if (port > 0) {
+        m->listen_fd = open_listener(port);
+        if (m->listen_fd < 0) {
+            welearn_log(WELEARN_LOG_ERROR, "Cannot serve metrics on 127.0.0.1:%d: %s\n", port, strerror(errno));
+            rc = -1;
+            if (!path) return rc;  // The file, if any, is still kept up to date
+        }
+    }
+    if (path) metrics_write_file(t, m->started, path);
+    m->thread_started = pthread_create(&m->thread, NULL, exporter_thread, m) == 0;
+    if (!m->thread_started) {
+        welearn_log(WELEARN_LOG_ERROR, "Cannot start the metrics thread\n");
+        return -1;
+    }
+    return rc;
+}
+
+void metrics_exporter_stop(struct MetricsExporter *m) {
+    if (m->thread_started) {
+        __atomic_store_n(&m->stop, 1, __ATOMIC_RELEASE);
+        pthread_join(m->thread, NULL);
+        m->thread_started = 0;
+    }
+    if (m->listen_fd >= 0) close(m->listen_fd);
+    m->listen_fd = -1;
+    if (m->path) metrics_write_file(m->telemetry, m->started, m->path);
+}
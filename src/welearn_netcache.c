@@ -0,0 +1,355 @@
+#include "../include/welearn_netcache.h"
+#include <errno.h>
+#include <fcntl.h>
+
+// Cache file, one record per line (tab separated):
+//   dns  <host> <port> <ip> <expires>
+//   tls  <expires> <session key> <hex shmac> <hex session data>
+
+static void free_ticket(struct NetCacheTicket *ticket) {
+    free(ticket->shmac);
+    free(ticket->sdata);
+    memset(ticket, 0, sizeof(*ticket));
+}
+
+static void hex_encode(FILE *fp, const unsigned char *data, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        fprintf(fp, "%02x", data[i]);
+    }
+}
+
+// Decode hex into a new buffer; returns NULL on malformed input
+static unsigned char *hex_decode(const char *hex, size_t *out_len) {
+    size_t len = strlen(hex);
+    if (len % 2 != 0 || len / 2 > NETCACHE_MAX_TICKET) return NULL;
+    unsigned char *out = malloc(len / 2 + 1);
+    if (!out) return NULL;
+    for (size_t i = 0; i < len / 2; i++) {
+        unsigned int byte;
+        if (sscanf(hex + 2 * i, "%2x", &byte) != 1) {
+            free(out);
+            return NULL;
+        }
+        out[i] = (unsigned char)byte;
+    }
+    *out_len = len / 2;
+    return out;
+}
+
+// Rebuild the CURLOPT_RESOLVE list from the unexpired host entries
+static void rebuild_resolve(struct NetCache *cache) {
+    curl_slist_free_all(cache->resolve);
+    cache->resolve = NULL;
+
+    time_t now = time(NULL);
+    for (size_t i = 0; i < cache->host_count; i++) {
+        const struct NetCacheHost *h = &cache->hosts[i];
+        if (h->expires <= now) continue;
+        // "+" lets libcurl expire the entry like a normal DNS result, so a
+        // stale address is looked up again instead of being pinned
+        char entry[384];
+        if (strchr(h->ip, ':')) {
+            snprintf(entry, sizeof(entry), "+%s:%ld:[%s]", h->host, h->port, h->ip);
+        } else {
+            snprintf(entry, sizeof(entry), "+%s:%ld:%s", h->host, h->port, h->ip);
+        }
+        struct curl_slist *tmp = curl_slist_append(cache->resolve, entry);
+        if (tmp) cache->resolve = tmp;
+    }
+}
+
+#if NETCACHE_HAVE_TLS
+// Keep one exported TLS session, replacing an older one with the same key
+static CURLcode store_ticket(CURL *handle, void *userptr, const char *session_key,
+                             const unsigned char *shmac, size_t shmac_len,
+                             const unsigned char *sdata, size_t sdata_len,
+                             curl_off_t valid_until, int ietf_tls_id, const char *alpn,
+                             size_t earlydata_max) {
+    (void)handle;
+    (void)ietf_tls_id;
+    (void)alpn;
+    (void)earlydata_max;
+    struct NetCache *cache = (struct NetCache *)userptr;
+    if (!session_key || strlen(session_key) >= sizeof(cache->tickets[0].session_key) ||
+        strchr(session_key, '\t') || strchr(session_key, '\n') || sdata_len > NETCACHE_MAX_TICKET) {
+        return CURLE_OK;
+    }
+
+    size_t slot = cache->ticket_count;
+    for (size_t i = 0; i < cache->ticket_count; i++) {
+        if (strcmp(cache->tickets[i].session_key, session_key) == 0) {
+            slot = i;
+            break;
+        }
+    }
+    if (slot == NETCACHE_MAX_TLS) return CURLE_OK;
+
+    unsigned char *mac_copy = malloc(shmac_len + 1);
+    unsigned char *data_copy = malloc(sdata_len + 1);
+    if (!mac_copy || !data_copy) {
+        free(mac_copy);
+        free(data_copy);
+        return CURLE_OUT_OF_MEMORY;
+    }
+    memcpy(mac_copy, shmac, shmac_len);
+    memcpy(data_copy, sdata, sdata_len);
+
+    struct NetCacheTicket *ticket = &cache->tickets[slot];
+    if (slot < cache->ticket_count) {
+        free_ticket(ticket);
+    } else {
+        cache->ticket_count++;
+    }
+    snprintf(ticket->session_key, sizeof(ticket->session_key), "%s", session_key);
+    ticket->shmac = mac_copy;
+    ticket->shmac_len = shmac_len;
+    ticket->sdata = data_copy;
+    ticket->sdata_len = sdata_len;
+    ticket->expires = valid_until > 0 ? (time_t)valid_until : time(NULL) + NETCACHE_DNS_TTL;
+    return CURLE_OK;
+}
+
+static void import_tickets(struct NetCache *cache, CURL *curl) {
+    time_t now = time(NULL);
+    for (size_t i = 0; i < cache->ticket_count; i++) {
+        const struct NetCacheTicket *t = &cache->tickets[i];
+        if (t->expires <= now) continue;
+        curl_easy_ssls_import(curl, t->session_key, t->shmac, t->shmac_len, t->sdata, t->sdata_len);
+    }
+}
+#endif
+
+static void lock_share(CURL *handle, curl_lock_data data, curl_lock_access access, void *userptr) {
+    (void)handle;
+    (void)access;
+    pthread_mutex_lock(&((struct NetCache *)userptr)->locks[data]);
+}
+
+static void unlock_share(CURL *handle, curl_lock_data data, void *userptr) {
+    (void)handle;
+    pthread_mutex_unlock(&((struct NetCache *)userptr)->locks[data]);
+}
+
+// Load the cache file (a missing file is an empty cache) and create the share
+int net_cache_load(struct NetCache *cache, const char *path) {
+    if (!cache) return 0;
+    memset(cache, 0, sizeof(*cache));
+    snprintf(cache->path, sizeof(cache->path), "%s", path ? path : NETCACHE_FILE);
+
+    for (int i = 0; i < CURL_LOCK_DATA_LAST; i++) {
+        pthread_mutex_init(&cache->locks[i], NULL);
+    }
+    pthread_mutex_init(&cache->lock, NULL);
+    cache->share = curl_share_init();
+    if (cache->share) {
+        curl_share_setopt(cache->share, CURLSHOPT_LOCKFUNC, lock_share);
+        curl_share_setopt(cache->share, CURLSHOPT_UNLOCKFUNC, unlock_share);
+        curl_share_setopt(cache->share, CURLSHOPT_USERDATA, cache);
+        curl_share_setopt(cache->share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+        curl_share_setopt(cache->share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+        curl_share_setopt(cache->share, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+    }
+
+    FILE *fp = fopen(cache->path, "r");
+    if (!fp) return 1;
+
+    time_t now = time(NULL);
+    char *line = NULL;
+    size_t line_cap = 0;
+    while (getline(&line, &line_cap, fp) != -1) {
+        line[strcspn(line, "\r\n")] = '\0';
+        char *fields[6] = {0};
+        int n = 0;
+        for (char *save = NULL, *tok = strtok_r(line, "\t", &save); tok && n < 6;
+             tok = strtok_r(NULL, "\t", &save)) {
+            fields[n++] = tok;
+        }
+
+        if (n == 5 && strcmp(fields[0], "dns") == 0 && cache->host_count < NETCACHE_MAX_DNS) {
+            struct NetCacheHost *h = &cache->hosts[cache->host_count];
+            h->expires = (time_t)strtoll(fields[4], NULL, 10);
+            h->port = strtol(fields[2], NULL, 10);
+            if (h->expires <= now || h->port <= 0) continue;
+            snprintf(h->host, sizeof(h->host), "%s", fields[1]);
+            snprintf(h->ip, sizeof(h->ip), "%s", fields[3]);
+            cache->host_count++;
+        } else if (n == 5 && strcmp(fields[0], "tls") == 0 && cache->ticket_count < NETCACHE_MAX_TLS) {
+            struct NetCacheTicket *t = &cache->tickets[cache->ticket_count];
+            t->expires = (time_t)strtoll(fields[1], NULL, 10);
+            if (t->expires <= now || strlen(fields[2]) >= sizeof(t->session_key)) continue;
+            t->shmac = hex_decode(fields[3], &t->shmac_len);
+            t->sdata = hex_decode(fields[4], &t->sdata_len);
+            if (!t->shmac || !t->sdata) {
+                free_ticket(t);
+                continue;
+            }
+            snprintf(t->session_key, sizeof(t->session_key), "%s", fields[2]);
+            cache->ticket_count++;
+        }
+    }
+    free(line);
+    fclose(fp);
+
+    rebuild_resolve(cache);
+    return 1;
+}
+
+// Attach a handle to the cached addresses and TLS sessions
+void net_cache_apply(struct NetCache *cache, CURL *curl) {
+    if (!cache || !curl) return;
+    if (cache->share) curl_easy_setopt(curl, CURLOPT_SHARE, cache->share);
+    if (cache->resolve) curl_easy_setopt(curl, CURLOPT_RESOLVE, cache->resolve);
+#if NETCACHE_HAVE_TLS
+    pthread_mutex_lock(&cache->lock);
+    import_tickets(cache, curl);
+    pthread_mutex_unlock(&cache->lock);
+#endif
+}
+
+// Load the cached TLS sessions into another share (e.g. a transfer engine's)
+void net_cache_seed_share(struct NetCache *cache, CURLSH *share) {
+#if NETCACHE_HAVE_TLS
+    if (!cache || !share || cache->ticket_count == 0) return;
+    CURL *seed = curl_easy_init();
+    if (!seed) return;
+    curl_easy_setopt(seed, CURLOPT_SHARE, share);
+    pthread_mutex_lock(&cache->lock);
+    import_tickets(cache, seed);
+    pthread_mutex_unlock(&cache->lock);
+    curl_easy_cleanup(seed);
+#else
+    (void)cache;
+    (void)share;
+#endif
+}
+
+// Remember the address and TLS sessions of a handle's last transfer
+void net_cache_record(struct NetCache *cache, CURL *curl) {
+    if (!cache || !curl) return;
+
+    char *effective_url = NULL;
+    char *ip = NULL;
+    long port = 0;
+    curl_easy_getinfo(curl, CURLINFO_EFFECTIVE_URL, &effective_url);
+    curl_easy_getinfo(curl, CURLINFO_PRIMARY_IP, &ip);
+    curl_easy_getinfo(curl, CURLINFO_PRIMARY_PORT, &port);
+
+    char *host = NULL;
+    CURLU *url = curl_url();
+    pthread_mutex_lock(&cache->lock);
+    if (url && effective_url && ip && ip[0] && port > 0 &&
+        curl_url_set(url, CURLUPART_URL, effective_url, 0) == CURLUE_OK &&
+        curl_url_get(url, CURLUPART_HOST, &host, 0) == CURLUE_OK && host[0] != '[' &&
+        strlen(host) < sizeof(cache->hosts[0].host) && strlen(ip) < sizeof(cache->hosts[0].ip)) {
+        size_t slot = cache->host_count;
+        for (size_t i = 0; i < cache->host_count; i++) {
+            if (strcmp(cache->hosts[i].host, host) == 0 && cache->hosts[i].port == port) {
+                slot = i;
+                break;
+            }
+        }
+        if (slot < NETCACHE_MAX_DNS) {
+            struct NetCacheHost *h = &cache->hosts[slot];
+            snprintf(h->host, sizeof(h->host), "%s", host);
+            snprintf(h->ip, sizeof(h->ip), "%s", ip);
+            h->port = port;
+            h->expires = time(NULL) + NETCACHE_DNS_TTL;
+            if (slot == cache->host_count) cache->host_count++;
+        }
+    }
+    curl_free(host);
+    curl_url_cleanup(url);
+
+#if NETCACHE_HAVE_TLS
+    curl_easy_ssls_export(curl, store_ticket, cache);
+#endif
+    pthread_mutex_unlock(&cache->lock);
+}
+
+// Collect the TLS sessions negotiated by the handles of another share
+void net_cache_collect_share(struct NetCache *cache, CURLSH *share) {
+#if NETCACHE_HAVE_TLS
+    if (!cache || !share) return;
+    CURL *seed = curl_easy_init();
+    if (!seed) return;
+    curl_easy_setopt(seed, CURLOPT_SHARE, share);
+    pthread_mutex_lock(&cache->lock);
+    curl_easy_ssls_export(seed, store_ticket, cache);
+    pthread_mutex_unlock(&cache->lock);
+    curl_easy_cleanup(seed);
+#else
+    (void)cache;
+    (void)share;
+#endif
+}
+
+// Write the unexpired entries back (via a temporary file so a crash never truncates it)
+int net_cache_save(struct NetCache *cache) {
+    if (!cache || !cache->path[0]) return 0;
+
+    char tmp_path[MAX_PATH_LEN + 8];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", cache->path);
+    // Session tickets resume a logged-in TLS session: the file is private from
+    // the start, not after a window in which others could open it
+    int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    FILE *fp = fd >= 0 ? fdopen(fd, "w") : NULL;
+    if (!fp) {
+        welearn_log(WELEARN_LOG_ERROR, "Failed to write network cache %s: %s\n", tmp_path, strerror(errno));
+        if (fd >= 0) {
+            close(fd);
+            remove(tmp_path);
+        }
+        return 0;
+    }
+    fchmod(fd, 0600);  // An existing temp file keeps its old mode on O_CREAT
+
+    time_t now = time(NULL);
+    for (size_t i = 0; i < cache->host_count; i++) {
+        const struct NetCacheHost *h = &cache->hosts[i];
+        if (h->expires <= now) continue;
+        fprintf(fp, "dns\t%s\t%ld\t%s\t%lld\n", h->host, h->port, h->ip, (long long)h->expires);
+    }
+    for (size_t i = 0; i < cache->ticket_count; i++) {
+        const struct NetCacheTicket *t = &cache->tickets[i];
+        if (t->expires <= now) continue;
+        fprintf(fp, "tls\t%lld\t%s\t", (long long)t->expires, t->session_key);
+        hex_encode(fp, t->shmac, t->shmac_len);
+        fputc('\t', fp);
+        hex_encode(fp, t->sdata, t->sdata_len);
+        fputc('\n', fp);
+    }
+
+    int failed = ferror(fp);
+    if (fclose(fp) != 0 || failed) {
+        welearn_log(WELEARN_LOG_ERROR, "Failed to write network cache %s: %s\n", tmp_path,
+                    failed ? "write error" : strerror(errno));
+        remove(tmp_path);
+        return 0;
+    }
+    if (rename(tmp_path, cache->path) != 0) {
+        welearn_log(WELEARN_LOG_ERROR, "Failed to replace network cache %s: %s\n", cache->path, strerror(errno));
+        remove(tmp_path);
+        return 0;
+    }
+    return 1;
+}
+
+// Release the cache; handles attached with net_cache_apply must be cleaned up first
+void net_cache_free(struct NetCache *cache) {
+    if (!cache) return;
+    for (size_t i = 0; i < cache->ticket_count; i++) {
+        free_ticket(&cache->tickets[i]);
+    }
+    cache->ticket_count = 0;
+    cache->host_count = 0;
+    curl_slist_free_all(cache->resolve);
+    cache->resolve = NULL;
+    if (cache->share) {
+        curl_share_cleanup(cache->share);
+        cache->share = NULL;
+    }
+    for (int i = 0; i < CURL_LOCK_DATA_LAST; i++) {
+        pthread_mutex_destroy(&cache->locks[i]);
+    }
+    pthread_mutex_destroy(&cache->lock);
+}
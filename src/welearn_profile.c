@@ -0,0 +1,128 @@
+#include "../include/welearn_profile.h"
+
+#ifdef WELEARN_PROFILE
+
+#include <pthread.h>
+#include <stdlib.h>
+
+#define PROFILE_CPU 0
+#define PROFILE_DISK 1
+#define PROFILE_SLEEP 2
+
+static const struct {
+    const char *name;
+    int category;
+} scope_info[PROFILE_SCOPE_COUNT] = {
+    {"parse.links", PROFILE_CPU},
+    {"parse.courses", PROFILE_CPU},
+    {"parse.headers", PROFILE_CPU},
+    {"buffer.grow", PROFILE_CPU},
+    {"filelist.append", PROFILE_CPU},
+    {"fs.mkdir", PROFILE_DISK},
+    {"fs.stat", PROFILE_DISK},
+    {"fs.open", PROFILE_DISK},
+    {"limiter.wait", PROFILE_SLEEP},
+    {"pace.sleep", PROFILE_SLEEP},
+};
+static const char *category_names[] = {"cpu", "disk", "sleep"};
+
+struct ProfileCounter {
+    uint64_t calls;
+    uint64_t total_ns;
+    uint64_t max_ns;
+    long long amount;
+};
+
+// One per thread that ever entered a scope; kept until exit so the counts of
+// finished threads still show up in the dump
+struct ProfileThread {
+    struct ProfileCounter counters[PROFILE_SCOPE_COUNT];
+    struct ProfileThread *next;
+};
+
+static pthread_mutex_t threads_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct ProfileThread *threads = NULL;
+static size_t thread_count = 0;
+static uint64_t first_use = 0;
+static pthread_once_t dump_once = PTHREAD_ONCE_INIT;
+static __thread struct ProfileThread *current = NULL;
+
+static void dump_at_exit(void) {
+    const char *path = getenv("WELEARN_PROFILE_OUT");
+    FILE *fp = path && path[0] ? fopen(path, "a") : NULL;
+    fflush(stdout);  // Keep the table after the run's own output
+    profile_dump(fp ? fp : stderr);
+    if (fp) fclose(fp);
+}
+
+static void register_dump(void) {
+    atexit(dump_at_exit);
+}
+
+static struct ProfileThread *thread_table(void) {
+    if (current) return current;
+    struct ProfileThread *table = calloc(1, sizeof(struct ProfileThread));
+    if (!table) return NULL;
+    pthread_once(&dump_once, register_dump);
+    pthread_mutex_lock(&threads_lock);
+    if (!first_use) first_use = profile_now();
+    table->next = threads;
+    threads = table;
+    thread_count++;
+    pthread_mutex_unlock(&threads_lock);
+    current = table;
+    return table;
+}
+
+void profile_span_end(struct ProfileSpan *span) {
+    uint64_t elapsed = profile_now() - span->start;
+    struct ProfileThread *table = thread_table();
+    if (!table) return;
+    struct ProfileCounter *counter = &table->counters[span->scope];
+    counter->calls++;
+    counter->total_ns += elapsed;
+    if (elapsed > counter->max_ns) counter->max_ns = elapsed;
+}
+
+void profile_count(int scope, long long amount) {
+    struct ProfileThread *table = thread_table();
+    if (table) table->counters[scope].amount += amount;
+}
+
+// Sum of every thread's counters per scope, then per category. Threads still
+// running may be mid-update; the dump is meant for the end of a run.
+void profile_dump(FILE *fp) {
+    struct ProfileCounter sums[PROFILE_SCOPE_COUNT] = {{0}};
+    double category_ms[3] = {0};
+
+    pthread_mutex_lock(&threads_lock);
+    for (struct ProfileThread *t = threads; t; t = t->next) {
+        for (int s = 0; s < PROFILE_SCOPE_COUNT; s++) {
+            sums[s].calls += t->counters[s].calls;
+            sums[s].total_ns += t->counters[s].total_ns;
+            sums[s].amount += t->counters[s].amount;
+            if (t->counters[s].max_ns > sums[s].max_ns) sums[s].max_ns = t->counters[s].max_ns;
+        }
+    }
+    size_t count = thread_count;
+    double wall = first_use ? (double)(profile_now() - first_use) / 1e9 : 0;
+    pthread_mutex_unlock(&threads_lock);
+
+    fprintf(fp, "\nProfile: %zu thread(s), %.2f s since the first scope\n", count, wall);
+    fprintf(fp, "%-16s %-5s %10s %11s %10s %10s %14s\n",
+            "scope", "kind", "calls", "total ms", "mean us", "max us", "amount");
+    for (int s = 0; s < PROFILE_SCOPE_COUNT; s++) {
+        const struct ProfileCounter *c = &sums[s];
+        if (c->calls == 0 && c->amount == 0) continue;
+        double total_ms = (double)c->total_ns / 1e6;
+        category_ms[scope_info[s].category] += total_ms;
+        fprintf(fp, "%-16s %-5s %10llu %11.2f %10.2f %10.1f %14lld\n",
+                scope_info[s].name, category_names[scope_info[s].category], (unsigned long long)c->calls,
+                total_ms, c->calls ? (double)c->total_ns / (double)c->calls / 1e3 : 0.0,
+                (double)c->max_ns / 1e3, c->amount);
+    }
+    fprintf(fp, "Summed over threads: cpu %.2f ms, disk %.2f ms, sleep %.2f ms\n",
+            category_ms[PROFILE_CPU], category_ms[PROFILE_DISK], category_ms[PROFILE_SLEEP]);
+}
+
+#endif // WELEARN_PROFILE
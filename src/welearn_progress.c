@@ -0,0 +1,133 @@
+#include "../include/welearn_progress.h"
+#include <time.h>
+
+double progress_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+void progress_init(struct ProgressStream *p, FILE *out) {
+    memset(p, 0, sizeof(*p));
+    pthread_mutex_init(&p->lock, NULL);
+    p->out = out;
+    p->started = progress_now();
+}
+
+void progress_free(struct ProgressStream *p) {
+    pthread_mutex_destroy(&p->lock);
+    p->out = NULL;
+}
+
+// Open an event line; called with p->lock held
+static void begin_event(struct ProgressStream *p, const char *event, const char *account) {
+    fprintf(p->out, "{\"event\":\"%s\",\"t\":%.3f", event, progress_now() - p->started);
+    if (account) {
+        fprintf(p->out, ",\"account\":");
+        fprint_json_string(p->out, account);
+    }
+}
+
+static void string_field(struct ProgressStream *p, const char *key, const char *value) {
+    fprintf(p->out, ",\"%s\":", key);
+    fprint_json_string(p->out, value ? value : "");
+}
+
+static void end_event(struct ProgressStream *p) {
+    fprintf(p->out, "}\n");
+    fflush(p->out);
+}
+
+void progress_discovered(struct ProgressStream *p, const char *account, const struct FileInfo *file, int selected) {
+    if (!p || !file) return;
+    pthread_mutex_lock(&p->lock);
+    begin_event(p, "discovered", account);
+    string_field(p, "course", file->course_name);
+    string_field(p, "name", file->remote_name[0] ? file->remote_name : file->filename);
+    string_field(p, "url", file->url);
+    fprintf(p->out, ",\"size\":%lld,\"selected\":%s",
+            file->meta_state == META_RESOLVED ? file->size : -1LL, selected ? "true" : "false");
+    end_event(p);
+    pthread_mutex_unlock(&p->lock);
+}
+
+void progress_plan(struct ProgressStream *p, const char *account, size_t scanned, size_t selected, long long known_bytes) {
+    if (!p) return;
+    pthread_mutex_lock(&p->lock);
+    begin_event(p, "plan", account);
+    fprintf(p->out, ",\"scanned\":%zu,\"selected\":%zu,\"known_bytes\":%lld", scanned, selected, known_bytes);
+    end_event(p);
+    pthread_mutex_unlock(&p->lock);
+}
+
+void progress_transfer_begin(struct ProgressStream *p, struct ProgressTransfer *tr, const char *url,
+                             const char *name, long long offset) {
+    memset(tr, 0, sizeof(*tr));
+    if (!p) return;
+    tr->stream = p;
+    tr->url = url;
+    tr->started = progress_now();
+    tr->last_event = tr->started;
+    tr->offset = offset;
+
+    pthread_mutex_lock(&p->lock);
+    begin_event(p, "start", NULL);
+    string_field(p, "url", url);
+    if (name && name[0]) string_field(p, "name", name);
+    fprintf(p->out, ",\"offset\":%lld", offset);
+    end_event(p);
+    pthread_mutex_unlock(&p->lock);
+}
+
+// Called by libcurl many times per second per transfer: only the clock is
+// read unless an event is due
+int progress_xferinfo(void *clientp, curl_off_t dltotal, curl_off_t dlnow, curl_off_t ultotal, curl_off_t ulnow) {
+    (void)ultotal;
+    (void)ulnow;
+    struct ProgressTransfer *tr = (struct ProgressTransfer *)clientp;
+    if (!tr || !tr->stream || dlnow <= 0) return 0;
+    double now = progress_now();
+    if (now - tr->last_event < PROGRESS_BYTES_INTERVAL) return 0;
+    tr->last_event = now;
+
+    struct ProgressStream *p = tr->stream;
+    long long received = tr->offset + (long long)dlnow;
+    long long total = dltotal > 0 ? tr->offset + (long long)dltotal : -1;
+    double seconds = now - tr->started;
+    pthread_mutex_lock(&p->lock);
+    begin_event(p, "bytes", NULL);
+    string_field(p, "url", tr->url);
+    fprintf(p->out, ",\"received\":%lld,\"total\":%lld,\"seconds\":%.3f,\"bytes_per_second\":%.0f",
+            received, total, seconds, seconds > 0 ? (double)dlnow / seconds : 0.0);
+    end_event(p);
+    pthread_mutex_unlock(&p->lock);
+    return 0;
+}
+
+void progress_done(struct ProgressStream *p, const struct ProgressTransfer *tr, const char *url,
+                   const char *course, const char *status, long long bytes) {
+    if (!p) return;
+    double seconds = tr && tr->stream ? progress_now() - tr->started : 0;
+    pthread_mutex_lock(&p->lock);
+    begin_event(p, "done", NULL);
+    string_field(p, "url", url);
+    string_field(p, "course", course);
+    string_field(p, "status", status);
+    fprintf(p->out, ",\"bytes\":%lld,\"seconds\":%.3f", bytes, seconds);
+    end_event(p);
+    pthread_mutex_unlock(&p->lock);
+}
+
+void progress_summary(struct ProgressStream *p, const char *account, const struct DownloadStats *stats,
+                      size_t selected, double seconds, int exit_code) {
+    if (!p || !stats) return;
+    pthread_mutex_lock(&p->lock);
+    begin_event(p, "summary", account);
+    fprintf(p->out, ",\"selected\":%zu,\"downloaded\":%zu,\"unchanged\":%zu,\"deduplicated\":%zu,"
+                    "\"skipped\":%zu,\"failed\":%zu,\"bytes\":%lld,\"seconds\":%.3f,\"bytes_per_second\":%.0f,"
+                    "\"exit_code\":%d",
+            selected, stats->downloaded, stats->unchanged, stats->deduplicated, stats->skipped, stats->failed,
+            stats->bytes, seconds, seconds > 0 ? (double)stats->bytes / seconds : 0.0, exit_code);
+    end_event(p);
+    pthread_mutex_unlock(&p->lock);
+}
@@ -0,0 +1,52 @@
+#include "../include/welearn_ratelimit.h"
+#include "../include/welearn_profile.h"
+#include <time.h>
+
+static double monotonic_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+void rate_limiter_init(struct RateLimiter *limiter, double rate, double burst) {
+    limiter->rate = rate;
+    limiter->burst = burst >= 1.0 ? burst : 1.0;
+    limiter->tokens = limiter->burst;
+    limiter->last_refill = monotonic_seconds();
+    pthread_mutex_init(&limiter->lock, NULL);
+}
+
+void rate_limiter_destroy(struct RateLimiter *limiter) {
+    pthread_mutex_destroy(&limiter->lock);
+}
+
+// Take a token if one is available. Returns 0 on success, otherwise the
+// number of milliseconds until the next token (for use as a poll timeout).
+long rate_limiter_try_acquire(struct RateLimiter *limiter) {
+    if (!limiter || limiter->rate <= 0) return 0;
+
+    pthread_mutex_lock(&limiter->lock);
+    double now = monotonic_seconds();
+    limiter->tokens += (now - limiter->last_refill) * limiter->rate;
+    if (limiter->tokens > limiter->burst) limiter->tokens = limiter->burst;
+    limiter->last_refill = now;
+
+    long wait_ms = 0;
+    if (limiter->tokens >= 1.0) {
+        limiter->tokens -= 1.0;
+    } else {
+        wait_ms = (long)((1.0 - limiter->tokens) / limiter->rate * 1000.0) + 1;
+    }
+    pthread_mutex_unlock(&limiter->lock);
+    return wait_ms;
+}
+
+// Block until a token is available
+void rate_limiter_acquire(struct RateLimiter *limiter) {
+    long wait_ms;
+    while ((wait_ms = rate_limiter_try_acquire(limiter)) > 0) {
+        PROFILE_SCOPE(PROFILE_LIMITER_WAIT);
+        struct timespec ts = {wait_ms / 1000, (wait_ms % 1000) * 1000000L};
+        nanosleep(&ts, NULL);
+    }
+}
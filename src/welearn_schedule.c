@@ -0,0 +1,118 @@
+#include "../include/welearn_schedule.h"
+#include "../include/welearn_context.h"
+#include <limits.h>
+
+static const char *order_names[] = {"list", "smallest", "newest", "fair"};
+
+void schedule_policy_init(struct SchedulePolicy *policy) {
+    memset(policy, 0, sizeof(*policy));
+    policy->order = SCHEDULE_LIST;
+    policy->small_limit = SCHEDULE_SMALL_FILE_BYTES;
+}
+
+// Parse an order name; returns -1 when it is unknown
+int schedule_order_from_name(const char *name) {
+    for (size_t i = 0; i < sizeof(order_names) / sizeof(order_names[0]); i++) {
+        if (strcmp(name, order_names[i]) == 0) return (int)i;
+    }
+    return -1;
+}
+
+const char *schedule_order_name(int order) {
+    if (order < 0 || (size_t)order >= sizeof(order_names) / sizeof(order_names[0])) return "list";
+    return order_names[order];
+}
+
+// Small enough for the small-file lane; files of unknown size are not
+int schedule_is_small(const struct FileInfo *file, const struct SchedulePolicy *policy) {
+    if (!file || file->is_folder) return 1;
+    long long limit = policy ? policy->small_limit : SCHEDULE_SMALL_FILE_BYTES;
+    return file->meta_state == META_RESOLVED && file->size >= 0 && file->size <= limit;
+}
+
+// Sort key of one selection
+struct ScheduleKey {
+    size_t position;    // Index into selections
+    size_t priority;    // Matching pattern index, priority_count when none matches
+    long long primary;  // Order-specific, ascending
+    size_t course;      // Course in order of first appearance (fair order)
+};
+
+static int compare_schedule_keys(const void *a, const void *b) {
+    const struct ScheduleKey *ka = (const struct ScheduleKey *)a;
+    const struct ScheduleKey *kb = (const struct ScheduleKey *)b;
+    if (ka->priority != kb->priority) return ka->priority < kb->priority ? -1 : 1;
+    if (ka->primary != kb->primary) return ka->primary < kb->primary ? -1 : 1;
+    if (ka->course != kb->course) return ka->course < kb->course ? -1 : 1;
+    if (ka->position != kb->position) return ka->position < kb->position ? -1 : 1;
+    return 0;
+}
+
+static size_t match_priority(const struct FileInfo *file, const struct SchedulePolicy *policy) {
+    for (size_t p = 0; p < policy->priority_count; p++) {
+        if (match_pattern_list(policy->priority[p], file->filename) ||
+            (file->remote_name[0] && match_pattern_list(policy->priority[p], file->remote_name)) ||
+            match_pattern_list(policy->priority[p], file->course_name)) {
+            return p;
+        }
+    }
+    return policy->priority_count;
+}
+
+// Order in which to download the selections, as indices into selections.
+// Returns a malloc'd array of selection_count entries, NULL on failure.
+size_t *schedule_selections(const struct FileList *list, const int *selections, size_t selection_count,
+                            const struct SchedulePolicy *policy) {
+    size_t *order = malloc((selection_count ? selection_count : 1) * sizeof(size_t));
+    struct ScheduleKey *keys = calloc(selection_count ? selection_count : 1, sizeof(struct ScheduleKey));
+    const char **courses = calloc(selection_count ? selection_count : 1, sizeof(const char *));
+    size_t *course_seen = calloc(selection_count ? selection_count : 1, sizeof(size_t));
+    if (!order || !keys || !courses || !course_seen) {
+        welearn_log(WELEARN_LOG_ERROR, "Failed to allocate the download schedule\n");
+        free(order);
+        free(keys);
+        free(courses);
+        free(course_seen);
+        return NULL;
+    }
+
+    size_t course_count = 0;
+    for (size_t i = 0; i < selection_count; i++) {
+        keys[i].position = i;
+        int file_idx = selections[i] - 1;
+        if (!policy || file_idx < 0 || (size_t)file_idx >= list->count) {
+            keys[i].priority = policy ? policy->priority_count : 0;
+            continue;
+        }
+        const struct FileInfo *file = &list->files[file_idx];
+        keys[i].priority = match_priority(file, policy);
+
+        switch (policy->order) {
+            case SCHEDULE_SMALLEST:
+                keys[i].primary = file->meta_state == META_RESOLVED && file->size >= 0 ? file->size : LLONG_MAX;
+                break;
+            case SCHEDULE_NEWEST:
+                keys[i].primary = file->meta_state == META_RESOLVED && file->remote_mtime >= 0
+                                  ? -(long long)file->remote_mtime : LLONG_MAX;
+                break;
+            case SCHEDULE_FAIR: {
+                // The n-th file of every course goes before the (n+1)-th of any course
+                size_t c = 0;
+                while (c < course_count && strcmp(courses[c], file->course_name) != 0) c++;
+                if (c == course_count) courses[course_count++] = file->course_name;
+                keys[i].primary = (long long)course_seen[c]++;
+                keys[i].course = c;
+                break;
+            }
+            default:
+                break;
+        }
+    }
+
+    qsort(keys, selection_count, sizeof(struct ScheduleKey), compare_schedule_keys);
+    for (size_t i = 0; i < selection_count; i++) order[i] = keys[i].position;
+    free(keys);
+    free(courses);
+    free(course_seen);
+    return order;
+}
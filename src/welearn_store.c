@@ -0,0 +1,457 @@
+#include "../include/welearn_store.h"
+#include "../include/welearn_profile.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#ifdef __linux__
+#include <linux/fs.h>
+#endif
+
+// Copy a file byte by byte; last resort when neither reflink nor hardlink works
+static int copy_file_contents(int src_fd, int dst_fd) {
+    char buffer[65536];
+    ssize_t n;
+    while ((n = read(src_fd, buffer, sizeof(buffer))) > 0) {
+        ssize_t off = 0;
+        while (off < n) {
+            ssize_t w = write(dst_fd, buffer + off, (size_t)(n - off));
+            if (w < 0) {
+                if (errno == EINTR) continue;
+                return 0;
+            }
+            off += w;
+        }
+    }
+    return n == 0;
+}
+
+// Split one manifest line into an entry; fields are tab-separated
+static int parse_manifest_line(char *line, struct ManifestEntry *entry) {
+    char *fields[7];
+    char *p = line;
+    for (int i = 0; i < 7; i++) {
+        fields[i] = p;
+        char *tab = strchr(p, '\t');
+        if (i < 6) {
+            if (!tab) return 0;
+            *tab = '\0';
+            p = tab + 1;
+        }
+    }
+    fields[6][strcspn(fields[6], "\r\n")] = '\0';
+
+    if (strlen(fields[0]) != SHA256_HEX_LEN - 1) return 0;
+    memset(entry, 0, sizeof(*entry));
+    memcpy(entry->sha256, fields[0], SHA256_HEX_LEN);
+    entry->size = strtoll(fields[1], NULL, 10);
+    strncpy(entry->etag, fields[2], sizeof(entry->etag) - 1);
+    entry->remote_mtime = strtol(fields[3], NULL, 10);
+    entry->downloaded_at = strtol(fields[4], NULL, 10);
+    strncpy(entry->url, fields[5], sizeof(entry->url) - 1);
+    strncpy(entry->path, fields[6], sizeof(entry->path) - 1);
+    return 1;
+}
+
+// Append an entry to the in-memory manifest
+static int manifest_append(struct Manifest *manifest, const struct ManifestEntry *entry) {
+    if (manifest->count >= manifest->capacity) {
+        size_t new_capacity = manifest->capacity ? manifest->capacity * 2 : INITIAL_MANIFEST_CAPACITY;
+        struct ManifestEntry *new_entries = realloc(manifest->entries, new_capacity * sizeof(struct ManifestEntry));
+        if (!new_entries) {
+            welearn_log(WELEARN_LOG_ERROR, "Failed to grow manifest: %s\n", strerror(errno));
+            return 0;
+        }
+        manifest->entries = new_entries;
+        manifest->capacity = new_capacity;
+    }
+    manifest->entries[manifest->count++] = *entry;
+    return 1;
+}
+
+// fopen() for a path relative to dirfd
+static FILE *fopen_at(int dirfd, const char *path, int flags, const char *mode) {
+    PROFILE_SCOPE(PROFILE_OPEN);
+    int fd = openat(dirfd, path, flags | O_CLOEXEC, 0644);
+    if (fd < 0) return NULL;
+    FILE *fp = fdopen(fd, mode);
+    if (!fp) close(fd);
+    return fp;
+}
+
+// Open (and create if needed) the store under a download root and load its manifest
+int content_store_open(struct ContentStore *store, const char *root) {
+    return content_store_open_at(store, AT_FDCWD, root);
+}
+
+// As content_store_open, with a root relative to dirfd; every store path resolves against dirfd
+int content_store_open_at(struct ContentStore *store, int dirfd, const char *root) {
+    if (!store || !root) return 0;
+    memset(store, 0, sizeof(*store));
+    strncpy(store->root, root, sizeof(store->root) - 1);
+    store->dirfd = dirfd;
+
+    char path[MAX_PATH_LEN];
+    snprintf(path, sizeof(path), "%s/%s", root, STORE_DIR);
+    if (mkdirat(dirfd, path, 0777) != 0 && errno != EEXIST) {
+        welearn_log(WELEARN_LOG_ERROR, "Failed to create store directory %s: %s\n", path, strerror(errno));
+        return 0;
+    }
+    snprintf(path, sizeof(path), "%s/%s", root, STORE_OBJECTS_DIR);
+    if (mkdirat(dirfd, path, 0777) != 0 && errno != EEXIST) {
+        welearn_log(WELEARN_LOG_ERROR, "Failed to create store directory %s: %s\n", path, strerror(errno));
+        return 0;
+    }
+
+    snprintf(path, sizeof(path), "%s/%s", root, STORE_MANIFEST_FILE);
+    FILE *fp = fopen_at(dirfd, path, O_RDONLY, "r");
+    if (!fp) return 1;  // Fresh store
+
+    char line[MAX_URL_LEN + MAX_PATH_LEN + 512];
+    struct ManifestEntry entry;
+    while (fgets(line, sizeof(line), fp)) {
+        if (line[0] == '#' || line[0] == '\n') continue;
+        if (parse_manifest_line(line, &entry)) {
+            manifest_append(&store->manifest, &entry);
+        }
+    }
+    fclose(fp);
+    return 1;
+}
+
+// Write the manifest atomically (temp file + rename)
+int content_store_save(struct ContentStore *store) {
+    if (!store) return 0;
+
+    char path[MAX_PATH_LEN];
+    char temp_path[MAX_PATH_LEN + 8];
+    if (snprintf(path, sizeof(path), "%s/%s", store->root, STORE_MANIFEST_FILE) >= (int)sizeof(path)) {
+        welearn_log(WELEARN_LOG_ERROR, "Manifest path too long: %s/%s\n", store->root, STORE_MANIFEST_FILE);
+        return 0;
+    }
+    snprintf(temp_path, sizeof(temp_path), "%s.tmp", path);
+
+    FILE *fp = fopen_at(store->dirfd, temp_path, O_WRONLY | O_CREAT | O_TRUNC, "w");
+    if (!fp) {
+        welearn_log(WELEARN_LOG_ERROR, "Error opening manifest for writing: %s\n", strerror(errno));
+        return 0;
+    }
+    fprintf(fp, "%s\n", STORE_MANIFEST_HEADER);
+    for (size_t i = 0; i < store->manifest.count; i++) {
+        const struct ManifestEntry *e = &store->manifest.entries[i];
+        fprintf(fp, "%s\t%lld\t%s\t%ld\t%ld\t%s\t%s\n", e->sha256, e->size, e->etag,
+                e->remote_mtime, e->downloaded_at, e->url, e->path);
+    }
+    if (fclose(fp) != 0 || renameat(store->dirfd, temp_path, store->dirfd, path) != 0) {
+        welearn_log(WELEARN_LOG_ERROR, "Error saving manifest: %s\n", strerror(errno));
+        unlinkat(store->dirfd, temp_path, 0);
+        return 0;
+    }
+    store->manifest.unsaved = 0;
+    return 1;
+}
+
+// Save the manifest and release the store
+void content_store_close(struct ContentStore *store) {
+    if (!store) return;
+    if (store->manifest.unsaved > 0) {
+        content_store_save(store);
+    }
+    free(store->manifest.entries);
+    store->manifest.entries = NULL;
+    store->manifest.count = 0;
+    store->manifest.capacity = 0;
+}
+
+// Most recent entry downloaded from a URL
+const struct ManifestEntry *manifest_find_url(const struct Manifest *manifest, const char *url) {
+    if (!manifest || !url) return NULL;
+    for (size_t i = manifest->count; i > 0; i--) {
+        if (strcmp(manifest->entries[i - 1].url, url) == 0) return &manifest->entries[i - 1];
+    }
+    return NULL;
+}
+
+// Any entry whose server ETag and size match (the same file posted under another URL)
+const struct ManifestEntry *manifest_find_etag(const struct Manifest *manifest, const char *etag, long long size) {
+    if (!manifest || !etag || etag[0] == '\0') return NULL;
+    for (size_t i = manifest->count; i > 0; i--) {
+        const struct ManifestEntry *e = &manifest->entries[i - 1];
+        if (strcmp(e->etag, etag) == 0 && (size < 0 || e->size == size)) return e;
+    }
+    return NULL;
+}
+
+// Entry materialized at a given root-relative path
+const struct ManifestEntry *manifest_find_path(const struct Manifest *manifest, const char *path) {
+    if (!manifest || !path) return NULL;
+    for (size_t i = 0; i < manifest->count; i++) {
+        if (strcmp(manifest->entries[i].path, path) == 0) return &manifest->entries[i];
+    }
+    return NULL;
+}
+
+// Record a materialized file, replacing any previous entry for the same path
+int manifest_record(struct ContentStore *store, const struct ManifestEntry *entry) {
+    if (!store || !entry) return 0;
+    struct Manifest *manifest = &store->manifest;
+
+    int ok = 0;
+    for (size_t i = 0; i < manifest->count; i++) {
+        if (strcmp(manifest->entries[i].path, entry->path) == 0) {
+            manifest->entries[i] = *entry;
+            ok = 1;
+            break;
+        }
+    }
+    if (!ok) ok = manifest_append(manifest, entry);
+
+    if (ok && ++manifest->unsaved >= MANIFEST_SAVE_INTERVAL) {
+        content_store_save(store);
+    }
+    return ok;
+}
+
+// Object path for a hash: <root>/.welearn/objects/ab/abcdef...
+void content_store_object_path(const struct ContentStore *store, const char *sha256, char *path, size_t size) {
+    snprintf(path, size, "%s/%s/%.2s/%s", store->root, STORE_OBJECTS_DIR, sha256, sha256);
+}
+
+int content_store_has(const struct ContentStore *store, const char *sha256) {
+    if (!store || !sha256 || sha256[0] == '\0') return 0;
+    char path[MAX_PATH_LEN];
+    content_store_object_path(store, sha256, path, sizeof(path));
+    PROFILE_SCOPE(PROFILE_STAT);
+    struct stat st;
+    return fstatat(store->dirfd, path, &st, 0) == 0 && S_ISREG(st.st_mode);
+}
+
+// Move a freshly downloaded temp file (relative to the store's dirfd) into the
+// store, or drop it if the object exists
+int content_store_ingest(struct ContentStore *store, const char *temp_path, const char *sha256) {
+    if (!store || !temp_path || !sha256) return 0;
+    int dirfd = store->dirfd;
+
+    if (content_store_has(store, sha256)) {
+        unlinkat(dirfd, temp_path, 0);
+        return 1;
+    }
+
+    char path[MAX_PATH_LEN];
+    if (snprintf(path, sizeof(path), "%s/%s/%.2s", store->root, STORE_OBJECTS_DIR, sha256) >= (int)sizeof(path)) {
+        welearn_log(WELEARN_LOG_ERROR, "Object directory path too long below %s\n", store->root);
+        return 0;
+    }
+    if (mkdirat(dirfd, path, 0777) != 0 && errno != EEXIST) {
+        welearn_log(WELEARN_LOG_ERROR, "Failed to create object directory %s: %s\n", path, strerror(errno));
+        return 0;
+    }
+    content_store_object_path(store, sha256, path, sizeof(path));
+
+    if (renameat(dirfd, temp_path, dirfd, path) == 0) return 1;
+    if (errno != EXDEV) {
+        welearn_log(WELEARN_LOG_ERROR, "Failed to move %s into store: %s\n", temp_path, strerror(errno));
+        return 0;
+    }
+
+    // Temp file lives on another filesystem: copy it across
+    int src = openat(dirfd, temp_path, O_RDONLY | O_CLOEXEC);
+    int dst = openat(dirfd, path, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    int ok = src >= 0 && dst >= 0 && copy_file_contents(src, dst);
+    if (src >= 0) close(src);
+    if (dst >= 0) close(dst);
+    if (!ok) {
+        unlinkat(dirfd, path, 0);
+        return 0;
+    }
+    unlinkat(dirfd, temp_path, 0);
+    return 1;
+}
+
+// Create dest_path with the contents of a store object: reflink, then hardlink, then copy
+int content_store_materialize(const struct ContentStore *store, const char *sha256, const char *dest_path) {
+    if (!store || !sha256 || !dest_path) return STORE_LINK_NONE;
+
+    char object_path[MAX_PATH_LEN];
+    content_store_object_path(store, sha256, object_path, sizeof(object_path));
+    int dirfd = store->dirfd;
+
+    int src = openat(dirfd, object_path, O_RDONLY | O_CLOEXEC);
+    if (src < 0) {
+        welearn_log(WELEARN_LOG_ERROR, "Store object missing: %s\n", object_path);
+        return STORE_LINK_NONE;
+    }
+
+#ifdef FICLONE
+    int dst = openat(dirfd, dest_path, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (dst < 0) {
+        close(src);
+        return STORE_LINK_NONE;
+    }
+    if (ioctl(dst, FICLONE, src) == 0) {
+        close(dst);
+        close(src);
+        return STORE_LINK_REFLINK;
+    }
+    close(dst);
+    unlinkat(dirfd, dest_path, 0);
+#endif
+
+    if (linkat(dirfd, object_path, dirfd, dest_path, 0) == 0) {
+        close(src);
+        return STORE_LINK_HARDLINK;
+    }
+
+    int result = STORE_LINK_NONE;
+    int out = openat(dirfd, dest_path, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (out >= 0) {
+        if (copy_file_contents(src, out)) {
+            result = STORE_LINK_COPY;
+        }
+        close(out);
+        if (result == STORE_LINK_NONE) unlinkat(dirfd, dest_path, 0);
+    }
+    close(src);
+    return result;
+}
+
+// Path relative to the store root, as recorded in the manifest
+const char *content_store_relative_path(const struct ContentStore *store, const char *path) {
+    size_t root_len = strlen(store->root);
+    if (strncmp(path, store->root, root_len) == 0 && path[root_len] == '/') {
+        path += root_len + 1;
+    }
+    while (strncmp(path, "./", 2) == 0) {
+        path += 2;
+    }
+    return path;
+}
+
+// Create a temp file in dir (relative to dirfd) for a download that is hashed as it streams in
+int hashed_writer_open(struct HashedFileWriter *writer, int dirfd, const char *dir) {
+    static unsigned long counter = 0;
+    memset(writer, 0, sizeof(*writer));
+    writer->dirfd = dirfd;
+
+    // mkstemp() has no *at variant: pick unique names the same way
+    int fd = -1;
+    unsigned long seed = (unsigned long)time(NULL) ^ ((unsigned long)getpid() << 16);
+    for (int attempt = 0; attempt < 100 && fd < 0; attempt++) {
+        PROFILE_SCOPE(PROFILE_OPEN);
+        unsigned long n = __atomic_add_fetch(&counter, 1, __ATOMIC_RELAXED);
+        snprintf(writer->temp_path, sizeof(writer->temp_path), "%s/.welearn-part-%06lx",
+                 dir, (seed + n * 2654435761UL) & 0xffffffUL);
+        fd = openat(dirfd, writer->temp_path, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+        if (fd < 0 && errno != EEXIST) break;
+    }
+    if (fd < 0) {
+        welearn_log(WELEARN_LOG_ERROR, "Error creating temporary download file: %s\n", strerror(errno));
+        writer->temp_path[0] = '\0';
+        return 0;
+    }
+    writer->fp = fdopen(fd, "wb");
+    if (!writer->fp) {
+        close(fd);
+        unlinkat(dirfd, writer->temp_path, 0);
+        writer->temp_path[0] = '\0';
+        return 0;
+    }
+    sha256_init(&writer->sha);
+    return 1;
+}
+
+// Open (or continue) the partial download named after key. Bytes left by an
+// earlier attempt are re-hashed so the digest covers the whole file.
+int hashed_writer_open_resumable(struct HashedFileWriter *writer, int dirfd, const char *dir, const char *key) {
+    memset(writer, 0, sizeof(*writer));
+    writer->dirfd = dirfd;
+    snprintf(writer->temp_path, sizeof(writer->temp_path), "%s/.welearn-part-%s", dir, key);
+    writer->fp = fopen_at(dirfd, writer->temp_path, O_RDWR | O_CREAT | O_APPEND, "a+b");
+    if (!writer->fp) {
+        welearn_log(WELEARN_LOG_ERROR, "Error opening partial download file: %s\n", strerror(errno));
+        writer->temp_path[0] = '\0';
+        return 0;
+    }
+    sha256_init(&writer->sha);
+
+    unsigned char buffer[65536];
+    size_t n;
+    rewind(writer->fp);
+    while ((n = fread(buffer, 1, sizeof(buffer), writer->fp)) > 0) {
+        sha256_update(&writer->sha, buffer, n);
+        writer->bytes += (long long)n;
+    }
+    if (ferror(writer->fp)) {
+        hashed_writer_discard(writer);
+        return 0;
+    }
+    writer->resume_from = writer->bytes;
+    return 1;
+}
+
+// libcurl write callback: append to the temp file and feed the hash
+size_t hashed_write_callback(void *ptr, size_t size, size_t nmemb, void *userp) {
+    struct HashedFileWriter *writer = (struct HashedFileWriter *)userp;
+    if (writer->headers && writer->headers->login_redirect) {
+        return 0;  // Session expired: never store the login form as the file
+    }
+    if (writer->resume_from > 0) {
+        // The server ignored the Range request and sent the whole file: start over
+        if (writer->headers && writer->headers->status_code != 206) {
+            if (ftruncate(fileno(writer->fp), 0) != 0) return 0;
+            rewind(writer->fp);
+            sha256_init(&writer->sha);
+            writer->bytes = 0;
+        }
+        writer->resume_from = 0;
+    }
+    size_t written = fwrite(ptr, size, nmemb, writer->fp);
+    if (written < nmemb) {
+        welearn_log(WELEARN_LOG_ERROR, "fwrite error: %s\n", strerror(errno));
+        return written * size;
+    }
+    sha256_update(&writer->sha, ptr, size * nmemb);
+    writer->bytes += (long long)(size * nmemb);
+    return size * nmemb;
+}
+
+// Close the temp file and produce the hex digest of everything written.
+// Returns 0 when the file could not be written out completely: the digest
+// would not match its contents.
+int hashed_writer_finish(struct HashedFileWriter *writer, char sha256[SHA256_HEX_LEN]) {
+    uint8_t digest[SHA256_DIGEST_LEN];
+    int ok = 1;
+    if (writer->fp) {
+        if (fflush(writer->fp) != 0 || ferror(writer->fp)) ok = 0;
+        if (fclose(writer->fp) != 0) ok = 0;
+        writer->fp = NULL;
+        if (!ok) welearn_log(WELEARN_LOG_ERROR, "Error writing %s: %s\n", writer->temp_path, strerror(errno));
+    }
+    sha256_final(&writer->sha, digest);
+    sha256_to_hex(digest, sha256);
+    return ok;
+}
+
+// Drop a partial download
+void hashed_writer_discard(struct HashedFileWriter *writer) {
+    if (writer->fp) {
+        fclose(writer->fp);
+        writer->fp = NULL;
+    }
+    if (writer->temp_path[0]) {
+        unlinkat(writer->dirfd, writer->temp_path, 0);
+        writer->temp_path[0] = '\0';
+    }
+}
+
+// Stop a download but keep what was received so a later run can resume it
+void hashed_writer_suspend(struct HashedFileWriter *writer) {
+    if (writer->fp) {
+        fclose(writer->fp);
+        writer->fp = NULL;
+    }
+    if (writer->bytes == 0 && writer->temp_path[0]) {
+        unlinkat(writer->dirfd, writer->temp_path, 0);
+    }
+    writer->temp_path[0] = '\0';
+}
@@ -0,0 +1,306 @@
+#include "../include/welearn_telemetry.h"
+#include "../include/welearn_context.h"
+#include <errno.h>
+#include <time.h>
+
+static const char *kind_names[] = {"login", "dashboard", "course", "folder", "file", "metadata"};
+static const char *phase_names[] = {"dns", "connect", "tls", "wait", "transfer", "total"};
+
+static double monotonic_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+void telemetry_init(struct Telemetry *t, int keep_samples) {
+    memset(t, 0, sizeof(*t));
+    pthread_mutex_init(&t->lock, NULL);
+    t->keep_samples = keep_samples;
+    t->started = monotonic_seconds();
+}
+
+void telemetry_free(struct Telemetry *t) {
+    for (size_t i = 0; i < t->sample_count; i++) free(t->samples[i].url);
+    free(t->samples);
+    t->samples = NULL;
+    t->sample_count = t->sample_capacity = 0;
+    pthread_mutex_destroy(&t->lock);
+}
+
+const char *telemetry_kind_name(int kind) {
+    if (kind < 0 || kind >= TELEMETRY_KIND_COUNT) return "other";
+    return kind_names[kind];
+}
+
+static int histogram_index(long long value) {
+    if (value < 2 * TELEMETRY_SUB_BUCKETS) return value < 0 ? 0 : (int)value;
+    int msb = 63 - __builtin_clzll((unsigned long long)value);
+    int shift = msb - 4;
+    int index = (shift + 1) * TELEMETRY_SUB_BUCKETS + (int)((value >> shift) - TELEMETRY_SUB_BUCKETS);
+    return index < TELEMETRY_BUCKET_COUNT ? index : TELEMETRY_BUCKET_COUNT - 1;
+}
+
+// Highest value that lands in the bucket
+static long long histogram_bucket_value(int index) {
+    if (index < 2 * TELEMETRY_SUB_BUCKETS) return index;
+    int shift = index / TELEMETRY_SUB_BUCKETS - 1;
+    long long low = (long long)(index % TELEMETRY_SUB_BUCKETS + TELEMETRY_SUB_BUCKETS) << shift;
+    return low + (1LL << shift) - 1;
+}
+
+static void histogram_add(struct LatencyHistogram *h, long long value) {
+    if (value < 0) value = 0;
+    h->counts[histogram_index(value)]++;
+    h->count++;
+    h->sum += (double)value;
+    if (value > h->max) h->max = value;
+}
+
+long long latency_histogram_percentile(const struct LatencyHistogram *h, double percentile) {
+    if (h->count == 0) return 0;
+    uint64_t rank = (uint64_t)(percentile / 100.0 * (double)h->count + 0.5);
+    if (rank < 1) rank = 1;
+    uint64_t seen = 0;
+    for (int i = 0; i < TELEMETRY_BUCKET_COUNT; i++) {
+        seen += h->counts[i];
+        if (seen >= rank) {
+            long long value = histogram_bucket_value(i);
+            return value < h->max ? value : h->max;
+        }
+    }
+    return h->max;
+}
+
+uint64_t latency_histogram_count_at_most(const struct LatencyHistogram *h, long long value) {
+    uint64_t count = 0;
+    for (int i = 0; i < TELEMETRY_BUCKET_COUNT && histogram_bucket_value(i) <= value; i++) {
+        count += h->counts[i];
+    }
+    return count;
+}
+
+void telemetry_count(struct Telemetry *t, int counter, size_t n) {
+    if (!t || counter < 0 || counter >= TELEMETRY_COUNTER_COUNT) return;
+    pthread_mutex_lock(&t->lock);
+    t->counters[counter] += n;
+    pthread_mutex_unlock(&t->lock);
+}
+
+void telemetry_count_current(int counter, size_t n) {
+    telemetry_count(welearn_context_current()->telemetry, counter, n);
+}
+
+void telemetry_add_limiter_wait(struct Telemetry *t, double seconds) {
+    if (!t || seconds <= 0) return;
+    pthread_mutex_lock(&t->lock);
+    t->limiter_wait += seconds;
+    pthread_mutex_unlock(&t->lock);
+}
+
+void telemetry_transfers_changed(struct Telemetry *t, int active_delta, int queued_delta) {
+    if (!t) return;
+    pthread_mutex_lock(&t->lock);
+    t->active += active_delta;
+    t->queued += queued_delta;
+    pthread_mutex_unlock(&t->lock);
+}
+
+void telemetry_record_file(struct Telemetry *t, int outcome, long long bytes, long long saved_bytes) {
+    if (!t || outcome < 0 || outcome >= TELEMETRY_OUTCOME_COUNT) return;
+    pthread_mutex_lock(&t->lock);
+    t->outcomes[outcome].files++;
+    t->outcomes[outcome].bytes += bytes;
+    if (saved_bytes > 0) t->outcomes[outcome].saved_bytes += saved_bytes;
+    pthread_mutex_unlock(&t->lock);
+}
+
+static long long info_us(CURL *easy, CURLINFO info) {
+    curl_off_t value = 0;
+    if (curl_easy_getinfo(easy, info, &value) != CURLE_OK) return 0;
+    return (long long)value;
+}
+
+static long long span(long long from, long long to) {
+    return to > from ? to - from : 0;
+}
+
+void telemetry_record(struct Telemetry *t, int kind, CURL *easy, CURLcode res) {
+    if (!t || !easy || kind < 0 || kind >= TELEMETRY_KIND_COUNT) return;
+
+    struct TransferSample sample;
+    memset(&sample, 0, sizeof(sample));
+    sample.kind = kind;
+    sample.result = (int)res;
+    curl_easy_getinfo(easy, CURLINFO_RESPONSE_CODE, &sample.http_code);
+
+    // libcurl's timers are cumulative from the start of the transfer
+    long long namelookup = info_us(easy, CURLINFO_NAMELOOKUP_TIME_T);
+    long long connect = info_us(easy, CURLINFO_CONNECT_TIME_T);
+    long long appconnect = info_us(easy, CURLINFO_APPCONNECT_TIME_T);
+    long long starttransfer = info_us(easy, CURLINFO_STARTTRANSFER_TIME_T);
+    long long total = info_us(easy, CURLINFO_TOTAL_TIME_T);
+    long long connected = appconnect > connect ? appconnect : connect;
+    sample.phase_us[TELEMETRY_DNS] = namelookup;
+    sample.phase_us[TELEMETRY_CONNECT] = span(namelookup, connect);
+    sample.phase_us[TELEMETRY_TLS] = appconnect > 0 ? span(connect, appconnect) : 0;
+    sample.phase_us[TELEMETRY_WAIT] = starttransfer > 0 ? span(connected, starttransfer) : 0;
+    sample.phase_us[TELEMETRY_TRANSFER] = starttransfer > 0 ? span(starttransfer, total) : 0;
+    sample.phase_us[TELEMETRY_TOTAL] = total;
+    sample.redirect_us = info_us(easy, CURLINFO_REDIRECT_TIME_T);
+
+    curl_off_t bytes = 0, speed = 0;
+    curl_easy_getinfo(easy, CURLINFO_SIZE_DOWNLOAD_T, &bytes);
+    curl_easy_getinfo(easy, CURLINFO_SPEED_DOWNLOAD_T, &speed);
+    sample.bytes = (long long)bytes;
+    sample.speed = (double)speed;
+
+    char *url = NULL;
+    curl_easy_getinfo(easy, CURLINFO_EFFECTIVE_URL, &url);
+    double now = monotonic_seconds();
+
+    pthread_mutex_lock(&t->lock);
+    struct TelemetryKindStats *stats = &t->kinds[kind];
+    stats->requests++;
+    if (res != CURLE_OK || sample.http_code >= 400) stats->errors++;
+    long status_class = res == CURLE_OK ? sample.http_code / 100 : 0;
+    stats->status[status_class > 0 && status_class < TELEMETRY_STATUS_COUNT ? status_class : 0]++;
+    stats->bytes += sample.bytes;
+    for (int p = 0; p < TELEMETRY_PHASE_COUNT; p++) {
+        histogram_add(&stats->phases[p], sample.phase_us[p]);
+    }
+
+    if (t->keep_samples) {
+        if (t->sample_count == t->sample_capacity) {
+            size_t capacity = t->sample_capacity ? t->sample_capacity * 2 : 256;
+            struct TransferSample *grown = realloc(t->samples, capacity * sizeof(*grown));
+            if (!grown) {
+                welearn_log(WELEARN_LOG_ERROR, "Failed to grow the telemetry samples\n");
+                pthread_mutex_unlock(&t->lock);
+                return;
+            }
+            t->samples = grown;
+            t->sample_capacity = capacity;
+        }
+        sample.start = now - t->started - (double)total / 1e6;
+        sample.url = strdup(url ? url : "");
+        t->samples[t->sample_count++] = sample;
+    }
+    pthread_mutex_unlock(&t->lock);
+}
+
+void telemetry_record_current(int kind, CURL *easy, CURLcode res) {
+    telemetry_record(welearn_context_current()->telemetry, kind, easy, res);
+}
+
+void telemetry_report(struct Telemetry *t, FILE *fp) {
+    size_t requests = 0;
+    long long bytes = 0;
+    pthread_mutex_lock(&t->lock);
+    for (int k = 0; k < TELEMETRY_KIND_COUNT; k++) {
+        requests += t->kinds[k].requests;
+        bytes += t->kinds[k].bytes;
+    }
+    char size_str[32];
+    format_size(bytes, size_str, sizeof(size_str));
+    fprintf(fp, "\nNetwork timings: %zu requests, %s received in %.1f s\n",
+            requests, size_str, monotonic_seconds() - t->started);
+    if (requests == 0) {
+        pthread_mutex_unlock(&t->lock);
+        return;
+    }
+
+    fprintf(fp, "%-10s %6s %5s %10s %8s %8s %8s %8s | %5s %7s %5s %5s %8s\n",
+            "kind", "reqs", "errs", "bytes", "p50 ms", "p90 ms", "p99 ms", "max ms",
+            "dns", "connect", "tls", "wait", "transfer");
+    for (int k = 0; k < TELEMETRY_KIND_COUNT; k++) {
+        const struct TelemetryKindStats *stats = &t->kinds[k];
+        if (stats->requests == 0) continue;
+        const struct LatencyHistogram *total = &stats->phases[TELEMETRY_TOTAL];
+        format_size(stats->bytes, size_str, sizeof(size_str));
+        fprintf(fp, "%-10s %6zu %5zu %10s %8.1f %8.1f %8.1f %8.1f |",
+                kind_names[k], stats->requests, stats->errors, size_str,
+                latency_histogram_percentile(total, 50) / 1000.0,
+                latency_histogram_percentile(total, 90) / 1000.0,
+                latency_histogram_percentile(total, 99) / 1000.0,
+                total->max / 1000.0);
+
+        // Share of the total time spent in each phase
+        int widths[] = {5, 7, 5, 5, 8};
+        for (int p = 0; p < TELEMETRY_TOTAL; p++) {
+            double share = total->sum > 0 ? stats->phases[p].sum * 100.0 / total->sum : 0;
+            fprintf(fp, " %*.0f%%", widths[p] - 1, share);
+        }
+        fprintf(fp, "\n");
+    }
+    pthread_mutex_unlock(&t->lock);
+}
+
+static void write_csv(struct Telemetry *t, FILE *fp) {
+    fprintf(fp, "kind,start_s,http_code,curl_code,dns_ms,connect_ms,tls_ms,wait_ms,transfer_ms,total_ms,"
+                "redirect_ms,bytes,speed_bps,url\n");
+    for (size_t i = 0; i < t->sample_count; i++) {
+        const struct TransferSample *s = &t->samples[i];
+        fprintf(fp, "%s,%.6f,%ld,%d", kind_names[s->kind], s->start, s->http_code, s->result);
+        for (int p = 0; p < TELEMETRY_PHASE_COUNT; p++) fprintf(fp, ",%.3f", s->phase_us[p] / 1000.0);
+        fprintf(fp, ",%.3f,%lld,%.0f,\"", s->redirect_us / 1000.0, s->bytes, s->speed);
+        for (const char *c = s->url; *c; c++) {
+            if (*c == '"') fputc('"', fp);
+            fputc(*c, fp);
+        }
+        fprintf(fp, "\"\n");
+    }
+}
+
+static void write_json(struct Telemetry *t, FILE *fp) {
+    fprintf(fp, "{\n  \"kinds\": {");
+    int first = 1;
+    for (int k = 0; k < TELEMETRY_KIND_COUNT; k++) {
+        const struct TelemetryKindStats *stats = &t->kinds[k];
+        if (stats->requests == 0) continue;
+        fprintf(fp, "%s\n    \"%s\": {\"requests\": %zu, \"errors\": %zu, \"bytes\": %lld",
+                first ? "" : ",", kind_names[k], stats->requests, stats->errors, stats->bytes);
+        for (int p = 0; p < TELEMETRY_PHASE_COUNT; p++) {
+            const struct LatencyHistogram *h = &stats->phases[p];
+            fprintf(fp, ", \"%s_ms\": {\"mean\": %.3f, \"p50\": %.3f, \"p90\": %.3f, \"p99\": %.3f, \"max\": %.3f}",
+                    phase_names[p], h->count ? h->sum / (double)h->count / 1000.0 : 0.0,
+                    latency_histogram_percentile(h, 50) / 1000.0, latency_histogram_percentile(h, 90) / 1000.0,
+                    latency_histogram_percentile(h, 99) / 1000.0, h->max / 1000.0);
+        }
+        fprintf(fp, "}");
+        first = 0;
+    }
+    fprintf(fp, "\n  },\n  \"requests\": [");
+    for (size_t i = 0; i < t->sample_count; i++) {
+        const struct TransferSample *s = &t->samples[i];
+        fprintf(fp, "%s\n    {\"kind\": \"%s\", \"url\": ", i ? "," : "", kind_names[s->kind]);
+        fprint_json_string(fp, s->url);
+        fprintf(fp, ", \"start_s\": %.6f, \"http_code\": %ld, \"curl_code\": %d", s->start, s->http_code, s->result);
+        for (int p = 0; p < TELEMETRY_PHASE_COUNT; p++) {
+            fprintf(fp, ", \"%s_ms\": %.3f", phase_names[p], s->phase_us[p] / 1000.0);
+        }
+        fprintf(fp, ", \"redirect_ms\": %.3f, \"bytes\": %lld, \"speed_bps\": %.0f}",
+                s->redirect_us / 1000.0, s->bytes, s->speed);
+    }
+    fprintf(fp, "\n  ]\n}\n");
+}
+
+int telemetry_export(struct Telemetry *t, const char *path) {
+    FILE *fp = fopen(path, "w");
+    if (!fp) {
+        welearn_log(WELEARN_LOG_ERROR, "Cannot write timings to %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    size_t len = strlen(path);
+    pthread_mutex_lock(&t->lock);
+    if (len >= 5 && strcmp(path + len - 5, ".json") == 0) {
+        write_json(t, fp);
+    } else {
+        write_csv(t, fp);
+    }
+    pthread_mutex_unlock(&t->lock);
+    if (fclose(fp) != 0) {
+        welearn_log(WELEARN_LOG_ERROR, "Cannot write timings to %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,172 @@
+#include "../include/welearn_trace.h"
+#include "../include/welearn_telemetry.h"
+#include "../include/welearn_context.h"
+#include <errno.h>
+#include <time.h>
+
+static int next_tid = 0;
+static __thread int thread_tid = 0;
+
+double trace_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+// Small per-thread number; the main thread asks first and gets 1
+static int current_tid(void) {
+    if (thread_tid == 0) thread_tid = __atomic_add_fetch(&next_tid, 1, __ATOMIC_RELAXED);
+    return thread_tid;
+}
+
+void trace_init(struct TraceLog *t) {
+    memset(t, 0, sizeof(*t));
+    pthread_mutex_init(&t->lock, NULL);
+    t->started = trace_now();
+}
+
+void trace_free(struct TraceLog *t) {
+    for (size_t i = 0; i < t->count; i++) {
+        free(t->events[i].name);
+        free(t->events[i].url);
+    }
+    free(t->events);
+    for (int i = 0; i < TRACE_MAX_THREADS; i++) free(t->thread_names[i]);
+    memset(t->thread_names, 0, sizeof(t->thread_names));
+    t->events = NULL;
+    t->count = t->capacity = 0;
+    pthread_mutex_destroy(&t->lock);
+}
+
+void trace_name_thread(struct TraceLog *t, const char *name) {
+    if (!t || !name) return;
+    int tid = current_tid();
+    if (tid >= TRACE_MAX_THREADS) return;
+    pthread_mutex_lock(&t->lock);
+    free(t->thread_names[tid]);
+    t->thread_names[tid] = strdup(name);
+    pthread_mutex_unlock(&t->lock);
+}
+
+// Append an event; called with t->lock held. Returns 0 when out of memory.
+static int add_event(struct TraceLog *t, char phase, int tid, unsigned long id, double start, double end,
+                     const char *cat, const char *name, const char *url) {
+    if (t->count == t->capacity) {
+        size_t capacity = t->capacity ? t->capacity * 2 : 1024;
+        struct TraceEvent *grown = realloc(t->events, capacity * sizeof(*grown));
+        if (!grown) {
+            welearn_log(WELEARN_LOG_ERROR, "Failed to grow the trace\n");
+            return 0;
+        }
+        t->events = grown;
+        t->capacity = capacity;
+    }
+    struct TraceEvent *event = &t->events[t->count++];
+    event->phase = phase;
+    event->tid = tid;
+    event->id = id;
+    event->ts = start - t->started;
+    event->dur = end > start ? end - start : 0;
+    event->cat = cat;
+    event->name = strdup(name);
+    event->url = url ? strdup(url) : NULL;
+    return 1;
+}
+
+void trace_span(struct TraceLog *t, const char *cat, const char *name, double start, const char *url) {
+    if (!t) return;
+    double end = trace_now();
+    int tid = current_tid();
+    pthread_mutex_lock(&t->lock);
+    add_event(t, 'X', tid, 0, start, end, cat, name, url);
+    pthread_mutex_unlock(&t->lock);
+}
+
+static double info_seconds(CURL *easy, CURLINFO info) {
+    curl_off_t value = 0;
+    if (curl_easy_getinfo(easy, info, &value) != CURLE_OK) return 0;
+    return (double)value / 1e6;
+}
+
+// One phase of an async transfer span, skipped when empty
+static void add_phase(struct TraceLog *t, int tid, unsigned long id, const char *name, double from, double to) {
+    if (to <= from) return;
+    add_event(t, 'b', tid, id, from, from, "transfer", name, NULL);
+    add_event(t, 'e', tid, id, to, to, "transfer", name, NULL);
+}
+
+void trace_transfer(struct TraceLog *t, int kind, CURL *easy, double queued_at) {
+    if (!t || !easy) return;
+    double end = trace_now();
+    double total = info_seconds(easy, CURLINFO_TOTAL_TIME_T);
+    double connected = info_seconds(easy, CURLINFO_APPCONNECT_TIME_T);
+    double connect = info_seconds(easy, CURLINFO_CONNECT_TIME_T);
+    if (connect > connected) connected = connect;
+    double first_byte = info_seconds(easy, CURLINFO_STARTTRANSFER_TIME_T);
+    double start = end - total;
+    double begin = queued_at > 0 && queued_at < start ? queued_at : start;
+
+    char *url = NULL;
+    curl_easy_getinfo(easy, CURLINFO_EFFECTIVE_URL, &url);
+    int tid = current_tid();
+
+    pthread_mutex_lock(&t->lock);
+    unsigned long id = ++t->next_id;
+    const char *name = telemetry_kind_name(kind);
+    add_event(t, 'b', tid, id, begin, begin, "transfer", name, url);
+    add_phase(t, tid, id, "queued", begin, start);
+    add_phase(t, tid, id, "connect", start, start + connected);
+    if (first_byte > 0) {
+        add_phase(t, tid, id, "wait", start + connected, start + first_byte);
+        add_phase(t, tid, id, "transfer", start + first_byte, end);
+    }
+    add_event(t, 'e', tid, id, end, end, "transfer", name, NULL);
+    pthread_mutex_unlock(&t->lock);
+}
+
+void trace_span_current(const char *cat, const char *name, double start, const char *url) {
+    trace_span(welearn_context_current()->trace, cat, name, start, url);
+}
+
+void trace_transfer_current(int kind, CURL *easy) {
+    trace_transfer(welearn_context_current()->trace, kind, easy, 0);
+}
+
+int trace_write(struct TraceLog *t, const char *path) {
+    FILE *fp = fopen(path, "w");
+    if (!fp) {
+        welearn_log(WELEARN_LOG_ERROR, "Cannot write trace to %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    pthread_mutex_lock(&t->lock);
+    fprintf(fp, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+    fprintf(fp, "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": 0, \"args\": {\"name\": \"welearn\"}}");
+    for (int tid = 0; tid < TRACE_MAX_THREADS; tid++) {
+        if (!t->thread_names[tid]) continue;
+        fprintf(fp, ",\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, \"args\": {\"name\": ", tid);
+        fprint_json_string(fp, t->thread_names[tid]);
+        fprintf(fp, "}}");
+    }
+    for (size_t i = 0; i < t->count; i++) {
+        const struct TraceEvent *e = &t->events[i];
+        fprintf(fp, ",\n{\"name\": ");
+        fprint_json_string(fp, e->name);
+        fprintf(fp, ", \"cat\": \"%s\", \"ph\": \"%c\", \"pid\": 1, \"tid\": %d, \"ts\": %.1f",
+                e->cat, e->phase, e->tid, e->ts * 1e6);
+        if (e->phase == 'X') fprintf(fp, ", \"dur\": %.1f", e->dur * 1e6);
+        if (e->phase != 'X') fprintf(fp, ", \"id\": %lu", e->id);
+        if (e->url) {
+            fprintf(fp, ", \"args\": {\"url\": ");
+            fprint_json_string(fp, e->url);
+            fprintf(fp, "}");
+        }
+        fprintf(fp, "}");
+    }
+    fprintf(fp, "\n]}\n");
+    pthread_mutex_unlock(&t->lock);
+    if (fclose(fp) != 0) {
+        welearn_log(WELEARN_LOG_ERROR, "Cannot write trace to %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,542 @@
+#include "../include/welearn_transfer.h"
+#include "../include/welearn_profile.h"
+#include <errno.h>
+#include <time.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#endif
+
+// Write callback for range probes: keeps at most TRANSFER_PROBE_BODY_LIMIT bytes
+static size_t probe_write_callback(void *contents, size_t size, size_t nmemb, void *userp) {
+    struct MemoryStruct *mem = (struct MemoryStruct *)userp;
+    if (mem->size + size * nmemb > TRANSFER_PROBE_BODY_LIMIT) {
+        return 0;  // Server ignored the Range header; the headers are all we need
+    }
+    return write_memory_callback(contents, size, nmemb, userp);
+}
+
+// Copy the cookies of an authenticated handle into the engine's share
+static void import_session_cookies(struct TransferEngine *engine, CURL *session) {
+    struct curl_slist *cookies = NULL;
+    if (curl_easy_getinfo(session, CURLINFO_COOKIELIST, &cookies) != CURLE_OK || !cookies) {
+        return;
+    }
+
+    CURL *seed = curl_easy_init();
+    if (seed) {
+        curl_easy_setopt(seed, CURLOPT_SHARE, engine->share);
+        for (struct curl_slist *c = cookies; c; c = c->next) {
+            curl_easy_setopt(seed, CURLOPT_COOKIELIST, c->data);
+        }
+        curl_easy_cleanup(seed);
+    }
+    curl_slist_free_all(cookies);
+}
+
+// Initialize the engine, inheriting the session cookies of an existing handle
+int transfer_engine_init(struct TransferEngine *engine, CURL *session, int max_active) {
+    if (!engine) return 0;
+    memset(engine, 0, sizeof(*engine));
+
+    engine->max_active = max_active > 0 ? max_active : DEFAULT_MAX_TRANSFERS;
+    engine->epoll_fd = engine->timer_fd = -1;
+    engine->multi = curl_multi_init();
+    engine->share = curl_share_init();
+    if (!engine->multi || !engine->share) {
+        welearn_log(WELEARN_LOG_ERROR, "Failed to initialize transfer engine\n");
+        transfer_engine_cleanup(engine);
+        return 0;
+    }
+
+    curl_share_setopt(engine->share, CURLSHOPT_SHARE, CURL_LOCK_DATA_COOKIE);
+    curl_share_setopt(engine->share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+    curl_share_setopt(engine->share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+
+    curl_multi_setopt(engine->multi, CURLMOPT_MAX_HOST_CONNECTIONS, (long)engine->max_active);
+    curl_multi_setopt(engine->multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+
+    if (session) {
+        engine->session = session;
+        import_session_cookies(engine, session);
+    }
+    return 1;
+}
+
+// Free a request and everything it owns
+static void free_request(struct TransferRequest *req) {
+    if (!req) return;
+    if (req->easy) curl_easy_cleanup(req->easy);
+    curl_slist_free_all(req->extra_headers);
+    free(req->body.memory);
+    free(req);
+}
+
+// Release the engine; requests still queued are dropped without callbacks
+void transfer_engine_cleanup(struct TransferEngine *engine) {
+    if (!engine) return;
+
+    struct TransferRequest *lists[2] = {engine->queue_head, engine->replay_head};
+    int dropped = 0;
+    for (int l = 0; l < 2; l++) {
+        struct TransferRequest *req = lists[l];
+        while (req) {
+            struct TransferRequest *next = req->next;
+            free_request(req);
+            dropped++;
+            req = next;
+        }
+    }
+    if (dropped > 0) telemetry_transfers_changed(engine->telemetry, 0, -dropped);
+    engine->queue_head = engine->queue_tail = NULL;
+    engine->replay_head = engine->replay_tail = NULL;
+
+    if (engine->multi) {
+        curl_multi_cleanup(engine->multi);
+        engine->multi = NULL;
+    }
+    if (engine->share) {
+        curl_share_cleanup(engine->share);
+        engine->share = NULL;
+    }
+}
+
+// Allocate a GET request for a URL
+struct TransferRequest *transfer_request_new(const char *url, transfer_done_callback on_done, void *userdata) {
+    if (!url) return NULL;
+
+    struct TransferRequest *req = calloc(1, sizeof(struct TransferRequest));
+    if (!req) {
+        welearn_log(WELEARN_LOG_ERROR, "Failed to allocate transfer request: %s\n", strerror(errno));
+        return NULL;
+    }
+    strncpy(req->url, url, sizeof(req->url) - 1);
+    req->content_length = -1;
+    req->filetime = -1;
+    req->on_done = on_done;
+    req->userdata = userdata;
+    init_memory_struct(&req->body);
+    return req;
+}
+
+// Free a request that was never submitted (submitted ones belong to the engine)
+void transfer_request_free(struct TransferRequest *req) {
+    free_request(req);
+}
+
+// Queue a request; it starts as soon as a transfer slot is free
+void transfer_engine_submit(struct TransferEngine *engine, struct TransferRequest *req) {
+    if (!engine || !req) return;
+    req->next = NULL;
+    if (engine->trace && req->queued_at == 0) req->queued_at = trace_now();
+    telemetry_transfers_changed(engine->telemetry, 0, 1);
+    if (engine->queue_tail) {
+        engine->queue_tail->next = req;
+    } else {
+        engine->queue_head = req;
+    }
+    engine->queue_tail = req;
+}
+
+// Create the easy handle for a request and hand it to the multi handle
+static int start_request(struct TransferEngine *engine, struct TransferRequest *req) {
+    req->easy = curl_easy_init();
+    if (!req->easy) return 0;
+
+    CURL *easy = req->easy;
+    curl_easy_setopt(easy, CURLOPT_URL, req->url);
+    curl_easy_setopt(easy, CURLOPT_SHARE, engine->share);
+    curl_easy_setopt(easy, CURLOPT_COOKIEFILE, "");  // A shared jar is only used with the cookie engine on
+    if (engine->resolve) curl_easy_setopt(easy, CURLOPT_RESOLVE, engine->resolve);
+    curl_easy_setopt(easy, CURLOPT_USERAGENT, WELEARN_USER_AGENT);
+    curl_easy_setopt(easy, CURLOPT_FOLLOWLOCATION, 1L);
+    curl_easy_setopt(easy, CURLOPT_SSL_VERIFYPEER, 1L);
+    curl_easy_setopt(easy, CURLOPT_SSL_VERIFYHOST, 2L);
+    curl_easy_setopt(easy, CURLOPT_FAILONERROR, 0L);
+    curl_easy_setopt(easy, CURLOPT_NOPROGRESS, 1L);
+    curl_easy_setopt(easy, CURLOPT_FILETIME, 1L);
+    curl_easy_setopt(easy, CURLOPT_ERRORBUFFER, req->errbuf);
+    curl_easy_setopt(easy, CURLOPT_HEADERFUNCTION, write_header_callback);
+    curl_easy_setopt(easy, CURLOPT_HEADERDATA, &req->headers);
+    curl_easy_setopt(easy, CURLOPT_WRITEDATA, &req->body);
+    curl_easy_setopt(easy, CURLOPT_PRIVATE, req);
+
+    if (req->head_only) {
+        curl_easy_setopt(easy, CURLOPT_NOBODY, 1L);
+        curl_easy_setopt(easy, CURLOPT_WRITEFUNCTION, write_memory_callback);
+    } else if (req->range_probe) {
+        if (!req->replayed) {
+            req->extra_headers = curl_slist_append(req->extra_headers, "Range: bytes=0-0");
+        }
+        curl_easy_setopt(easy, CURLOPT_WRITEFUNCTION, probe_write_callback);
+    } else if (req->write_fn) {
+        curl_easy_setopt(easy, CURLOPT_WRITEFUNCTION, req->write_fn);
+        curl_easy_setopt(easy, CURLOPT_WRITEDATA, req->write_data);
+    } else {
+        curl_easy_setopt(easy, CURLOPT_WRITEFUNCTION, write_memory_callback);
+    }
+    if (req->extra_headers) {
+        curl_easy_setopt(easy, CURLOPT_HTTPHEADER, req->extra_headers);
+    }
+    if (req->progress_fn) {
+        curl_easy_setopt(easy, CURLOPT_NOPROGRESS, 0L);
+        curl_easy_setopt(easy, CURLOPT_XFERINFOFUNCTION, req->progress_fn);
+        curl_easy_setopt(easy, CURLOPT_XFERINFODATA, req->progress_data);
+    }
+
+    if (curl_multi_add_handle(engine->multi, easy) != CURLM_OK) {
+        curl_easy_cleanup(easy);
+        req->easy = NULL;
+        return 0;
+    }
+    engine->active++;
+    return 1;
+}
+
+// Track a started request until it leaves the multi handle
+static void link_active(struct TransferEngine *engine, struct TransferRequest *req) {
+    req->prev = NULL;
+    req->next = engine->active_head;
+    if (engine->active_head) engine->active_head->prev = req;
+    engine->active_head = req;
+}
+
+static void unlink_active(struct TransferEngine *engine, struct TransferRequest *req) {
+    if (req->prev) {
+        req->prev->next = req->next;
+    } else {
+        engine->active_head = req->next;
+    }
+    if (req->next) req->next->prev = req->prev;
+    req->next = req->prev = NULL;
+}
+
+// Whether a finished request was answered with the login form instead of its resource
+static int needs_reauth(const struct TransferEngine *engine, const struct TransferRequest *req) {
+    if (!engine->reauth || req->replayed) return 0;
+    return req->headers.login_redirect || strstr(req->effective_url, "/login/index.php") != NULL;
+}
+
+// Take a request whose session expired out of the multi handle and keep it for replay
+static void park_for_replay(struct TransferEngine *engine, struct TransferRequest *req) {
+    unlink_active(engine, req);
+    curl_multi_remove_handle(engine->multi, req->easy);
+    curl_easy_cleanup(req->easy);
+    req->easy = NULL;
+    engine->active--;
+    telemetry_transfers_changed(engine->telemetry, -1, 1);
+
+    req->http_code = 0;
+    req->effective_url[0] = '\0';
+    req->content_type[0] = '\0';
+    req->content_length = -1;
+    req->filetime = -1;
+    memset(&req->headers, 0, sizeof(req->headers));
+    req->body.size = 0;
+    req->replayed = 1;
+
+    req->next = NULL;
+    if (engine->replay_tail) {
+        engine->replay_tail->next = req;
+    } else {
+        engine->replay_head = req;
+    }
+    engine->replay_tail = req;
+    engine->reauth_pending = 1;
+}
+
+// Log in once for every parked request, then put them back at the front of the queue
+static void renew_session(struct TransferEngine *engine) {
+    struct TransferRequest *replay = engine->replay_head;
+    struct TransferRequest *replay_tail = engine->replay_tail;
+    engine->replay_head = engine->replay_tail = NULL;
+    engine->reauth_pending = 0;
+    if (!replay) return;
+
+    if (engine->reauth(engine->reauth_data)) {
+        engine->relogins++;
+        if (engine->session) {
+            import_session_cookies(engine, engine->session);
+        }
+        size_t replayed = 0;
+        for (struct TransferRequest *req = replay; req; req = req->next) replayed++;
+        telemetry_count(engine->telemetry, TELEMETRY_RETRIES, replayed);
+        replay_tail->next = engine->queue_head;
+        engine->queue_head = replay;
+        if (!engine->queue_tail) engine->queue_tail = replay_tail;
+        return;
+    }
+
+    // Logging in again failed: fail the parked requests and stop trying
+    welearn_log(WELEARN_LOG_ERROR, "Session could not be renewed, failing parked transfers\n");
+    engine->reauth = NULL;
+    while (replay) {
+        struct TransferRequest *next = replay->next;
+        telemetry_transfers_changed(engine->telemetry, 0, -1);
+        if (replay->on_done) replay->on_done(replay, CURLE_LOGIN_DENIED, replay->userdata);
+        free_request(replay);
+        replay = next;
+    }
+}
+
+// Collect the response details of a finished request and run its callback
+static void finish_request(struct TransferEngine *engine, struct TransferRequest *req, CURLcode res) {
+    CURL *easy = req->easy;
+    char *effective_url = NULL;
+    char *content_type = NULL;
+    curl_off_t length = -1;
+    long filetime = -1;
+
+    curl_easy_getinfo(easy, CURLINFO_RESPONSE_CODE, &req->http_code);
+    if (curl_easy_getinfo(easy, CURLINFO_EFFECTIVE_URL, &effective_url) == CURLE_OK && effective_url) {
+        strncpy(req->effective_url, effective_url, sizeof(req->effective_url) - 1);
+    }
+    if (curl_easy_getinfo(easy, CURLINFO_CONTENT_TYPE, &content_type) == CURLE_OK && content_type) {
+        strncpy(req->content_type, content_type, sizeof(req->content_type) - 1);
+    }
+    if (curl_easy_getinfo(easy, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, &length) == CURLE_OK) {
+        req->content_length = (long long)length;
+    }
+    if (curl_easy_getinfo(easy, CURLINFO_FILETIME, &filetime) == CURLE_OK) {
+        req->filetime = filetime;
+    }
+
+    // A probe aborted because the Range header was ignored still has usable headers
+    if (req->range_probe && res == CURLE_WRITE_ERROR && req->http_code > 0 && req->http_code < 400) {
+        res = CURLE_OK;
+    }
+    telemetry_record(engine->telemetry, req->kind, easy, res);
+    trace_transfer(engine->trace, req->kind, easy, req->queued_at);
+
+    if (needs_reauth(engine, req)) {
+        park_for_replay(engine, req);
+        return;
+    }
+
+    if (engine->adaptive) adaptive_record(engine->adaptive, easy, res, req->http_code);
+    unlink_active(engine, req);
+    curl_multi_remove_handle(engine->multi, easy);
+    engine->active--;
+    telemetry_transfers_changed(engine->telemetry, -1, 0);
+
+    if (req->on_done) {
+        req->on_done(req, res, req->userdata);
+    }
+    free_request(req);
+}
+
+// Fill free transfer slots from the queue, as fast as the rate limiter allows.
+// Returns how long to wait for the next limiter token (0 if none is needed).
+static long start_queued_requests(struct TransferEngine *engine) {
+    // Once the transfers in flight during a session expiry are done, log in again
+    if (engine->reauth_pending && engine->active == 0) {
+        renew_session(engine);
+    }
+
+    int limit = engine->max_active;
+    if (engine->adaptive && engine->adaptive->limit < limit) limit = engine->adaptive->limit;
+
+    long wait_ms = 0;
+    while (!engine->reauth_pending && engine->queue_head && engine->active < limit) {
+        wait_ms = rate_limiter_try_acquire(engine->limiter);
+        if (wait_ms > 0) {
+            if (engine->limited_since == 0) engine->limited_since = trace_now();
+            break;
+        }
+        if (engine->limited_since > 0) {
+            telemetry_add_limiter_wait(engine->telemetry, trace_now() - engine->limited_since);
+            engine->limited_since = 0;
+        }
+
+        struct TransferRequest *req = engine->queue_head;
+        engine->queue_head = req->next;
+        if (!engine->queue_head) engine->queue_tail = NULL;
+        req->next = NULL;
+
+        if (!start_request(engine, req)) {
+            welearn_log(WELEARN_LOG_ERROR, "Failed to start transfer for %s\n", req->url);
+            telemetry_transfers_changed(engine->telemetry, 0, -1);
+            if (req->on_done) req->on_done(req, CURLE_FAILED_INIT, req->userdata);
+            free_request(req);
+            continue;
+        }
+        link_active(engine, req);
+        telemetry_transfers_changed(engine->telemetry, 1, -1);
+    }
+    return wait_ms;
+}
+
+// Run the completion callbacks of every transfer curl reports as done
+static void finish_completed_requests(struct TransferEngine *engine) {
+    CURLMsg *msg;
+    int msgs_left = 0;
+    while ((msg = curl_multi_info_read(engine->multi, &msgs_left)) != NULL) {
+        if (msg->msg != CURLMSG_DONE) continue;
+        struct TransferRequest *req = NULL;
+        curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, (char **)&req);
+        if (req) finish_request(engine, req, msg->data.result);
+    }
+}
+
+static int engine_has_work(const struct TransferEngine *engine) {
+    return engine->queue_head || engine->active > 0 || engine->replay_head;
+}
+
+// The loop cannot go on: fail every running, queued and parked request through
+// its callback, including any the callbacks submit meanwhile
+static void fail_remaining_requests(struct TransferEngine *engine, CURLcode res) {
+    engine->reauth_pending = 0;
+    while (engine_has_work(engine)) {
+        struct TransferRequest *req = engine->active_head;
+        if (req) {
+            unlink_active(engine, req);
+            curl_multi_remove_handle(engine->multi, req->easy);
+            engine->active--;
+            telemetry_transfers_changed(engine->telemetry, -1, 0);
+        } else if ((req = engine->queue_head) != NULL) {
+            engine->queue_head = req->next;
+            if (!engine->queue_head) engine->queue_tail = NULL;
+            telemetry_transfers_changed(engine->telemetry, 0, -1);
+        } else {
+            req = engine->replay_head;
+            engine->replay_head = req->next;
+            if (!engine->replay_head) engine->replay_tail = NULL;
+            telemetry_transfers_changed(engine->telemetry, 0, -1);
+        }
+        req->next = NULL;
+        if (req->on_done) req->on_done(req, res, req->userdata);
+        free_request(req);
+    }
+    engine->active = 0;
+}
+
+#ifdef __linux__
+// CURLMOPT_SOCKETFUNCTION: mirror the sockets curl waits on into the epoll set
+static int event_socket_callback(CURL *easy, curl_socket_t fd, int what, void *userp, void *socketp) {
+    (void)easy;
+    (void)socketp;
+    struct TransferEngine *engine = (struct TransferEngine *)userp;
+    if (what == CURL_POLL_REMOVE) {
+        epoll_ctl(engine->epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+        return 0;
+    }
+
+    struct epoll_event ev = {0};
+    ev.data.fd = fd;
+    if (what & CURL_POLL_IN) ev.events |= EPOLLIN;
+    if (what & CURL_POLL_OUT) ev.events |= EPOLLOUT;
+    if (epoll_ctl(engine->epoll_fd, EPOLL_CTL_MOD, fd, &ev) != 0 && errno == ENOENT) {
+        epoll_ctl(engine->epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+    }
+    return 0;
+}
+
+// CURLMOPT_TIMERFUNCTION: arm the timerfd with the timeout curl asks for (-1 disarms)
+static int event_timer_callback(CURLM *multi, long timeout_ms, void *userp) {
+    (void)multi;
+    struct TransferEngine *engine = (struct TransferEngine *)userp;
+    struct itimerspec its = {0};
+    if (timeout_ms == 0) {
+        its.it_value.tv_nsec = 1;  // An all-zero value would disarm the timer
+    } else if (timeout_ms > 0) {
+        its.it_value.tv_sec = timeout_ms / 1000;
+        its.it_value.tv_nsec = (timeout_ms % 1000) * 1000000L;
+    }
+    timerfd_settime(engine->timer_fd, 0, &its, NULL);
+    return 0;
+}
+
+// Event-driven loop: epoll reports ready sockets and curl's timer, and
+// curl_multi_socket_action only touches the transfers that have work
+static int run_event_loop(struct TransferEngine *engine) {
+    engine->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    engine->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (engine->epoll_fd < 0 || engine->timer_fd < 0) {
+        welearn_log(WELEARN_LOG_ERROR, "Event loop unavailable (%s), polling instead\n", strerror(errno));
+        if (engine->epoll_fd >= 0) close(engine->epoll_fd);
+        if (engine->timer_fd >= 0) close(engine->timer_fd);
+        return 0;
+    }
+    struct epoll_event timer_ev = {0};
+    timer_ev.events = EPOLLIN;
+    timer_ev.data.fd = engine->timer_fd;
+    epoll_ctl(engine->epoll_fd, EPOLL_CTL_ADD, engine->timer_fd, &timer_ev);
+
+    curl_multi_setopt(engine->multi, CURLMOPT_SOCKETFUNCTION, event_socket_callback);
+    curl_multi_setopt(engine->multi, CURLMOPT_SOCKETDATA, engine);
+    curl_multi_setopt(engine->multi, CURLMOPT_TIMERFUNCTION, event_timer_callback);
+    curl_multi_setopt(engine->multi, CURLMOPT_TIMERDATA, engine);
+
+    struct epoll_event events[TRANSFER_EVENT_BATCH];
+    int running = 0;
+    while (engine_has_work(engine)) {
+        long wait_ms = start_queued_requests(engine);
+        if (!engine_has_work(engine)) break;
+
+        // Sleep until a socket or curl's timer is ready, or the limiter has a token
+        int timeout = wait_ms > 0 ? (int)wait_ms : (engine->active > 0 ? -1 : 0);
+        int n = epoll_wait(engine->epoll_fd, events, TRANSFER_EVENT_BATCH, timeout);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            welearn_log(WELEARN_LOG_ERROR, "epoll_wait() failed: %s\n", strerror(errno));
+            fail_remaining_requests(engine, CURLE_ABORTED_BY_CALLBACK);
+            break;
+        }
+
+        for (int i = 0; i < n; i++) {
+            if (events[i].data.fd == engine->timer_fd) {
+                uint64_t expirations;
+                ssize_t r = read(engine->timer_fd, &expirations, sizeof(expirations));
+                (void)r;  // EAGAIN only means the timer was re-armed meanwhile
+                curl_multi_socket_action(engine->multi, CURL_SOCKET_TIMEOUT, 0, &running);
+                continue;
+            }
+            int flags = 0;
+            if (events[i].events & (EPOLLIN | EPOLLHUP)) flags |= CURL_CSELECT_IN;
+            if (events[i].events & EPOLLOUT) flags |= CURL_CSELECT_OUT;
+            if (events[i].events & EPOLLERR) flags |= CURL_CSELECT_ERR;
+            curl_multi_socket_action(engine->multi, events[i].data.fd, flags, &running);
+        }
+        finish_completed_requests(engine);
+    }
+
+    curl_multi_setopt(engine->multi, CURLMOPT_SOCKETFUNCTION, NULL);
+    curl_multi_setopt(engine->multi, CURLMOPT_TIMERFUNCTION, NULL);
+    close(engine->epoll_fd);
+    close(engine->timer_fd);
+    engine->epoll_fd = engine->timer_fd = -1;
+    return 1;
+}
+#endif
+
+// Run until every queued request (including ones submitted from callbacks) has finished
+void transfer_engine_run(struct TransferEngine *engine) {
+    if (!engine || !engine->multi) return;
+
+#ifdef __linux__
+    if (engine->event_driven && run_event_loop(engine)) return;
+#endif
+
+    while (engine_has_work(engine)) {
+        long wait_ms = start_queued_requests(engine);
+
+        int running = 0;
+        CURLMcode mc = curl_multi_perform(engine->multi, &running);
+        if (mc != CURLM_OK) {
+            welearn_log(WELEARN_LOG_ERROR, "curl_multi_perform() failed: %s\n", curl_multi_strerror(mc));
+            fail_remaining_requests(engine, CURLE_ABORTED_BY_CALLBACK);
+            break;
+        }
+        finish_completed_requests(engine);
+
+        if (engine->active > 0) {
+            curl_multi_poll(engine->multi, NULL, 0, wait_ms > 0 && wait_ms < 1000 ? (int)wait_ms : 1000, NULL);
+        } else if (wait_ms > 0) {
+            PROFILE_SCOPE(PROFILE_LIMITER_WAIT);
+            double slept_from = trace_now();
+            struct timespec ts = {wait_ms / 1000, (wait_ms % 1000) * 1000000L};
+            nanosleep(&ts, NULL);
+            trace_span(engine->trace, "sleep", "limiter", slept_from, NULL);
+        }
+    }
+}
@@ -0,0 +1,334 @@
+#include "../include/welearn_verify.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/mman.h>
+
+// One unique file (inode) to hash; hardlinked paths share a job
+struct VerifyJob {
+    size_t entry;  // Manifest entry whose path is hashed
+    dev_t dev;
+    ino_t ino;
+    long long size;
+    char sha256[SHA256_HEX_LEN];
+    int outcome;   // VERIFY_OK once hashed, else VERIFY_READ_ERROR or VERIFY_SIZE_MISMATCH
+};
+
+// Distinct-inode candidate of a manifest entry, sorted to find hardlinked paths
+struct InodeRef {
+    dev_t dev;
+    ino_t ino;
+    size_t entry;
+};
+
+struct VerifyWorkQueue {
+    const struct ContentStore *store;
+    struct VerifyJob **order;  // Largest file first
+    size_t count;
+    size_t next;
+    pthread_mutex_t lock;
+};
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+// Hash a file of the expected size through read-only mappings of
+// VERIFY_HASH_WINDOW bytes at a time. Returns VERIFY_OK, VERIFY_READ_ERROR, or
+// VERIFY_SIZE_MISMATCH when the file changed size since it was checked: mapping
+// pages past its end would raise SIGBUS.
+static int hash_file_mmap(int dirfd, const char *path, long long size, char sha256[SHA256_HEX_LEN]) {
+    struct Sha256Context ctx;
+    uint8_t digest[SHA256_DIGEST_LEN];
+    sha256_init(&ctx);
+
+    int fd = openat(dirfd, path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return VERIFY_READ_ERROR;
+    struct stat st;
+    int outcome = fstat(fd, &st) != 0 ? VERIFY_READ_ERROR
+                : (long long)st.st_size != size ? VERIFY_SIZE_MISMATCH : VERIFY_OK;
+    if (outcome != VERIFY_OK) {
+        close(fd);
+        return outcome;
+    }
+#ifdef POSIX_FADV_SEQUENTIAL
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+    long long offset = 0;
+    while (offset < size) {
+        size_t len = (size_t)(size - offset < VERIFY_HASH_WINDOW ? size - offset : VERIFY_HASH_WINDOW);
+        void *map = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, (off_t)offset);
+        if (map == MAP_FAILED) {
+            close(fd);
+            return VERIFY_READ_ERROR;
+        }
+        madvise(map, len, MADV_SEQUENTIAL | MADV_WILLNEED);
+        sha256_update(&ctx, map, len);
+        munmap(map, len);
+        offset += (long long)len;
+    }
+    close(fd);
+
+    sha256_final(&ctx, digest);
+    sha256_to_hex(digest, sha256);
+    return VERIFY_OK;
+}
+
+// Worker: claim jobs until the queue is empty (largest files were sorted first)
+static void *verify_worker(void *arg) {
+    struct VerifyWorkQueue *queue = (struct VerifyWorkQueue *)arg;
+    for (;;) {
+        pthread_mutex_lock(&queue->lock);
+        size_t index = queue->next++;
+        pthread_mutex_unlock(&queue->lock);
+        if (index >= queue->count) break;
+
+        struct VerifyJob *job = queue->order[index];
+        char path[MAX_PATH_LEN];
+        if (snprintf(path, sizeof(path), "%s/%s", queue->store->root,
+                     queue->store->manifest.entries[job->entry].path) >= (int)sizeof(path)) {
+            job->outcome = VERIFY_READ_ERROR;
+            continue;
+        }
+        job->outcome = hash_file_mmap(queue->store->dirfd, path, job->size, job->sha256);
+    }
+    return NULL;
+}
+
+static int compare_inode_refs(const void *a, const void *b) {
+    const struct InodeRef *ra = (const struct InodeRef *)a;
+    const struct InodeRef *rb = (const struct InodeRef *)b;
+    if (ra->dev != rb->dev) return ra->dev < rb->dev ? -1 : 1;
+    if (ra->ino != rb->ino) return ra->ino < rb->ino ? -1 : 1;
+    return 0;
+}
+
+static int compare_jobs_by_size_desc(const void *a, const void *b) {
+    long long sa = (*(struct VerifyJob *const *)a)->size;
+    long long sb = (*(struct VerifyJob *const *)b)->size;
+    return (sb > sa) - (sb < sa);
+}
+
+// Compare every manifest entry against the file on disk, hashing in parallel
+int verify_download_tree(struct ContentStore *store, int threads, struct VerifyResult *result) {
+    if (!store || !result) return 0;
+    memset(result, 0, sizeof(*result));
+
+    struct Manifest *manifest = &store->manifest;
+    result->entries = manifest->count;
+    if (manifest->count == 0) return 1;
+
+    double start = now_seconds();
+    result->status = calloc(manifest->count, sizeof(int));
+    size_t *entry_job = calloc(manifest->count, sizeof(size_t));
+    struct InodeRef *refs = calloc(manifest->count, sizeof(struct InodeRef));
+    struct VerifyJob *jobs = calloc(manifest->count, sizeof(struct VerifyJob));
+    struct VerifyJob **order = calloc(manifest->count, sizeof(struct VerifyJob *));
+    if (!result->status || !entry_job || !refs || !jobs || !order) {
+        welearn_log(WELEARN_LOG_ERROR, "Failed to allocate verification state: %s\n", strerror(errno));
+        free(entry_job);
+        free(refs);
+        free(jobs);
+        free(order);
+        free_verify_result(result);
+        return 0;
+    }
+
+    // Pass 1: stat every path; cheap checks decide most failures without reading data
+    size_t ref_count = 0;
+    for (size_t i = 0; i < manifest->count; i++) {
+        const struct ManifestEntry *entry = &manifest->entries[i];
+        char path[MAX_PATH_LEN];
+        struct stat st;
+        if (snprintf(path, sizeof(path), "%s/%s", store->root, entry->path) >= (int)sizeof(path)) {
+            result->status[i] = VERIFY_READ_ERROR;  // The path does not fit
+        } else if (fstatat(store->dirfd, path, &st, 0) != 0 || !S_ISREG(st.st_mode)) {
+            result->status[i] = VERIFY_MISSING;
+        } else if ((long long)st.st_size != entry->size) {
+            result->status[i] = VERIFY_SIZE_MISMATCH;
+        } else {
+            refs[ref_count].dev = st.st_dev;
+            refs[ref_count].ino = st.st_ino;
+            refs[ref_count].entry = i;
+            ref_count++;
+        }
+    }
+
+    // Hardlinked paths (deduplicated content) share an inode: hash each inode once
+    qsort(refs, ref_count, sizeof(struct InodeRef), compare_inode_refs);
+    size_t job_count = 0;
+    for (size_t r = 0; r < ref_count; r++) {
+        if (r == 0 || compare_inode_refs(&refs[r - 1], &refs[r]) != 0) {
+            struct VerifyJob *job = &jobs[job_count++];
+            job->entry = refs[r].entry;
+            job->dev = refs[r].dev;
+            job->ino = refs[r].ino;
+            job->size = manifest->entries[refs[r].entry].size;
+        }
+        entry_job[refs[r].entry] = job_count - 1;
+    }
+
+    // Pass 2: hash the inodes in parallel, biggest first so the tail stays short
+    for (size_t j = 0; j < job_count; j++) {
+        order[j] = &jobs[j];
+    }
+    qsort(order, job_count, sizeof(struct VerifyJob *), compare_jobs_by_size_desc);
+
+    if (threads <= 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cpus > 0 ? (int)cpus : 1;
+    }
+    if ((size_t)threads > job_count) threads = job_count > 0 ? (int)job_count : 1;
+
+    struct VerifyWorkQueue queue = {store, order, job_count, 0, PTHREAD_MUTEX_INITIALIZER};
+    pthread_t *workers = malloc((size_t)threads * sizeof(pthread_t));
+    int started = 0;
+    if (workers) {
+        for (; started < threads; started++) {
+            if (pthread_create(&workers[started], NULL, verify_worker, &queue) != 0) break;
+        }
+    }
+    if (started == 0) {
+        verify_worker(&queue);  // No threads available: hash on the calling thread
+    }
+    for (int t = 0; t < started; t++) {
+        pthread_join(workers[t], NULL);
+    }
+    free(workers);
+
+    // Pass 3: map hashes back to entries
+    for (size_t r = 0; r < ref_count; r++) {
+        size_t i = refs[r].entry;
+        const struct VerifyJob *job = &jobs[entry_job[i]];
+        if (job->outcome != VERIFY_OK) {
+            result->status[i] = job->outcome;
+        } else if (strcmp(job->sha256, manifest->entries[i].sha256) != 0) {
+            result->status[i] = VERIFY_HASH_MISMATCH;
+        }
+    }
+    for (size_t j = 0; j < job_count; j++) {
+        if (jobs[j].outcome == VERIFY_OK) {
+            result->files_hashed++;
+            result->bytes_hashed += jobs[j].size;
+        }
+    }
+
+    for (size_t i = 0; i < manifest->count; i++) {
+        switch (result->status[i]) {
+            case VERIFY_OK: result->ok++; break;
+            case VERIFY_MISSING: result->missing++; break;
+            case VERIFY_SIZE_MISMATCH: result->size_mismatch++; break;
+            case VERIFY_HASH_MISMATCH: result->hash_mismatch++; break;
+            default: result->errors++; break;
+        }
+    }
+    result->queued = manifest->count - result->ok;
+    result->seconds = now_seconds() - start;
+
+    free(entry_job);
+    free(refs);
+    free(jobs);
+    free(order);
+    return 1;
+}
+
+// Move a damaged file out of the way into STORE_QUARANTINE_DIR, keeping its data
+// for the user. A hardlinked file shares its inode with the store object and
+// other copies, so it is renamed, never deleted. Returns 1 when moved.
+static int quarantine_file(struct ContentStore *store, const char *path, const char *label,
+                           struct VerifyResult *result) {
+    struct stat st;
+    if (fstatat(store->dirfd, path, &st, AT_SYMLINK_NOFOLLOW) != 0) return 0;  // Nothing there
+
+    char dir[MAX_PATH_LEN];
+    char dest[MAX_PATH_LEN];
+    const char *name = strrchr(path, '/');
+    name = name ? name + 1 : path;
+    if (snprintf(dir, sizeof(dir), "%s/%s", store->root, STORE_QUARANTINE_DIR) >= (int)sizeof(dir) ||
+        snprintf(dest, sizeof(dest), "%s/%ld-%zu-%s", dir, (long)time(NULL), result->quarantined,
+                 name) >= (int)sizeof(dest)) {
+        welearn_log(WELEARN_LOG_ERROR, "Cannot quarantine %s: path too long, left in place\n", path);
+        return 0;
+    }
+    if ((mkdirat(store->dirfd, dir, 0700) != 0 && errno != EEXIST) ||
+        renameat(store->dirfd, path, store->dirfd, dest) != 0) {
+        welearn_log(WELEARN_LOG_ERROR, "Cannot quarantine %s: %s, left in place\n", path, strerror(errno));
+        return 0;
+    }
+    welearn_log(WELEARN_LOG_INFO, "Moved damaged %s to %s\n", label, dest);
+    result->quarantined++;
+    return 1;
+}
+
+// Repair broken entries whose store object is intact. Damaged files and objects
+// are quarantined, not deleted; the entries left broken are queued for re-download.
+size_t repair_from_store(struct ContentStore *store, struct VerifyResult *result) {
+    if (!store || !result || !result->status) return 0;
+
+    size_t restored = 0;
+    for (size_t i = 0; i < result->entries && i < store->manifest.count; i++) {
+        if (result->status[i] == VERIFY_OK) continue;
+        const struct ManifestEntry *entry = &store->manifest.entries[i];
+
+        char path[MAX_PATH_LEN];
+        char object_path[MAX_PATH_LEN];
+        if (snprintf(path, sizeof(path), "%s/%s", store->root, entry->path) >= (int)sizeof(path)) continue;
+        content_store_object_path(store, entry->sha256, object_path, sizeof(object_path));
+
+        // A hardlinked path shares the object's inode, so a damaged file means a damaged object
+        struct stat st;
+        char sha256[SHA256_HEX_LEN] = "";
+        int object_ok = fstatat(store->dirfd, object_path, &st, 0) == 0 && (long long)st.st_size == entry->size &&
+                        hash_file_mmap(store->dirfd, object_path, entry->size, sha256) == VERIFY_OK &&
+                        strcmp(sha256, entry->sha256) == 0;
+        if (!object_ok) quarantine_file(store, object_path, "store object", result);  // Never linked again
+        quarantine_file(store, path, "file", result);
+
+        if (object_ok && content_store_materialize(store, entry->sha256, path) != STORE_LINK_NONE) {
+            welearn_log(WELEARN_LOG_INFO, "Restored from store: %s\n", path);
+            result->status[i] = VERIFY_OK;
+            restored++;
+        } else {
+            welearn_log(WELEARN_LOG_INFO, "No intact stored copy, queued for re-download: %s\n", path);
+        }
+    }
+
+    result->restored += restored;
+    result->queued -= restored;
+    return restored;
+}
+
+void print_verify_summary(const struct VerifyResult *result) {
+    if (!result) return;
+
+    char hashed[32];
+    format_size(result->bytes_hashed, hashed, sizeof(hashed));
+    double rate = result->seconds > 0 ? (double)result->bytes_hashed / result->seconds : 0;
+    char rate_str[32];
+    format_size((long long)rate, rate_str, sizeof(rate_str));
+
+    printf("\n========================================\n");
+    printf("Verification Summary\n");
+    printf("========================================\n");
+    printf("Entries checked:   %zu\n", result->entries);
+    printf("OK:                %zu\n", result->ok);
+    printf("Missing:           %zu\n", result->missing);
+    printf("Size mismatch:     %zu\n", result->size_mismatch);
+    printf("Hash mismatch:     %zu\n", result->hash_mismatch);
+    printf("Read errors:       %zu\n", result->errors);
+    printf("Restored locally:  %zu\n", result->restored);
+    printf("Quarantined:       %zu (moved to %s)\n", result->quarantined, STORE_QUARANTINE_DIR);
+    printf("Need re-download:  %zu\n", result->queued);
+    printf("Hashed %zu file(s), %s in %.1f s (%s/s)\n", result->files_hashed, hashed, result->seconds, rate_str);
+    printf("========================================\n");
+}
+
+void free_verify_result(struct VerifyResult *result) {
+    if (!result) return;
+    free(result->status);
+    result->status = NULL;
+}